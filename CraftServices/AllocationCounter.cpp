@@ -0,0 +1,89 @@
+/*
+ * This file is part of CraftServices.
+ *
+ * CraftServices is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CraftServices is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CraftServices. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "AllocationCounter.hpp"
+
+namespace
+{
+	std::atomic<bool> CountingAllocations(false);
+	// Only ever touched by its own thread. Plain data, so it needs no construction (and can't itself allocate).
+	thread_local uint64_t ThreadAllocationCount = 0;
+}
+
+namespace CraftServices
+{
+	namespace AllocationCounter
+	{
+		void StartCounting()
+		{
+			CountingAllocations.store(true, std::memory_order_relaxed);
+		}
+
+		void StopCounting()
+		{
+			CountingAllocations.store(false, std::memory_order_relaxed);
+		}
+
+		uint64_t GetAllocationCount()
+		{
+			return ThreadAllocationCount;
+		}
+	}
+
+} // Namespace CraftServices
+
+// The replacements for the whole program. The array and nothrow forms of new come through this one by default.
+void * operator new(std::size_t byteCount)
+{
+	if (CountingAllocations.load(std::memory_order_relaxed))
+	{
+		ThreadAllocationCount++;
+	}
+
+	void * pAllocation = std::malloc(byteCount == 0 ? 1 : byteCount);
+	if (pAllocation == NULL)
+	{
+		throw std::bad_alloc();
+	}
+	return pAllocation;
+}
+
+void operator delete(void * pAllocation) noexcept
+{
+	std::free(pAllocation);
+}
+
+// The sized and array forms of delete are replaced as well, so memory from our new is never handed to the
+// library's own delete (which a compiler using sized deallocation would otherwise call)
+void operator delete(void * pAllocation, std::size_t) noexcept
+{
+	operator delete(pAllocation);
+}
+
+void operator delete[](void * pAllocation) noexcept
+{
+	operator delete(pAllocation);
+}
+
+void operator delete[](void * pAllocation, std::size_t) noexcept
+{
+	operator delete(pAllocation);
+}
@@ -0,0 +1,43 @@
+/*
+ * This file is part of CraftServices.
+ *
+ * CraftServices is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CraftServices is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CraftServices. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Counts heap allocations made through operator new, for seeing what a piece of code allocates (i.e. when
+// replaying a capture; see MspCaptureReplay). Counting is off unless started, and costs one check per
+// allocation when it is.
+//
+// Each thread keeps its own count, so what the logging, metrics or emulator threads allocate in the
+// meantime is never charged to the code being measured.
+
+#ifndef ALLOCATIONCOUNTER_HPP
+#define ALLOCATIONCOUNTER_HPP
+
+#include <cstdint>
+
+namespace CraftServices
+{
+	namespace AllocationCounter
+	{
+		void StartCounting();
+		void StopCounting();
+
+		// Allocations made by the calling thread while counting was on
+		uint64_t GetAllocationCount();
+	}
+
+} // Namespace CraftServices
+
+#endif // ALLOCATIONCOUNTER_HPP
@@ -0,0 +1,93 @@
+/*
+ * This file is part of CraftServices.
+ *
+ * CraftServices is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CraftServices is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CraftServices. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ASYNCLOGGING_HPP
+#define ASYNCLOGGING_HPP
+
+#include <memory>
+#include <string>
+
+#include "spdlog/spdlog.h"
+#include "spdlog/async.h"
+
+namespace CraftServices
+{
+	// What to do when log messages come in faster than the logging thread can write them out
+	enum class LogQueueOverflowPolicy
+	{
+		// Throw away the oldest waiting messages. Nothing that logs ever waits.
+		DropOldest,
+		// Wait for room. Nothing is lost, but a burst of logging can hold up the session that's logging.
+		Block
+	};
+
+	// How loggers get their messages to their sinks (console, log files)
+	struct LoggingSettings
+	{
+		// Hand messages to a background thread to be written, rather than writing them out (to three sinks,
+		// for a session) on whichever thread logged them
+		bool Asynchronous;
+
+		// Most messages waiting for the logging thread at once
+		size_t QueueSize;
+
+		LogQueueOverflowPolicy OverflowPolicy;
+	};
+
+	namespace Logging
+	{
+		// Start the background logging thread, if logging is asynchronous. Call before creating any loggers
+		// with these settings.
+		inline void StartLogging(const LoggingSettings & loggingSettings)
+		{
+			if (loggingSettings.Asynchronous)
+			{
+				// A single thread, so messages are written in the order they were logged
+				spdlog::init_thread_pool(loggingSettings.QueueSize, 1);
+			}
+		}
+
+		// A logger writing to these sinks, synchronously or through the logging thread as the settings say.
+		// Not added to spdlog's registry; whoever creates it owns it.
+		inline std::shared_ptr<spdlog::logger> CreateLogger(const std::string & loggerName, spdlog::sinks_init_list sinks, const LoggingSettings & loggingSettings)
+		{
+			if (!loggingSettings.Asynchronous)
+			{
+				return std::make_shared<spdlog::logger>(loggerName, sinks);
+			}
+
+			spdlog::async_overflow_policy overflowPolicy = (loggingSettings.OverflowPolicy == LogQueueOverflowPolicy::Block) ? 
+				spdlog::async_overflow_policy::block : spdlog::async_overflow_policy::overrun_oldest;
+			return std::make_shared<spdlog::async_logger>(loggerName, sinks, spdlog::thread_pool(), overflowPolicy);
+		}
+
+		// Write out anything still waiting and stop the logging thread. Loggers created after this log synchronously
+		// only if their settings say so; asynchronous ones no longer log at all.
+		inline void StopLogging()
+		{
+			spdlog::shutdown();
+		}
+
+		inline std::string GetOverflowPolicyAsString(LogQueueOverflowPolicy overflowPolicy)
+		{
+			return (overflowPolicy == LogQueueOverflowPolicy::Block) ? "block" : "drop";
+		}
+	}
+
+} // Namespace CraftServices
+
+#endif // ASYNCLOGGING_HPP
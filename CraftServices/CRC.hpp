@@ -14,38 +14,64 @@
  * You should have received a copy of the GNU General Public License
  * along with CraftServices. If not, see <http://www.gnu.org/licenses/>.
  */
+#ifndef CRC_HPP
+#define CRC_HPP
+
 using namespace std;
 #include <cstdint>
+#include <cstddef>
 
-class Crc
+// The crc8_dvb_s2 result for every possible (crc ^ byte) value, so a byte
+// can be folded into the CRC with a single lookup instead of eight shift/xor steps.
+struct Crc8DvbS2Table
 {
-	public:
+	uint8_t Values[256];
+};
 
-	static uint8_t crc8_dvb_s2(uint8_t crc, unsigned char c)
+// Builds the lookup table from the bitwise algorithm. constexpr, so the table
+// is computed by the compiler rather than at startup.
+constexpr Crc8DvbS2Table MakeCrc8DvbS2Table()
+{
+	Crc8DvbS2Table table = {};
+	for (int tableIndex = 0; tableIndex < 256; ++tableIndex)
 	{
-		crc ^= c;
-		for (int ii = 0; ii < 8; ++ii) 
+		uint8_t crc = (uint8_t)tableIndex;
+		for (int ii = 0; ii < 8; ++ii)
 		{
-			if (crc & 0x80) 
+			if (crc & 0x80)
 			{
-				crc = (crc << 1) ^ 0xD5;
+				crc = (uint8_t)((crc << 1) ^ 0xD5);
 			}
-			else 
+			else
 			{
-				crc = crc << 1;
+				crc = (uint8_t)(crc << 1);
 			}
 		}
-		return crc;
+		table.Values[tableIndex] = crc;
 	}
+	return table;
+}
+
+constexpr Crc8DvbS2Table Crc8DvbS2LookupTable = MakeCrc8DvbS2Table();
 
-	static uint8_t crc8_dvb_s2_update(uint8_t crc, const void *data, uint32_t length)
+class Crc
+{
+	public:
+
+	// Fold one byte into the CRC. Usable in constant expressions, so fixed
+	// messages can be checksummed at compile time.
+	static constexpr uint8_t crc8_dvb_s2(uint8_t crc, unsigned char c)
 	{
-		const uint8_t *p = (const uint8_t *)data;
-		const uint8_t *pend = p + length;
+		return Crc8DvbS2LookupTable.Values[(uint8_t)(crc ^ c)];
+	}
 
-		for (; p != pend; p++) 
+	// Fold a run of bytes into the CRC. Pass the CRC of the bytes seen so far to
+	// continue a calculation that was started on an earlier run.
+	static constexpr uint8_t crc8_dvb_s2_update(uint8_t crc, const uint8_t * pData, size_t length)
+	{
+		for (size_t byteIndex = 0; byteIndex < length; ++byteIndex) 
 		{
-			crc = crc8_dvb_s2(crc, *p);
+			crc = crc8_dvb_s2(crc, pData[byteIndex]);
 		}
 		return crc;
 	}
@@ -63,4 +89,6 @@ class Crc
 	}
 	*/
 
-};
\ No newline at end of file
+};
+
+#endif // CRC_HPP
@@ -18,7 +18,9 @@
 #ifndef CRAFTINFOANDPOSITION_HPP
 #define CRAFTINFOANDPOSITION_HPP
 
-#include "deserialise.hpp"
+#include <string>
+
+#include "CraftServicesTypes.hpp"
 #include "GeoSpatialUtil.hpp"
 
 namespace CraftServices 
@@ -0,0 +1,120 @@
+/*
+ * This file is part of CraftServices.
+ *
+ * CraftServices is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CraftServices is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CraftServices. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CRAFTPROXIMITY_HPP
+#define CRAFTPROXIMITY_HPP
+
+#include <cstdint>
+#include <math.h>
+#include <algorithm>
+
+#include "GeoSpatialUtil.hpp"
+
+// How far ahead we look when working out how close two craft will get
+#define CLOSEST_APPROACH_HORIZON_IN_SECONDS 10.0
+
+// A craft whose position has been deferred for lack of airtime this many rounds running is sent right after the
+// nearest craft, however far away it is, so distant craft still get timely updates. If it's deferred twice this
+// many rounds, it goes ahead of the nearest.
+#define PROXIMITY_FAIRNESS_FLOOR_IN_ROUNDS 4
+
+namespace CraftServices
+{
+	// Where a craft is, and where it is heading, in units handy for working out separation
+	struct CraftKinematics
+	{
+		// False until there is a position to work with; craft without one sort after those with one
+		bool IsKnown;
+
+		double LatInDecimalDegrees;
+		double LonInDecimalDegrees;
+		double AltitudeInMeters;
+
+		// Ground velocity, meters per second
+		double VelocityNorth;
+		double VelocityEast;
+	};
+
+	namespace CraftProximity
+	{
+		inline CraftKinematics GetUnknownKinematics()
+		{
+			CraftKinematics craftKinematics = { false, 0, 0, 0, 0, 0 };
+			return craftKinematics;
+		}
+
+		// From the values in an MSP_RAW_GPS reply. Speed is in cm/s, course in decidegrees, and altitude is signed.
+		inline CraftKinematics GetKinematicsFromMspPosition(uint32_t mspLat, uint32_t mspLon, uint16_t altitudeInMeters, uint16_t speed, uint16_t groundCourseInDecidegrees)
+		{
+			double groundSpeedInMetersPerSecond = speed / ((double)CENTIMETERS_PER_METER);
+			double groundCourseInRadians = GeoSpatialUtil::DegreesToRadians(groundCourseInDecidegrees / 10.0);
+
+			CraftKinematics craftKinematics;
+			craftKinematics.IsKnown = true;
+			craftKinematics.LatInDecimalDegrees = GeoSpatialUtil::ConvertMspGpsValueToDecimalDegree(mspLat);
+			craftKinematics.LonInDecimalDegrees = GeoSpatialUtil::ConvertMspGpsValueToDecimalDegree(mspLon);
+			craftKinematics.AltitudeInMeters = (int16_t)altitudeInMeters;
+			craftKinematics.VelocityNorth = groundSpeedInMetersPerSecond * cos(groundCourseInRadians);
+			craftKinematics.VelocityEast = groundSpeedInMetersPerSecond * sin(groundCourseInRadians);
+			return craftKinematics;
+		}
+
+		// How close two craft will get over the next horizonInSeconds, assuming both hold their current ground
+		// velocity (vertical speed isn't reported, so altitude difference is taken as fixed). Craft that are
+		// closing on each other rank as nearer than their current separation, and craft pulling apart rank by
+		// how far apart they are now.
+		//
+		// The craft are close enough that a flat local approximation is fine; this is for ordering, not navigation.
+		inline double GetClosestApproachInMeters(const CraftKinematics & craftA, const CraftKinematics & craftB, double horizonInSeconds, double & timeToClosestApproachInSeconds)
+		{
+			timeToClosestApproachInSeconds = 0;
+
+			double meanLatInRadians = GeoSpatialUtil::DegreesToRadians((craftA.LatInDecimalDegrees + craftB.LatInDecimalDegrees) / 2);
+			double northInMeters = GeoSpatialUtil::DegreesToRadians(craftB.LatInDecimalDegrees - craftA.LatInDecimalDegrees) * RADIUS_EARTH_IN_METERS;
+			double eastInMeters = GeoSpatialUtil::DegreesToRadians(craftB.LonInDecimalDegrees - craftA.LonInDecimalDegrees) * RADIUS_EARTH_IN_METERS * cos(meanLatInRadians);
+			double upInMeters = craftB.AltitudeInMeters - craftA.AltitudeInMeters;
+
+			double relativeVelocityNorth = craftB.VelocityNorth - craftA.VelocityNorth;
+			double relativeVelocityEast = craftB.VelocityEast - craftA.VelocityEast;
+			double relativeSpeedSquared = relativeVelocityNorth * relativeVelocityNorth + relativeVelocityEast * relativeVelocityEast;
+
+			if (relativeSpeedSquared > 0)
+			{
+				double closingTime = -(northInMeters * relativeVelocityNorth + eastInMeters * relativeVelocityEast) / relativeSpeedSquared;
+				timeToClosestApproachInSeconds = std::min(std::max(closingTime, 0.0), horizonInSeconds);
+			}
+
+			northInMeters += relativeVelocityNorth * timeToClosestApproachInSeconds;
+			eastInMeters += relativeVelocityEast * timeToClosestApproachInSeconds;
+			return sqrt(northInMeters * northInMeters + eastInMeters * eastInMeters + upInMeters * upInMeters);
+		}
+
+		// Closest approach, as used for ordering. Unknown positions sort last.
+		inline double GetProximityRank(const CraftKinematics & craftA, const CraftKinematics & craftB)
+		{
+			if (!craftA.IsKnown || !craftB.IsKnown)
+			{
+				return HUGE_VAL;
+			}
+
+			double timeToClosestApproachInSeconds = 0;
+			return GetClosestApproachInMeters(craftA, craftB, CLOSEST_APPROACH_HORIZON_IN_SECONDS, timeToClosestApproachInSeconds);
+		}
+	}
+}
+
+#endif // CRAFTPROXIMITY_HPP
@@ -22,6 +22,7 @@
 namespace po = boost::program_options;
 #include <codecvt>
 #include <iostream>
+#include <atomic>
 using std::cin;
 
 #include "spdlog/spdlog.h"
@@ -33,9 +34,13 @@ using std::cin;
 #include "PhantomTestCraftFixed.hpp"
 #include "PhantomWingman.hpp"
 #include "MSPFlightControllerAsync.hpp"
+#include "MspMetricsExporter.hpp"
+#include "MspCaptureReplay.hpp"
+#include "MspFlightControllerEmulator.hpp"
 #include "CraftServices.hpp"
 #include "SerialPortDefaults.hpp"
 #include "CommandLineArgumentsException.hpp"
+#include "CraftServiceException.hpp"
 
 #ifdef WIN32
 #include <windows.h> 
@@ -49,8 +54,7 @@ std::string DateTimeLogFilePrefixString;
 // When was CraftServices started?
 boost::posix_time::ptime CraftServicesStartTime;
 
-// TODO: Make smart pointer of some kind
-spdlog::logger * pConsoleAndAllLogger;
+std::shared_ptr<spdlog::logger> pConsoleAndAllLogger;
 
 auto console_sink = std::make_shared<spdlog::sinks::stdout_color_sink_mt>();
 std::shared_ptr<spdlog::sinks::basic_file_sink_mt> all_log_file_sink;
@@ -63,12 +67,28 @@ std::vector<CraftServices::MSPFlightControllerAsync *> AsyncFlightControllerSess
 uint32_t RefreshIntervalInMilliseconds;
 
 // Are we in the process of shutting down?
-static bool ShutdownInProgress = false;
+static std::atomic<bool> ShutdownInProgress(false);
 // Has the app already completed a shutdown? (We don't want to do the relevant operations twice)
-static bool ShutdownCompleted = false;
+static std::atomic<bool> ShutdownCompleted(false);
+// Has a shutdown been asked for while the IO worker threads were still running? (See DoCleanupAndShutdown)
+static std::atomic<bool> ShutdownRequested(false);
+// Are the IO worker threads running?
+static std::atomic<bool> IoWorkerThreadsRunning(false);
 
-// Refresh timer for all flight controllers
+// Refresh timer for all flight controllers (round robin mode only)
 boost::asio::steady_timer * pFlightControllerSteadyTimer;
+// The round robin scheduler's handlers all run on this strand
+boost::asio::io_context::strand * pRoundRobinStrand;
+// Order the Flight Controllers are serviced in each round (round robin mode only). Worked out again every round.
+static std::vector<CraftServices::MSPFlightControllerAsync *> FlightControllerServiceOrder;
+
+// Serves link metrics to dashboards, if asked for (--metricsport, --metricssocket)
+CraftServices::MspMetricsExporter * pMetricsExporter = NULL;
+
+#ifdef CRAFT_SERVICES_HAS_FLIGHT_CONTROLLER_EMULATOR
+// Pretend flight controllers on pseudo-terminals, if asked for (--emulate)
+CraftServices::MspFlightControllerEmulator * pFlightControllerEmulator = NULL;
+#endif // CRAFT_SERVICES_HAS_FLIGHT_CONTROLLER_EMULATOR
 
 // Global logging pattern
 
@@ -96,12 +116,32 @@ po::variables_map ProcessArguments(int argc, char** argv)
 	po::options_description desc("Allowed options");
 	desc.add_options()
 		("help", "Get help on command line usage")
-		("ports", po::value<std::string>(), "Set ports to use. List of ports like 'com4,com20,com48' or 'auto' to find ports automatically. Auto can work, but its generally better to figure out your ports ahead of time and specify them explicitly.")
+		("ports", po::value<std::string>(), "Set ports to use. List of ports like 'com4,com20,com48' or 'auto' to find ports automatically. Auto can work, but its generally better to figure out your ports ahead of time and specify them explicitly. Flight controllers behind a network bridge (i.e. an ESP WiFi to MSP bridge) can be given as 'tcp:host:port' or 'udp:host:port', alongside serial ports; set baud to match the bridge's serial side.")
 		("baud", po::value<uint32_t>(), "Set baud rate to use. 9600, 19200, 57600 (for example). See documentation for specific suggestions.")
-		("refresh", po::value<uint32_t>(), "Set refresh interval in milliseconds to use. 250 refreshes 4 times a second, 50 refreshes 20 times per second, etc. Faster is generally better, up to the point you start dropping messages, or get excessive errors. It may take some experimentation to find a happy value. There is a default; omit this parameter to try it before adjusting on your own. See documentation for specific suggestions.")
+		("refresh", po::value<uint32_t>(), "Set refresh interval in milliseconds to use. 250 refreshes 4 times a second, 50 refreshes 20 times per second, etc. Faster is generally better, up to the point you start dropping messages, or get excessive errors. It may take some experimentation to find a happy value. There is a default; omit this parameter to try it before adjusting on your own. See documentation for specific suggestions. (Or see autorefresh.)")
+		("autorefresh", "Let each port find its own refresh interval, starting from the refresh setting. The interval is tightened while replies come back promptly and cleanly, and backed off on timeouts, CRC errors or slowing replies, so each link settles at the fastest rate it can sustain.")
 		("stale", po::value<uint32_t>(), "Set stale interval in milliseconds to use. This is the length of time beyond which a received craft position will be considered stale, and no longer forwarded to other crafts. For example, if set to 4000, any received craft position older than 4 seconds will be treated as stale and will not be forwarded to other crafts. If set to 0, craft positions will never be treated as stale and will always be forwarded.")
+		("timeout", po::value<uint32_t>(), "Set response timeout in milliseconds. If a flight controller has not replied to a request in this long, the request is given up on (and possibly resent; see retries).")
+		("retries", po::value<uint32_t>(), "Set how many times a request that gets no reply is resent before giving up on it. 0 never resends. A request is never resent if a newer one of the same kind is already waiting to go out, and other craft positions are never resent at all (the next refresh sends a current one).")
+		("threads", po::value<uint32_t>(), "Set how many worker threads service the flight controllers. Each flight controller is only ever serviced by one thread at a time, but different flight controllers can be serviced at once by different threads. 0 uses one thread per processor core. There is never more than one thread per port.")
+		("window", po::value<uint32_t>(), "Set how many requests may be awaiting replies from a flight controller at once. Higher keeps the link busier; 1 waits for each reply before sending the next request. 0 means no limit.")
 		("phantomwingman", po::value<std::string>(), "This mode is intended for testing. If set, a phantom craft will be injected that appears at the given angle and distance from the craft. This allows solo testing in a kind of loopback arrangement, so you can judge round-trip connectivity quality and latency.\r\n\r\nSyntax:\r\n\r\n--phantomwingman [port|'all'],[angle],[distInMeters],\r\n[relativeAltDifferenceInMeters].\r\n\r\nFor example \"-- phantomwingman com20,90,100,-35\" will put a phantom wingman 100 meters to the immediate right (90 degrees) of, and and 35 meters below, the craft on com20. \" --phantomwingman all,180,50,10\" will put a phantom wingman 50 meters directly behind (180 degrees) and 10 meters above all the crafts, no matter what com port they are connected to.")
+		("asynclog", "Write log output from a background thread, so the flight controller sessions never wait on the console or log files. Messages queue up until the logging thread gets to them; see logqueue and logoverflow.")
+		("logqueue", po::value<uint32_t>(), "Set how many log messages may be waiting to be written at once, when using asynclog.")
+		("logoverflow", po::value<std::string>(), "Set what happens when the log queue is full, when using asynclog. 'drop' throws away the oldest waiting messages (the default; sessions never wait). 'block' waits for room, so nothing is lost, but a burst of logging can slow a session down.")
 		("loglevel", po::value<std::string>(), "Set log level to use in output. Levels are trace, debug, info, warn, err, critical and off in level of priority. trace gives you everything, off gives you nothing, info is the in-between default.")
+	    ("roundrobin", "Refresh flight controllers one at a time, taking turns, rather than each on its own. Normally every port is refreshed independently, since each is its own link. Use this if your links share a radio channel, so only one craft is talked to at a time.")
+		("capture", "Record every byte sent to and received from each port, with timestamps, into capture files next to the logs (<log prefix>--Capture_<port>_<n>.cscap). Recording is a copy into memory-mapped files, so it doesn't slow the links down, and what was captured survives the program crashing. Useful for working out afterwards what a link was doing.")
+		("capturesegment", po::value<uint32_t>(), "Set the size of each capture file in megabytes, when using capture. Each file is created at full size up front; a new one is started when it fills.")
+		("replay", po::value<std::string>(), "Replay captured traffic (see capture) instead of monitoring ports, and report how fast it was processed and where the time went. List of capture files like 'a--Capture_com4_0000.cscap,a--Capture_com20_0000.cscap'; give the first file of each capture, and the rest are found from it. Captures of several ports from the same session are replayed together, so positions are forwarded between the crafts. The other settings (refresh, window, etc) apply as usual.")
+		("replaytiming", po::value<std::string>(), "Set how fast to replay, when using replay. 'fast' feeds the traffic in as fast as it can be processed (the default). 'original' feeds it in at the pace it was captured.")
+		("emulate", po::value<uint32_t>(), "This mode is intended for testing. Emulate this many flight controllers, each on its own pseudo-terminal (or in-memory link, see emulatelink), and monitor them just as if they were boards on real ports. They answer like iNav does, fly the path set with emulatepath, and are paced as if at the baud rate set with baud. This lets you try out large group flights without any hardware. Any ports given with ports are monitored too; auto-detected ports are not. Not available on Windows.")
+		("emulatepath", po::value<std::string>(), "Set where emulated flight controllers fly, when using emulate. They all fly the same path, spread out evenly along it.\r\n\r\nSyntax:\r\n\r\n--emulatepath [circle|outandback|stationary],[sizeInMeters],[speedInMetersPerSecond],[altitudeInMeters],\r\n[centerLat],[centerLon].\r\n\r\nThe centre is optional. For example \"--emulatepath circle,300,20,120\" flies circles 300 meters in radius at 20 meters per second, 120 meters up. outandback flies out from the centre for the given distance and back, each craft on its own heading. stationary holds each craft still, the given distance from the centre.")
+		("emulatedelay", po::value<uint32_t>(), "Set how long emulated flight controllers wait, in milliseconds, before starting to reply to a request, when using emulate.")
+		("emulatelink", po::value<std::string>(), "Set what emulated flight controllers are reached over, when using emulate. 'pty' puts each on its own pseudo-terminal, opened like any serial port (the default). 'memory' puts each on an in-memory link (port memory:EMU001 and so on), which never touches the OS; with a high baud and no emulatedelay, the links run about as fast as the sessions can go, for repeatable benchmarks of the processing alone. memory can't be used with emulateonly.")
+		("emulateonly", "Run the emulated flight controllers (see emulate) and list their ports, without monitoring them. Something else (another CraftServices, for example) can then open the ports. Runs until stopped.")
+		("metricsport", po::value<uint16_t>(), "Serve link metrics (position age, poll rate, round trip times, errors, per port and craft) in Prometheus text format at http://127.0.0.1:<port>/metrics, and how old positions are by the time they reach each craft (source -> destination, with percentiles) at /positionage. Only reachable from this machine. Off unless set.")
+		("metricssocket", po::value<std::string>(), "Serve the same link metrics over HTTP on a Unix domain socket at this path, rather than (or as well as) a loopback port. Not available on Windows.")
 	    ("omitgpspos", "Omits exact GPS positions in logging output. Will include relative distances however.")
 	    ("exitgpsloss", "if GPS position is no longer heard from a running flight controller, after a certain interval the program will exit, allowing it to be restarted via a batch file, etc. This is a somewhat desperate hack, intended to exist only until serial port restarting code works properly.");
 		;
@@ -164,6 +204,24 @@ uint32_t ProcessRefreshArgument(const po::variables_map & argumentVariablesMap)
 	return refreshToUse;
 }
 
+CraftServices::MspRefreshRateSettings ProcessAutoRefreshArgument(const po::variables_map & argumentVariablesMap, uint32_t refreshIntervalInMilliseconds)
+{
+	CraftServices::MspRefreshRateSettings refreshRateSettings;
+	refreshRateSettings.Automatic = argumentVariablesMap.count("autorefresh") > 0;
+	refreshRateSettings.MinimumIntervalInMilliseconds = std::min((uint32_t)DEFAULT_MINIMUM_AUTO_REFRESH_INTERVAL_IN_MILLISECONDS, refreshIntervalInMilliseconds);
+	refreshRateSettings.MaximumIntervalInMilliseconds = std::max((uint32_t)DEFAULT_MAXIMUM_AUTO_REFRESH_INTERVAL_IN_MILLISECONDS, refreshIntervalInMilliseconds);
+	if (refreshRateSettings.Automatic)
+	{
+		pConsoleAndAllLogger->info("Automatic Refresh Rate: {} - {} ms", refreshRateSettings.MinimumIntervalInMilliseconds, refreshRateSettings.MaximumIntervalInMilliseconds);
+	}
+	else
+	{
+		pConsoleAndAllLogger->info("Automatic Refresh Rate: {}", false);
+	}
+
+	return refreshRateSettings;
+}
+
 uint32_t ProcessStaleArgument(const po::variables_map & argumentVariablesMap)
 {
 	uint32_t staleToUse = DEFAULT_STALE_INTERVAL_IN_MILLISECONDS;
@@ -176,6 +234,42 @@ uint32_t ProcessStaleArgument(const po::variables_map & argumentVariablesMap)
 	return staleToUse;
 }
 
+uint32_t ProcessTimeoutArgument(const po::variables_map & argumentVariablesMap)
+{
+	uint32_t timeoutToUse = DEFAULT_RESPONSE_TIMEOUT_IN_MILLISECONDS;
+	if (argumentVariablesMap.count("timeout"))
+	{
+		timeoutToUse = argumentVariablesMap["timeout"].as<std::uint32_t>();
+	}
+	pConsoleAndAllLogger->info("Response Timeout: {} ms", timeoutToUse);
+
+	return timeoutToUse;
+}
+
+uint32_t ProcessRetriesArgument(const po::variables_map & argumentVariablesMap)
+{
+	uint32_t retriesToUse = DEFAULT_MAX_RETRY_COUNT;
+	if (argumentVariablesMap.count("retries"))
+	{
+		retriesToUse = argumentVariablesMap["retries"].as<std::uint32_t>();
+	}
+	pConsoleAndAllLogger->info("Retries: {}", retriesToUse);
+
+	return retriesToUse;
+}
+
+uint32_t ProcessWindowArgument(const po::variables_map & argumentVariablesMap)
+{
+	uint32_t windowToUse = DEFAULT_REQUEST_WINDOW_SIZE;
+	if (argumentVariablesMap.count("window"))
+	{
+		windowToUse = argumentVariablesMap["window"].as<std::uint32_t>();
+	}
+	pConsoleAndAllLogger->info("Request Window: {}", windowToUse);
+
+	return windowToUse;
+}
+
 spdlog::level::level_enum ProcessLogLevelArgument(const po::variables_map & argumentVariablesMap)
 {
 	spdlog::level::level_enum logLevel = CRAFT_SERVICES_DEFAULT_LOG_LEVEL;
@@ -223,6 +317,25 @@ bool ProcessExitGpsLoss(const po::variables_map & argumentVariablesMap)
 	return exitOnGpsLoss;
 }
 
+uint32_t ProcessThreadsArgument(const po::variables_map & argumentVariablesMap)
+{
+	uint32_t threadsToUse = DEFAULT_WORKER_THREAD_COUNT;
+	if (argumentVariablesMap.count("threads"))
+	{
+		threadsToUse = argumentVariablesMap["threads"].as<std::uint32_t>();
+	}
+	pConsoleAndAllLogger->info("Worker Threads: {}", (threadsToUse == 0) ? std::string("one per core") : std::to_string(threadsToUse));
+
+	return threadsToUse;
+}
+
+bool ProcessRoundRobin(const po::variables_map & argumentVariablesMap)
+{
+	bool roundRobin = argumentVariablesMap.count("roundrobin") > 0;
+	pConsoleAndAllLogger->info("Round Robin Refresh: {}", roundRobin);
+	return roundRobin;
+}
+
 bool ProcessOmitGpsPos(const po::variables_map & argumentVariablesMap)
 {
 	bool omitGpsPosition = argumentVariablesMap.count("omitgpspos") > 0;
@@ -231,6 +344,285 @@ bool ProcessOmitGpsPos(const po::variables_map & argumentVariablesMap)
 }
 
 
+// Switch to asynchronous logging, if asked for. Every logger created from here on uses these settings, and
+// the console/all-log logger is recreated with them.
+CraftServices::LoggingSettings ProcessLoggingArguments(const po::variables_map & argumentVariablesMap, spdlog::level::level_enum spdLogLevel)
+{
+	CraftServices::LoggingSettings loggingSettings;
+	loggingSettings.Asynchronous = argumentVariablesMap.count("asynclog") > 0;
+	loggingSettings.QueueSize = DEFAULT_LOG_QUEUE_SIZE;
+	loggingSettings.OverflowPolicy = CraftServices::LogQueueOverflowPolicy::DropOldest;
+
+	if (argumentVariablesMap.count("logqueue"))
+	{
+		loggingSettings.QueueSize = std::max(1u, argumentVariablesMap["logqueue"].as<std::uint32_t>());
+	}
+	if (argumentVariablesMap.count("logoverflow"))
+	{
+		std::string overflowPolicyString = boost::to_lower_copy(argumentVariablesMap["logoverflow"].as<std::string>());
+		if (overflowPolicyString == "block")
+		{
+			loggingSettings.OverflowPolicy = CraftServices::LogQueueOverflowPolicy::Block;
+		}
+		else if (overflowPolicyString != "drop")
+		{
+			throw CommandLineArgumentsException("logoverflow must be 'drop' or 'block'");
+		}
+	}
+
+	if (loggingSettings.Asynchronous)
+	{
+		CraftServices::Logging::StartLogging(loggingSettings);
+		pConsoleAndAllLogger = CraftServices::Logging::CreateLogger("ConsoleAndAll", { console_sink, all_log_file_sink }, loggingSettings);
+		pConsoleAndAllLogger->set_level(spdLogLevel);
+		pConsoleAndAllLogger->info("Asynchronous Logging: queue of {} messages, {} when full", loggingSettings.QueueSize, CraftServices::Logging::GetOverflowPolicyAsString(loggingSettings.OverflowPolicy));
+	}
+	else
+	{
+		pConsoleAndAllLogger->info("Asynchronous Logging: off");
+	}
+
+	return loggingSettings;
+}
+
+// Capture raw port traffic, if asked for
+CraftServices::MspLinkCaptureSettings ProcessCaptureArguments(const po::variables_map & argumentVariablesMap)
+{
+	CraftServices::MspLinkCaptureSettings captureSettings;
+	captureSettings.Enabled = argumentVariablesMap.count("capture") > 0;
+
+	uint32_t segmentSizeInMegabytes = DEFAULT_CAPTURE_SEGMENT_SIZE_IN_MEGABYTES;
+	if (argumentVariablesMap.count("capturesegment"))
+	{
+		segmentSizeInMegabytes = argumentVariablesMap["capturesegment"].as<std::uint32_t>();
+		if (segmentSizeInMegabytes == 0)
+		{
+			throw CommandLineArgumentsException("capturesegment must be at least 1 megabyte");
+		}
+	}
+	captureSettings.SegmentByteCount = (uint64_t)segmentSizeInMegabytes * 1024 * 1024;
+
+	if (captureSettings.Enabled)
+	{
+		pConsoleAndAllLogger->info("Capture: on, {} MB segments", segmentSizeInMegabytes);
+	}
+	else
+	{
+		pConsoleAndAllLogger->info("Capture: off");
+	}
+
+	return captureSettings;
+}
+
+// Replay captures instead of monitoring ports, if asked for. Fills in replayCaptureFilePaths (which stays empty if not).
+CraftServices::MspReplayTiming ProcessReplayArguments(const po::variables_map & argumentVariablesMap, std::vector<std::string> & replayCaptureFilePaths)
+{
+	CraftServices::MspReplayTiming replayTiming = CraftServices::MspReplayTiming::AsFastAsPossible;
+	if (!argumentVariablesMap.count("replay"))
+	{
+		return replayTiming;
+	}
+
+	boost::split(replayCaptureFilePaths, argumentVariablesMap["replay"].as<std::string>(), boost::is_any_of(","), boost::token_compress_on);
+	replayCaptureFilePaths.erase(std::remove(replayCaptureFilePaths.begin(), replayCaptureFilePaths.end(), std::string()), replayCaptureFilePaths.end());
+	if (replayCaptureFilePaths.empty())
+	{
+		throw CommandLineArgumentsException("replay needs at least one capture file");
+	}
+
+	if (argumentVariablesMap.count("replaytiming"))
+	{
+		std::string replayTimingString = boost::to_lower_copy(argumentVariablesMap["replaytiming"].as<std::string>());
+		if (replayTimingString == "original")
+		{
+			replayTiming = CraftServices::MspReplayTiming::OriginalTiming;
+		}
+		else if (replayTimingString != "fast")
+		{
+			throw CommandLineArgumentsException("replaytiming must be 'fast' or 'original'");
+		}
+	}
+
+	pConsoleAndAllLogger->info("Replay: {} capture(s), {}", replayCaptureFilePaths.size(), 
+		(replayTiming == CraftServices::MspReplayTiming::OriginalTiming) ? "original timing" : "as fast as possible");
+	return replayTiming;
+}
+
+// Start serving link metrics, if a metrics port or socket was asked for. Failing to start the exporter is
+// logged, but isn't fatal; the craft still get their positions either way.
+void ProcessMetricsArguments(const po::variables_map & argumentVariablesMap)
+{
+	bool serveOnPort = argumentVariablesMap.count("metricsport") > 0;
+	bool serveOnSocket = argumentVariablesMap.count("metricssocket") > 0;
+	if (!serveOnPort && !serveOnSocket)
+	{
+		pConsoleAndAllLogger->info("Metrics Export: off");
+		return;
+	}
+
+	pMetricsExporter = new CraftServices::MspMetricsExporter(pConsoleAndAllLogger.get());
+	try
+	{
+		if (serveOnPort)
+		{
+			pMetricsExporter->ListenOnLoopbackPort(argumentVariablesMap["metricsport"].as<uint16_t>());
+		}
+		if (serveOnSocket)
+		{
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+			pMetricsExporter->ListenOnUnixSocket(argumentVariablesMap["metricssocket"].as<std::string>());
+#else
+			pConsoleAndAllLogger->warn("Metrics Export: Unix domain sockets aren't supported on this platform; ignoring metricssocket.");
+#endif // BOOST_ASIO_HAS_LOCAL_SOCKETS
+		}
+		pMetricsExporter->Start();
+	}
+	catch (std::exception & e)
+	{
+		pConsoleAndAllLogger->error("Metrics Export: could not start, continuing without it: {}", e.what());
+		delete pMetricsExporter;
+		pMetricsExporter = NULL;
+	}
+}
+
+// How to emulate flight controllers, if asked for (--emulate). FlightControllerCount is zero if not.
+CraftServices::MspFlightControllerEmulatorSettings ProcessEmulateArguments(const po::variables_map & argumentVariablesMap, uint32_t baudRate)
+{
+	CraftServices::MspFlightControllerEmulatorSettings emulatorSettings;
+	emulatorSettings.FlightControllerCount = argumentVariablesMap.count("emulate") ? argumentVariablesMap["emulate"].as<uint32_t>() : 0;
+	emulatorSettings.LinkType = CraftServices::MspEmulatedLinkType::PseudoTerminal;
+	emulatorSettings.BaudRate = baudRate;
+	emulatorSettings.ResponseDelayInMilliseconds = argumentVariablesMap.count("emulatedelay") ? argumentVariablesMap["emulatedelay"].as<uint32_t>() : DEFAULT_EMULATED_RESPONSE_DELAY_IN_MILLISECONDS;
+
+	CraftServices::MspEmulatedFlightPath & flightPath = emulatorSettings.FlightPath;
+	flightPath.Shape = CraftServices::MspEmulatedFlightPathShape::Circle;
+	flightPath.CenterLatInDecimalDegrees = DEFAULT_EMULATED_FLIGHT_PATH_CENTER_LAT;
+	flightPath.CenterLonInDecimalDegrees = DEFAULT_EMULATED_FLIGHT_PATH_CENTER_LON;
+	flightPath.SizeInMeters = DEFAULT_EMULATED_FLIGHT_PATH_SIZE_IN_METERS;
+	flightPath.SpeedInMetersPerSecond = DEFAULT_EMULATED_FLIGHT_PATH_SPEED_IN_METERS_PER_SECOND;
+	flightPath.AltitudeInMeters = DEFAULT_EMULATED_FLIGHT_PATH_ALTITUDE_IN_METERS;
+
+	if (argumentVariablesMap.count("emulatepath"))
+	{
+		const std::string invalidArgumentsForEmulatePath = "Invalid sub-arguments for emulatepath argument.";
+
+		std::vector<std::string> commaDelimitedSubArguments;
+		boost::split(commaDelimitedSubArguments, argumentVariablesMap["emulatepath"].as<std::string>(), boost::is_any_of(","));
+		if (commaDelimitedSubArguments.size() != 4 && commaDelimitedSubArguments.size() != 6)
+		{
+			throw CommandLineArgumentsException(invalidArgumentsForEmulatePath);
+		}
+
+		std::string shapeString = boost::to_lower_copy(commaDelimitedSubArguments[0]);
+		if (shapeString == "circle")
+		{
+			flightPath.Shape = CraftServices::MspEmulatedFlightPathShape::Circle;
+		}
+		else if (shapeString == "outandback")
+		{
+			flightPath.Shape = CraftServices::MspEmulatedFlightPathShape::OutAndBack;
+		}
+		else if (shapeString == "stationary")
+		{
+			flightPath.Shape = CraftServices::MspEmulatedFlightPathShape::Stationary;
+		}
+		else
+		{
+			throw CommandLineArgumentsException(invalidArgumentsForEmulatePath);
+		}
+
+		try
+		{
+			flightPath.SizeInMeters = boost::lexical_cast<double>(commaDelimitedSubArguments[1]);
+			flightPath.SpeedInMetersPerSecond = boost::lexical_cast<double>(commaDelimitedSubArguments[2]);
+			flightPath.AltitudeInMeters = boost::lexical_cast<double>(commaDelimitedSubArguments[3]);
+			if (commaDelimitedSubArguments.size() == 6)
+			{
+				flightPath.CenterLatInDecimalDegrees = boost::lexical_cast<double>(commaDelimitedSubArguments[4]);
+				flightPath.CenterLonInDecimalDegrees = boost::lexical_cast<double>(commaDelimitedSubArguments[5]);
+			}
+		}
+		catch (...)
+		{
+			throw CommandLineArgumentsException(invalidArgumentsForEmulatePath);
+		}
+
+		if (flightPath.SizeInMeters < 0 || flightPath.SpeedInMetersPerSecond < 0)
+		{
+			throw CommandLineArgumentsException(invalidArgumentsForEmulatePath);
+		}
+	}
+
+	if (argumentVariablesMap.count("emulatelink"))
+	{
+		std::string linkTypeString = boost::to_lower_copy(argumentVariablesMap["emulatelink"].as<std::string>());
+		if (linkTypeString == "pty")
+		{
+			emulatorSettings.LinkType = CraftServices::MspEmulatedLinkType::PseudoTerminal;
+		}
+		else if (linkTypeString == "memory")
+		{
+			emulatorSettings.LinkType = CraftServices::MspEmulatedLinkType::Memory;
+		}
+		else
+		{
+			throw CommandLineArgumentsException("Invalid value for emulatelink argument.");
+		}
+	}
+
+	if (emulatorSettings.FlightControllerCount == 0 && argumentVariablesMap.count("emulateonly"))
+	{
+		throw CommandLineArgumentsException("emulateonly needs emulate");
+	}
+
+	// Nothing outside this process can reach an in-memory link
+	if (emulatorSettings.LinkType == CraftServices::MspEmulatedLinkType::Memory && argumentVariablesMap.count("emulateonly"))
+	{
+		throw CommandLineArgumentsException("emulateonly can't be used with emulatelink memory");
+	}
+
+	return emulatorSettings;
+}
+
+// Start the emulated flight controllers, and add their ports to the ones to monitor. Ports that were only
+// auto-detected are dropped; the emulated ones are what's being tested.
+void StartFlightControllerEmulator(const CraftServices::MspFlightControllerEmulatorSettings & emulatorSettings, PortDetectionType portDetectionType, std::vector<std::string> & portNamesToMonitor)
+{
+#ifdef CRAFT_SERVICES_HAS_FLIGHT_CONTROLLER_EMULATOR
+	pFlightControllerEmulator = new CraftServices::MspFlightControllerEmulator(emulatorSettings, pConsoleAndAllLogger.get());
+
+	std::string errorMessage;
+	if (!pFlightControllerEmulator->Open(errorMessage))
+	{
+		throw CraftServiceException("Could not start flight controller emulator: " + errorMessage);
+	}
+	pFlightControllerEmulator->Start();
+
+	std::vector<std::string> emulatedPortNames = pFlightControllerEmulator->GetPortNames();
+	if (portDetectionType == PortDetectionType::Auto)
+	{
+		portNamesToMonitor.clear();
+	}
+	portNamesToMonitor.insert(portNamesToMonitor.end(), emulatedPortNames.begin(), emulatedPortNames.end());
+
+	pConsoleAndAllLogger->info("Emulated Ports:{}", GetAllSerialPortNames(emulatedPortNames));
+#else
+	throw NotImplementedException("Emulated flight controllers need pseudo-terminals, which this platform doesn't have");
+#endif // CRAFT_SERVICES_HAS_FLIGHT_CONTROLLER_EMULATOR
+}
+
+// Just answer as the emulated flight controllers until stopped (--emulateonly)
+void DoEmulationOnly()
+{
+	pConsoleAndAllLogger->info("Emulating flight controllers only; not monitoring any ports.");
+
+	// Nothing is posted to the IO context here, so it would return straight away without this
+	auto workGuard = boost::asio::make_work_guard(ioContext);
+	IoWorkerThreadsRunning = true;
+	RunIoContextWorkerThread();
+	IoWorkerThreadsRunning = false;
+}
+
 // Returns relevant PortDetectionType, with list of ports that should
 // have monitoring attempted on them in portNamesToMonitor
 PortDetectionType ProcessPortsArgument(const po::variables_map & argumentVariablesMap, std::vector<std::string> & portNamesToMonitor)
@@ -389,10 +781,16 @@ void DoAsyncMonitoring(std::vector<std::string> portNamesToMonitor,
 					   uint32_t baudRateForAllPorts, 
 					   uint32_t refreshIntervalInMillisecondsForAllPorts,
 					   uint32_t staleIntervalInMilliseconds,
+					   const CraftServices::MspRequestTrackingSettings & requestTrackingSettings,
+					   const CraftServices::MspRefreshRateSettings & refreshRateSettings,
 					   spdlog::level::level_enum spdLogLevel,
+					   const CraftServices::LoggingSettings & loggingSettings,
+					   const CraftServices::MspLinkCaptureSettings & captureSettings,
 					   std::vector<CraftServices::PhantomTestCraft *> phantomTestCraft,
 					   bool exitOnGpsLoss,
-					   bool omitGpsPos)
+					   bool omitGpsPos,
+					   bool roundRobin,
+					   uint32_t workerThreadCount)
 {
 	pConsoleAndAllLogger->trace("DoAsyncMonitoring()");
 
@@ -402,37 +800,210 @@ void DoAsyncMonitoring(std::vector<std::string> portNamesToMonitor,
 	{
 		std::string currentSerialPortName = *comPortIt;
 		CraftServices::MSPFlightControllerAsync * pCurrentFlightController = 
-			new CraftServices::MSPFlightControllerAsync(&ioContext, currentSerialPortName, baudRateForAllPorts, refreshIntervalInMillisecondsForAllPorts, staleIntervalInMilliseconds, 
-														console_sink, all_log_file_sink, spdLogLevel, SpdLogLoggingPattern, DateTimeLogFilePrefixString,
+			new CraftServices::MSPFlightControllerAsync(&ioContext, currentSerialPortName, baudRateForAllPorts, refreshIntervalInMillisecondsForAllPorts, staleIntervalInMilliseconds, requestTrackingSettings, refreshRateSettings,
+														console_sink, all_log_file_sink, spdLogLevel, SpdLogLoggingPattern, loggingSettings, captureSettings, DateTimeLogFilePrefixString,
 														&AsyncFlightControllerSessions, &phantomTestCraft, exitOnGpsLoss, omitGpsPos);
 		AsyncFlightControllerSessions.push_back(pCurrentFlightController);
 
 		pConsoleAndAllLogger->info("Created MSPFlightControllerAsync to monitor {}.", currentSerialPortName);
 	}
 
-	StartFlightControllerRefreshTimerFiring(refreshIntervalInMillisecondsForAllPorts);
+	if (roundRobin)
+	{
+		// Flight Controllers take turns on one shared timer
+		StartFlightControllerRefreshTimerFiring(refreshIntervalInMillisecondsForAllPorts);
+	}
+	else
+	{
+		// Each Flight Controller is refreshed on its own timer, all in parallel
+		for (std::vector<CraftServices::MSPFlightControllerAsync *>::iterator fcIter = AsyncFlightControllerSessions.begin(); fcIter < AsyncFlightControllerSessions.end(); fcIter++)
+		{
+			(*fcIter)->StartRefreshTimerFiring();
+		}
+	}
 
-	pConsoleAndAllLogger->trace("IO Context running...");
-	ioContext.run();
+	// Run the IO context on a pool of worker threads. Each flight controller's handlers are serialized on its own
+	// strand, so different ports can be serviced at the same time, but no one session is ever on two threads at once.
+	if (workerThreadCount == 0)
+	{
+		workerThreadCount = std::max(1u, boost::thread::hardware_concurrency());
+	}
+	// More threads than sessions would only sit idle
+	workerThreadCount = std::max(1u, std::min(workerThreadCount, (uint32_t)AsyncFlightControllerSessions.size()));
+
+	pConsoleAndAllLogger->trace("IO Context running on {} thread(s)...", workerThreadCount);
+	IoWorkerThreadsRunning = true;
+	boost::thread_group ioWorkerThreads;
+	// This thread is one of the workers too
+	for (uint32_t threadIndex = 1; threadIndex < workerThreadCount; threadIndex++)
+	{
+		ioWorkerThreads.create_thread(RunIoContextWorkerThread);
+	}
+	RunIoContextWorkerThread();
+	ioWorkerThreads.join_all();
+	IoWorkerThreadsRunning = false;
 	//pConsoleAndAllLogger->trace("IO Context exited...");
 }
 
+// Feed captured traffic through a session per capture, in place of monitoring ports (--replay)
+void DoCaptureReplay(const std::vector<std::string> & replayCaptureFilePaths,
+					 CraftServices::MspReplayTiming replayTiming,
+					 uint32_t refreshIntervalInMillisecondsForAllPorts,
+					 uint32_t staleIntervalInMilliseconds,
+					 const CraftServices::MspRequestTrackingSettings & requestTrackingSettings,
+					 const CraftServices::MspRefreshRateSettings & refreshRateSettings,
+					 spdlog::level::level_enum spdLogLevel,
+					 const CraftServices::LoggingSettings & loggingSettings,
+					 std::vector<CraftServices::PhantomTestCraft *> phantomTestCraft,
+					 bool omitGpsPos)
+{
+	pConsoleAndAllLogger->trace("DoCaptureReplay()");
+
+	CraftServices::MspCaptureReplay captureReplay(&ioContext, pConsoleAndAllLogger.get());
+	for (const auto & replayCaptureFilePath : replayCaptureFilePaths)
+	{
+		std::string errorMessage;
+		if (!captureReplay.AddCapture(replayCaptureFilePath, errorMessage))
+		{
+			pConsoleAndAllLogger->error("Replay: {}", errorMessage);
+			return;
+		}
+	}
+
+	// (A replay isn't captured again)
+	CraftServices::MspLinkCaptureSettings captureSettings = { false, 0 };
+	for (size_t captureIndex = 0; captureIndex < captureReplay.GetCaptureCount(); captureIndex++)
+	{
+		// The port name goes into log file names, so it can't keep any path separators it came with
+		std::string sessionName = CraftServices::MspLinkCaptureRecorder::GetFileSafePortName(captureReplay.GetCapturePortName(captureIndex));
+		CraftServices::MSPFlightControllerAsync * pCurrentFlightController = 
+			new CraftServices::MSPFlightControllerAsync(&ioContext, sessionName, captureReplay.GetCaptureBaudRate(captureIndex), refreshIntervalInMillisecondsForAllPorts, staleIntervalInMilliseconds, requestTrackingSettings, refreshRateSettings,
+														console_sink, all_log_file_sink, spdLogLevel, SpdLogLoggingPattern, loggingSettings, captureSettings, DateTimeLogFilePrefixString,
+														&AsyncFlightControllerSessions, &phantomTestCraft, false, omitGpsPos);
+		AsyncFlightControllerSessions.push_back(pCurrentFlightController);
+		captureReplay.AttachFlightController(captureIndex, pCurrentFlightController);
+	}
+
+	// The sessions' handlers run on this thread, from inside the replay, so a shutdown has to wait for it to notice
+	IoWorkerThreadsRunning = true;
+	captureReplay.Run(replayTiming);
+	IoWorkerThreadsRunning = false;
+
+	captureReplay.OutputReport();
+}
+
+void RunIoContextWorkerThread()
+{
+	try
+	{
+		ioContext.run();
+	}
+	catch (std::exception & e)
+	{
+		pConsoleAndAllLogger->error("Exception in IO worker thread: {}", e.what());
+		DoCleanupAndShutdown();
+	}
+}
+
 void StartFlightControllerRefreshTimerFiring(uint32_t refreshIntervalInMilliseconds)
 {
 	pConsoleAndAllLogger->trace("StartFlightControllerRefreshTimerFiring() - {} ms", refreshIntervalInMilliseconds);
 
 	// Create main Flight Controller refresh timer
 	pFlightControllerSteadyTimer = new boost::asio::steady_timer(ioContext, boost::asio::chrono::milliseconds(refreshIntervalInMilliseconds));
+	pRoundRobinStrand = new boost::asio::io_context::strand(ioContext);
+
+	// Configured order to begin with; there are no positions to go by yet
+	FlightControllerServiceOrder = AsyncFlightControllerSessions;
 
 	// Start timer firing at regular interval
-	boost::system::error_code errorCode;
-	pFlightControllerSteadyTimer->async_wait([&](const boost::system::error_code & error) { RefreshFlightControllers(errorCode); });
+	WaitForNextFlightControllerRefresh();
 }
 
-static int currentFlightControllerIndex = 0;
+// Bumped every time we start waiting on the refresh timer. If the timer is moved up after it has already fired, 
+// the callback for the old firing may still be on its way; it carries an old generation, and is ignored.
+static uint64_t RefreshTimerGeneration = 0;
 
-// Called at a regular interval. Updates each flight controller in turn,
-// picking a different flight controller to update each time it is called
+void WaitForNextFlightControllerRefresh()
+{
+	uint64_t timerGeneration = ++RefreshTimerGeneration;
+	pFlightControllerSteadyTimer->async_wait(boost::asio::bind_executor(*pRoundRobinStrand, [timerGeneration](const boost::system::error_code & error) 
+	{ 
+		if (timerGeneration == RefreshTimerGeneration)
+		{
+			RefreshFlightControllers(error);
+		}
+	}));
+}
+
+static size_t currentFlightControllerIndex = 0;
+
+// Round robin mode only. Put the Flight Controllers whose crafts are nearest another craft first, so the closest
+// pairs hear about each other soonest. With 3 or more crafts and one cycle per craft, this can make a real 
+// difference to how stale the nearest neighbour's position is by the time it arrives.
+//
+// Each craft is ranked by how close it will get to its nearest neighbour (see CraftProximity), ties broken by how 
+// close it gets to all the others combined. Given crafts A, B, C with A <--> B 250 meters apart, B <--> C 15 meters,
+// C <--> A 25 meters, that's C (15, sum 40), B (15, sum 265), A (25, sum 275). Every Flight Controller is still
+// serviced once a round, so far-off crafts are only ever moved later in the round, never skipped.
+void OrderFlightControllersByProximity()
+{
+	struct FlightControllerRank
+	{
+		CraftServices::MSPFlightControllerAsync * pFlightController;
+		double NearestNeighbourRank;
+		double SumOfRanks;
+	};
+
+	std::vector<CraftServices::CraftKinematics> allKinematics;
+	for (CraftServices::MSPFlightControllerAsync * pFlightController : AsyncFlightControllerSessions)
+	{
+		std::shared_ptr<const CraftServices::PublishedCraftPosition> pPosition = pFlightController->GetPublishedPosition();
+		allKinematics.push_back(pPosition ? pPosition->Kinematics : CraftServices::CraftProximity::GetUnknownKinematics());
+	}
+
+	std::vector<FlightControllerRank> flightControllerRanks;
+	for (size_t fcIndex = 0; fcIndex < AsyncFlightControllerSessions.size(); fcIndex++)
+	{
+		FlightControllerRank flightControllerRank = { AsyncFlightControllerSessions[fcIndex], HUGE_VAL, 0 };
+		for (size_t otherFcIndex = 0; otherFcIndex < AsyncFlightControllerSessions.size(); otherFcIndex++)
+		{
+			if (otherFcIndex != fcIndex)
+			{
+				double proximityRank = CraftServices::CraftProximity::GetProximityRank(allKinematics[fcIndex], allKinematics[otherFcIndex]);
+				flightControllerRank.NearestNeighbourRank = std::min(flightControllerRank.NearestNeighbourRank, proximityRank);
+				flightControllerRank.SumOfRanks += proximityRank;
+			}
+		}
+		flightControllerRanks.push_back(flightControllerRank);
+	}
+
+	// Stable, so crafts we can't rank yet keep their configured order
+	std::stable_sort(flightControllerRanks.begin(), flightControllerRanks.end(), [](const FlightControllerRank & first, const FlightControllerRank & second)
+	{
+		if (first.NearestNeighbourRank != second.NearestNeighbourRank)
+		{
+			return first.NearestNeighbourRank < second.NearestNeighbourRank;
+		}
+		return first.SumOfRanks < second.SumOfRanks;
+	});
+
+	FlightControllerServiceOrder.clear();
+	for (const FlightControllerRank & flightControllerRank : flightControllerRanks)
+	{
+		FlightControllerServiceOrder.push_back(flightControllerRank.pFlightController);
+	}
+}
+
+// The Flight Controller whose refresh cycle is running now. Its cycle completing early moves the schedule along.
+static CraftServices::MSPFlightControllerAsync * pFlightControllerInCurrentCycle = NULL;
+
+// Round robin mode only. Called at a regular interval. Updates each flight controller in turn,
+// picking a different flight controller to update each time it is called.
+//
+// The interval is really an upper bound. Each refresh cycle ends as soon as the flight controller has answered 
+// everything it was sent (see FlightControllerRefreshCycleComplete), so on a clean link we go as fast as the
+// link allows. On a poor link, where replies are slow or go missing, we fall back to the regular interval.
 void RefreshFlightControllers(const boost::system::error_code & error)
 {
 	if (IsShutdownInProgressOrComplete())
@@ -457,37 +1028,56 @@ void RefreshFlightControllers(const boost::system::error_code & error)
 	}
 
 	// Update this flight controller
-	AsyncFlightControllerSessions[currentFlightControllerIndex]->RefreshFlightControllerState();
+	// (The refresh itself runs on the flight controller's own strand, like everything else it does)
+	CraftServices::MSPFlightControllerAsync * pCurrentFlightController = FlightControllerServiceOrder[currentFlightControllerIndex];
+	pFlightControllerInCurrentCycle = pCurrentFlightController;
+	boost::asio::post(*pCurrentFlightController->pSessionStrand, [pCurrentFlightController]() { pCurrentFlightController->RefreshFlightControllerState(); });
 
 	// Move to the next index, so that the next time we trip this function, we update the next FlightController.
 	currentFlightControllerIndex++;
 	if (currentFlightControllerIndex >= flightControllerCount)
 	{
-		// Wrap back to first
+		// Wrap back to first. Every one has been serviced, so this is a good time to work out the next round's order.
 		currentFlightControllerIndex = 0;
-		// TODO:
-		// At this point, once all have been serviced, we could sort the Flight Controllers by distance and service them
-		// such that the crafts nearest each other hear about each other first. With about .5 second latency per craft, and multiple
-		// (3 or more) crafts, this could actually make a difference in performance. -- SLG
+		OrderFlightControllersByProximity();
 	}
 
 	if (!IsShutdownInProgressOrComplete())
 	{
-		//ScheduleNextFlightControllerTimerFiring();
-
-	    // Reschedule the timer to fire again at interval
-		pFlightControllerSteadyTimer->expires_at(pFlightControllerSteadyTimer->expires_at() + boost::asio::chrono::milliseconds(RefreshIntervalInMilliseconds));
-		pFlightControllerSteadyTimer->async_wait([&](const boost::system::error_code & error) { RefreshFlightControllers(error); });
+		// Reschedule the timer to fire again at interval. This is the longest this flight controller's cycle gets;
+		// it will usually be cut short when the last reply comes in.
+		uint32_t cycleTimeoutInMilliseconds = pCurrentFlightController->GetRefreshIntervalInMilliseconds();
+		pFlightControllerSteadyTimer->expires_at(pFlightControllerSteadyTimer->expires_at() + boost::asio::chrono::milliseconds(cycleTimeoutInMilliseconds));
+		WaitForNextFlightControllerRefresh();
 	}
 }
 
-void ScheduleNextFlightControllerTimerToFireImmediately()
+// A flight controller has had replies to everything it was sent this cycle, so there's no need to wait out the
+// rest of the interval. Move on to the next one, after leaving a short gap on the link.
+void FlightControllerRefreshCycleComplete(CraftServices::MSPFlightControllerAsync * pFlightController)
 {
-	pConsoleAndAllLogger->trace("ScheduleNextFlightControllerTimerToFireImmediately()");
+	// Called from the flight controller's strand; hop over to the scheduler's
+	boost::asio::post(*pRoundRobinStrand, [pFlightController]()
+	{
+		if (IsShutdownInProgressOrComplete() || pFlightController != pFlightControllerInCurrentCycle)
+		{
+			return;
+		}
+
+		// Only the first completion per cycle counts
+		pFlightControllerInCurrentCycle = NULL;
 
-	// Reschedule the timer to fire immediately. (Current timer will be cancelled, and called with error code; we ignore that call.)
-	pFlightControllerSteadyTimer->expires_after(boost::asio::chrono::milliseconds(0));
-	pFlightControllerSteadyTimer->async_wait([&](const boost::system::error_code & error) { RefreshFlightControllers(error); });
+		ScheduleNextFlightControllerTimerToFireAfter((uint32_t)pFlightController->GetMinimumInterFrameGapInMilliseconds());
+	});
+}
+
+void ScheduleNextFlightControllerTimerToFireAfter(uint32_t delayInMilliseconds)
+{
+	pConsoleAndAllLogger->trace("ScheduleNextFlightControllerTimerToFireAfter() - {} ms", delayInMilliseconds);
+
+	// Reschedule the timer to fire shortly. (Current wait will be cancelled, and called with error code; we ignore that call.)
+	pFlightControllerSteadyTimer->expires_after(boost::asio::chrono::milliseconds(delayInMilliseconds));
+	WaitForNextFlightControllerRefresh();
 }
 
 
@@ -516,7 +1106,7 @@ void CleanupFlightControllers(std::vector<CraftServices::MSPFlightControllerAsyn
 		for (std::vector<CraftServices::MSPFlightControllerAsync *>::iterator it = asyncFlightControllerSessionsVect.begin(); it < asyncFlightControllerSessionsVect.end(); it++)
 		{
 			CraftServices::MSPFlightControllerAsync * pCurrentFlightController = (*it);
-			pCurrentFlightController->pSerialPort->close();
+			pCurrentFlightController->pTransport->Close();
 
 			delete pCurrentFlightController;
 			pCurrentFlightController = NULL;
@@ -571,7 +1161,8 @@ void SetUpBaseLogger(spdlog::level::level_enum spdLogLevel)
 	all_log_file_sink->set_level(spdLogLevel);
 	all_log_file_sink->set_pattern(SpdLogLoggingPattern);
 
-	pConsoleAndAllLogger = new spdlog::logger("ConsoleAndAll", { console_sink, all_log_file_sink });
+	// Synchronous to start with; see ProcessLoggingArguments()
+	pConsoleAndAllLogger = std::make_shared<spdlog::logger>("ConsoleAndAll", spdlog::sinks_init_list({ console_sink, all_log_file_sink }));
 	pConsoleAndAllLogger->set_level(spdLogLevel);
 
 	/*
@@ -602,6 +1193,16 @@ static boost::mutex ShutdownMutex;
 
 void DoCleanupAndShutdown(bool playBeepsAndShowExitLogging)
 {
+	// The flight controllers can't be torn down while IO worker threads might still be running their handlers.
+	// So if the workers are running, just stop them. DoAsyncMonitoring() returns on the main thread once they
+	// have all finished, and the cleanup proper happens from there.
+	if (IoWorkerThreadsRunning)
+	{
+		ShutdownRequested = true;
+		ioContext.stop();
+		return;
+	}
+
 	ShutdownMutex.lock();
 	if (!ShutdownInProgress && !ShutdownCompleted)
 	{
@@ -611,12 +1212,33 @@ void DoCleanupAndShutdown(bool playBeepsAndShowExitLogging)
 		if (playBeepsAndShowExitLogging)
 		{
 			OutputCraftServicesTotalRuntime();
+			OutputPositionAgeMatrix();
 		}
 		CleanupFlightControllers(AsyncFlightControllerSessions);
 		CleanUpPhantomTestCrafts(PhantomTestCrafts);
+
+		// (Before the logger it uses goes away)
+		delete pMetricsExporter;
+		pMetricsExporter = NULL;
+
+#ifdef CRAFT_SERVICES_HAS_FLIGHT_CONTROLLER_EMULATOR
+		// Only once the sessions talking to it are gone
+		if (pFlightControllerEmulator != NULL)
+		{
+			pFlightControllerEmulator->Stop();
+			if (playBeepsAndShowExitLogging)
+			{
+				pFlightControllerEmulator->OutputSummary();
+			}
+			delete pFlightControllerEmulator;
+			pFlightControllerEmulator = NULL;
+		}
+#endif // CRAFT_SERVICES_HAS_FLIGHT_CONTROLLER_EMULATOR
 		
 		delete pFlightControllerSteadyTimer;
 		pFlightControllerSteadyTimer = NULL;
+		delete pRoundRobinStrand;
+		pRoundRobinStrand = NULL;
 
 		if (pConsoleAndAllLogger != NULL)
 		{
@@ -625,9 +1247,10 @@ void DoCleanupAndShutdown(bool playBeepsAndShowExitLogging)
 				pConsoleAndAllLogger->info("Exiting...");
 				pConsoleAndAllLogger->flush();
 			}
-			delete pConsoleAndAllLogger;
-			pConsoleAndAllLogger = NULL;
+			pConsoleAndAllLogger.reset();
 		}
+		// Anything still waiting on the logging thread gets written out
+		CraftServices::Logging::StopLogging();
 		if (playBeepsAndShowExitLogging)
 		{
 			#ifdef WIN32
@@ -645,7 +1268,7 @@ void DoCleanupAndShutdown(bool playBeepsAndShowExitLogging)
 
 bool IsShutdownInProgressOrComplete()
 {
-	return ShutdownInProgress || ShutdownCompleted;
+	return ShutdownRequested || ShutdownInProgress || ShutdownCompleted;
 }
 
 void OutputCraftServicesTotalRuntime()
@@ -660,6 +1283,17 @@ void OutputCraftServicesTotalRuntime()
 	}
 }
 
+// How long positions took to get from each craft to each other craft, over the whole run
+void OutputPositionAgeMatrix()
+{
+	if (pConsoleAndAllLogger != NULL)
+	{
+		std::string positionAgeMatrixText = CraftServices::FormatPositionAgeMatrixAsText(CraftServices::MspMetricsRegistry::GetInstance());
+		boost::algorithm::trim_right(positionAgeMatrixText);
+		pConsoleAndAllLogger->info("{}", positionAgeMatrixText);
+	}
+}
+
 #ifdef WIN32
 
 BOOL WINAPI CtrlHandler(DWORD fdwCtrlType)
@@ -731,6 +1365,12 @@ int main(int argc, char** argv)
 		spdlog::level::level_enum spdLogLevel = ProcessLogLevelArgument(argumentVariablesMap);
 		// Change Logging level (may do nothing depending on what user input was)
 		ChangeLogLevelForAllLoggers(spdLogLevel);
+		// Log from a background thread?
+		CraftServices::LoggingSettings loggingSettings = ProcessLoggingArguments(argumentVariablesMap, spdLogLevel);
+
+		// Replay captured traffic rather than monitoring ports?
+		std::vector<std::string> replayCaptureFilePaths;
+		CraftServices::MspReplayTiming replayTiming = ProcessReplayArguments(argumentVariablesMap, replayCaptureFilePaths);
 
 		// Determine which ports to monitor
 		std::vector<std::string> portNamesToMonitor;
@@ -739,15 +1379,51 @@ int main(int argc, char** argv)
 		uint32_t baudRateForAllPorts = ProcessBaudArgument(argumentVariablesMap);
 		// Parse various refresh rates
 		RefreshIntervalInMilliseconds = ProcessRefreshArgument(argumentVariablesMap);
+		CraftServices::MspRefreshRateSettings refreshRateSettings = ProcessAutoRefreshArgument(argumentVariablesMap, RefreshIntervalInMilliseconds);
 		uint32_t staleIntervalInMilliseconds = ProcessStaleArgument(argumentVariablesMap);
+		// Parse how requests are followed up on
+		CraftServices::MspRequestTrackingSettings requestTrackingSettings;
+		requestTrackingSettings.ResponseTimeoutInMilliseconds = ProcessTimeoutArgument(argumentVariablesMap);
+		requestTrackingSettings.MaxRetryCount = ProcessRetriesArgument(argumentVariablesMap);
+		requestTrackingSettings.WindowSize = ProcessWindowArgument(argumentVariablesMap);
 		// Parse any instructions about phantom, test Craft to inject into telemetry.		
 		PhantomTestCrafts = ProcessPhantomTestCraftArguments(argumentVariablesMap);
 		// Should we exit on GPS loss? This is a brutal and desperate hack.
 		bool exitOnGpsLoss = ProcessExitGpsLoss(argumentVariablesMap);
 		bool omitGpsPos = ProcessOmitGpsPos(argumentVariablesMap);
+		// Should the flight controllers take turns being refreshed?
+		bool roundRobin = ProcessRoundRobin(argumentVariablesMap);
+		// How many threads to service the flight controllers with
+		uint32_t workerThreadCount = ProcessThreadsArgument(argumentVariablesMap);
+		// Record raw port traffic?
+		CraftServices::MspLinkCaptureSettings captureSettings = ProcessCaptureArguments(argumentVariablesMap);
+		// Emulate flight controllers to monitor?
+		CraftServices::MspFlightControllerEmulatorSettings emulatorSettings = ProcessEmulateArguments(argumentVariablesMap, baudRateForAllPorts);
+		// Serve link metrics to dashboards?
+		ProcessMetricsArguments(argumentVariablesMap);
+
+		if (!replayCaptureFilePaths.empty())
+		{
+			DoCaptureReplay(replayCaptureFilePaths, replayTiming, RefreshIntervalInMilliseconds, staleIntervalInMilliseconds, requestTrackingSettings, refreshRateSettings, spdLogLevel, loggingSettings, PhantomTestCrafts, omitGpsPos);
+
+			DoCleanupAndShutdown();
+			return EXIT_SUCCESS;
+		}
+
+		if (emulatorSettings.FlightControllerCount > 0)
+		{
+			StartFlightControllerEmulator(emulatorSettings, portDetectionType, portNamesToMonitor);
+			if (argumentVariablesMap.count("emulateonly"))
+			{
+				DoEmulationOnly();
+
+				DoCleanupAndShutdown();
+				return EXIT_SUCCESS;
+			}
+		}
 
 		// Loop and repeatedly exchange messages between various crafts
-		DoAsyncMonitoring(portNamesToMonitor, baudRateForAllPorts, RefreshIntervalInMilliseconds, staleIntervalInMilliseconds, spdLogLevel, PhantomTestCrafts, exitOnGpsLoss, omitGpsPos);
+		DoAsyncMonitoring(portNamesToMonitor, baudRateForAllPorts, RefreshIntervalInMilliseconds, staleIntervalInMilliseconds, requestTrackingSettings, refreshRateSettings, spdLogLevel, loggingSettings, captureSettings, PhantomTestCrafts, exitOnGpsLoss, omitGpsPos, roundRobin, workerThreadCount);
 
 		DoCleanupAndShutdown();
 		return EXIT_SUCCESS;
@@ -760,6 +1436,10 @@ int main(int argc, char** argv)
 	{
 		pConsoleAndAllLogger->error("CommandLineArguments exception: {}", commandLineArgumentsException.what());
 	}
+	catch (CraftServiceException & craftServiceException)
+	{
+		pConsoleAndAllLogger->error("CraftService exception: {}", craftServiceException.what());
+	}
 	catch(...)
 	{
 		pConsoleAndAllLogger->error("Unhandled exception, exiting...");
@@ -27,19 +27,23 @@
 
 //#include "types.hpp"
 
-#include "deserialise.hpp"
 #include "AsyncMspMessageTypes.hpp"
 #include "MspFlightControllerAsync.hpp"
 #include "CraftInfoAndPosition.hpp"
 
 #define CRAFT_SERVICES_DEFAULT_LOG_LEVEL spdlog::level::info
 
+void RunIoContextWorkerThread();
+void OrderFlightControllersByProximity();
 void StartFlightControllerRefreshTimerFiring(uint32_t refreshIntervalInMillisecondsForAllPorts);
-void ScheduleNextFlightControllerTimerToFireImmediately();
+void WaitForNextFlightControllerRefresh();
+void ScheduleNextFlightControllerTimerToFireAfter(uint32_t delayInMilliseconds);
 void RefreshFlightControllers(const boost::system::error_code & error);
+void FlightControllerRefreshCycleComplete(CraftServices::MSPFlightControllerAsync * pFlightController);
 bool IsShutdownInProgressOrComplete();
 void DoCleanupAndShutdown(bool playBeepsAndShowExitLogging = true);
 void OutputCraftServicesTotalRuntime();
+void OutputPositionAgeMatrix();
 
 
 #endif // CRAFTSERVICES_HPP
\ No newline at end of file
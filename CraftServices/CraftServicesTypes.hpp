@@ -19,6 +19,8 @@
 #define CRAFT_SERVICES_TYPES_HPP
 
 #include <vector>
+#include <string>
+#include <cstddef>
 #include <stdint.h>
 //#include "msp_id.hpp"
 
@@ -30,6 +32,42 @@ namespace CraftServices
  */
 typedef std::vector<uint8_t> ByteVector;
 
+// A non-owning, read-only view of a run of bytes -- a received message payload, for example.
+// Lets us decode straight out of the buffers a message was read into, without first copying
+// it into a ByteVector. A ByteVector converts to one implicitly.
+class ByteSpan
+{
+	public:
+
+		ByteSpan() : pBytes(NULL), ByteCount(0)
+		{
+		}
+
+		ByteSpan(const uint8_t * pSpanBytes, size_t byteCount) : pBytes(pSpanBytes), ByteCount(byteCount)
+		{
+		}
+
+		ByteSpan(const ByteVector & byteVector) : pBytes(byteVector.data()), ByteCount(byteVector.size())
+		{
+		}
+
+		// Lower case to match the ByteVector calls that messages were originally written against
+		const uint8_t * data() const { return pBytes; }
+		size_t size() const { return ByteCount; }
+		bool empty() const { return ByteCount == 0; }
+		const uint8_t * begin() const { return pBytes; }
+		const uint8_t * end() const { return pBytes + ByteCount; }
+		const uint8_t & operator[](size_t index) const { return pBytes[index]; }
+
+	private:
+		const uint8_t * pBytes;
+		size_t ByteCount;
+};
+
+static inline const std::string BoolToString(bool b)
+{
+	return b ? "True" : "False";
+}
 
 /////////////////////////////////////////////////////////////////////
 /// Generic message types
@@ -0,0 +1,268 @@
+/*
+ * This file is part of CraftServices.
+ *
+ * CraftServices is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CraftServices is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CraftServices. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MSPAIRTIMESCHEDULER_HPP
+#define MSPAIRTIMESCHEDULER_HPP
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+#include "CraftServicesMspID.hpp"
+#include "AsyncMspMessageTypes.hpp"
+#include "MspMessageAsyncs.hpp"
+#include "MspMessageSchema.hpp"
+#include "MspTransmitBatch.hpp"
+#include "MspTransmitQueue.hpp"
+#include "MspInFlightRequestTable.hpp"
+
+namespace CraftServices
+{
+	// How much a message matters, most important first. When a refresh has more to send than the link can
+	// carry, the least important messages wait for a later refresh.
+	enum class MspTrafficPriority : uint8_t
+	{
+		// Asking for this craft's own position; everyone else depends on it
+		OwnPosition = 0,
+		// Telling this craft where the other (real) craft are
+		OtherCraftPosition = 1,
+		// Identifying the Flight Controller (UID, name, API version...). Asked for again each refresh until answered.
+		InitialInformation = 2,
+		// Test craft
+		PhantomCraftPosition = 3
+	};
+
+	namespace MspAirtime
+	{
+		// Assumes 1 start, 1 stop bit
+		const uint32_t BitsToSendAByte = 10;
+
+		// '$', 'X', direction, flag, ID, length, then CRC after the payload
+		const size_t FrameOverheadByteCount = MspMessageScratchPad::HeaderLength + 1;
+
+		// Gap left between bursts on the link, in character times (see MSPFlightControllerAsync::GetMinimumInterFrameGapInMilliseconds)
+		const size_t InterFrameGapByteCount = 4;
+
+		// Flight Controller names are at most this long (iNav's MAX_NAME_LENGTH)
+		const size_t MaxCraftNameLength = 16;
+
+		// FC variants are always 4 characters ("INAV", "BTFL"...)
+		const size_t FcVariantLength = 4;
+
+		// How long the reply to a message should be, going by what the Flight Controller sends back for it.
+		// Anything we don't know about is assumed to get a bare acknowledgement.
+		inline size_t GetExpectedReplyByteCount(uint16_t messageID)
+		{
+			size_t payloadLength = 0;
+			switch ((ID)messageID)
+			{
+				case ID::MSP_RAW_GPS:
+					payloadLength = MspPayloadCodec<msg::RawGPS>::Fields::MinimumLength;
+					break;
+				case ID::MSP_UID:
+					payloadLength = MspPayloadCodec<msg::UidMessage>::Fields::MinimumLength;
+					break;
+				case ID::MSP_API_VERSION:
+					payloadLength = MspPayloadCodec<msg::ApiVersion>::Fields::MinimumLength;
+					break;
+				case ID::MSP_FC_VARIANT:
+					payloadLength = FcVariantLength;
+					break;
+				case ID::MSP_NAME:
+					payloadLength = MaxCraftNameLength;
+					break;
+				case ID::MSP2_INAV_OTHER_CRAFT_POSITION_SETTING:
+					payloadLength = MspPayloadCodec<msg::OtherCraftPositionSettingMessage>::Fields::MinimumLength;
+					break;
+				default:
+					payloadLength = 0;
+					break;
+			}
+			return FrameOverheadByteCount + payloadLength;
+		}
+
+		inline uint64_t GetAirtimeInMicrosecondsForByteCount(size_t byteCount, uint32_t baudRate)
+		{
+			const uint64_t MicrosecondsInSecond = 1000000;
+			return ((uint64_t)byteCount * BitsToSendAByte * MicrosecondsInSecond) / baudRate;
+		}
+	}
+
+	// A message waiting to be fitted into this refresh's airtime
+	struct MspPlannedFrame
+	{
+		MspTransmitKey Key;
+		MspTransmitFrame Frame;
+		MspTrafficPriority Priority;
+	};
+
+	// Fits each refresh cycle's messages to what the link can actually carry.
+	//
+	// Each message costs the time to send it, plus the time for its reply to come back, plus a few character
+	// times of gap. Requests and replies are counted against the same budget; on a half duplex radio link they
+	// really do share the air, and on a wired link it keeps us from asking for more replies than we can read.
+	// At 9600 baud every byte is about a millisecond, so one refresh of a handful of crafts can easily be more
+	// than a short refresh interval allows.
+	//
+	// Messages are planned during a refresh, then packed most important first. Whatever doesn't fit is
+	// deferred: it isn't sent this cycle, and since every refresh rebuilds its messages from current state,
+	// the next refresh asks again with fresher data.
+	class MspAirtimeScheduler
+	{
+		public:
+
+			MspAirtimeScheduler() : BaudRate(1), CycleBudgetInMicroseconds(0), CommittedInMicroseconds(0), PlannedAirtimeInMicroseconds(0), 
+				DeferredFrameCount(0), OverBudgetCycleCount(0)
+			{
+			}
+
+			void SetBaudRate(uint32_t baudRate)
+			{
+				BaudRate = std::max(baudRate, (uint32_t)1);
+			}
+
+			// Link time one message takes up: request, reply, and the gap after it
+			uint64_t GetAirtimeInMicroseconds(uint16_t messageID, size_t transmitByteCount) const
+			{
+				size_t byteCount = transmitByteCount + MspAirtime::GetExpectedReplyByteCount(messageID) + MspAirtime::InterFrameGapByteCount;
+				return MspAirtime::GetAirtimeInMicrosecondsForByteCount(byteCount, BaudRate);
+			}
+
+			// Link time still owed to messages from earlier: everything waiting in the queue, and the replies
+			// to requests already sent
+			uint64_t GetOutstandingAirtimeInMicroseconds(const MspTransmitQueue & transmitQueue, const MspInFlightRequestTable & inFlightRequests) const
+			{
+				uint64_t outstandingInMicroseconds = 0;
+				transmitQueue.VisitQueuedFrames([&](const MspTransmitKey & key, const MspTransmitFrame & transmitFrame)
+				{
+					outstandingInMicroseconds += GetAirtimeInMicroseconds(key.MessageID, transmitFrame.GetByteCount());
+				});
+				inFlightRequests.VisitInFlightRequests([&](const MspInFlightRequest & inFlightRequest)
+				{
+					outstandingInMicroseconds += MspAirtime::GetAirtimeInMicrosecondsForByteCount(MspAirtime::GetExpectedReplyByteCount(inFlightRequest.Key.MessageID), BaudRate);
+				});
+				return outstandingInMicroseconds;
+			}
+
+			// Start planning a refresh. alreadyCommittedInMicroseconds is airtime already spoken for by earlier
+			// messages (see GetOutstandingAirtimeInMicroseconds).
+			void StartCycle(uint64_t cycleBudgetInMicroseconds, uint64_t alreadyCommittedInMicroseconds)
+			{
+				PlannedFrames.clear();
+				CycleBudgetInMicroseconds = cycleBudgetInMicroseconds;
+				CommittedInMicroseconds = alreadyCommittedInMicroseconds;
+				PlannedAirtimeInMicroseconds = 0;
+			}
+
+			void Plan(MspPlannedFrame plannedFrame)
+			{
+				PlannedAirtimeInMicroseconds += GetAirtimeInMicroseconds(plannedFrame.Key.MessageID, plannedFrame.Frame.GetByteCount());
+				PlannedFrames.push_back(std::move(plannedFrame));
+			}
+
+			bool HasPlannedFrames() const
+			{
+				return !PlannedFrames.empty();
+			}
+
+			// Decide what goes this cycle. Admitted messages are handed back most important first (ties keep the
+			// order they were planned in); the rest are deferred, and handed back in deferredFrames.
+			//
+			// A message replacing one already waiting in the queue takes no extra airtime, so always fits. And if
+			// nothing at all has been committed yet, the first message goes regardless, so a budget too small for
+			// even one message doesn't stall the link.
+			size_t Pack(const MspTransmitQueue & transmitQueue, std::vector<MspPlannedFrame> & admittedFrames, std::vector<MspPlannedFrame> & deferredFrames)
+			{
+				std::stable_sort(PlannedFrames.begin(), PlannedFrames.end(), [](const MspPlannedFrame & first, const MspPlannedFrame & second)
+				{
+					return first.Priority < second.Priority;
+				});
+
+				size_t deferredCount = 0;
+				for (auto & plannedFrame : PlannedFrames)
+				{
+					uint64_t airtimeInMicroseconds = GetAirtimeInMicroseconds(plannedFrame.Key.MessageID, plannedFrame.Frame.GetByteCount());
+					bool replacesQueuedFrame = transmitQueue.Contains(plannedFrame.Key);
+					bool fitsInBudget = CommittedInMicroseconds + airtimeInMicroseconds <= CycleBudgetInMicroseconds;
+
+					if (replacesQueuedFrame || fitsInBudget || CommittedInMicroseconds == 0)
+					{
+						if (!replacesQueuedFrame)
+						{
+							CommittedInMicroseconds += airtimeInMicroseconds;
+						}
+						admittedFrames.push_back(std::move(plannedFrame));
+					}
+					else
+					{
+						deferredCount++;
+						deferredFrames.push_back(std::move(plannedFrame));
+					}
+				}
+
+				if (deferredCount > 0)
+				{
+					DeferredFrameCount += deferredCount;
+					OverBudgetCycleCount++;
+				}
+
+				PlannedFrames.clear();
+				return deferredCount;
+			}
+
+			uint64_t GetCycleBudgetInMicroseconds() const
+			{
+				return CycleBudgetInMicroseconds;
+			}
+
+			// Airtime taken up by what's been admitted so far (plus anything committed before the cycle started)
+			uint64_t GetCommittedInMicroseconds() const
+			{
+				return CommittedInMicroseconds;
+			}
+
+			// Airtime everything planned this cycle would have taken, had it all been sent
+			uint64_t GetPlannedAirtimeInMicroseconds() const
+			{
+				return PlannedAirtimeInMicroseconds;
+			}
+
+			// Running totals, for diagnostics
+			uint64_t GetDeferredFrameCount() const
+			{
+				return DeferredFrameCount;
+			}
+
+			uint64_t GetOverBudgetCycleCount() const
+			{
+				return OverBudgetCycleCount;
+			}
+
+		private:
+
+			uint32_t BaudRate;
+			uint64_t CycleBudgetInMicroseconds;
+			uint64_t CommittedInMicroseconds;
+			uint64_t PlannedAirtimeInMicroseconds;
+			std::vector<MspPlannedFrame> PlannedFrames;
+			uint64_t DeferredFrameCount;
+			uint64_t OverBudgetCycleCount;
+	};
+
+} // Namespace CraftServices
+
+#endif // MSPAIRTIMESCHEDULER_HPP
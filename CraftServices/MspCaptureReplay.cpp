@@ -0,0 +1,283 @@
+/*
+ * This file is part of CraftServices.
+ *
+ * CraftServices is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CraftServices is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CraftServices. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <thread>
+#include <algorithm>
+
+#include "MspCaptureReplay.hpp"
+#include "AllocationCounter.hpp"
+#include "CraftServices.hpp"
+
+namespace CraftServices
+{
+	static boost::posix_time::ptime GetPtimeFromUnixTimeInMicroseconds(uint64_t unixTimeInMicroseconds)
+	{
+		return boost::posix_time::ptime(boost::gregorian::date(1970, 1, 1)) + boost::posix_time::microseconds((int64_t)unixTimeInMicroseconds);
+	}
+
+	// Constructor
+	MspCaptureReplay::MspCaptureReplay(boost::asio::io_context * pIo_context, spdlog::logger * pLogger)
+	{
+		// Non-owning pointers
+		pIoContext = pIo_context;
+		pReplayLogger = pLogger;
+
+		ReplayTiming = MspReplayTiming::AsFastAsPossible;
+		FirstRecordUnixTimeInMicroseconds = 0;
+		LastRecordUnixTimeInMicroseconds = 0;
+		ReplayElapsedMicroseconds = 0;
+	}
+
+	bool MspCaptureReplay::AddCapture(const std::string & segmentFilePath, std::string & errorMessage)
+	{
+		ReplaySession replaySession = {};
+		replaySession.pCaptureReader.reset(new MspLinkCaptureReader());
+		if (!replaySession.pCaptureReader->Open(segmentFilePath, errorMessage))
+		{
+			return false;
+		}
+
+		pReplayLogger->info("Replay: {} is a capture of {} at {} baud", segmentFilePath, replaySession.pCaptureReader->GetPortName(), 
+			replaySession.pCaptureReader->GetHeader().BaudRate);
+		Sessions.push_back(std::move(replaySession));
+		return true;
+	}
+
+	std::string MspCaptureReplay::GetCapturePortName(size_t captureIndex) const
+	{
+		return Sessions[captureIndex].pCaptureReader->GetPortName();
+	}
+
+	uint32_t MspCaptureReplay::GetCaptureBaudRate(size_t captureIndex) const
+	{
+		return Sessions[captureIndex].pCaptureReader->GetHeader().BaudRate;
+	}
+
+	void MspCaptureReplay::AttachFlightController(size_t captureIndex, MSPFlightControllerAsync * pFlightController)
+	{
+		Sessions[captureIndex].pFlightController = pFlightController;
+	}
+
+	void MspCaptureReplay::Run(MspReplayTiming replayTiming)
+	{
+		ReplayTiming = replayTiming;
+
+		FirstRecordUnixTimeInMicroseconds = UINT64_MAX;
+		for (auto & replaySession : Sessions)
+		{
+			ReadNextRecord(replaySession);
+			if (replaySession.HasNextRecord)
+			{
+				FirstRecordUnixTimeInMicroseconds = std::min(FirstRecordUnixTimeInMicroseconds, replaySession.NextRecordUnixTimeInMicroseconds);
+			}
+		}
+		if (FirstRecordUnixTimeInMicroseconds == UINT64_MAX)
+		{
+			pReplayLogger->warn("Replay: nothing to replay; the captures are empty.");
+			return;
+		}
+		LastRecordUnixTimeInMicroseconds = FirstRecordUnixTimeInMicroseconds;
+
+		// As with the refresh timers, the first refresh comes one interval after the start
+		for (auto & replaySession : Sessions)
+		{
+			replaySession.pFlightController->SetReplayClockTime(GetPtimeFromUnixTimeInMicroseconds(FirstRecordUnixTimeInMicroseconds));
+			replaySession.pFlightController->StartReplaySession(&StageTimes);
+			replaySession.NextRefreshUnixTimeInMicroseconds = FirstRecordUnixTimeInMicroseconds + 
+				(uint64_t)replaySession.pFlightController->GetRefreshIntervalInMilliseconds() * 1000;
+		}
+
+		AllocationCounter::StartCounting();
+		ReplayStartTime = std::chrono::steady_clock::now();
+
+		while (!IsShutdownInProgressOrComplete())
+		{
+			// Records from all the captures go in in the order they happened
+			ReplaySession * pNextReplaySession = NULL;
+			for (auto & replaySession : Sessions)
+			{
+				if (replaySession.HasNextRecord && 
+					(pNextReplaySession == NULL || replaySession.NextRecordUnixTimeInMicroseconds < pNextReplaySession->NextRecordUnixTimeInMicroseconds))
+				{
+					pNextReplaySession = &replaySession;
+				}
+			}
+			if (pNextReplaySession == NULL)
+			{
+				break;
+			}
+
+			RunRefreshesDueBy(pNextReplaySession->NextRecordUnixTimeInMicroseconds);
+			WaitUntilDue(pNextReplaySession->NextRecordUnixTimeInMicroseconds);
+			ReplayRecord(*pNextReplaySession);
+			PollIoContext();
+
+			LastRecordUnixTimeInMicroseconds = pNextReplaySession->NextRecordUnixTimeInMicroseconds;
+			ReadNextRecord(*pNextReplaySession);
+		}
+
+		ReplayElapsedMicroseconds = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - ReplayStartTime).count();
+		AllocationCounter::StopCounting();
+	}
+
+	void MspCaptureReplay::ReadNextRecord(ReplaySession & replaySession)
+	{
+		replaySession.HasNextRecord = replaySession.pCaptureReader->ReadNextRecord(replaySession.NextRecord);
+		if (replaySession.HasNextRecord)
+		{
+			replaySession.NextRecordUnixTimeInMicroseconds = replaySession.pCaptureReader->GetHeader().CaptureStartUnixTimeInMicroseconds + 
+				replaySession.NextRecord.TimeInMicroseconds;
+		}
+	}
+
+	void MspCaptureReplay::RunRefreshesDueBy(uint64_t unixTimeInMicroseconds)
+	{
+		while (!IsShutdownInProgressOrComplete())
+		{
+			ReplaySession * pNextReplaySession = NULL;
+			for (auto & replaySession : Sessions)
+			{
+				if (pNextReplaySession == NULL || replaySession.NextRefreshUnixTimeInMicroseconds < pNextReplaySession->NextRefreshUnixTimeInMicroseconds)
+				{
+					pNextReplaySession = &replaySession;
+				}
+			}
+			if (pNextReplaySession == NULL || pNextReplaySession->NextRefreshUnixTimeInMicroseconds > unixTimeInMicroseconds)
+			{
+				return;
+			}
+
+			WaitUntilDue(pNextReplaySession->NextRefreshUnixTimeInMicroseconds);
+			pNextReplaySession->pFlightController->SetReplayClockTime(GetPtimeFromUnixTimeInMicroseconds(pNextReplaySession->NextRefreshUnixTimeInMicroseconds));
+			pNextReplaySession->pFlightController->RefreshFlightControllerState();
+			pNextReplaySession->RefreshCount++;
+			PollIoContext();
+
+			// (The interval may have changed, if the refresh rate is automatic)
+			pNextReplaySession->NextRefreshUnixTimeInMicroseconds += (uint64_t)pNextReplaySession->pFlightController->GetRefreshIntervalInMilliseconds() * 1000;
+		}
+	}
+
+	void MspCaptureReplay::ReplayRecord(ReplaySession & replaySession)
+	{
+		const MspCaptureRecord & captureRecord = replaySession.NextRecord;
+		replaySession.pFlightController->SetReplayClockTime(GetPtimeFromUnixTimeInMicroseconds(replaySession.NextRecordUnixTimeInMicroseconds));
+		switch (captureRecord.Type)
+		{
+			case MspCaptureRecordType::Received:
+			{
+				replaySession.pFlightController->ReplayReceivedBytes(captureRecord.pData, captureRecord.ByteCount);
+				replaySession.ReplayedReadCount++;
+				replaySession.ReplayedByteCount += captureRecord.ByteCount;
+				break;
+			}
+			case MspCaptureRecordType::Transmitted:
+			{
+				replaySession.CapturedTransmittedByteCount += captureRecord.ByteCount;
+				break;
+			}
+			case MspCaptureRecordType::PortEvent:
+			{
+				pReplayLogger->debug("Replay: {} at {:.3f} s: {}", replaySession.pCaptureReader->GetPortName(), captureRecord.TimeInMicroseconds / 1000000.0,
+					std::string((const char *)captureRecord.pData, captureRecord.ByteCount));
+				break;
+			}
+			default:
+			{
+				// From a newer version, perhaps
+				pReplayLogger->debug("Replay: {} skipping record of unknown type {}", replaySession.pCaptureReader->GetPortName(), (int)captureRecord.Type);
+				break;
+			}
+		}
+	}
+
+	void MspCaptureReplay::WaitUntilDue(uint64_t unixTimeInMicroseconds)
+	{
+		if (ReplayTiming != MspReplayTiming::OriginalTiming || unixTimeInMicroseconds <= FirstRecordUnixTimeInMicroseconds)
+		{
+			return;
+		}
+
+		// In short naps, so a shutdown isn't held up by a long quiet spell in the capture
+		const std::chrono::milliseconds LongestNap(100);
+		std::chrono::steady_clock::time_point dueTime = ReplayStartTime + std::chrono::microseconds(unixTimeInMicroseconds - FirstRecordUnixTimeInMicroseconds);
+		while (!IsShutdownInProgressOrComplete())
+		{
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			if (now >= dueTime)
+			{
+				return;
+			}
+			std::this_thread::sleep_for(std::min(std::chrono::duration_cast<std::chrono::microseconds>(dueTime - now), std::chrono::microseconds(LongestNap)));
+		}
+	}
+
+	void MspCaptureReplay::PollIoContext()
+	{
+		if (IsShutdownInProgressOrComplete())
+		{
+			return;
+		}
+
+		// Running out of handlers stops the IO context; there'll be more along shortly
+		if (pIoContext->stopped())
+		{
+			pIoContext->restart();
+		}
+		pIoContext->poll();
+	}
+
+	void MspCaptureReplay::OutputReport()
+	{
+		double replaySeconds = std::max((uint64_t)1, ReplayElapsedMicroseconds) / 1000000.0;
+		double captureSeconds = (LastRecordUnixTimeInMicroseconds - FirstRecordUnixTimeInMicroseconds) / 1000000.0;
+		uint64_t decodedMessageCount = StageTimes.RunCount[(size_t)MspPipelineStage::Decode];
+
+		uint64_t replayedByteCount = 0;
+		for (const auto & replaySession : Sessions)
+		{
+			replayedByteCount += replaySession.ReplayedByteCount;
+		}
+
+		pReplayLogger->info("Replay: {:.1f} s of captured traffic replayed in {:.3f} s ({:.1f}x, {})", captureSeconds, replaySeconds, captureSeconds / replaySeconds,
+			(ReplayTiming == MspReplayTiming::OriginalTiming) ? "original timing" : "as fast as possible");
+		pReplayLogger->info("Replay: {} messages decoded from {} bytes: {:.0f} messages/s, {:.0f} bytes/s", decodedMessageCount, replayedByteCount, 
+			decodedMessageCount / replaySeconds, replayedByteCount / replaySeconds);
+
+		for (const auto & replaySession : Sessions)
+		{
+			const MspSessionMetrics & linkMetrics = *replaySession.pFlightController->pLinkMetrics;
+			pReplayLogger->info("Replay: {}: {} bytes in {} reads, {} refreshes. Replies {} matched, {} unmatched. {} bytes discarded, {} messages rejected, {} CRC mismatches. Sent {} frames, {} bytes ({} bytes in the capture).",
+				replaySession.pCaptureReader->GetPortName(), replaySession.ReplayedByteCount, replaySession.ReplayedReadCount, replaySession.RefreshCount,
+				linkMetrics.RepliesMatched.Get(), linkMetrics.RepliesUnmatched.Get(), 
+				linkMetrics.DiscardedByteCount.Get(), linkMetrics.RejectedMessageCount.Get(), linkMetrics.CrcMismatchCount.Get(),
+				linkMetrics.FramesSent.Get(), linkMetrics.BytesSent.Get(), replaySession.CapturedTransmittedByteCount);
+		}
+
+		pReplayLogger->info("Replay: {:<10} {:>10} {:>12} {:>10} {:>12} {:>10}", "Stage", "Runs", "Total ms", "us/run", "Allocations", "Allocs/run");
+		for (size_t stageIndex = 0; stageIndex < MspPipelineStageTimes::StageCount; stageIndex++)
+		{
+			uint64_t runCount = StageTimes.RunCount[stageIndex];
+			double totalMilliseconds = StageTimes.ElapsedNanoseconds[stageIndex] / 1000000.0;
+			double microsecondsPerRun = (runCount > 0) ? StageTimes.ElapsedNanoseconds[stageIndex] / 1000.0 / runCount : 0.0;
+			double allocationsPerRun = (runCount > 0) ? (double)StageTimes.AllocationCount[stageIndex] / runCount : 0.0;
+			pReplayLogger->info("Replay: {:<10} {:>10} {:>12.3f} {:>10.3f} {:>12} {:>10.2f}", MspPipelineStageTimes::GetStageName(stageIndex), runCount, 
+				totalMilliseconds, microsecondsPerRun, StageTimes.AllocationCount[stageIndex], allocationsPerRun);
+		}
+	}
+
+} // Namespace CraftServices
@@ -0,0 +1,130 @@
+/*
+ * This file is part of CraftServices.
+ *
+ * CraftServices is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CraftServices is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CraftServices. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MSPCAPTUREREPLAY_HPP
+#define MSPCAPTUREREPLAY_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <cstdint>
+
+#include <boost/asio.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "spdlog/spdlog.h"
+#include "spdlog/sinks/stdout_color_sinks.h"
+#include "spdlog/sinks/basic_file_sink.h"
+
+#include "MspLinkCapture.hpp"
+#include "MspPipelineStageTimes.hpp"
+#include "MspFlightControllerAsync.hpp"
+
+namespace CraftServices
+{
+	enum class MspReplayTiming
+	{
+		// Feed each record in as soon as the one before it has been dealt with
+		AsFastAsPossible,
+		// Feed each record in when it arrived in the capture, relative to the start
+		OriginalTiming
+	};
+
+	// Replays captured port traffic (see MspLinkCapture) through real Flight Controller sessions, and reports how
+	// fast it went, and where the time and allocations went.
+	//
+	// Each capture drives one session. Received bytes are fed to the session as though they'd just been read from
+	// its port. What was transmitted in the capture isn't replayed; the session sends its own messages, to nowhere. 
+	// Refreshes are driven by the capture's clock, every refresh interval, so the same traffic always sees the same
+	// number of refreshes however fast it's replayed. The sessions keep time by the capture's clock as well, so 
+	// requests time out and positions go stale just as they did in the field. Several captures from one session can
+	// be replayed together, and positions are forwarded between their crafts.
+	//
+	// Everything runs on the calling thread, polling the IO context for the sessions' own handlers in between.
+	class MspCaptureReplay
+	{
+		public:
+
+			MspCaptureReplay(boost::asio::io_context * pIo_context, spdlog::logger * pLogger);
+
+			// Open a capture at its first segment file. Returns false (with errorMessage set) if it couldn't be.
+			bool AddCapture(const std::string & segmentFilePath, std::string & errorMessage);
+
+			size_t GetCaptureCount() const
+			{
+				return Sessions.size();
+			}
+
+			// What the session replaying a capture should be set up with
+			std::string GetCapturePortName(size_t captureIndex) const;
+			uint32_t GetCaptureBaudRate(size_t captureIndex) const;
+
+			// The session a capture is fed to. Not owned.
+			void AttachFlightController(size_t captureIndex, MSPFlightControllerAsync * pFlightController);
+
+			// Replay every capture to the end (or until shutdown)
+			void Run(MspReplayTiming replayTiming);
+
+			void OutputReport();
+
+		private:
+
+			struct ReplaySession
+			{
+				std::unique_ptr<MspLinkCaptureReader> pCaptureReader;
+				MSPFlightControllerAsync * pFlightController;
+
+				// The next record to replay, if there is one
+				MspCaptureRecord NextRecord;
+				bool HasNextRecord;
+				// When the next record and the next refresh are due, in microseconds since 1970 (captures started
+				// at different moments, so they're lined up by wall clock time)
+				uint64_t NextRecordUnixTimeInMicroseconds;
+				uint64_t NextRefreshUnixTimeInMicroseconds;
+
+				uint64_t ReplayedReadCount;
+				uint64_t ReplayedByteCount;
+				uint64_t CapturedTransmittedByteCount;
+				uint64_t RefreshCount;
+			};
+
+			void ReadNextRecord(ReplaySession & replaySession);
+			// Run any refreshes due by this time, in time order across the sessions
+			void RunRefreshesDueBy(uint64_t unixTimeInMicroseconds);
+			void ReplayRecord(ReplaySession & replaySession);
+			// Under original timing, wait for the moment a record (or refresh) at this time is due
+			void WaitUntilDue(uint64_t unixTimeInMicroseconds);
+			// Let the sessions' own handlers (i.e. finished writes) run
+			void PollIoContext();
+
+			boost::asio::io_context * pIoContext;
+			spdlog::logger * pReplayLogger;
+
+			std::vector<ReplaySession> Sessions;
+			MspPipelineStageTimes StageTimes;
+
+			MspReplayTiming ReplayTiming;
+			std::chrono::steady_clock::time_point ReplayStartTime;
+			uint64_t FirstRecordUnixTimeInMicroseconds;
+			uint64_t LastRecordUnixTimeInMicroseconds;
+			uint64_t ReplayElapsedMicroseconds;
+	};
+
+} // Namespace CraftServices
+
+#endif // MSPCAPTUREREPLAY_HPP
@@ -16,7 +16,9 @@
  */
 
 #include <iostream>
-#include <boost/asio/serial_port.hpp> 
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
 #include <boost/asio.hpp> 
 #include <boost/optional.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
@@ -33,10 +35,11 @@
 #include "GeoSpatialUtil.hpp"
 #include "crc.hpp"
 #include "CraftServices.hpp"
+#include "MspMemoryTransport.hpp"
 
 namespace CraftServices
 {
-	std::string OverallPortStateAsString(CraftServices::OverallPortState overallPortState)
+	const char * OverallPortStateAsString(CraftServices::OverallPortState overallPortState)
 	{
 		switch (overallPortState)
 		{
@@ -71,10 +74,14 @@ namespace CraftServices
 													   uint32_t baudRate,
 													   uint32_t refreshTimerIntervalInMilliseconds,
 													   uint32_t staleIntervalInMilliseconds,
+													   const CraftServices::MspRequestTrackingSettings & requestTrackingSettings,
+													   const CraftServices::MspRefreshRateSettings & refreshRateSettings,
 													   std::shared_ptr<spdlog::sinks::stdout_color_sink_mt> pConsoleSink,
 													   std::shared_ptr<spdlog::sinks::basic_file_sink_mt> pAllSink,
 													   spdlog::level::level_enum spdLogLevel,
 													   const std::string & loggingPattern,
+													   const CraftServices::LoggingSettings & loggingSettings,
+													   const CraftServices::MspLinkCaptureSettings & captureSettings,
 													   std::string dateTimeLogFilePrefixString,
 													   std::vector<CraftServices::MSPFlightControllerAsync *> * pAllFlightControllers,
 													   std::vector<CraftServices::PhantomTestCraft *> * pPhantomTestCraft,
@@ -82,16 +89,30 @@ namespace CraftServices
 													   bool omitGpsPos) : SerialPortName(serialPortName)
 	{
 		InProcessOfShuttingDownThisFlightController = false;
+		// Link quality metrics for this port, readable by anyone through the registry
+		pLinkMetrics = CraftServices::MspMetricsRegistry::GetInstance().RegisterSession(SerialPortName);
 		// Non-owning pointer
 		pIoContext = pIo_context;
-		// Create the serial port, but do not open it yet
-		pSerialPort = new boost::asio::serial_port(*pIoContext);
+		// All of this session's handlers run on its own strand
+		pSessionStrand = new boost::asio::io_context::strand(*pIoContext);
+		// Create the transport (a serial port, unless the port name says otherwise), but do not open it yet
+		pTransport = CraftServices::CreateMspTransport(SerialPortName, baudRate, pIoContext, pSessionStrand, this);
+		// Timer used to hold back writes while the link is busy
+		pLinkBusyTimer = new boost::asio::steady_timer(*pIoContext);
+		// Timer for refreshing this Flight Controller on its own (not used in round robin mode)
+		pRefreshTimer = new boost::asio::steady_timer(*pIoContext);
 		// Baud rate to use on the port
 		BaudRate = baudRate;
-		// Refresh interval
-		RefreshTimerIntervalInMilliseconds = refreshTimerIntervalInMilliseconds;
+		// Refresh interval (the starting point, if the refresh rate is automatic)
+		ApplyRefreshInterval(refreshTimerIntervalInMilliseconds);
+		RefreshRateController.Start(refreshRateSettings, refreshTimerIntervalInMilliseconds);
 		// Stale interval
 		StaleIntervalInMilliseconds = staleIntervalInMilliseconds;
+		// How long to wait for replies, how often to resend, and how many requests to keep in flight
+		RequestTrackingSettings = requestTrackingSettings;
+		InFlightRequests.SetWindowSize(RequestTrackingSettings.WindowSize);
+		// Each refresh is fitted to the airtime the link has at this baud rate
+		AirtimeScheduler.SetBaudRate(BaudRate);
 		// We start in a closed state
 		PortState = CraftServices::OverallPortState::PortClosed;
 		// We keep track of the parent container of Flight Controllers so we can talk to our peers
@@ -107,10 +128,29 @@ namespace CraftServices
 		// Should we obscure/omit exact GPS positions from logging?
 		OmitGpsPos = omitGpsPos;
 
-		SetUpLogger(pConsoleSink, pAllSink, spdLogLevel, loggingPattern, dateTimeLogFilePrefixString);
+		UpdatePortAndCraftNamePrefix();
+		SetUpLogger(pConsoleSink, pAllSink, spdLogLevel, loggingPattern, loggingSettings, dateTimeLogFilePrefixString);
 		// This refresh period may well be the single most important parameter, at least as I type this. A bad one will
 		// give terrible results.
 		pSerialPortLogger->debug("{}: Refresh Interval {} milliseconds.", GetPortAndCraftNamePrefix(), refreshTimerIntervalInMilliseconds);
+		pSerialPortLogger->debug("{}: Response timeout {} milliseconds, {} retries, window of {} requests.", GetPortAndCraftNamePrefix(), 
+			RequestTrackingSettings.ResponseTimeoutInMilliseconds, RequestTrackingSettings.MaxRetryCount, RequestTrackingSettings.WindowSize);
+
+		if (captureSettings.Enabled)
+		{
+			pLinkCapture = new CraftServices::MspLinkCaptureRecorder(dateTimeLogFilePrefixString, SerialPortName, BaudRate, captureSettings.SegmentByteCount);
+			std::string captureErrorMessage;
+			if (pLinkCapture->Start(captureErrorMessage))
+			{
+				pSerialPortLogger->info("{}: Capturing port traffic to {}", GetPortAndCraftNamePrefix(), pLinkCapture->GetCurrentSegmentFilePath());
+			}
+			else
+			{
+				pSerialPortLogger->error("{}: Could not start capturing port traffic: {}", GetPortAndCraftNamePrefix(), captureErrorMessage);
+				delete pLinkCapture;
+				pLinkCapture = NULL;
+			}
+		}
 	}
 
 	// Destructor
@@ -121,13 +161,30 @@ namespace CraftServices
 		// TODO: Show total runtime per-port here?
 		pSerialPortLogger->info("{}: shutting down.", GetPortAndCraftNamePrefix());
 
-		//pSerialPort->cancel();
-		//pSerialPort->close();
-		delete pSerialPort;
-		pSerialPort = NULL;
+		delete pTransport;
+		pTransport = NULL;
+
+		pLinkBusyTimer->cancel();
+		delete pLinkBusyTimer;
+		pLinkBusyTimer = NULL;
+
+		pRefreshTimer->cancel();
+		delete pRefreshTimer;
+		pRefreshTimer = NULL;
+
+		delete pSessionStrand;
+		pSessionStrand = NULL;
+
+		if (pLinkCapture != NULL)
+		{
+			pSerialPortLogger->info("{}: Captured {} bytes in {} segment(s).", GetPortAndCraftNamePrefix(), pLinkCapture->GetRecordedByteCount(), pLinkCapture->GetSegmentCount());
+			delete pLinkCapture;
+			pLinkCapture = NULL;
+		}
+
+		pSerialPortLogger.reset();
 
-		delete pSerialPortLogger;
-		pSerialPortLogger = NULL;
+		CraftServices::MspMetricsRegistry::GetInstance().UnregisterSession(pLinkMetrics);
 	}
 
 	// Set up Logging
@@ -135,18 +192,33 @@ namespace CraftServices
 											   std::shared_ptr<spdlog::sinks::basic_file_sink_mt> pAllSink,
 											   spdlog::level::level_enum spdLogLevel,
 											   const std::string & loggingPattern,
+											   const CraftServices::LoggingSettings & loggingSettings,
 		                                       std::string dateTimeLogFilePrefixString)
 	{
 		// TODO - Date and time as part of filename. And should be consistent across file sets.
-		std::string serialPortLoggerFilename = dateTimeLogFilePrefixString + "--CraftServices_" + SerialPortName + ".txt";
+		// Port names on Unix are paths (i.e. /dev/pts/7), so they are flattened into something that can go in a file name
+		std::string serialPortLoggerFilename = dateTimeLogFilePrefixString + "--CraftServices_" + CraftServices::MspLinkCaptureRecorder::GetFileSafePortName(SerialPortName) + ".txt";
 		auto serial_port_file_sink = std::make_shared<spdlog::sinks::basic_file_sink_mt>(serialPortLoggerFilename, true);
 		serial_port_file_sink->set_level(spdLogLevel);
 		serial_port_file_sink->set_pattern(loggingPattern);
 
-		pSerialPortLogger = new spdlog::logger("SerialPort_" + SerialPortName, { serial_port_file_sink, pAllSink, pConsoleSink });
+		pSerialPortLogger = CraftServices::Logging::CreateLogger("SerialPort_" + SerialPortName, { serial_port_file_sink, pAllSink, pConsoleSink }, loggingSettings);
 		pSerialPortLogger->set_level(spdLogLevel);
 	}
 
+	// Capture stops for good if it can't go on (i.e. the disk filled up); say so once, and stop trying
+	void MSPFlightControllerAsync::StopLinkCaptureIfFailed()
+	{
+		if (pLinkCapture == NULL || pLinkCapture->IsRecording())
+		{
+			return;
+		}
+
+		pSerialPortLogger->error("{}: Stopped capturing port traffic after {} bytes: {}", GetPortAndCraftNamePrefix(), pLinkCapture->GetRecordedByteCount(), pLinkCapture->GetErrorMessage());
+		delete pLinkCapture;
+		pLinkCapture = NULL;
+	}
+
 	void MSPFlightControllerAsync::OpenPortAndStartSession()
 	{
 		if (IsThisFlightControllerShuttingDown())
@@ -159,39 +231,54 @@ namespace CraftServices
 		// Mark the time we first start trying to open the port
 		if (!HasMarkedPortStartupTime)
 		{
-			InitialPortStartupTime = boost::posix_time::microsec_clock::universal_time();
+			InitialPortStartupTime = GetSessionTime();
 			HasMarkedPortStartupTime = true;
 		}
 
-		try
+		// Some transports (a network bridge, say) take a while to open; the rest happens in OnTransportOpened()
+		if (TransportOpenInProgress)
+		{
+			return;
+		}
+		TransportOpenInProgress = true;
+		pTransport->StartOpen();
+	}
+
+	void MSPFlightControllerAsync::OnTransportOpened(const boost::system::error_code & error)
+	{
+		TransportOpenInProgress = false;
+
+		if (IsThisFlightControllerShuttingDown())
 		{
-			pSerialPort->open(SerialPortName);
+			return;
 		}
-		catch (const boost::system::system_error &e)
+
+		if (error)
 		{
 			pSerialPortLogger->error("{}: could not connect", SerialPortName);
-			pSerialPortLogger->error("{}: Port open Exception: {}", SerialPortName, e.what());
+			pSerialPortLogger->error("{}: Port open failed: {}", SerialPortName, error.message());
 
 			PortState = OverallPortState::PortOpenFailed;
+			if (pLinkCapture != NULL)
+			{
+				pLinkCapture->RecordPortEvent("Port open failed: " + error.message());
+				StopLinkCaptureIfFailed();
+			}
 			return;
 		}
 
-		// TODO: Try other (higher?) baud rates. Make configurable from command line.
-		pSerialPort->set_option(boost::asio::serial_port::baud_rate(BaudRate));
-		pSerialPort->set_option(boost::asio::serial_port::parity(boost::asio::serial_port::parity::none));
-		pSerialPort->set_option(boost::asio::serial_port::character_size(boost::asio::serial_port::character_size(8)));
-		pSerialPort->set_option(boost::asio::serial_port::stop_bits(boost::asio::serial_port::stop_bits::one));
-
-		// clear buffer for new session
-		ClearSerialBuffer();
-
 		// Mark as opened
 		PortState = CraftServices::OverallPortState::PortOpened;
+		if (pLinkCapture != NULL)
+		{
+			pLinkCapture->RecordPortEvent("Port opened: " + pTransport->GetDescription());
+			StopLinkCaptureIfFailed();
+		}
 
 		// Start trying to read
 		StartReadMessageReceiveLoopForFlightController();
 
-		pSerialPortLogger->info("Connected to: {} at {} baud - {}", SerialPortName, BaudRate, OverallPortStateAsString(PortState));
+		pSerialPortLogger->info("Connected to: {} - {}", pTransport->GetDescription(), OverallPortStateAsString(PortState));
 	}
 
 	// Request the initial information about this flight controller -- Type, API version number, UID, etc.
@@ -239,6 +326,47 @@ namespace CraftServices
 		// TODO: Craft type (quad, fixed wing, tricopter...)	
 	}
 
+	// Refresh this Flight Controller on its own timer, independent of all the others. Each port is its own
+	// link, so there's no reason for one to wait its turn behind another.
+	void MSPFlightControllerAsync::StartRefreshTimerFiring()
+	{
+		pSerialPortLogger->trace("{}: StartRefreshTimerFiring() - {} ms", GetPortAndCraftNamePrefix(), GetRefreshIntervalInMilliseconds());
+
+		ServicedByOwnRefreshTimer = true;
+		pRefreshTimer->expires_after(boost::asio::chrono::milliseconds(GetRefreshIntervalInMilliseconds()));
+		WaitForNextRefresh();
+	}
+
+	void MSPFlightControllerAsync::WaitForNextRefresh()
+	{
+		uint64_t timerGeneration = ++RefreshTimerGeneration;
+		pRefreshTimer->async_wait(boost::asio::bind_executor(*pSessionStrand, [this, timerGeneration](const boost::system::error_code & error) 
+		{ 
+			if (timerGeneration == RefreshTimerGeneration)
+			{
+				RefreshTimerCallback(error);
+			}
+		}));
+	}
+
+	// As with the global refresh timer, the interval is an upper bound on a refresh cycle. The cycle is usually 
+	// cut short by the last reply coming in; see CheckForRefreshCycleComplete().
+	void MSPFlightControllerAsync::RefreshTimerCallback(const boost::system::error_code & error)
+	{
+		if (error == boost::asio::error::operation_aborted || IsThisFlightControllerShuttingDown())
+		{
+			return;
+		}
+
+		RefreshFlightControllerState();
+
+		if (!IsThisFlightControllerShuttingDown())
+		{
+			pRefreshTimer->expires_at(pRefreshTimer->expires_at() + boost::asio::chrono::milliseconds(GetRefreshIntervalInMilliseconds()));
+			WaitForNextRefresh();
+		}
+	}
+
 	void MSPFlightControllerAsync::RefreshFlightControllerState()
 	{
 		if (IsThisFlightControllerShuttingDown())
@@ -246,8 +374,12 @@ namespace CraftServices
 			return;
 		}
 
+		CraftServices::MspPipelineStageStopwatch stageStopwatch(pPipelineStageTimes, CraftServices::MspPipelineStage::Refresh);
+
 		pSerialPortLogger->trace("{}: RefreshFlightControllerState() - {}", GetPortAndCraftNamePrefix(), OverallPortStateAsString(PortState));
 
+		ReportDiscardedBytes();
+
 		RestartPortIfNecessary();
 		if (IsThisFlightControllerShuttingDown())
 		{
@@ -255,11 +387,35 @@ namespace CraftServices
 			return;
 		}
 
+		// Free up the window from requests that never got a reply, resending them if they're still worth it
+		ExpireOverdueRequests();
+
+		// The last cycle ran out of time before all its replies came in
+		if (RefreshCycleInProgress)
+		{
+			RefreshCycleInProgress = false;
+			UpdateRefreshRate(false);
+		}
+
+		// Everything this refresh wants to send is planned first, then fitted to the link's airtime for one refresh
+		// interval (less whatever is still owed to earlier messages and resends)
+		const uint64_t MicrosecondsInMillisecond = 1000;
+		AirtimeScheduler.StartCycle((uint64_t)GetRefreshIntervalInMilliseconds() * MicrosecondsInMillisecond, 
+									AirtimeScheduler.GetOutstandingAirtimeInMicroseconds(TransmitQueue, InFlightRequests));
+		PlanningRefreshCycle = true;
+
 		switch (PortState)
 		{
 			case CraftServices::OverallPortState::PortClosed:
 			case CraftServices::OverallPortState::PortOpenFailed:
 			{
+				// Give a port that was just hard reset a moment to finish closing
+				if (GetSessionTime() < PortReopenHoldOffTime)
+				{
+					pSerialPortLogger->trace("{}: Waiting for port to finish closing before reopening.", GetPortAndCraftNamePrefix());
+					break;
+				}
+
 				// Aggressively try to open ports that aren't already open.
 				// TODO: A setting to have it give up after some user-defined interval.
 				OpenPortAndStartSession();
@@ -297,9 +453,131 @@ namespace CraftServices
 			}
 		}
 
+		PackPlannedFramesIntoAirtime();
+
+		// Everything queued up during this refresh goes out together
+		FlushTransmitBatch();
+
+		// This refresh cycle is done once everything it sent has been answered. If it sent nothing (i.e. the
+		// port is still opening) there's nothing to wait on, and the scheduler just waits out the interval.
+		RefreshCycleStartTime = GetSessionTime();
+		RefreshCycleInProgress = !TransmitQueue.IsEmpty() || !InFlightRequests.IsEmpty();
+		if (RefreshCycleInProgress)
+		{
+			pLinkMetrics->RefreshCycleCount.Add();
+		}
+
 		// TODO: More real work here
 	}
 
+	// Called as replies come in. Once the last reply this refresh cycle was waiting on has arrived, move on to the
+	// next cycle right away (after a short gap on the link) rather than waiting out the rest of the refresh interval.
+	// In round robin mode, that's the next Flight Controller's turn, so let the global scheduler know instead.
+	void MSPFlightControllerAsync::CheckForRefreshCycleComplete()
+	{
+		if (!RefreshCycleInProgress || WriteInProgress || !TransmitQueue.IsEmpty() || !InFlightRequests.IsEmpty())
+		{
+			return;
+		}
+
+		RefreshCycleInProgress = false;
+
+		boost::posix_time::time_duration cycleDuration = GetSessionTime() - RefreshCycleStartTime;
+		pLinkMetrics->RefreshCycleCompleteCount.Add();
+		pLinkMetrics->RefreshCycleDuration.Record(cycleDuration.total_milliseconds());
+		pSerialPortLogger->trace("{}: Refresh cycle complete; all replies in after {} ms.", GetPortAndCraftNamePrefix(), cycleDuration.total_milliseconds());
+
+		UpdateRefreshRate(true);
+
+		if (IsThisFlightControllerShuttingDown())
+		{
+			return;
+		}
+
+		if (ServicedByOwnRefreshTimer)
+		{
+			pRefreshTimer->expires_after(boost::asio::chrono::milliseconds(GetMinimumInterFrameGapInMilliseconds()));
+			WaitForNextRefresh();
+		}
+		else if (!ReplayingCapture)
+		{
+			FlightControllerRefreshCycleComplete(this);
+		}
+		// (When replaying a capture, the replay decides when each refresh happens)
+	}
+
+	// Let the refresh rate controller know how the cycle that just ended went, and pick up any new interval.
+	// Only cycles of a running session count; while the port is opening or identifying the Flight Controller,
+	// the traffic says nothing about what the link can sustain.
+	void MSPFlightControllerAsync::UpdateRefreshRate(bool allRepliesIn)
+	{
+		uint64_t timedOutRequestCount = InFlightRequests.GetTimedOutRequestCount();
+		CraftServices::MspRefreshCycleOutcome cycleOutcome;
+		cycleOutcome.AllRepliesIn = allRepliesIn;
+		cycleOutcome.TimedOutRequestCount = timedOutRequestCount - TimedOutRequestCountAtLastRateDecision;
+		uint64_t crcMismatchCount = pLinkMetrics->CrcMismatchCount.Get();
+		cycleOutcome.CrcMismatchCount = crcMismatchCount - CrcMismatchCountAtLastRateDecision;
+		cycleOutcome.ReadOrWriteErrors = SequentialReadErrorCount > 0 || SequentialWriteErrorCount > 0;
+		const uint64_t MicrosecondsInMillisecond = 1000;
+		cycleOutcome.AirtimeNeededInMilliseconds = (uint32_t)((AirtimeScheduler.GetPlannedAirtimeInMicroseconds() + MicrosecondsInMillisecond - 1) / MicrosecondsInMillisecond);
+
+		TimedOutRequestCountAtLastRateDecision = timedOutRequestCount;
+		CrcMismatchCountAtLastRateDecision = crcMismatchCount;
+
+		if (!RefreshRateController.IsAutomatic() || PortState != CraftServices::OverallPortState::SessionRunning)
+		{
+			return;
+		}
+
+		if (!RefreshRateController.EndCycle(cycleOutcome))
+		{
+			return;
+		}
+
+		uint32_t previousIntervalInMilliseconds = GetRefreshIntervalInMilliseconds();
+		ApplyRefreshInterval(RefreshRateController.GetIntervalInMilliseconds());
+
+		switch (RefreshRateController.GetLastChange())
+		{
+			case CraftServices::MspRefreshRateChange::BackedOffForLoss:
+			{
+				pSerialPortLogger->info("{}: Link losing messages ({} timed out, {} CRC errors{}); refresh interval backed off {} -> {} ms.", GetPortAndCraftNamePrefix(),
+					cycleOutcome.TimedOutRequestCount, cycleOutcome.CrcMismatchCount, cycleOutcome.ReadOrWriteErrors ? ", port errors" : "",
+					previousIntervalInMilliseconds, GetRefreshIntervalInMilliseconds());
+				break;
+			}
+			case CraftServices::MspRefreshRateChange::BackedOffForRoundTripTime:
+			{
+				pSerialPortLogger->info("{}: Replies slowing (round trip {} ms, best {} ms); refresh interval backed off {} -> {} ms.", GetPortAndCraftNamePrefix(),
+					RefreshRateController.GetSmoothedRoundTripTimeInMilliseconds(), RefreshRateController.GetBaselineRoundTripTimeInMilliseconds(),
+					previousIntervalInMilliseconds, GetRefreshIntervalInMilliseconds());
+				break;
+			}
+			default:
+			{
+				pSerialPortLogger->debug("{}: Refresh interval tightened {} -> {} ms (round trip {} ms).", GetPortAndCraftNamePrefix(),
+					previousIntervalInMilliseconds, GetRefreshIntervalInMilliseconds(), RefreshRateController.GetSmoothedRoundTripTimeInMilliseconds());
+				break;
+			}
+		}
+	}
+
+	void MSPFlightControllerAsync::ApplyRefreshInterval(uint32_t refreshIntervalInMilliseconds)
+	{
+		RefreshTimerIntervalInMilliseconds = refreshIntervalInMilliseconds;
+		pLinkMetrics->RefreshIntervalInMilliseconds.Set(refreshIntervalInMilliseconds);
+
+		// Never queue up more than the link can send in one refresh, or the queue just grows stale.
+		// (But always leave room for at least one message of the largest size.)
+		size_t smallestTransmitByteBudget = MspMessageScratchPad::MaxMessageLength;
+		TransmitQueue.SetByteBudget(std::max(GetByteCountTransmittableInMilliseconds(refreshIntervalInMilliseconds), smallestTransmitByteBudget));
+	}
+
+	uint32_t MSPFlightControllerAsync::GetRefreshIntervalInMilliseconds()
+	{
+		return RefreshTimerIntervalInMilliseconds.load();
+	}
+
 	bool MSPFlightControllerAsync::IsThisFlightControllerShuttingDown()
 	{
 		// This is redundant and paranoid; it really needs to be cleaned up and consolidated.
@@ -313,38 +591,39 @@ namespace CraftServices
 	// A softer attempt at closing serial port.
 	void MSPFlightControllerAsync::ResetPortSoftish()
 	{
-		try
+		pTransport->Cancel();
+		// Anything not yet sent (or not yet answered) was meant for the old session
+		TransmitQueue.Clear();
+		InFlightRequests.Clear();
+		pTransport->Flush();
+		pTransport->Close();
+		PortState = CraftServices::OverallPortState::PortClosed;
+		if (pLinkCapture != NULL)
 		{
-			pSerialPort->cancel();
-			ClearSerialBuffer();
-			pSerialPort->close();
-			PortState = CraftServices::OverallPortState::PortClosed;
-			MspFcInfo.ResetStateValues();
-			CurrentPositionEverBeenSet = false;
-			HasMarkedPortStartupTime = false;
-		}
-		catch (const boost::system::system_error &e)
-		{
-			pSerialPortLogger->error("{}: Could not close", GetPortAndCraftNamePrefix());
-			pSerialPortLogger->error("{}: Port close Exception: {}", GetPortAndCraftNamePrefix(), e.what());
-
-			PortState = OverallPortState::PortOpened;
-			return;
+			pLinkCapture->RecordPortEvent("Port closed for reset");
+			StopLinkCaptureIfFailed();
 		}
+		MspFcInfo.ResetStateValues();
+		UpdatePortAndCraftNamePrefix();
+		CurrentPositionEverBeenSet = false;
+		WithdrawPublishedPosition();
+		HasMarkedPortStartupTime = false;
 	}
 
 	// A harder attempt at closing the serial port.
 	void MSPFlightControllerAsync::ResetPortHard()
 	{
 		ResetPortSoftish();
-		delete pSerialPort;
+		delete pTransport;
 
-		// Suggested here: https://stackoverflow.com/questions/541062/boostasioserial-port-reading-after-reconnecting-device#541097
-		pIoContext->stop();
-		pIoContext->reset();
+		// Create a new transport, but do not open it yet. (Anything still waiting on the old one went with it.)
+		pTransport = CraftServices::CreateMspTransport(SerialPortName, BaudRate, pIoContext, pSessionStrand, this);
+		TransportOpenInProgress = false;
 
-		// Create a new serial port object, but do not open it yet
-		pSerialPort = new boost::asio::serial_port(*pIoContext);		
+		// Delay to allow the port to hopefully actually close before we attempt to reopen it. (The IO context is
+		// shared by every session, so we can't stop it, or sleep on it, the way we once did.)
+		const int PORT_REOPEN_HOLD_OFF_IN_MILLISECONDS = 1000;
+		PortReopenHoldOffTime = GetSessionTime() + boost::posix_time::milliseconds(PORT_REOPEN_HOLD_OFF_IN_MILLISECONDS);
 	}
 
 	// If we need to (i.e. lack of response from remote Flight Controller), reboot the port and restart the session.
@@ -357,6 +636,12 @@ namespace CraftServices
 	{
 		pSerialPortLogger->trace("{}: RestartPortIfNecessary()", GetPortAndCraftNamePrefix());
 
+		// There's no port to restart; the capture decides what the link does
+		if (ReplayingCapture)
+		{
+			return;
+		}
+
 		// TODO: Make configurable
 		const int RESTART_PORT_TIMEOUT_IN_MILLISECONDS = 15000;
 
@@ -378,7 +663,7 @@ namespace CraftServices
 		}
 
 		// How stale is the last position in milliseconds?
-		boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+		boost::posix_time::ptime now = GetSessionTime();
 		boost::posix_time::time_duration timeDiff = (now - comparisonTime);
 		uint32_t elapsedMilliseconds = timeDiff.total_milliseconds();
 		if (elapsedMilliseconds > RESTART_PORT_TIMEOUT_IN_MILLISECONDS)
@@ -422,6 +707,20 @@ namespace CraftServices
 	}
 
 	// Send notices about other Craft to the Craft associated with this Session
+	//
+	// Nearest craft go first. Collision risk grows as distance shrinks, so the latency of the nearest neighbour's
+	// position is the one that actually matters; a craft a kilometer away can wait a few milliseconds more. "Nearest"
+	// here is how close the two craft will get over the next few seconds at their current velocities (see 
+	// CraftProximity::GetClosestApproachInMeters), so a craft closing fast outranks one that is nearer but pulling away.
+	//
+	// Given 3 crafts A, B, C, with A <--> B 250 meters apart, B <--> C 15 meters, C <--> A 25 meters, C is sent B then A,
+	// B is sent C then A, and A is sent C then B. (The order the Flight Controllers themselves are serviced in is worked
+	// out the same way, in CraftServices.cpp.)
+	//
+	// Order only matters when the link can't carry every position in a refresh; the ones at the back are deferred (see
+	// PackPlannedFramesIntoAirtime). So that distant craft aren't deferred forever, a craft whose position has been
+	// deferred PROXIMITY_FAIRNESS_FLOOR_IN_ROUNDS rounds running is moved up to go right after the nearest. Only if it is
+	// still being deferred there does it go ahead of the nearest.
 	void MSPFlightControllerAsync::SendNoticesAboutOtherCrafts()
 	{
 		if (IsShutdownInProgressOrComplete())
@@ -436,40 +735,14 @@ namespace CraftServices
 		{
 			pSerialPortLogger->trace("{}: SendNoticesAboutOtherCraft() - {}", GetPortAndCraftNamePrefix(), OverallPortStateAsString(PortState));
 
-			// TODO, possibly: Sort by distance, and update positions of closest crafts first. This would be working
-			// under the assumption that latency becomes more important the closer you are to the other craft. Here's 
-			// the rough idea:
-			//
-			// Given 3 crafts A, B, C, there are 3 distances between them:
-			// 
-			// A <--> B = Distance DAB = 250 meters
-			// B <--> C = Distance DBC = 15 meters
-			// C <--> A = Distance DCA = 25 meters
-			//
-			// To service the closest craft first, we'd service in the following orders for each craft:
-			//
-			//  1. Servicing Craft C:  B, A  (15, 25 meters)  (Distance sum = 15 + 25  = 40)
-			//  2. Servicing Craft B:  C, A  (15, 250 meters) (Distance sum = 15 + 250 = 265)
-			//  3. Servicing Craft A:  C, B  (25, 250 meters) (Distance sum = 25 + 250 = 275)
-			// 
-			// There are two orders here: The overall order of crafts to service (in this case A, C, B),
-			// and then the order to service PER CRAFT. In both cases we favor the near craft.
-			// This still assumes we are servicing one entire craft at a time. 
-			// 
-			// To determine the overall order (1,2,3 above), you sort by the distance sum.
-			//
-			// If we could change between crafts while we were doing servicing, we could take this farther and
-			// send out the closest pairs, one side at a time, like so:
-			// 
-			//  1. Service C, send B (DBC = 15 meters)
-			//  2. Service B, send C (DBC = 15 meters)
-			//  3. Service A, send C (DCA = 25 meters)
-			//  4. Service C, send A (DCA = 25 meters)
-			//  5. Service A, send B (DAB = 250 meters)
-			//  4. Service B, send A (DAB = 250 meters)
-			//
-			// This will take loop restructuring though. Ok, enough pre-optimization/hyperoptimization.		
-			// -- SLG
+			struct OtherCraftToSend
+			{
+				std::shared_ptr<const CraftServices::PublishedCraftPosition> pPosition;
+				double ProximityRank;
+			};
+			std::vector<OtherCraftToSend> otherCraftsToSend;
+
+			CraftServices::CraftKinematics ourKinematics = GetCurrentKinematics();
 
 			// Go through all the Flight Controllers known to Craft Services
 			for (std::vector<CraftServices::MSPFlightControllerAsync *>::iterator fcIter = pAllMspFlightControllers->begin(); fcIter < pAllMspFlightControllers->end(); fcIter++)
@@ -477,25 +750,27 @@ namespace CraftServices
 				CraftServices::MSPFlightControllerAsync * pCurrentFc = (*fcIter);
 
 				// Skip over ourself. Only tell Flight Controller about OTHER crafts we know the position of.
-				if (pCurrentFc->MspFcInfo.GetUidAsHexString() != MspFcInfo.GetUidAsHexString())
+				if (pCurrentFc != this)
 				{
-					if (!pCurrentFc->CurrentPositionEverBeenSet)
+					// Other sessions may be running on other threads, so we only look at what they've published
+					std::shared_ptr<const CraftServices::PublishedCraftPosition> pOtherCraftPosition = pCurrentFc->GetPublishedPosition();
+					if (!pOtherCraftPosition)
 					{
-						pSerialPortLogger->warn("{}: Other Craft {} - GPS position not yet received, not sending notice to other crafts, skipping.", GetPortAndCraftNamePrefix(), pCurrentFc->MspFcInfo.GetCraftName());
+						pSerialPortLogger->warn("{}: Other Craft on {} - GPS position not yet received, not sending notice to other crafts, skipping.", GetPortAndCraftNamePrefix(), pCurrentFc->SerialPortName);
 					}
 					else
 					{
-						std::string currentCraftName = MspFcInfo.GetCraftName();
-						std::string otherCraftName = pCurrentFc->MspFcInfo.GetCraftName();
+						std::string otherCraftName = pOtherCraftPosition->CraftName;
 
 						// How stale is information about this Craft? How old is the last position in milliseconds?
 						int64_t timeDiffInMilliseconds = 0;
-						bool currentCraftPositionIsStale = CraftPositionIsStale(pCurrentFc, timeDiffInMilliseconds);
+						bool currentCraftPositionIsStale = CraftPositionIsStale(pOtherCraftPosition->RetrievalTime, timeDiffInMilliseconds);
 						if (!currentCraftPositionIsStale)
 						{
 							pSerialPortLogger->debug("{}: Other craft {} position sufficiently fresh, is {} ms old. Sending...", GetPortAndCraftNamePrefix(), otherCraftName, timeDiffInMilliseconds);
-							// Send position information about one particular Craft
-							SendOtherCraftPositionMessage(*pCurrentFc);
+							pLinkMetrics->ForwardedPositionAge.Record(timeDiffInMilliseconds);
+							OtherCraftToSend otherCraftToSend = { pOtherCraftPosition, CraftServices::CraftProximity::GetProximityRank(ourKinematics, pOtherCraftPosition->Kinematics) };
+							otherCraftsToSend.push_back(otherCraftToSend);
 						}
 						else
 						{
@@ -509,14 +784,58 @@ namespace CraftServices
 					}
 				}
 			}
+
+			// Nearest first. Stable, so craft we can't rank keep the order they were configured in.
+			std::stable_sort(otherCraftsToSend.begin(), otherCraftsToSend.end(), [](const OtherCraftToSend & first, const OtherCraftToSend & second)
+			{
+				return first.ProximityRank < second.ProximityRank;
+			});
+
+			// Fairness floor: the craft that has been deferred longest, if it has been deferred long enough, moves up behind
+			// the nearest. The nearest only gives up first place if that hasn't been enough.
+			auto longestDeferredIterator = otherCraftsToSend.end();
+			uint32_t longestDeferredInRounds = 0;
+			for (auto otherCraftIterator = otherCraftsToSend.begin(); otherCraftIterator != otherCraftsToSend.end(); ++otherCraftIterator)
+			{
+				auto roundsDeferredIterator = RoundsPositionDeferred.find(GetTransmitKeyForCraftPosition(*otherCraftIterator->pPosition));
+				if (roundsDeferredIterator != RoundsPositionDeferred.end())
+				{
+					uint32_t roundsDeferred = roundsDeferredIterator->second;
+					if (roundsDeferred >= PROXIMITY_FAIRNESS_FLOOR_IN_ROUNDS && roundsDeferred > longestDeferredInRounds)
+					{
+						longestDeferredIterator = otherCraftIterator;
+						longestDeferredInRounds = roundsDeferred;
+					}
+				}
+			}
+			if (longestDeferredIterator != otherCraftsToSend.end())
+			{
+				auto moveToIterator = otherCraftsToSend.begin();
+				if (longestDeferredInRounds < 2 * PROXIMITY_FAIRNESS_FLOOR_IN_ROUNDS)
+				{
+					++moveToIterator;
+				}
+				if (longestDeferredIterator > moveToIterator)
+				{
+					std::rotate(moveToIterator, longestDeferredIterator, longestDeferredIterator + 1);
+				}
+			}
+
+			for (size_t sendIndex = 0; sendIndex < otherCraftsToSend.size(); sendIndex++)
+			{
+				const OtherCraftToSend & otherCraftToSend = otherCraftsToSend[sendIndex];
+				pSerialPortLogger->trace("{}: Sending other craft {} ({} of {}, closest approach {:.0f} m)", GetPortAndCraftNamePrefix(), otherCraftToSend.pPosition->CraftName, sendIndex + 1, otherCraftsToSend.size(), otherCraftToSend.ProximityRank);
+				// Send position information about one particular Craft
+				SendOtherCraftPositionMessage(*otherCraftToSend.pPosition);
+			}
 		}
 	}
 
-	bool MSPFlightControllerAsync::CraftPositionIsStale(CraftServices::MSPFlightControllerAsync * pMspFlightController, int64_t & timeDifferenceInMilliseconds)
+	bool MSPFlightControllerAsync::CraftPositionIsStale(const boost::posix_time::ptime & positionRetrievalTime, int64_t & timeDifferenceInMilliseconds)
 	{
 		// How stale is information about this Craft? How old is the last position in milliseconds?
-		boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
-		boost::posix_time::time_duration timeDiff = (now - pMspFlightController->CurrentPositionRetrievalTime);
+		boost::posix_time::ptime now = GetSessionTime();
+		boost::posix_time::time_duration timeDiff = (now - positionRetrievalTime);
 		timeDifferenceInMilliseconds = timeDiff.total_milliseconds();
 
 		bool staleIntervalSetToNeverTimeout = StaleIntervalInMilliseconds == 0;
@@ -524,6 +843,8 @@ namespace CraftServices
 		return craftPositionIsStale;
 	}
 
+	static boost::mutex PhantomCraftMutex;
+
 	// Send notices about other, fake Craft
 	void MSPFlightControllerAsync::SendNoticesAboutPhantomCrafts()
 	{
@@ -537,6 +858,9 @@ namespace CraftServices
 		{
 			pSerialPortLogger->trace("{}: SendNoticesAboutPhantomCrafts() - {}", GetPortAndCraftNamePrefix(), OverallPortStateAsString(PortState));
 
+			// Phantom Craft are shared by every session, and sessions may be running on different threads
+			boost::mutex::scoped_lock phantomCraftLock(PhantomCraftMutex);
+
 			// Go through all the Phantom Craft
 			for (std::vector<CraftServices::PhantomTestCraft *>::iterator phantIter = pPhantomCraft->begin(); phantIter < pPhantomCraft->end(); phantIter++)
 			{
@@ -544,7 +868,7 @@ namespace CraftServices
 
 				// How stale is information about this Craft? How old is the last position in milliseconds?
 				int64_t timeDiffInMilliseconds = 0;
-				bool currentCraftPositionIsStale = CraftPositionIsStale(this, timeDiffInMilliseconds);
+				bool currentCraftPositionIsStale = CraftPositionIsStale(CurrentPositionRetrievalTime, timeDiffInMilliseconds);
 
 				// Update all the reference positions (although not all phantom craft will care about this)
 				CraftServices::msg::OtherCraftPositionMessage OtherCraftPositionMessage(*this);
@@ -566,43 +890,45 @@ namespace CraftServices
 		}
 	}
 
-	// This is responsible for *reading* in messages, byte by byte.
+	// This is responsible for *reading* in messages. Reads are done in chunks of whatever the port has
+	// available, and the message parser picks up where it left off with each new chunk.
 	void MSPFlightControllerAsync::StartReadMessageReceiveLoopForFlightController()
 	{
 		pSerialPortLogger->trace("{}: StartReadMessageReceiveLoopForFlightController()", GetPortAndCraftNamePrefix());
 
-		// Clear read buffer
-		ReadBuffer[0] = 0;
-		boost::asio::async_read(*pSerialPort, boost::asio::buffer(&ReadBuffer, 1), [this](const boost::system::error_code& error, size_t sizeRead) { MessageReceiveOneByteReadCallback(error, sizeRead); });
+		ReadNextMessageChunk();
+	}
+
+	// Ask for the next chunk of bytes from the port. Completes as soon as at least one byte is available.
+	void MSPFlightControllerAsync::ReadNextMessageChunk()
+	{
+		pTransport->StartRead(boost::asio::buffer(ReadBuffer));
+	}
+
+	void MSPFlightControllerAsync::OnTransportRead(const boost::system::error_code & error, size_t sizeRead)
+	{
+		MessageReceiveReadCallback(error, sizeRead);
 	}
 
-	// Callback routine when one byte is received for a particular Flight Controller connection
-	void MSPFlightControllerAsync::MessageReceiveOneByteReadCallback(const boost::system::error_code& error, std::size_t sizeRead)
+	// Callback routine when a chunk of bytes is received for a particular Flight Controller connection
+	void MSPFlightControllerAsync::MessageReceiveReadCallback(const boost::system::error_code& error, std::size_t sizeRead)
 	{
 		if (IsThisFlightControllerShuttingDown())
 		{
 			return;
 		}
 
-		//pSerialPortLogger->trace("{}: MessageReceiveOneByteReadCallback()", SerialPortName);
-
 		CountErrorsAfterRead(error, sizeRead);
 
-		// No problems reading a single byte
-		if (!error && sizeRead == 1)
+		// No problems reading; run everything we got through the parser
+		if (!error && sizeRead > 0)
 		{
-			std::string errorMessage = "";
-			char currentCharacterRead = ReadBuffer[0];
-			//pSerialPortLogger->trace("{}: Read character: ({})", SerialPortName, (static_cast<int>(currentCharacterRead)));
-			bool byteProcessedOk = ProcessReceivedMessageByte(currentCharacterRead, errorMessage);
-			if (!byteProcessedOk)
+			if (pLinkCapture != NULL)
 			{
-				pSerialPortLogger->error("{}: Had problem parsing message byte: {}", GetPortAndCraftNamePrefix(), errorMessage);
-
-				// RESET somehow here?? Restart the message loop? 
-				// A softer alternative would be to reset the buffers, perhaps? Errors here could
-				// maybe lead to enjambment?
+				pLinkCapture->RecordReceived(ReadBuffer.data(), sizeRead);
+				StopLinkCaptureIfFailed();
 			}
+			HandleReceivedBytes(ReadBuffer.data(), sizeRead);
 		}
 
 		// There was a problem reading
@@ -611,42 +937,189 @@ namespace CraftServices
 			// We expect (and ignore) read errors when the port is in a failed or closed state
 			if (!IsClosedOrFailedPort(PortState))
 			{
-				pSerialPortLogger->error("{}: Had problem reading byte from port", GetPortAndCraftNamePrefix());
+				pSerialPortLogger->error("{}: Had problem reading from port", GetPortAndCraftNamePrefix());
 				pSerialPortLogger->error("{}: Doing hard reset on port {}", GetPortAndCraftNamePrefix(), SerialPortName);
 
 				ResetPortHard();
-				// Delay to allow the port to hopefully actually close before we attempt to reopen it
-				boost::this_thread::sleep(boost::posix_time::milliseconds(1000));
 			}
+
+			// The port is closed (or was cancelled on purpose). The read loop starts up again when the port is reopened.
+			return;
 		}
 
-		// There was no problem, but we didn't read anything
-		// (This happens after the end of message received and appears to be normal)
-		if (!error && sizeRead == 0)
+		// Read the next chunk
+		ReadNextMessageChunk();
+	}
+
+	void MSPFlightControllerAsync::HandleReceivedBytes(const uint8_t * pReceivedBytes, size_t byteCount)
+	{
+		pLinkMetrics->BytesReceived.Add(byteCount);
 		{
-			pSerialPortLogger->trace("{}: ## No Error, nothing read", GetPortAndCraftNamePrefix());
+			CraftServices::MspPipelineStageStopwatch stageStopwatch(pPipelineStageTimes, CraftServices::MspPipelineStage::Parse);
+			ProcessReceivedMessageBytes(pReceivedBytes, byteCount);
 		}
 
-		// Attempt to read the next byte (Yes, no matter what happened above. We solider on in the face of errors.)
-		pSerialPortLogger->trace("{}: Setting up callback to read next byte", GetPortAndCraftNamePrefix());
-		boost::asio::async_read(*pSerialPort, boost::asio::buffer(&ReadBuffer, 1), [this](const boost::system::error_code& error, size_t sizeRead) { MessageReceiveOneByteReadCallback(error, sizeRead); });
+		// Any replies in there opened up the window, so send whatever was waiting on it
+		FlushTransmitBatch();
+		// .. and may have been the last ones this refresh cycle was waiting on
+		CheckForRefreshCycleComplete();
+	}
+
+	void MSPFlightControllerAsync::StartReplaySession(CraftServices::MspPipelineStageTimes * pStageTimes)
+	{
+		ReplayingCapture = true;
+		pPipelineStageTimes = pStageTimes;
+
+		// Writes go to an in-memory link with nothing on the far end, and are done as soon as they're made
+		CraftServices::MspMemoryTransport * pReplayTransport = new CraftServices::MspMemoryTransport(pSessionStrand, this, std::make_shared<CraftServices::MspMemoryLink>(), SerialPortName);
+		pReplayTransport->Open();
+		delete pTransport;
+		pTransport = pReplayTransport;
+
+		InitialPortStartupTime = GetSessionTime();
+		HasMarkedPortStartupTime = true;
+		PortState = CraftServices::OverallPortState::PortOpened;
+
+		pSerialPortLogger->info("{}: Replaying captured traffic - {}", GetPortAndCraftNamePrefix(), OverallPortStateAsString(PortState));
+	}
+
+	void MSPFlightControllerAsync::SetReplayClockTime(const boost::posix_time::ptime & replayClockTime)
+	{
+		ReplayClockTime = replayClockTime;
+	}
+
+	// The time as far as this session is concerned: the wall clock, or the capture's clock when replaying one
+	// (so timeouts and staleness work out the same however fast the capture is replayed)
+	boost::posix_time::ptime MSPFlightControllerAsync::GetSessionTime()
+	{
+		return ReplayingCapture ? ReplayClockTime : boost::posix_time::microsec_clock::universal_time();
 	}
 
-	// Process a single received message byte
-	// Returns true if processed successfully, false if there was a problem of some kind, with message place in errorMessage
-	bool MSPFlightControllerAsync::ProcessReceivedMessageByte(char messageByte, std::string & errorMessage)
+	void MSPFlightControllerAsync::ReplayReceivedBytes(const uint8_t * pReceivedBytes, size_t byteCount)
 	{
 		if (IsThisFlightControllerShuttingDown())
 		{
-			return false;
-			errorMessage = "Shutting down";
+			return;
 		}
 
-		errorMessage = "";
+		HandleReceivedBytes(pReceivedBytes, byteCount);
+	}
+
+	// Process a chunk of received bytes. The chunk can end anywhere in a message; ReadState and the
+	// MessageScratchPad carry the partially read message over to the next chunk.
+	//
+	// Between messages, and after any bad message, we are in resync mode: we jump straight to the next 
+	// '$' in the chunk, and only count the bytes skipped over rather than complaining about each one. If a 
+	// message that started with a '$' goes bad partway through, it may have been a '$' inside some other
+	// message's payload, so scanning restarts at the byte after that '$' rather than after the bad byte.
+	void MSPFlightControllerAsync::ProcessReceivedMessageBytes(const uint8_t * pMessageBytes, size_t byteCount)
+	{
+		const size_t NoMessageStartIndex = SIZE_MAX;
+
+		// Where in this chunk the message currently being read started, if it started in this chunk at all
+		size_t messageStartIndex = NoMessageStartIndex;
+		// How many bytes of the current message came in with earlier chunks
+		size_t messageBytesFromEarlierChunks = (ReadState == CraftServices::MessageReadState::PreambleOne) ? 0 : MessageScratchPad.MessageBytesRead;
+
+		size_t byteIndex = 0;
+		while (byteIndex < byteCount)
+		{
+			if (IsThisFlightControllerShuttingDown())
+			{
+				return;
+			}
+
+			if (ReadState == CraftServices::MessageReadState::PreambleOne)
+			{
+				// Skip directly to the next possible start of a message
+				const void * pPreamble = std::memchr(pMessageBytes + byteIndex, '$', byteCount - byteIndex);
+				if (pPreamble == NULL)
+				{
+					pLinkMetrics->DiscardedByteCount.Add(byteCount - byteIndex);
+					return;
+				}
+				size_t preambleIndex = (const uint8_t *)pPreamble - pMessageBytes;
+				pLinkMetrics->DiscardedByteCount.Add(preambleIndex - byteIndex);
+				byteIndex = preambleIndex;
+				messageStartIndex = preambleIndex;
+				messageBytesFromEarlierChunks = 0;
+			}
+
+			CraftServices::MessageByteResult messageByteResult = CraftServices::MessageByteResult::InProgress;
+
+			// The data payload is the bulk of most messages, so take as much of it as this chunk holds in one go
+			// rather than stepping through the state machine for each byte.
+			if (ReadState == CraftServices::MessageReadState::DataPayload)
+			{
+				size_t payloadBytesStillExpected = MessageScratchPad.DataPayloadLength - MessageScratchPad.DataPayloadBytesRead;
+				size_t payloadBytesToCopy = std::min(payloadBytesStillExpected, byteCount - byteIndex);
+				std::memcpy(MessageScratchPad.GetNextDataPayloadByte(), pMessageBytes + byteIndex, payloadBytesToCopy);
+				MessageScratchPad.CalculatedCrc = Crc::crc8_dvb_s2_update(MessageScratchPad.CalculatedCrc, pMessageBytes + byteIndex, payloadBytesToCopy);
+				MessageScratchPad.DataPayloadBytesRead += (uint16_t)payloadBytesToCopy;
+				MessageScratchPad.MessageBytesRead += payloadBytesToCopy;
+				byteIndex += payloadBytesToCopy;
+
+				if (MessageScratchPad.DataPayloadBytesRead == MessageScratchPad.DataPayloadLength)
+				{
+					ReadState = CraftServices::MessageReadState::CrcByte;
+				}
+			}
+			else
+			{
+				messageByteResult = ProcessReceivedMessageByte(pMessageBytes[byteIndex]);
+				byteIndex++;
+			}
+
+			if (messageByteResult == CraftServices::MessageByteResult::MessageComplete)
+			{
+				std::string errorMessage;
+				CraftServices::MspPipelineStageStopwatch stageStopwatch(pPipelineStageTimes, CraftServices::MspPipelineStage::Decode);
+				if (!ProcessMessageScratchPad(MessageScratchPad, errorMessage))
+				{
+					pSerialPortLogger->error("{}: Had problem processing message: {}", GetPortAndCraftNamePrefix(), errorMessage);
+				}
+				// Clean up immediately for clarity
+				MessageScratchPad.ClearValue();
+				messageStartIndex = NoMessageStartIndex;
+				messageBytesFromEarlierChunks = 0;
+			}
+			else if (messageByteResult == CraftServices::MessageByteResult::MessageRejected)
+			{
+				pLinkMetrics->RejectedMessageCount.Add();
+				// The '$' that started the bad message is discarded; everything after it gets another look
+				pLinkMetrics->DiscardedByteCount.Add();
+
+				if (messageStartIndex != NoMessageStartIndex)
+				{
+					// The bad message started in this chunk, so just back up
+					byteIndex = messageStartIndex + 1;
+				}
+				else
+				{
+					// The bad message started in an earlier chunk, so we no longer have those bytes in hand -- except
+					// in the scratch pad. Rescan them from there before carrying on from the start of this chunk.
+					uint8_t earlierMessageBytes[MspMessageScratchPad::MaxMessageLength];
+					size_t earlierMessageByteCount = messageBytesFromEarlierChunks - 1;
+					std::memcpy(earlierMessageBytes, MessageScratchPad.MessageBytes + 1, earlierMessageByteCount);
+					MessageScratchPad.ClearValue();
+					ProcessReceivedMessageBytes(earlierMessageBytes, earlierMessageByteCount);
+
+					// Any message the rescan left partly read continues into this chunk
+					byteIndex = 0;
+					messageBytesFromEarlierChunks = (ReadState == CraftServices::MessageReadState::PreambleOne) ? 0 : MessageScratchPad.MessageBytesRead;
+				}
+				messageStartIndex = NoMessageStartIndex;
+			}
+		}
+	}
 
+	// Process a single received message byte (other than the bulk of the data payload; see above)
+	// Returns whether this byte completed a good message, showed the message so far to be bad, or neither.
+	// Nothing is logged here -- on a noisy link this runs for every byte of garbage.
+	CraftServices::MessageByteResult MSPFlightControllerAsync::ProcessReceivedMessageByte(uint8_t messageByte)
+	{
 		// Here we start to use a little structure - MessageScratchPad - to
 		// build up the message information before we process it.
-		bool messageScratchPadReadyToBeProcessed = false;
 
 		switch (ReadState)
 		{
@@ -654,30 +1127,24 @@ namespace CraftServices
 			MessageScratchPad.ClearValue();
 			if (messageByte != '$')
 			{
-				errorMessage = "Expected $ for preamble byte 1";
-				return false;
+				pLinkMetrics->DiscardedByteCount.Add();
+				return CraftServices::MessageByteResult::InProgress;
 			}
 			ReadState = CraftServices::MessageReadState::PreambleTwo;
 			break;
 		case CraftServices::MessageReadState::PreambleTwo:
 			if (messageByte != 'X')
 			{
-				errorMessage = "Expected X for preamble byte 2";
-				return false;
+				// Expected X for preamble byte 2
+				return RejectMessage();
 			}
 			ReadState = CraftServices::MessageReadState::Direction;
 			break;
 		case CraftServices::MessageReadState::Direction:
 			if (messageByte != '<' && messageByte != '>' && messageByte != '!')
 			{
-				// Something we did not expect
-				errorMessage = "Expected <, >, or ! for direction, but got " + CraftServices::UidUtil::IntToHex(messageByte);
-				return false;
-			}
-			if (messageByte == '!')
-			{
-				// Just debugging
-				//cout << "Received error response" << endl;
+				// Expected <, >, or ! for direction
+				return RejectMessage();
 			}
 
 			MessageScratchPad.MessageDirectionCharacter = messageByte;
@@ -686,27 +1153,37 @@ namespace CraftServices
 		case CraftServices::MessageReadState::ZeroFlag:
 			if (messageByte != 0)
 			{
-				errorMessage = "Expected 0 for Zero Flag";
-				return false;
+				// Expected 0 for Zero Flag
+				return RejectMessage();
 			}
+			// The CRC covers everything from the flag byte through the end of the payload
+			MessageScratchPad.CalculatedCrc = Crc::crc8_dvb_s2(0, messageByte);
 			ReadState = CraftServices::MessageReadState::MessageIDLowByte;
 			break;
 		case CraftServices::MessageReadState::MessageIDLowByte:
 			MessageScratchPad.MessageIDLowByte = messageByte;
+			MessageScratchPad.CalculatedCrc = Crc::crc8_dvb_s2(MessageScratchPad.CalculatedCrc, messageByte);
 			ReadState = CraftServices::MessageReadState::MessageIDHighByte;
 			break;
 		case CraftServices::MessageReadState::MessageIDHighByte:
 			MessageScratchPad.MessageIDHighByte = messageByte;
+			MessageScratchPad.CalculatedCrc = Crc::crc8_dvb_s2(MessageScratchPad.CalculatedCrc, messageByte);
 			MessageScratchPad.InitMessageID();
 			ReadState = CraftServices::MessageReadState::DataPayloadLengthLowByte;
 			break;
 		case CraftServices::MessageReadState::DataPayloadLengthLowByte:
 			MessageScratchPad.DataPayloadLengthLowByte = messageByte;
+			MessageScratchPad.CalculatedCrc = Crc::crc8_dvb_s2(MessageScratchPad.CalculatedCrc, messageByte);
 			ReadState = CraftServices::MessageReadState::DataPayloadLengthHighByte;
 			break;
 		case CraftServices::MessageReadState::DataPayloadLengthHighByte:
 			MessageScratchPad.DataPayloadLengthHighByte = messageByte;
-			MessageScratchPad.InitDataPayload();
+			MessageScratchPad.CalculatedCrc = Crc::crc8_dvb_s2(MessageScratchPad.CalculatedCrc, messageByte);
+			if (!MessageScratchPad.InitDataPayload())
+			{
+				// Longer than any message we accept. Almost certainly garbage rather than a real message.
+				return RejectMessage();
+			}
 			if (MessageScratchPad.DataPayloadLength > 0)
 			{
 				// There's a payload, so expect it
@@ -719,8 +1196,8 @@ namespace CraftServices
 			}
 			break;
 		case CraftServices::MessageReadState::DataPayload:
-			assert(MessageScratchPad.pDataPayload != NULL);
-			MessageScratchPad.pDataPayload[MessageScratchPad.DataPayloadBytesRead] = messageByte;
+			*MessageScratchPad.GetNextDataPayloadByte() = messageByte;
+			MessageScratchPad.CalculatedCrc = Crc::crc8_dvb_s2(MessageScratchPad.CalculatedCrc, messageByte);
 			MessageScratchPad.DataPayloadBytesRead++;
 			// If we've read the entire expected payload, we move on to the CRC. Otherwise,
 			// keep expecting data payload bytes.
@@ -731,27 +1208,51 @@ namespace CraftServices
 			break;
 		case CraftServices::MessageReadState::CrcByte:
 			MessageScratchPad.CrcByte = messageByte;
-			// Handled outside of the case statement to highlight it's importance
-			messageScratchPadReadyToBeProcessed = true;
+			// The CRC was calculated as the message was read, so this is just a compare
+			if (MessageScratchPad.CrcByte != MessageScratchPad.CalculatedCrc)
+			{
+				pLinkMetrics->CrcMismatchCount.Add();
+				return RejectMessage();
+			}
+			MessageScratchPad.AppendMessageByte(messageByte);
 			ReadState = CraftServices::MessageReadState::PreambleOne;
-			break;
+			return CraftServices::MessageByteResult::MessageComplete;
 		default:
 			throw NotImplementedException("Unknown MessageReadState");
 			break;
 		}
 
-		bool readStatus = true;
+		MessageScratchPad.AppendMessageByte(messageByte);
+		return CraftServices::MessageByteResult::InProgress;
+	}
+
+	// Give up on the message currently being read, and go back to looking for the start of the next one
+	CraftServices::MessageByteResult MSPFlightControllerAsync::RejectMessage()
+	{
+		ReadState = CraftServices::MessageReadState::PreambleOne;
+		return CraftServices::MessageByteResult::MessageRejected;
+	}
+
+	// Summarize any line noise since the last time we checked, rather than logging it as it happens
+	void MSPFlightControllerAsync::ReportDiscardedBytes()
+	{
+		uint64_t discardedByteCount = pLinkMetrics->DiscardedByteCount.Get();
+		uint64_t rejectedMessageCount = pLinkMetrics->RejectedMessageCount.Get();
+		uint64_t crcMismatchCount = pLinkMetrics->CrcMismatchCount.Get();
 
-		// We have a complete message ready to be processed. Attempt to do so.
-		if (messageScratchPadReadyToBeProcessed)
+		if (discardedByteCount != LastReportedDiscardedByteCount)
 		{
-			readStatus = ProcessMessageScratchPad(MessageScratchPad, errorMessage);
-			// Clean up immediately for clarity
-			MessageScratchPad.ClearValue();
+			pSerialPortLogger->warn("{}: Discarded {} bytes of line noise ({} bad messages, {} CRC mismatches) since last report. Totals: {} bytes, {} bad messages, {} CRC mismatches.", 
+				GetPortAndCraftNamePrefix(), 
+				discardedByteCount - LastReportedDiscardedByteCount,
+				rejectedMessageCount - LastReportedRejectedMessageCount,
+				crcMismatchCount - LastReportedCrcMismatchCount,
+				discardedByteCount, rejectedMessageCount, crcMismatchCount);
+
+			LastReportedDiscardedByteCount = discardedByteCount;
+			LastReportedRejectedMessageCount = rejectedMessageCount;
+			LastReportedCrcMismatchCount = crcMismatchCount;
 		}
-
-		// Everything OK
-		return readStatus;
 	}
 
 	bool MSPFlightControllerAsync::ProcessMessageScratchPad(MspMessageScratchPad & messageScratchPadToProcess, std::string & errorMessage)
@@ -764,18 +1265,24 @@ namespace CraftServices
 
 		errorMessage = "";
 
-		// Check CRC first
-		ByteVector dataPayloadAsByteVector(messageScratchPadToProcess.pDataPayload, messageScratchPadToProcess.pDataPayload + messageScratchPadToProcess.DataPayloadLength);
-		uint8_t calculatedCrc = CalculateCrcOfMessage(ZeroFlag, messageScratchPadToProcess.MessageID, dataPayloadAsByteVector);
-		if (messageScratchPadToProcess.CrcByte != calculatedCrc)
+		// Everything below decodes straight out of the scratch pad, no copies
+		ByteSpan payloadData = messageScratchPadToProcess.GetPayloadData();
+
+		// Check CRC first. It was calculated as the message was read, so this is just a compare.
+		if (messageScratchPadToProcess.CrcByte != messageScratchPadToProcess.CalculatedCrc)
 		{
 			errorMessage = "CRC Mismatch";
 			return false;
 		}
 
+		// Whatever the reply says, it answers one of our requests
+		MatchResponseToInFlightRequest(messageScratchPadToProcess);
+
 		// Was this an error response?
 		if (messageScratchPadToProcess.MessageDirectionCharacter == '!')
 		{
+			pLinkMetrics->ErrorReplyCount.Add();
+			pLinkMetrics->Messages.Get(messageScratchPadToProcess.MessageID).ErrorReplyCount.Add();
 			std::ostringstream outString;
 			outString << "Received error - ! message direction error response for Message ID " << CraftServices::UidUtil::IntToHex(messageScratchPadToProcess.MessageID) << ", did not process.";
 			errorMessage = outString.str();
@@ -793,7 +1300,7 @@ namespace CraftServices
 			{
 				case ID::MSP_FC_VARIANT:
 				{
-					CraftServices::msg::FcVariant fcVariantMsg(messageScratchPadToProcess.GetPayloadDataAsVector());
+					CraftServices::msg::FcVariant fcVariantMsg(payloadData);
 					MspFcInfo.FcVariantString = fcVariantMsg.CraftIdentifier;
 					MspFcInfo.HasFcVariantString = true;
 					pSerialPortLogger->debug("{}: Successfully parsed FcVariant message: {}", GetPortAndCraftNamePrefix(), MspFcInfo.FcVariantString);
@@ -802,11 +1309,16 @@ namespace CraftServices
 
 				case ID::MSP_UID:
 				{
-					CraftServices::msg::UidMessage uidMessage(messageScratchPadToProcess.GetPayloadDataAsVector());
+					CraftServices::msg::UidMessage uidMessage(payloadData);
 					MspFcInfo.UID_0 = uidMessage.UID_0;
 					MspFcInfo.UID_1 = uidMessage.UID_1;
 					MspFcInfo.UID_2 = uidMessage.UID_2;
 					MspFcInfo.HasUID = true;
+					// Anything already published about this craft went out under the wrong UID
+					if (CurrentPositionEverBeenSet)
+					{
+						PublishPosition();
+					}
 					pSerialPortLogger->debug("{}: Successfully parsed UID message: {}", GetPortAndCraftNamePrefix(), MspFcInfo.GetUidAsHexString());
 					break;
 				}
@@ -814,7 +1326,7 @@ namespace CraftServices
 				case ID::MSP_API_VERSION:
 				{
 					// ApiVersion
-					CraftServices::msg::ApiVersion apiVersionMessage(messageScratchPadToProcess.GetPayloadDataAsVector());
+					CraftServices::msg::ApiVersion apiVersionMessage(payloadData);
 					MspFcInfo.MSP_Version_Protocol = (int8_t)apiVersionMessage.Protocol;
 					MspFcInfo.API_Version_Major = (int8_t)apiVersionMessage.Major;
 					MspFcInfo.API_Version_Minor = (int8_t)apiVersionMessage.Minor;
@@ -831,9 +1343,15 @@ namespace CraftServices
 					// was parsed. This gives us a better idea if this message actually did work or not (i.e. we did not already
 					// have the CraftName.)
 					std::string portAndCraftNamePrefix = GetPortAndCraftNamePrefix();
-					CraftServices::msg::CraftNameMessage craftNameMessage(messageScratchPadToProcess.GetPayloadDataAsVector());
+					CraftServices::msg::CraftNameMessage craftNameMessage(payloadData);
 					MspFcInfo.CraftName = craftNameMessage.CraftName;
 					MspFcInfo.HasCraftName = true;
+					pLinkMetrics->SetCraftName(MspFcInfo.CraftName);
+					UpdatePortAndCraftNamePrefix();
+					if (CurrentPositionEverBeenSet)
+					{
+						PublishPosition();
+					}
 					pSerialPortLogger->debug("{}: Successfully parsed Craft Name: {}", portAndCraftNamePrefix, MspFcInfo.CraftName);
 					break;
 				}
@@ -841,7 +1359,7 @@ namespace CraftServices
 				case ID::MSP_RAW_GPS:
 				{
 					// Current location of the Craft
-					CraftServices::msg::RawGPS gpsPositionMessage(messageScratchPadToProcess.GetPayloadDataAsVector());
+					CraftServices::msg::RawGPS gpsPositionMessage(payloadData);
 
 					// Stash the updated position
 					CurrentPosition = gpsPositionMessage;
@@ -850,27 +1368,25 @@ namespace CraftServices
 					// Also track how old the position information is. We only need millisecond resolution, and in fact
 					// we may only get millisecond resolution depending on the platform, but we have to ask for microsecond
 					// resolution from Boost.
-					CurrentPositionRetrievalTime = boost::posix_time::microsec_clock::universal_time();
-					std::string latLonString = CraftServices::GeoSpatialUtil::GetLatLonString(OmitGpsPos, CurrentPosition.MspLat, CurrentPosition.MspLon);
-
-					// TODO: Speed needs units/formatting here...
-					std::string groundCourseString = CraftServices::GeoSpatialUtil::GetDecidegreesAsDegreeString((int16_t)CurrentPosition.GroundCourseInDecidegrees);
-					std::string hdopString = CraftServices::GeoSpatialUtil::GetHDOPAsString(CurrentPosition.HDOP);
-					std::string fixTypeString = CraftServices::GetGpsFixTypeAsString(static_cast<CraftServices::GPSFixType>(CurrentPosition.FixType));
-					pSerialPortLogger->info("{}: got new GPS position: {} - Alt {} meters - Course {} - Speed {} - {} (HDOP {}, {} sat)", GetPortAndCraftNamePrefix(), latLonString, (int16_t)CurrentPosition.AltitudeInMeters, groundCourseString, CurrentPosition.Speed, fixTypeString, hdopString, CurrentPosition.NumSat);
-
-					// NOPE: This optimization still needs more work. It runs, but I'm seeing more contention over the air than hardwired led me to believe. Taking out for now.
-					// 
-					// Currently, the last operation we do on the port during a refresh cycle is to request the GPS position from the Flight Controller.
-					// So, when we retrieve it successfully, we know we can move directly on to the next Flight Controller, without waiting any longer in refresh interval.
-					// This means that when things are running smoothly, with no errors, we run as fast as possible.					
-					/*
-					if (!IsShutdownInProgressOrComplete())
+					CurrentPositionRetrievalTime = GetSessionTime();
+					// Let the other sessions know
+					PublishPosition();
+
+					// This arrives every refresh, so the strings describing it are only built if they'll be logged
+					if (pSerialPortLogger->should_log(spdlog::level::info))
 					{
-						ScheduleNextFlightControllerTimerToFireImmediately();
+						std::string latLonString = CraftServices::GeoSpatialUtil::GetLatLonString(OmitGpsPos, CurrentPosition.MspLat, CurrentPosition.MspLon);
+
+						// TODO: Speed needs units/formatting here...
+						std::string groundCourseString = CraftServices::GeoSpatialUtil::GetDecidegreesAsDegreeString((int16_t)CurrentPosition.GroundCourseInDecidegrees);
+						std::string hdopString = CraftServices::GeoSpatialUtil::GetHDOPAsString(CurrentPosition.HDOP);
+						std::string fixTypeString = CraftServices::GetGpsFixTypeAsString(static_cast<CraftServices::GPSFixType>(CurrentPosition.FixType));
+						pSerialPortLogger->info("{}: got new GPS position: {} - Alt {} meters - Course {} - Speed {} - {} (HDOP {}, {} sat)", GetPortAndCraftNamePrefix(), latLonString, (int16_t)CurrentPosition.AltitudeInMeters, groundCourseString, CurrentPosition.Speed, fixTypeString, hdopString, CurrentPosition.NumSat);
 					}
-					*/
-					
+
+					// This is normally the last reply a refresh cycle waits on, so the scheduler will usually move on to the
+					// next cycle as soon as it has been processed. See CheckForRefreshCycleComplete().
+
 					break;
 				}
 
@@ -878,7 +1394,7 @@ namespace CraftServices
 				{
 					// We are being TOLD about the settings the Flight Controller on the other side has for being sent position updates.
 					// (Does the MSP connected Flight Controller want to be told about the other Crafts that Craft Services is tracking?)
-					CraftServices::msg::OtherCraftPositionSettingMessage otherCraftPositionSettingMessage(messageScratchPadToProcess.GetPayloadDataAsVector());
+					CraftServices::msg::OtherCraftPositionSettingMessage otherCraftPositionSettingMessage(payloadData);
 
 					MspFcInfo.ShouldBeSentOtherCraftPositionUpdates = otherCraftPositionSettingMessage.ShouldSendUpdates;
 					MspFcInfo.HasOtherCraftPositionSetting = true;
@@ -890,17 +1406,15 @@ namespace CraftServices
 				case ID::MSP2_INAV_OTHER_CRAFT_POSITION:
 				{
 					// Flight controller is acknowledging that we've sent it a OTHER_CRAFT_POSITION message
-					CraftServices::ByteVector payloadDataVector = messageScratchPadToProcess.GetPayloadDataAsVector();
-
 					// May be a generic type check we can make for a variety of messages, we'll see if this becomes needed.
-					if (payloadDataVector.size() != 0)
+					if (payloadData.size() != 0)
 					{
 						processedSuccessfully = false;
 						errorMessage = "Data payload for MSP2_INAV_OTHER_CRAFT_POSITION unexpectedly non-empty, so not an ACK - Message ID: " + std::to_string(messageScratchPadToProcess.MessageID);
 
 						// Should the need arise, we could try something like this, but so far no need.
 						/*
-						CraftServices::msg::OtherCraftPositionMessage otherCraftPositionMessage(payloadDataVector);
+						CraftServices::msg::OtherCraftPositionMessage otherCraftPositionMessage(payloadData);
 						cout << SerialPortName << ": Received OtherCraftPositionMessage response: " << otherCraftPositionMessage.MessageCraftInfoAndPosition.GetCompleteCraftLocationString() << endl;
 						*/
 						break;
@@ -914,6 +1428,7 @@ namespace CraftServices
 				// Add more incoming message types here if you need them processed.
 				default:
 				{
+					pLinkMetrics->UnknownMessageIdCount.Add();
 					processedSuccessfully = false;
 					errorMessage = "ProcessMessageScratchPad() - Unknown message ID: " + std::to_string(messageScratchPadToProcess.MessageID);
 					break;
@@ -931,6 +1446,109 @@ namespace CraftServices
 		return processedSuccessfully;
 	}
 
+	// The write that just completed is when other craft positions in it reached this Flight Controller (give or
+	// take the time to clock the bytes out). Their age now, from when their own session decoded them, is the
+	// end-to-end delay: GPS reply on one link to position written on this one.
+	void MSPFlightControllerAsync::RecordDeliveredPositionAges()
+	{
+		boost::posix_time::ptime now = GetSessionTime();
+		InFlightTransmitBatch.VisitFrames([this, &now](const CraftServices::MspTransmitFrame & transmitFrame)
+		{
+			if (transmitFrame.PositionTrace.IsTraced())
+			{
+				int64_t positionAgeInMilliseconds = (now - transmitFrame.PositionTrace.RetrievalTime).total_milliseconds();
+				pLinkMetrics->DeliveredPositionAgeBySource.Get(transmitFrame.PositionTrace.SourceSessionID).Record(positionAgeInMilliseconds);
+			}
+		});
+	}
+
+	// Find the request this reply (or error reply) answers, and take it out of the in-flight table
+	void MSPFlightControllerAsync::MatchResponseToInFlightRequest(const MspMessageScratchPad & messageScratchPadToMatch)
+	{
+		// A '<' message is the Flight Controller asking us something, not answering
+		if (messageScratchPadToMatch.MessageDirectionCharacter == '<')
+		{
+			return;
+		}
+
+		boost::posix_time::ptime now = GetSessionTime();
+		int64_t roundTripTimeInMilliseconds = 0;
+		if (InFlightRequests.MatchResponse(messageScratchPadToMatch.MessageID, now, roundTripTimeInMilliseconds))
+		{
+			RefreshRateController.AddRoundTripTimeSample(roundTripTimeInMilliseconds);
+
+			CraftServices::MspMessageMetrics & messageMetrics = pLinkMetrics->Messages.Get(messageScratchPadToMatch.MessageID);
+			messageMetrics.ReplyCount.Add();
+			messageMetrics.RoundTripTime.Record(roundTripTimeInMilliseconds);
+			pLinkMetrics->RepliesMatched.Add();
+			pLinkMetrics->RoundTripTime.Record(roundTripTimeInMilliseconds);
+			pLinkMetrics->RequestsInFlight.Set((int64_t)InFlightRequests.GetCount());
+
+			// (Message IDs are formatted by the logger, so nothing is built when trace is off)
+			pSerialPortLogger->trace("{}: Reply to Message ID 0x{:04x} after {} ms. {} request(s) still awaiting replies.", GetPortAndCraftNamePrefix(), 
+				messageScratchPadToMatch.MessageID, roundTripTimeInMilliseconds, InFlightRequests.GetCount());
+		}
+		else
+		{
+			// Most likely the reply to a request we had already given up on
+			pLinkMetrics->RepliesUnmatched.Add();
+			pSerialPortLogger->debug("{}: Reply to Message ID 0x{:04x} matched no outstanding request; arrived after timeout?", GetPortAndCraftNamePrefix(), 
+				messageScratchPadToMatch.MessageID);
+		}
+	}
+
+	// Give up waiting on any request whose reply is overdue. A request is resent if it has retries left, and
+	// nothing newer of the same kind is already waiting to go out (a newer one makes the resend pointless).
+	//
+	// Other craft positions are never resent: by the time a retry went out, the position in it would be at least
+	// a timeout old, and the next refresh sends the current one anyway.
+	void MSPFlightControllerAsync::ExpireOverdueRequests()
+	{
+		if (InFlightRequests.IsEmpty())
+		{
+			return;
+		}
+
+		boost::posix_time::ptime now = GetSessionTime();
+		std::vector<CraftServices::MspInFlightRequest> timedOutRequests;
+		if (InFlightRequests.TakeTimedOutRequests(now, RequestTrackingSettings.ResponseTimeoutInMilliseconds, timedOutRequests) == 0)
+		{
+			return;
+		}
+
+		pLinkMetrics->RequestsTimedOut.Add(timedOutRequests.size());
+		pLinkMetrics->RequestsInFlight.Set((int64_t)InFlightRequests.GetCount());
+
+		for (auto & timedOutRequest : timedOutRequests)
+		{
+			pLinkMetrics->Messages.Get(timedOutRequest.Key.MessageID).TimedOutCount.Add();
+			uint16_t messageID = timedOutRequest.Key.MessageID;
+
+			if (TransmitQueue.Contains(timedOutRequest.Key))
+			{
+				pSerialPortLogger->debug("{}: No reply to Message ID 0x{:04x} within {} ms; newer one already queued, not resending.", GetPortAndCraftNamePrefix(), 
+					messageID, RequestTrackingSettings.ResponseTimeoutInMilliseconds);
+			}
+			else if (messageID == (uint16_t)ID::MSP2_INAV_OTHER_CRAFT_POSITION)
+			{
+				pSerialPortLogger->debug("{}: No reply to other craft position within {} ms; not resending, the next refresh sends a current one.", GetPortAndCraftNamePrefix(), 
+					RequestTrackingSettings.ResponseTimeoutInMilliseconds);
+			}
+			else if (timedOutRequest.RetryCount < RequestTrackingSettings.MaxRetryCount)
+			{
+				uint32_t retryCount = timedOutRequest.RetryCount + 1;
+				pSerialPortLogger->debug("{}: No reply to Message ID 0x{:04x} within {} ms; resending (retry {} of {}).", GetPortAndCraftNamePrefix(), 
+					messageID, RequestTrackingSettings.ResponseTimeoutInMilliseconds, retryCount, RequestTrackingSettings.MaxRetryCount);
+				QueueFrameForTransmit(timedOutRequest.Key, std::move(timedOutRequest.Frame), retryCount);
+			}
+			else
+			{
+				pSerialPortLogger->debug("{}: No reply to Message ID 0x{:04x} within {} ms; giving up after {} retries.", GetPortAndCraftNamePrefix(), 
+					messageID, RequestTrackingSettings.ResponseTimeoutInMilliseconds, timedOutRequest.RetryCount);
+			}
+		}
+	}
+
 	void MSPFlightControllerAsync::CountErrorsAfterWrite(const boost::system::error_code& error, size_t sizeWritten)
 	{
 		//pSerialPortLogger->trace("{}: CountErrorsAfterWrite()", SerialPortName);
@@ -985,12 +1603,8 @@ namespace CraftServices
 
 		pSerialPortLogger->debug("{}: RequestFcVariant()", GetPortAndCraftNamePrefix());
 
-		// Build up the request
-		CraftServices::msg::FcVariant fcVariantRequest;
-		ByteVector fcVariantMessageBytes = BuildMspMessageAsByteVector(fcVariantRequest);
-
-		// Write it out to the serial port ASYNC FASHION
-		boost::asio::async_write(*pSerialPort, boost::asio::buffer(fcVariantMessageBytes.data(), fcVariantMessageBytes.size()), [this](const boost::system::error_code& error, size_t sizeWritten) { CountErrorsAfterWrite(error, sizeWritten); });
+		// Queued up; goes out with the rest of this refresh's messages
+		QueueRequestFrameForTransmit(CraftServices::RequestFrames::FcVariant, CraftServices::MspTrafficPriority::InitialInformation);
 	}
 
 	// Send request for FC Variant information (e.g. "INAV", etc.)
@@ -1003,12 +1617,8 @@ namespace CraftServices
 
 		pSerialPortLogger->debug("{}: RequestUid()", GetPortAndCraftNamePrefix());
 
-		// Build up the request
-		CraftServices::msg::UidMessage uidMessage;
-		ByteVector uidMessageBytes = BuildMspMessageAsByteVector(uidMessage);
-
-		// Write it out to the serial port ASYNC FASHION
-		boost::asio::async_write(*pSerialPort, boost::asio::buffer(uidMessageBytes.data(), uidMessageBytes.size()), [this](const boost::system::error_code& error, size_t sizeWritten) { CountErrorsAfterWrite(error, sizeWritten); });
+		// Queued up; goes out with the rest of this refresh's messages
+		QueueRequestFrameForTransmit(CraftServices::RequestFrames::Uid, CraftServices::MspTrafficPriority::InitialInformation);
 	}
 
 	// Send request for MSP API version (2.0.1 for example)
@@ -1021,12 +1631,8 @@ namespace CraftServices
 
 		pSerialPortLogger->debug("{}: RequestApi()", GetPortAndCraftNamePrefix());
 
-		// Build up the request
-		CraftServices::msg::ApiVersion apiVersionMessage;
-		ByteVector uidMessageBytes = BuildMspMessageAsByteVector(apiVersionMessage);
-
-		// Write it out to the serial port ASYNC FASHION
-		boost::asio::async_write(*pSerialPort, boost::asio::buffer(uidMessageBytes.data(), uidMessageBytes.size()), [this](const boost::system::error_code& error, size_t sizeWritten) { CountErrorsAfterWrite(error, sizeWritten); });
+		// Queued up; goes out with the rest of this refresh's messages
+		QueueRequestFrameForTransmit(CraftServices::RequestFrames::ApiVersion, CraftServices::MspTrafficPriority::InitialInformation);
 	}
 
 	// Send request for Craft Name ("Bob's MegaQuad")
@@ -1039,12 +1645,8 @@ namespace CraftServices
 
 		pSerialPortLogger->debug("{}: RequestCraftName()", GetPortAndCraftNamePrefix());
 
-		// Build up the request
-		CraftServices::msg::CraftNameMessage craftNameRequestMessage;
-		ByteVector uidMessageBytes = BuildMspMessageAsByteVector(craftNameRequestMessage);
-
-		// Write it out to the serial port ASYNC FASHION
-		boost::asio::async_write(*pSerialPort, boost::asio::buffer(uidMessageBytes.data(), uidMessageBytes.size()), [this](const boost::system::error_code& error, size_t sizeWritten) { CountErrorsAfterWrite(error, sizeWritten); });
+		// Queued up; goes out with the rest of this refresh's messages
+		QueueRequestFrameForTransmit(CraftServices::RequestFrames::CraftName, CraftServices::MspTrafficPriority::InitialInformation);
 	}
 
 	// Send request for current Raw GPS position
@@ -1057,12 +1659,8 @@ namespace CraftServices
 
 		pSerialPortLogger->debug("{}: RequestRawGPSPosition()", GetPortAndCraftNamePrefix());
 
-		// Build up the request
-		CraftServices::msg::RawGPS rawGpsRequestMessage;
-		ByteVector uidMessageBytes = BuildMspMessageAsByteVector(rawGpsRequestMessage);
-
-		// Write it out to the serial port ASYNC FASHION
-		boost::asio::async_write(*pSerialPort, boost::asio::buffer(uidMessageBytes.data(), uidMessageBytes.size()), [this](const boost::system::error_code& error, size_t sizeWritten) { CountErrorsAfterWrite(error, sizeWritten); });
+		// Queued up; goes out with the rest of this refresh's messages
+		QueueRequestFrameForTransmit(CraftServices::RequestFrames::RawGps, CraftServices::MspTrafficPriority::OwnPosition);
 	}
 
 	void MSPFlightControllerAsync::RequestOtherCraftPositionSetting()
@@ -1079,15 +1677,20 @@ namespace CraftServices
 		SendOtherCraftPositionSettingMessage(false);
 	}
 
-	std::string MSPFlightControllerAsync::GetPortAndCraftNamePrefix()
+	// Nearly every log line starts with this, so it's kept ready rather than formatted for each one
+	const std::string & MSPFlightControllerAsync::GetPortAndCraftNamePrefix()
+	{
+		return PortAndCraftNamePrefix;
+	}
+
+	// Call whenever the craft name changes
+	void MSPFlightControllerAsync::UpdatePortAndCraftNamePrefix()
 	{
 		std::string optionalCraftNameAndParens = (MspFcInfo.CraftName != "") ? fmt::format(" ({})", MspFcInfo.CraftName) : "";
-		std::string portAndCraftNamePrefix = fmt::format("{}{}", SerialPortName, optionalCraftNameAndParens);
-		return portAndCraftNamePrefix;
+		PortAndCraftNamePrefix = fmt::format("{}{}", SerialPortName, optionalCraftNameAndParens);
 	}
 
-	// Perhaps someday we could use such math to try to optimize our refresh/wait intervals, calculating how much time it will
-	// take to transmit, and how much time it might take to receive what's expected. Hmmm..
+	// How long it takes to send this many bytes at our baud rate
 	size_t MSPFlightControllerAsync::GetExpectedTransmitTimeInMillisecondsForByteCount(size_t byteCount)
 	{
 		// Assumes 1 start, 1 stop bit
@@ -1096,6 +1699,24 @@ namespace CraftServices
 		return ((double)byteCount * (double)BitsToSendAByte / (double)BaudRate) * (double)MillisecondsInSecond;
 	}
 
+	// Time to leave between one write and the next on this port. MSP has no framing gap of its own, but the
+	// Flight Controller's serial handling (and any radio in between) needs a moment between bursts. Allow a
+	// few character times at our baud rate, and never less than a millisecond.
+	size_t MSPFlightControllerAsync::GetMinimumInterFrameGapInMilliseconds()
+	{
+		size_t smallestGapInMilliseconds = 1;
+		return std::max(GetExpectedTransmitTimeInMillisecondsForByteCount(CraftServices::MspAirtime::InterFrameGapByteCount), smallestGapInMilliseconds);
+	}
+
+	// The reverse of the above: how many bytes can we send in this many milliseconds?
+	size_t MSPFlightControllerAsync::GetByteCountTransmittableInMilliseconds(size_t milliseconds)
+	{
+		// Assumes 1 start, 1 stop bit
+		const int BitsToSendAByte = 10; 
+		const int MillisecondsInSecond = 1000;
+		return ((double)milliseconds / (double)MillisecondsInSecond) * ((double)BaudRate / (double)BitsToSendAByte);
+	}
+
 	// -- Craft Services Messages --
 	// -----------------------------
 
@@ -1115,14 +1736,12 @@ namespace CraftServices
 
 		// Build up the request
 		CraftServices::msg::OtherCraftPositionSettingMessage OtherCraftPositionSettingMessage(thisServerWantsToBeToldAboutOtherCrafts);
-		ByteVector uidMessageBytes = BuildMspMessageAsByteVector(OtherCraftPositionSettingMessage);
-
-		// Write it out to the serial port ASYNC FASHION
-		boost::asio::async_write(*pSerialPort, boost::asio::buffer(uidMessageBytes.data(), uidMessageBytes.size()), [this](const boost::system::error_code& error, size_t sizeWritten) { CountErrorsAfterWrite(error, sizeWritten); });
+		// Queued up; goes out with the rest of this refresh's messages
+		QueueMessageForTransmit(OtherCraftPositionSettingMessage, CraftServices::MspTrafficPriority::InitialInformation);
 	}
 
 	// Here we are actually telling the external Flight Controller about a particular Craft that Craft Services knows about.
-	void MSPFlightControllerAsync::SendOtherCraftPositionMessage(MSPFlightControllerAsync & mspFlightControllerWithCraftToSendPositionOf)
+	void MSPFlightControllerAsync::SendOtherCraftPositionMessage(const CraftServices::PublishedCraftPosition & otherCraftPosition)
 	{
 		if (IsThisFlightControllerShuttingDown())
 		{
@@ -1131,12 +1750,17 @@ namespace CraftServices
 
 		pSerialPortLogger->trace("{}: SendOtherCraftPositionMessage()", GetPortAndCraftNamePrefix());
 
-		// Build up the request
-		CraftServices::msg::OtherCraftPositionMessage OtherCraftPositionMessage(mspFlightControllerWithCraftToSendPositionOf);
-		ByteVector uidMessageBytes = BuildMspMessageAsByteVector(OtherCraftPositionMessage);
+		// Every Flight Controller being told about this craft gets the same bytes, so they are built once per position
+		// by the craft's own session and shared.
+		CraftServices::MspTransmitKey transmitKey = GetTransmitKeyForCraftPosition(otherCraftPosition);
+
+		// The frame carries when and where the position came from, so its age can be taken once it's actually written
+		CraftServices::MspTransmitFrame transmitFrame = CraftServices::MspTransmitFrame::FromSharedBytes(transmitKey.MessageID, otherCraftPosition.pEncodedPositionFrame);
+		transmitFrame.PositionTrace.SourceSessionID = otherCraftPosition.SourceSessionID;
+		transmitFrame.PositionTrace.RetrievalTime = otherCraftPosition.RetrievalTime;
 
-		// Write it out to the serial port ASYNC FASHION
-		boost::asio::async_write(*pSerialPort, boost::asio::buffer(uidMessageBytes.data(), uidMessageBytes.size()), [this](const boost::system::error_code& error, size_t sizeWritten) { CountErrorsAfterWrite(error, sizeWritten); });
+		// Queued up; replaces any older position for this craft that hasn't gone out yet
+		PlanFrameForTransmit(transmitKey, std::move(transmitFrame), CraftServices::MspTrafficPriority::OtherCraftPosition);
 	}
 
 	// Here we are actually telling the external Flight Controller about a particular Craft that Craft Services knows about.
@@ -1151,46 +1775,331 @@ namespace CraftServices
 
 		// Build up the request
 		CraftServices::msg::OtherCraftPositionMessage OtherCraftPositionMessage(phantomTestCraft);
-		auto phantomCraftPosInfoString = OtherCraftPositionMessage.MessageCraftInfoAndPosition.GetCompleteCraftLocationString(OmitGpsPos);
-		// Again, note the deliberate cast here to signed!
-		int16_t altInMeters = OtherCraftPositionMessage.MessageCraftInfoAndPosition.AltitudeInMeters;
-		pSerialPortLogger->info("{}: Sending Phantom Craft: {} - Alt {} meters", GetPortAndCraftNamePrefix(), phantomCraftPosInfoString, altInMeters);
+		if (pSerialPortLogger->should_log(spdlog::level::info))
+		{
+			auto phantomCraftPosInfoString = OtherCraftPositionMessage.MessageCraftInfoAndPosition.GetCompleteCraftLocationString(OmitGpsPos);
+			// Again, note the deliberate cast here to signed!
+			int16_t altInMeters = OtherCraftPositionMessage.MessageCraftInfoAndPosition.AltitudeInMeters;
+			pSerialPortLogger->info("{}: Sending Phantom Craft: {} - Alt {} meters", GetPortAndCraftNamePrefix(), phantomCraftPosInfoString, altInMeters);
+		}
+
+		// Queued up; replaces any older position for this craft that hasn't gone out yet
+		QueueMessageForTransmit(OtherCraftPositionMessage, GetTransmitKeyForCraftPosition(OtherCraftPositionMessage), CraftServices::MspTrafficPriority::PhantomCraftPosition);
+	}
+
+	// Build a message and add it to the transmit queue. Messages of the same kind replace one another,
+	// so if one is still waiting from an earlier refresh, only the new one gets sent.
+	void MSPFlightControllerAsync::QueueMessageForTransmit(CraftServices::MspMessageAsync & mspMessageAsync, CraftServices::MspTrafficPriority priority)
+	{
+		uint16_t messageID = (uint16_t)mspMessageAsync.MessageID();
+		QueueMessageForTransmit(mspMessageAsync, CraftServices::MspTransmitKey(messageID), priority);
+	}
 
-		ByteVector uidMessageBytes = BuildMspMessageAsByteVector(OtherCraftPositionMessage);
+	// As above, with the key given explicitly (i.e. for messages about a particular craft)
+	void MSPFlightControllerAsync::QueueMessageForTransmit(CraftServices::MspMessageAsync & mspMessageAsync, const CraftServices::MspTransmitKey & transmitKey, CraftServices::MspTrafficPriority priority)
+	{
+		std::shared_ptr<const ByteVector> pFrameBytes = std::make_shared<const ByteVector>(BuildMspMessageAsByteVector(mspMessageAsync));
+		PlanFrameForTransmit(transmitKey, CraftServices::MspTransmitFrame::FromSharedBytes(transmitKey.MessageID, std::move(pFrameBytes)), priority);
+	}
 
-		// Write it out to the serial port ASYNC FASHION
-		boost::asio::async_write(*pSerialPort, boost::asio::buffer(uidMessageBytes.data(), uidMessageBytes.size()), [this](const boost::system::error_code& error, size_t sizeWritten) { CountErrorsAfterWrite(error, sizeWritten); });
+	// Queue one of the fixed, compile-time request frames. Nothing is built or copied; the write goes
+	// straight from the frame's static storage.
+	void MSPFlightControllerAsync::QueueRequestFrameForTransmit(const CraftServices::MspRequestFrame & requestFrame, CraftServices::MspTrafficPriority priority)
+	{
+		uint16_t messageID = requestFrame.GetMessageID();
+		PlanFrameForTransmit(CraftServices::MspTransmitKey(messageID), CraftServices::MspTransmitFrame::FromStaticBytes(messageID, requestFrame.data(), requestFrame.size()), priority);
+	}
+
+	// During a refresh, messages are planned rather than queued, so the airtime scheduler can decide what fits
+	// (see PackPlannedFramesIntoAirtime). Outside of one, they're queued straight away.
+	void MSPFlightControllerAsync::PlanFrameForTransmit(const CraftServices::MspTransmitKey & transmitKey, CraftServices::MspTransmitFrame transmitFrame, CraftServices::MspTrafficPriority priority)
+	{
+		if (!PlanningRefreshCycle)
+		{
+			QueueFrameForTransmit(transmitKey, std::move(transmitFrame));
+			return;
+		}
+
+		CraftServices::MspPlannedFrame plannedFrame = { transmitKey, std::move(transmitFrame), priority };
+		AirtimeScheduler.Plan(std::move(plannedFrame));
+	}
+
+	// Queue as much of this refresh's plan as the link has airtime for, most important first. The rest is deferred
+	// to a later refresh. Other craft positions that were deferred are counted, for the fairness floor in
+	// SendNoticesAboutOtherCrafts.
+	void MSPFlightControllerAsync::PackPlannedFramesIntoAirtime()
+	{
+		PlanningRefreshCycle = false;
+
+		if (!AirtimeScheduler.HasPlannedFrames())
+		{
+			return;
+		}
+
+		std::vector<CraftServices::MspPlannedFrame> admittedFrames;
+		std::vector<CraftServices::MspPlannedFrame> deferredFrames;
+		size_t deferredCount = AirtimeScheduler.Pack(TransmitQueue, admittedFrames, deferredFrames);
+		for (auto & admittedFrame : admittedFrames)
+		{
+			if (admittedFrame.Priority == CraftServices::MspTrafficPriority::OtherCraftPosition)
+			{
+				RoundsPositionDeferred.erase(admittedFrame.Key);
+			}
+			QueueFrameForTransmit(admittedFrame.Key, std::move(admittedFrame.Frame));
+		}
+		for (const auto & deferredFrame : deferredFrames)
+		{
+			if (deferredFrame.Priority == CraftServices::MspTrafficPriority::OtherCraftPosition)
+			{
+				RoundsPositionDeferred[deferredFrame.Key]++;
+			}
+		}
+
+		const uint64_t MicrosecondsInMillisecond = 1000;
+		if (deferredCount > 0)
+		{
+			pSerialPortLogger->debug("{}: Refresh wanted {} ms of link time, only {} ms available at {} baud; deferred {} low priority message(s).", GetPortAndCraftNamePrefix(),
+				AirtimeScheduler.GetPlannedAirtimeInMicroseconds() / MicrosecondsInMillisecond, AirtimeScheduler.GetCycleBudgetInMicroseconds() / MicrosecondsInMillisecond, 
+				BaudRate, deferredCount);
+		}
+		else
+		{
+			pSerialPortLogger->trace("{}: Refresh planned {} ms of link time, {} ms committed of {} ms available.", GetPortAndCraftNamePrefix(),
+				AirtimeScheduler.GetPlannedAirtimeInMicroseconds() / MicrosecondsInMillisecond, AirtimeScheduler.GetCommittedInMicroseconds() / MicrosecondsInMillisecond,
+				AirtimeScheduler.GetCycleBudgetInMicroseconds() / MicrosecondsInMillisecond);
+		}
+	}
+
+	// Add an already built message frame to the transmit queue
+	void MSPFlightControllerAsync::QueueFrameForTransmit(const CraftServices::MspTransmitKey & transmitKey, CraftServices::MspTransmitFrame transmitFrame, uint32_t retryCount)
+	{
+		size_t droppedCount = TransmitQueue.Enqueue(transmitKey, std::move(transmitFrame), retryCount);
+		if (droppedCount > 0)
+		{
+			pSerialPortLogger->debug("{}: Transmit queue over budget ({} bytes) - dropped {} oldest message(s).", GetPortAndCraftNamePrefix(), TransmitQueue.GetByteBudget(), droppedCount);
+		}
+	}
+
+	// The latest position of this craft, for the other sessions. Safe to call from any thread.
+	// Empty if there's no position yet.
+	std::shared_ptr<const CraftServices::PublishedCraftPosition> MSPFlightControllerAsync::GetPublishedPosition()
+	{
+		boost::mutex::scoped_lock publishedPositionLock(PublishedPositionMutex);
+		return pPublishedPosition;
+	}
+
+	// Take a snapshot of this craft's current position for the other sessions to send on. The position message is
+	// encoded here, once, so every Flight Controller told about this craft gets the same bytes.
+	void MSPFlightControllerAsync::PublishPosition()
+	{
+		CraftServices::msg::OtherCraftPositionMessage otherCraftPositionMessage(*this);
+
+		std::shared_ptr<CraftServices::PublishedCraftPosition> pNewPosition = std::make_shared<CraftServices::PublishedCraftPosition>();
+		pNewPosition->UID_0 = MspFcInfo.UID_0;
+		pNewPosition->UID_1 = MspFcInfo.UID_1;
+		pNewPosition->UID_2 = MspFcInfo.UID_2;
+		pNewPosition->CraftName = MspFcInfo.GetCraftName();
+		pNewPosition->RetrievalTime = CurrentPositionRetrievalTime;
+		pNewPosition->SourceSessionID = pLinkMetrics->GetSessionID();
+		pNewPosition->Kinematics = GetCurrentKinematics();
+		pNewPosition->pEncodedPositionFrame = std::make_shared<const ByteVector>(BuildMspMessageAsByteVector(otherCraftPositionMessage));
+
+		boost::mutex::scoped_lock publishedPositionLock(PublishedPositionMutex);
+		pPublishedPosition = std::move(pNewPosition);
+	}
+
+	CraftServices::CraftKinematics MSPFlightControllerAsync::GetCurrentKinematics()
+	{
+		if (!CurrentPositionEverBeenSet)
+		{
+			return CraftServices::CraftProximity::GetUnknownKinematics();
+		}
+
+		return CraftServices::CraftProximity::GetKinematicsFromMspPosition(CurrentPosition.MspLat, CurrentPosition.MspLon, CurrentPosition.AltitudeInMeters,
+																		   CurrentPosition.Speed, CurrentPosition.GroundCourseInDecidegrees);
+	}
+
+	// This craft's position is no longer known (i.e. the port was reset)
+	void MSPFlightControllerAsync::WithdrawPublishedPosition()
+	{
+		boost::mutex::scoped_lock publishedPositionLock(PublishedPositionMutex);
+		pPublishedPosition.reset();
+	}
+
+	CraftServices::MspTransmitKey MSPFlightControllerAsync::GetTransmitKeyForCraftPosition(const CraftServices::msg::OtherCraftPositionMessage & otherCraftPositionMessage)
+	{
+		const CraftServices::CraftInfoAndPosition & craftInfoAndPosition = otherCraftPositionMessage.MessageCraftInfoAndPosition;
+		return CraftServices::MspTransmitKey((uint16_t)otherCraftPositionMessage.MessageID(), craftInfoAndPosition.U_ID_0, craftInfoAndPosition.U_ID_1, craftInfoAndPosition.U_ID_2);
+	}
+
+	CraftServices::MspTransmitKey MSPFlightControllerAsync::GetTransmitKeyForCraftPosition(const CraftServices::PublishedCraftPosition & otherCraftPosition)
+	{
+		return CraftServices::MspTransmitKey((uint16_t)ID::MSP2_INAV_OTHER_CRAFT_POSITION, otherCraftPosition.UID_0, otherCraftPosition.UID_1, otherCraftPosition.UID_2);
+	}
+
+	// Send everything in the transmit queue that fits in the request window, with a single write.
+	//
+	// Only one write is ever outstanding on the port, and we don't start another until the link should have
+	// finished sending the last one. The OS accepts a write long before the bytes have actually gone out, so
+	// without this, batches would pile up in the OS buffer on a slow link. While we wait, messages stay in
+	// the queue, where newer ones can still replace them.
+	//
+	// Each message sent goes into the in-flight table until its reply comes back. Once the window is full,
+	// the rest wait in the queue; replies coming back open the window up again.
+	void MSPFlightControllerAsync::FlushTransmitBatch()
+	{
+		if (WriteInProgress || TransmitQueue.IsEmpty())
+		{
+			return;
+		}
+
+		if (IsThisFlightControllerShuttingDown() || !pTransport->IsOpen())
+		{
+			TransmitQueue.Clear();
+			return;
+		}
+
+		CraftServices::MspPipelineStageStopwatch stageStopwatch(pPipelineStageTimes, CraftServices::MspPipelineStage::Transmit);
+
+		// (A replay's writes go nowhere, so there's no airtime to wait out)
+		boost::posix_time::ptime now = GetSessionTime();
+		if (!ReplayingCapture && now < LinkBusyUntilTime)
+		{
+			pSerialPortLogger->trace("{}: Link still busy; holding {} queued messages.", GetPortAndCraftNamePrefix(), TransmitQueue.GetFrameCount());
+			StartLinkBusyTimer(now);
+			return;
+		}
+
+		size_t frameCountToSend = std::min(TransmitQueue.GetFrameCount(), InFlightRequests.GetOpenSlotCount());
+		if (frameCountToSend == 0)
+		{
+			pSerialPortLogger->trace("{}: Request window full ({} awaiting replies); holding {} queued messages.", GetPortAndCraftNamePrefix(), 
+				InFlightRequests.GetCount(), TransmitQueue.GetFrameCount());
+			return;
+		}
+
+		// The in-flight batch owns the bytes until the write completes
+		for (size_t frameIndex = 0; frameIndex < frameCountToSend; frameIndex++)
+		{
+			CraftServices::MspTransmitKey transmitKey(0);
+			CraftServices::MspTransmitFrame transmitFrame;
+			uint32_t retryCount = 0;
+			TransmitQueue.TakeOldest(transmitKey, transmitFrame, retryCount);
+
+			// Each request's reply clock starts when its last byte should be out on the wire
+			size_t byteCountSentByThisFrame = InFlightTransmitBatch.GetByteCount() + transmitFrame.GetByteCount();
+			boost::posix_time::ptime sendTime = now + boost::posix_time::milliseconds(GetExpectedTransmitTimeInMillisecondsForByteCount(byteCountSentByThisFrame));
+			CraftServices::MspInFlightRequest inFlightRequest = { transmitKey, transmitFrame, sendTime, retryCount };
+			InFlightRequests.Add(std::move(inFlightRequest));
+			pLinkMetrics->Messages.Get(transmitKey.MessageID).SentCount.Add();
+
+			InFlightTransmitBatch.AddFrame(std::move(transmitFrame));
+		}
+		WriteInProgress = true;
+		pLinkMetrics->FramesSent.Add(frameCountToSend);
+		pLinkMetrics->RequestsInFlight.Set((int64_t)InFlightRequests.GetCount());
+
+		size_t expectedTransmitTimeInMilliseconds = GetExpectedTransmitTimeInMillisecondsForByteCount(InFlightTransmitBatch.GetByteCount());
+		LinkBusyUntilTime = now + boost::posix_time::milliseconds(expectedTransmitTimeInMilliseconds + GetMinimumInterFrameGapInMilliseconds());
+
+		pSerialPortLogger->trace("{}: Sending {} messages, {} bytes. Expected transmit time: {} ms. {} request(s) awaiting replies.", GetPortAndCraftNamePrefix(), 
+			InFlightTransmitBatch.GetFrameCount(), InFlightTransmitBatch.GetByteCount(), expectedTransmitTimeInMilliseconds, InFlightRequests.GetCount());
+
+		if (pLinkCapture != NULL)
+		{
+			pLinkCapture->RecordTransmitted(InFlightTransmitBatch.GetBuffers());
+			StopLinkCaptureIfFailed();
+		}
+
+		// Write it out to the port ASYNC FASHION
+		pTransport->StartWrite(InFlightTransmitBatch.GetBuffers());
+	}
+
+	void MSPFlightControllerAsync::OnTransportWritten(const boost::system::error_code & error, size_t sizeWritten)
+	{
+		TransmitBatchWriteCallback(error, sizeWritten);
+	}
+
+	void MSPFlightControllerAsync::TransmitBatchWriteCallback(const boost::system::error_code& error, size_t sizeWritten)
+	{
+		CraftServices::MspPipelineStageStopwatch stageStopwatch(pPipelineStageTimes, CraftServices::MspPipelineStage::Transmit);
+
+		CountErrorsAfterWrite(error, sizeWritten);
+		pLinkMetrics->BytesSent.Add(sizeWritten);
+		if (!error)
+		{
+			RecordDeliveredPositionAges();
+		}
+
+		InFlightTransmitBatch.Clear();
+		WriteInProgress = false;
+
+		// Anything queued while we were writing goes as soon as the link is free
+		FlushTransmitBatch();
+		// (Replies can beat the write completion, so the refresh cycle may already be done)
+		CheckForRefreshCycleComplete();
+	}
+
+	// Come back to the transmit queue once the link is free. Without this, messages held back while the link was
+	// busy would sit until something else (a reply, or the next refresh) happened to flush the queue.
+	void MSPFlightControllerAsync::StartLinkBusyTimer(const boost::posix_time::ptime & now)
+	{
+		if (LinkBusyTimerPending)
+		{
+			return;
+		}
+
+		LinkBusyTimerPending = true;
+		boost::posix_time::time_duration timeUntilLinkFree = LinkBusyUntilTime - now;
+		pLinkBusyTimer->expires_after(boost::asio::chrono::microseconds(timeUntilLinkFree.total_microseconds()));
+		pLinkBusyTimer->async_wait(boost::asio::bind_executor(*pSessionStrand, [this](const boost::system::error_code & error) { LinkBusyTimerCallback(error); }));
+	}
+
+	void MSPFlightControllerAsync::LinkBusyTimerCallback(const boost::system::error_code & error)
+	{
+		LinkBusyTimerPending = false;
+
+		if (error == boost::asio::error::operation_aborted || IsThisFlightControllerShuttingDown())
+		{
+			return;
+		}
+
+		FlushTransmitBatch();
 	}
 
 	ByteVector MSPFlightControllerAsync::BuildMspMessageAsByteVector(CraftServices::MspMessageAsync & mspMessageAsync)
 	{
 		// TODO: Why am I forced into this cast??
 		uint16_t messageID = (uint16_t)mspMessageAsync.MessageID();
-		return BuildMspMessageAsByteVector(messageID, mspMessageAsync.EncodePayload());
+
+		// Encode onto the stack; the only allocation is the finished message itself
+		uint8_t payloadBuffer[MspMessageScratchPad::MaxDataPayloadLength];
+		CraftServices::PayloadWriter payloadWriter(payloadBuffer, sizeof(payloadBuffer));
+		mspMessageAsync.EncodePayload(payloadWriter);
+
+		return BuildMspMessageAsByteVector(messageID, payloadWriter.GetWrittenData());
 	}
 
 	// Build up an outgoing message as a vector of bytes
-	ByteVector MSPFlightControllerAsync::BuildMspMessageAsByteVector(const uint16_t messageId, const ByteVector & payloadData)
+	ByteVector MSPFlightControllerAsync::BuildMspMessageAsByteVector(const uint16_t messageId, const ByteSpan & payloadData)
 	{
-		ByteVector msg;
-		msg.reserve(8 + payloadData.size());
+		ByteVector msg(MspMessageScratchPad::HeaderLength + payloadData.size() + 1);
+		CraftServices::PayloadWriter messageWriter(msg.data(), msg.size());
 
-		msg.push_back('$');
+		messageWriter.WriteUint8('$');
 		// 'X' is used in MSP V2 instead of 'M' in MSP V1. 
 		// (We only speak V2)
-		msg.push_back('X');
+		messageWriter.WriteUint8('X');
 		// Direction indicator
-		msg.push_back('<');
+		messageWriter.WriteUint8('<');
 
-		msg.push_back(uint8_t(ZeroFlag));						  	    // Unused flag (always 0 for now)
-		msg.push_back(BitOperators::LowByte(messageId));                // message_id (function) - low byte
-		msg.push_back(BitOperators::HighByte(messageId));               // message_id (function) - high byte
-		msg.push_back(BitOperators::LowByte((uint16_t)payloadData.size()));    // data payload length - low byte
-		msg.push_back(BitOperators::HighByte((uint16_t)payloadData.size()));   // data payload length - low byte
-		msg.insert(msg.end(), payloadData.begin(), payloadData.end());                // data payload
+		messageWriter.WriteUint8(ZeroFlag);								// Unused flag (always 0 for now)
+		messageWriter.WriteUint16(messageId);							// message_id (function)
+		messageWriter.WriteUint16((uint16_t)payloadData.size());		// data payload length
+		messageWriter.WriteBytes(payloadData.data(), payloadData.size());	// data payload
 
 		uint8_t calculatedCrc = CalculateCrcOfMessage(ZeroFlag, messageId, payloadData);
-		msg.push_back(calculatedCrc);
+		messageWriter.WriteUint8(calculatedCrc);
 
 		auto messageSize = msg.size();
 		auto expectedTransmitTimeinMilliseconds = GetExpectedTransmitTimeInMillisecondsForByteCount(messageSize);
@@ -1199,19 +2108,8 @@ namespace CraftServices
 		return msg;
 	}
 
-	void MSPFlightControllerAsync::ClearSerialBuffer()
-	{
-#if __unix__ || __APPLE__
-		tcflush(pimpl->port.native_handle(), TCIOFLUSH);
-#elif _WIN32
-		PurgeComm(pSerialPort->native_handle(), PURGE_TXCLEAR);
-#else
-		#warning "clear() will be unimplemented"
-#endif
-	}
-
 	// "crc8_dvb_s2 checksum algorithm. This is a single byte CRC algorithm that is much more robust than the XOR checksum in MSP v1."
-	uint8_t MSPFlightControllerAsync::CalculateCrcOfMessage(const uint8_t flag, const uint16_t id, const ByteVector &data)
+	uint8_t MSPFlightControllerAsync::CalculateCrcOfMessage(const uint8_t flag, const uint16_t id, const ByteSpan &data)
 	{
 		// flag byte
 		uint8_t crc = Crc::crc8_dvb_s2(0, flag);
@@ -19,19 +19,34 @@
 #define MSPFLIGHTCONTROLLERASYNC_HPP
 
 #include <vector>
+#include <array>
 #include <string>
 #include <regex>
+#include <map>
+#include <atomic>
 
 #include <boost/algorithm/string.hpp>
 #include <boost/asio.hpp>
-#include <boost/asio/serial_port.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread/mutex.hpp>
 
 #include "NotImplementedException.hpp"
 #include "AsyncMspMessageTypes.hpp"
 #include "MspMessageAsyncs.hpp"
 #include "UidUtil.hpp"
 #include "PhantomTestCraft.hpp"
+#include "MspTransmitBatch.hpp"
+#include "MspTransmitQueue.hpp"
+#include "MspRequestFrames.hpp"
+#include "MspInFlightRequestTable.hpp"
+#include "CraftProximity.hpp"
+#include "MspAirtimeScheduler.hpp"
+#include "MspRefreshRateController.hpp"
+#include "MspLinkMetrics.hpp"
+#include "AsyncLogging.hpp"
+#include "MspLinkCapture.hpp"
+#include "MspPipelineStageTimes.hpp"
+#include "MspTransport.hpp"
 
 namespace CraftServices
 {
@@ -47,7 +62,7 @@ namespace CraftServices
 		SessionRunning
 	};
 
-	std::string OverallPortStateAsString(CraftServices::OverallPortState overallPortState);
+	const char * OverallPortStateAsString(CraftServices::OverallPortState overallPortState);
 
 	// Is this Port in a Closed or Failed state?
 	bool IsClosedOrFailedPort(CraftServices::OverallPortState overallPortState);
@@ -76,6 +91,17 @@ namespace CraftServices
 		CrcByte
 	};
 
+	// Outcome of feeding one byte to the message parser
+	enum class MessageByteResult
+	{
+		// Byte taken; message not finished yet (or still looking for one)
+		InProgress,
+		// Byte finished a message that passed its CRC check
+		MessageComplete,
+		// Byte showed the message being read to be bad; parser is back to looking for a preamble
+		MessageRejected
+	};
+
 	const std::string NotSetString = "[Not Set]";
 
 	// We can't work with any protocol besides this
@@ -215,14 +241,44 @@ namespace CraftServices
 
 	};
 
+	// What the other sessions get to see of a craft: a snapshot taken each time its position comes in.
+	// Sessions can run on different threads, so they never read each other's live state, only this.
+	struct PublishedCraftPosition
+	{
+		uint32_t UID_0;
+		uint32_t UID_1;
+		uint32_t UID_2;
+
+		std::string CraftName;
+
+		// When the position was retrieved from the Flight Controller
+		boost::posix_time::ptime RetrievalTime;
+
+		// Metrics session ID of the session it came from, for tracing how old it is when it reaches the others
+		uint32_t SourceSessionID;
+
+		// Where the craft is and where it's heading, for working out which craft are closest to each other
+		CraftServices::CraftKinematics Kinematics;
+
+		// The position as a complete OtherCraftPosition message, ready to send to any other Flight Controller.
+		// Built once, and shared by everyone it is sent to.
+		std::shared_ptr<const ByteVector> pEncodedPositionFrame;
+	};
+
+	namespace msg
+	{
+		// OtherCraftPositionMessage.hpp includes this file, so we can only forward declare it here
+		struct OtherCraftPositionMessage;
+	}
+
 	// A single instance of a communications channel with an MSP-speaking flight controller (iNav, Betaflight, etc.)
-	class MSPFlightControllerAsync
+	class MSPFlightControllerAsync : public CraftServices::MspTransportListener
 	{
 		public:
 
 			// Every flight controller / serial port gets its own logger.
 			// This connects to two sinks, typically: the "all" sink (total output), and a sink just for this serial port.
-			spdlog::logger * pSerialPortLogger;
+			std::shared_ptr<spdlog::logger> pSerialPortLogger;
 
 			// Always 0 in MSP V2 protocol
 			static const uint8_t ZeroFlag = 0;
@@ -243,17 +299,28 @@ namespace CraftServices
 			// Relevant IOContext
 			boost::asio::io_context * pIoContext;
 
+			// Everything this session does runs on this strand. The IO context may be run by several threads,
+			// but no two handlers for the same session ever run at once.
+			boost::asio::io_context::strand * pSessionStrand;
+
 			// Name of Serial Port
 			std::string SerialPortName;
 
-			// Our serial port object
-			boost::asio::serial_port * pSerialPort;
+			// "port (craft name)", as every log line for this session starts. Built once, and again only
+			// when the craft name changes; see UpdatePortAndCraftNamePrefix().
+			std::string PortAndCraftNamePrefix;
+
+			// How we reach the flight controller - usually a serial port, but see CreateMspTransport() for the others
+			CraftServices::MspTransport * pTransport;
+			// Waiting to hear how opening the transport went
+			bool TransportOpenInProgress = false;
 
 			// Baud rate to use on port
 			uint32_t BaudRate;
 
-			// Refresh interval in milliseconds
-			uint32_t RefreshTimerIntervalInMilliseconds;
+			// Refresh interval in milliseconds. Changes as we go if the refresh rate is automatic, and the round robin
+			// scheduler reads it from its own strand, hence atomic. (Use GetRefreshIntervalInMilliseconds().)
+			std::atomic<uint32_t> RefreshTimerIntervalInMilliseconds;
 
 			// Stale interval in milliseconds
 			uint32_t StaleIntervalInMilliseconds;
@@ -262,12 +329,67 @@ namespace CraftServices
 			// Read once at startup and kept for reference.
 			MspFlightControllerInfo MspFcInfo;
 
-			// one-byte read buffer
-			char ReadBuffer[1];
+			// Size of the buffer serial reads land in. Large enough to hold several complete MSP messages,
+			// so a burst of replies from the Flight Controller is handled by a single read completion.
+			static const size_t ReadBufferSize = 512;
+
+			// Receive buffer. Each read fills it with whatever bytes the port has available, and the whole
+			// chunk is run through the message parser before the next read is started.
+			std::array<uint8_t, ReadBufferSize> ReadBuffer;
 
 			// Scratch pad for the message being currently read
 			MspMessageScratchPad MessageScratchPad;
 
+			// Link quality metrics for this port, registered so they can be read from outside the session.
+			// Line noise is counted here too: bad bytes are counted as they are skipped, and summarized in the log
+			// once per refresh, rather than logged one by one.
+			std::shared_ptr<CraftServices::MspSessionMetrics> pLinkMetrics;
+
+			// Raw capture of every byte in and out of the port (--capture). NULL when not capturing, or once capture has failed.
+			CraftServices::MspLinkCaptureRecorder * pLinkCapture = NULL;
+			void StopLinkCaptureIfFailed();
+
+			// Is this session being fed from a capture (see MspCaptureReplay) rather than a port?
+			bool ReplayingCapture = false;
+			// Where to charge the time each stage of work takes. NULL (and nothing is timed) except when profiling.
+			CraftServices::MspPipelineStageTimes * pPipelineStageTimes = NULL;
+			// The capture's clock, when replaying one. See GetSessionTime().
+			boost::posix_time::ptime ReplayClockTime;
+			boost::posix_time::ptime GetSessionTime();
+
+			// Messages waiting to be sent, all of which go out together in one write.
+			// Bounded by how much the link can carry in one refresh; newer messages replace older ones of the same kind.
+			CraftServices::MspTransmitQueue TransmitQueue;
+			// Messages currently being written to the port. Kept alive here until the write completes.
+			CraftServices::MspTransmitBatch InFlightTransmitBatch;
+			// Is a write outstanding on the port? We only ever have one at a time.
+			bool WriteInProgress = false;
+			// When the link should have finished sending the last write, going by baud rate. (Starts out long past;
+			// an unset ptime would compare as later than any real time, and hold the first write back forever.)
+			boost::posix_time::ptime LinkBusyUntilTime = boost::posix_time::ptime(boost::posix_time::min_date_time);
+
+			// Timeout, retry and window settings for requests to this Flight Controller
+			CraftServices::MspRequestTrackingSettings RequestTrackingSettings;
+			// Requests sent that are still waiting on their replies
+			CraftServices::MspInFlightRequestTable InFlightRequests;
+
+			// Fits each refresh's messages to the airtime the link has, most important first
+			CraftServices::MspAirtimeScheduler AirtimeScheduler;
+
+			// Picks the refresh interval, if it is automatic
+			CraftServices::MspRefreshRateController RefreshRateController;
+			// Counts as of the last refresh rate decision, to see what went wrong since
+			uint64_t TimedOutRequestCountAtLastRateDecision = 0;
+			uint64_t CrcMismatchCountAtLastRateDecision = 0;
+			void UpdateRefreshRate(bool allRepliesIn);
+			void ApplyRefreshInterval(uint32_t refreshIntervalInMilliseconds);
+
+			// Is a refresh cycle waiting on replies? A cycle is complete once everything sent during it has
+			// been answered (or timed out), and then the scheduler can move on without waiting out the interval.
+			bool RefreshCycleInProgress = false;
+			// When the current refresh cycle started
+			boost::posix_time::ptime RefreshCycleStartTime;
+
 			// Have we ever tried to open the port?
 			bool HasMarkedPortStartupTime;
 			// What time did we first try to open the port?
@@ -305,10 +427,14 @@ namespace CraftServices
 									 uint32_t baudRate,
 									 uint32_t refreshTimerIntervalInMilliseconds,
 									 uint32_t staleIntervalInMilliseconds,
+									 const CraftServices::MspRequestTrackingSettings & requestTrackingSettings,
+									 const CraftServices::MspRefreshRateSettings & refreshRateSettings,
 									 std::shared_ptr<spdlog::sinks::stdout_color_sink_mt> pConsoleSink,
 									 std::shared_ptr<spdlog::sinks::basic_file_sink_mt> pAllSink,
 									 spdlog::level::level_enum spdLogLevel,
 									 const std::string & loggingPattern,
+									 const CraftServices::LoggingSettings & loggingSettings,
+									 const CraftServices::MspLinkCaptureSettings & captureSettings,
 									 std::string dateTimeLogFilePrefixString,
 									 std::vector<CraftServices::MSPFlightControllerAsync *> * pAllMspFlightControllers,
 									 std::vector<CraftServices::PhantomTestCraft *> * pPhantomTestCraft,
@@ -323,14 +449,26 @@ namespace CraftServices
 							 std::shared_ptr<spdlog::sinks::basic_file_sink_mt> pAllSink,
 							 spdlog::level::level_enum spdLogLevel,
 							 const std::string & loggingPattern,
+							 const CraftServices::LoggingSettings & loggingSettings,
 				             std::string dateTimeLogFilePrefixString);
 
 			// Open 
 			void OpenPortAndStartSession();
+			void OnTransportOpened(const boost::system::error_code & error) override;
 			// TODO: Maybe make private? 
 			void RequestInitialInformationFromFlightController();
 
+			void StartRefreshTimerFiring();
 			void RefreshFlightControllerState();
+			void CheckForRefreshCycleComplete();
+
+			// Run this session from captured traffic instead of the port. The session acts as though the port had just
+			// opened; writes go to an in-memory link with nothing on the far end, and the caller feeds in received bytes
+			// and drives each refresh.
+			void StartReplaySession(CraftServices::MspPipelineStageTimes * pStageTimes);
+			void ReplayReceivedBytes(const uint8_t * pReceivedBytes, size_t byteCount);
+			// Move the session's clock along to the moment in the capture being replayed
+			void SetReplayClockTime(const boost::posix_time::ptime & replayClockTime);
 
 			void ResetPortSoftish();
 			void ResetPortHard();
@@ -340,12 +478,18 @@ namespace CraftServices
 			void SendNoticesAboutOtherCrafts();
 			void SendNoticesAboutPhantomCrafts();
 
-			bool CraftPositionIsStale(CraftServices::MSPFlightControllerAsync * pMspFlightController, int64_t & timeDifferenceInMilliseconds);
+			bool CraftPositionIsStale(const boost::posix_time::ptime & positionRetrievalTime, int64_t & timeDifferenceInMilliseconds);
 
 			void StartReadMessageReceiveLoopForFlightController();
-			void MessageReceiveOneByteReadCallback(const boost::system::error_code & error, std::size_t bytes_transferred);
-			bool ProcessReceivedMessageByte(char messageByte, std::string & errorMessage);
+			void OnTransportRead(const boost::system::error_code & error, size_t sizeRead) override;
+			void MessageReceiveReadCallback(const boost::system::error_code & error, std::size_t bytes_transferred);
+			void HandleReceivedBytes(const uint8_t * pReceivedBytes, size_t byteCount);
+			void ProcessReceivedMessageBytes(const uint8_t * pMessageBytes, size_t byteCount);
+			CraftServices::MessageByteResult ProcessReceivedMessageByte(uint8_t messageByte);
 			bool ProcessMessageScratchPad(MspMessageScratchPad & messageScratchPadToProcess, std::string & errorMessage);
+			void MatchResponseToInFlightRequest(const MspMessageScratchPad & messageScratchPadToMatch);
+			void RecordDeliveredPositionAges();
+			void ExpireOverdueRequests();
 
 			void CountErrorsAfterRead(const boost::system::error_code & error, size_t sizeRead);
 			void CountErrorsAfterWrite(const boost::system::error_code& error, size_t sizeWritten);
@@ -357,24 +501,86 @@ namespace CraftServices
 			void RequestRawGPSPosition();
 			void RequestOtherCraftPositionSetting();
 
-			std::string GetPortAndCraftNamePrefix();
+			const std::string & GetPortAndCraftNamePrefix();
+			void UpdatePortAndCraftNamePrefix();
 			size_t GetExpectedTransmitTimeInMillisecondsForByteCount(size_t byteCount);
+			size_t GetByteCountTransmittableInMilliseconds(size_t milliseconds);
+			size_t GetMinimumInterFrameGapInMilliseconds();
+
+			// Current refresh interval (safe to call from any thread)
+			uint32_t GetRefreshIntervalInMilliseconds();
 
 			void SendOtherCraftPositionSettingMessage(bool thisServerWantsToBeToldAboutOtherCrafts);
-			void SendOtherCraftPositionMessage(MSPFlightControllerAsync & mspFlightControllerWithCraftToSendPositionOf);
+			void SendOtherCraftPositionMessage(const CraftServices::PublishedCraftPosition & otherCraftPosition);
 			void SendPhantomCraftPositionMessage(CraftServices::PhantomTestCraft & phantomTestCraft);
 
+			std::shared_ptr<const CraftServices::PublishedCraftPosition> GetPublishedPosition();
+
 			bool IsThisFlightControllerShuttingDown();
 
 		private:
 			// Timer that fires to prompt refreshing of information from this Flight Controller
 			boost::asio::steady_timer * pRefreshTimer;
+			// Is this Flight Controller refreshed by the timer above? If not, it is one of several taking turns
+			// on the global refresh timer (round robin mode).
+			bool ServicedByOwnRefreshTimer = false;
+			// Bumped every time we start waiting on the refresh timer, so a firing that was already on its way
+			// when the timer got moved up can be recognized and ignored
+			uint64_t RefreshTimerGeneration = 0;
+			void WaitForNextRefresh();
+			void RefreshTimerCallback(const boost::system::error_code & error);
+
+			// Latest position of this craft for the other sessions to read. Empty until a position comes in.
+			// Replaced wholesale (never modified) under the mutex, so a reader always gets a consistent snapshot.
+			std::shared_ptr<const CraftServices::PublishedCraftPosition> pPublishedPosition;
+			boost::mutex PublishedPositionMutex;
+			void PublishPosition();
+			void WithdrawPublishedPosition();
+
+			// Where this craft is, from its own (unpublished) current position
+			CraftServices::CraftKinematics GetCurrentKinematics();
+
+			// For each other craft, how many rounds running its position has been deferred for lack of airtime
+			// (keyed by the position's transmit key). See PROXIMITY_FAIRNESS_FLOOR_IN_ROUNDS.
+			std::map<CraftServices::MspTransmitKey, uint32_t> RoundsPositionDeferred;
+
+			// Don't try to reopen the port before this time (gives a hard reset time to finish closing it)
+			boost::posix_time::ptime PortReopenHoldOffTime = boost::posix_time::ptime(boost::posix_time::min_date_time);
+
+			// Timer that fires when the link is free again, to send anything held back while it was busy
+			boost::asio::steady_timer * pLinkBusyTimer;
+			// Is the above timer waiting to fire?
+			bool LinkBusyTimerPending = false;
+			void StartLinkBusyTimer(const boost::posix_time::ptime & now);
+			void LinkBusyTimerCallback(const boost::system::error_code & error);
+
+			void ReadNextMessageChunk();
+			CraftServices::MessageByteResult RejectMessage();
+			void ReportDiscardedBytes();
+
+			// Line noise counts as of the last ReportDiscardedBytes()
+			uint64_t LastReportedDiscardedByteCount = 0;
+			uint64_t LastReportedRejectedMessageCount = 0;
+			uint64_t LastReportedCrcMismatchCount = 0;
+
+			void QueueMessageForTransmit(CraftServices::MspMessageAsync & mspMessageAsync, CraftServices::MspTrafficPriority priority);
+			void QueueMessageForTransmit(CraftServices::MspMessageAsync & mspMessageAsync, const CraftServices::MspTransmitKey & transmitKey, CraftServices::MspTrafficPriority priority);
+			void QueueRequestFrameForTransmit(const CraftServices::MspRequestFrame & requestFrame, CraftServices::MspTrafficPriority priority);
+			void PlanFrameForTransmit(const CraftServices::MspTransmitKey & transmitKey, CraftServices::MspTransmitFrame transmitFrame, CraftServices::MspTrafficPriority priority);
+			void PackPlannedFramesIntoAirtime();
+			// Are messages being planned for a refresh right now? (Otherwise they go straight to the queue)
+			bool PlanningRefreshCycle = false;
+			void QueueFrameForTransmit(const CraftServices::MspTransmitKey & transmitKey, CraftServices::MspTransmitFrame transmitFrame, uint32_t retryCount = 0);
+			CraftServices::MspTransmitKey GetTransmitKeyForCraftPosition(const CraftServices::msg::OtherCraftPositionMessage & otherCraftPositionMessage);
+			CraftServices::MspTransmitKey GetTransmitKeyForCraftPosition(const CraftServices::PublishedCraftPosition & otherCraftPosition);
+			void FlushTransmitBatch();
+			void OnTransportWritten(const boost::system::error_code & error, size_t sizeWritten) override;
+			void TransmitBatchWriteCallback(const boost::system::error_code& error, size_t sizeWritten);
 
 			ByteVector BuildMspMessageAsByteVector(CraftServices::MspMessageAsync & mspMessageAsync);
-			ByteVector BuildMspMessageAsByteVector(const uint16_t messageId, const ByteVector & data);			
+			ByteVector BuildMspMessageAsByteVector(const uint16_t messageId, const ByteSpan & payloadData);			
 
-			void ClearSerialBuffer();
-			uint8_t CalculateCrcOfMessage(const uint8_t flag, const uint16_t id, const ByteVector &data);
+			uint8_t CalculateCrcOfMessage(const uint8_t flag, const uint16_t id, const ByteSpan &data);
 
 	};
 }
@@ -0,0 +1,734 @@
+/*
+ * This file is part of CraftServices.
+ *
+ * CraftServices is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CraftServices is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CraftServices. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+#include "MspFlightControllerEmulator.hpp"
+#include "OtherCraftPositionMessage.hpp"
+#include "GeoSpatialUtil.hpp"
+#include "crc.hpp"
+
+#ifdef CRAFT_SERVICES_HAS_FLIGHT_CONTROLLER_EMULATOR
+#include <stdlib.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#endif // CRAFT_SERVICES_HAS_FLIGHT_CONTROLLER_EMULATOR
+
+namespace CraftServices
+{
+	const char * MspEmulatedFlightPathShapeAsString(MspEmulatedFlightPathShape flightPathShape)
+	{
+		switch (flightPathShape)
+		{
+			case MspEmulatedFlightPathShape::Stationary:
+				return "stationary";
+			case MspEmulatedFlightPathShape::Circle:
+				return "circle";
+			case MspEmulatedFlightPathShape::OutAndBack:
+				return "outandback";
+			default:
+				return "unknown";
+		}
+	}
+
+	CraftServices::GeoSpatialPoint MspEmulatedFlightPath::GetPosition(double phase, double secondsFlown, double & groundCourseInDegrees) const
+	{
+		CraftServices::GeoSpatialPoint centerPoint(CenterLatInDecimalDegrees, CenterLonInDecimalDegrees);
+		double startBearingInDegrees = phase * 360;
+		double distanceFlownInMeters = SpeedInMetersPerSecond * secondsFlown;
+
+		switch (Shape)
+		{
+			case MspEmulatedFlightPathShape::Circle:
+			{
+				// Flown clockwise, so the craft always heads a quarter turn on from its bearing from the centre
+				double bearingFromCenterInDegrees = startBearingInDegrees;
+				if (SizeInMeters > 0)
+				{
+					bearingFromCenterInDegrees += GeoSpatialUtil::RadiansToDegrees(distanceFlownInMeters / SizeInMeters);
+				}
+				bearingFromCenterInDegrees = GeoSpatialUtil::NormalizeDegreeRotation(bearingFromCenterInDegrees);
+				groundCourseInDegrees = GeoSpatialUtil::NormalizeDegreeRotation(bearingFromCenterInDegrees + 90);
+				return GeoSpatialUtil::GetDestinationPoint(centerPoint, bearingFromCenterInDegrees, (uint32_t)SizeInMeters);
+			}
+
+			case MspEmulatedFlightPathShape::OutAndBack:
+			{
+				if (SizeInMeters <= 0)
+				{
+					groundCourseInDegrees = startBearingInDegrees;
+					return centerPoint;
+				}
+
+				double distanceIntoLapInMeters = std::fmod(distanceFlownInMeters, 2 * SizeInMeters);
+				bool headingOut = distanceIntoLapInMeters < SizeInMeters;
+				double distanceFromCenterInMeters = headingOut ? distanceIntoLapInMeters : 2 * SizeInMeters - distanceIntoLapInMeters;
+				groundCourseInDegrees = headingOut ? startBearingInDegrees : GeoSpatialUtil::NormalizeDegreeRotation(startBearingInDegrees + 180);
+				return GeoSpatialUtil::GetDestinationPoint(centerPoint, startBearingInDegrees, (uint32_t)distanceFromCenterInMeters);
+			}
+
+			case MspEmulatedFlightPathShape::Stationary:
+			default:
+			{
+				// Facing away from the centre
+				groundCourseInDegrees = startBearingInDegrees;
+				return GeoSpatialUtil::GetDestinationPoint(centerPoint, startBearingInDegrees, (uint32_t)SizeInMeters);
+			}
+		}
+	}
+
+	std::string MspEmulatedFlightPath::GetParametersAsString() const
+	{
+		return fmt::format("{} around {:.6f}, {:.6f} - Size {} meters - Speed {} m/s - Alt {} meters", MspEmulatedFlightPathShapeAsString(Shape),
+			CenterLatInDecimalDegrees, CenterLonInDecimalDegrees, SizeInMeters, SpeedInMetersPerSecond, AltitudeInMeters);
+	}
+
+#ifdef CRAFT_SERVICES_HAS_FLIGHT_CONTROLLER_EMULATOR
+
+	// Deliberately, ridiculously high, as for the phantom craft, as a reminder that the position is synthetic
+	static const uint8_t EmulatedSatelliteCount = 50;
+
+	// HDOP of 1.0 - as good as it gets
+	static const uint16_t EmulatedHdop = 100;
+
+	// 'EMU', so emulated craft are easy to pick out by UID alone
+	static const uint32_t EmulatedUidMarker = 0x454D55;
+
+	// Constructor
+	MspEmulatedFlightController::MspEmulatedFlightController(boost::asio::io_context * pIo_context, uint32_t emulatorIndex, double flightPathPhase,
+															 const MspFlightControllerEmulatorSettings & settings, spdlog::logger * pLogger)
+	{
+		// Non-owning pointers
+		pIoContext = pIo_context;
+		pEmulatorLogger = pLogger;
+
+		EmulatorIndex = emulatorIndex;
+		FlightPathPhase = flightPathPhase;
+		Settings = settings;
+
+		// The same from run to run, so one test's logs line up with the last one's
+		CraftName = fmt::format("EMU{:03}", emulatorIndex + 1);
+		UID_0 = EmulatedUidMarker;
+		UID_1 = emulatorIndex + 1;
+		UID_2 = 0;
+
+		pMasterDescriptor = NULL;
+		SlaveFileDescriptor = -1;
+
+		RequestReadState = MessageReadState::PreambleOne;
+		pWriteTimer = new boost::asio::steady_timer(*pIoContext);
+		WriteTimerArmed = false;
+		WriteInProgress = false;
+
+		RequestCount = 0;
+		RejectedRequestCount = 0;
+		UnsupportedRequestCount = 0;
+		OtherCraftPositionCount = 0;
+		MalformedOtherCraftPositionCount = 0;
+		ReplyByteCount = 0;
+	}
+
+	// Destructor
+	MspEmulatedFlightController::~MspEmulatedFlightController()
+	{
+		Close();
+
+		delete pWriteTimer;
+		pWriteTimer = NULL;
+	}
+
+	bool MspEmulatedFlightController::Open(std::string & errorMessage)
+	{
+		if (Settings.LinkType == MspEmulatedLinkType::Memory)
+		{
+			OpenMemoryLink();
+		}
+		else if (!OpenPseudoTerminal(errorMessage))
+		{
+			return false;
+		}
+
+		FlightStartTime = std::chrono::steady_clock::now();
+		ReceiveLinkFreeTime = FlightStartTime;
+		TransmitLinkFreeTime = FlightStartTime;
+
+		if (pMasterDescriptor != NULL)
+		{
+			StartRead();
+		}
+		return true;
+	}
+
+	bool MspEmulatedFlightController::OpenPseudoTerminal(std::string & errorMessage)
+	{
+		int masterFileDescriptor = posix_openpt(O_RDWR | O_NOCTTY);
+		if (masterFileDescriptor < 0)
+		{
+			errorMessage = fmt::format("Could not create a pseudo-terminal for {}: {}", CraftName, std::strerror(errno));
+			return false;
+		}
+
+		const char * pSlaveName = NULL;
+		if (grantpt(masterFileDescriptor) != 0 || unlockpt(masterFileDescriptor) != 0 || (pSlaveName = ptsname(masterFileDescriptor)) == NULL)
+		{
+			errorMessage = fmt::format("Could not set up the pseudo-terminal for {}: {}", CraftName, std::strerror(errno));
+			::close(masterFileDescriptor);
+			return false;
+		}
+		PortName = pSlaveName;
+
+		// With nothing holding the far end open, reads on our end fail, so we keep it open ourselves. Raw, so the
+		// line discipline passes MSP through untouched (no echo, no newline translation) before a session sets it up.
+		SlaveFileDescriptor = ::open(PortName.c_str(), O_RDWR | O_NOCTTY);
+		struct termios slaveTerminalSettings;
+		if (SlaveFileDescriptor < 0 || tcgetattr(SlaveFileDescriptor, &slaveTerminalSettings) != 0)
+		{
+			errorMessage = fmt::format("Could not open {} for {}: {}", PortName, CraftName, std::strerror(errno));
+			::close(masterFileDescriptor);
+			Close();
+			return false;
+		}
+		cfmakeraw(&slaveTerminalSettings);
+		tcsetattr(SlaveFileDescriptor, TCSANOW, &slaveTerminalSettings);
+
+		pMasterDescriptor = new boost::asio::posix::stream_descriptor(*pIoContext, masterFileDescriptor);
+		return true;
+	}
+
+	void MspEmulatedFlightController::OpenMemoryLink()
+	{
+		PortName = "memory:" + CraftName;
+		pMemoryLink = MspMemoryLink::GetNamedLink(CraftName);
+
+		// Requests arrive on the session's strand, as it writes them. They are handled on our own thread, same as
+		// they would be off a pseudo-terminal.
+		pMemoryLink->SetFarEndReceiver([this](const uint8_t * pBytes, size_t byteCount)
+		{
+			ByteVector receivedBytes(pBytes, pBytes + byteCount);
+			boost::asio::post(*pIoContext, [this, receivedBytes = std::move(receivedBytes)]()
+			{
+				if (pMemoryLink)
+				{
+					ProcessReceivedBytes(receivedBytes.data(), receivedBytes.size());
+				}
+			});
+		});
+	}
+
+	bool MspEmulatedFlightController::IsOpen() const
+	{
+		return pMasterDescriptor != NULL || pMemoryLink;
+	}
+
+	void MspEmulatedFlightController::Close()
+	{
+		if (pWriteTimer != NULL)
+		{
+			pWriteTimer->cancel();
+		}
+
+		if (pMasterDescriptor != NULL)
+		{
+			boost::system::error_code ignoredError;
+			pMasterDescriptor->close(ignoredError);
+			delete pMasterDescriptor;
+			pMasterDescriptor = NULL;
+		}
+
+		if (SlaveFileDescriptor >= 0)
+		{
+			::close(SlaveFileDescriptor);
+			SlaveFileDescriptor = -1;
+		}
+
+		if (pMemoryLink)
+		{
+			pMemoryLink->SetFarEndReceiver(NULL);
+			pMemoryLink.reset();
+		}
+	}
+
+	std::string MspEmulatedFlightController::GetSummaryString() const
+	{
+		return fmt::format("{} ({}): {} requests answered - {} other craft positions ({} malformed) - {} unsupported - {} rejected - {} bytes sent",
+			PortName, CraftName, RequestCount, OtherCraftPositionCount, MalformedOtherCraftPositionCount, UnsupportedRequestCount, RejectedRequestCount, ReplyByteCount);
+	}
+
+	void MspEmulatedFlightController::StartRead()
+	{
+		pMasterDescriptor->async_read_some(boost::asio::buffer(ReadBuffer), [this](const boost::system::error_code & error, size_t sizeRead)
+		{
+			ReadCallback(error, sizeRead);
+		});
+	}
+
+	void MspEmulatedFlightController::ReadCallback(const boost::system::error_code & error, size_t sizeRead)
+	{
+		if (error == boost::asio::error::operation_aborted)
+		{
+			return;
+		}
+
+		if (error)
+		{
+			pEmulatorLogger->warn("{}: Emulated flight controller {} stopped answering, read failed: {}", PortName, CraftName, error.message());
+			return;
+		}
+
+		ProcessReceivedBytes(ReadBuffer.data(), sizeRead);
+		StartRead();
+	}
+
+	// The link hands over a whole write at once. Over the emulated link, each byte waits its turn.
+	void MspEmulatedFlightController::ProcessReceivedBytes(const uint8_t * pReceivedBytes, size_t receivedByteCount)
+	{
+		EmulatorTime readTime = std::chrono::steady_clock::now();
+		EmulatorTime::duration byteTransmitTime = GetTransmitTimeForByteCount(1);
+		for (size_t byteIndex = 0; byteIndex < receivedByteCount; byteIndex++)
+		{
+			ReceiveLinkFreeTime = std::max(readTime, ReceiveLinkFreeTime) + byteTransmitTime;
+			ProcessReceivedByte(pReceivedBytes[byteIndex], ReceiveLinkFreeTime);
+		}
+	}
+
+	// Requests come from our own sessions, so they are assumed to be well formed. Anything that isn't is just
+	// dropped, and we go back to looking for the next '$'.
+	void MspEmulatedFlightController::ProcessReceivedByte(uint8_t receivedByte, EmulatorTime receiveTime)
+	{
+		if (RequestReadState == MessageReadState::PreambleOne)
+		{
+			if (receivedByte == '$')
+			{
+				RequestScratchPad.ClearValue();
+				RequestScratchPad.AppendMessageByte(receivedByte);
+				RequestReadState = MessageReadState::PreambleTwo;
+			}
+			return;
+		}
+
+		if (RequestReadState == MessageReadState::CrcByte)
+		{
+			RequestReadState = MessageReadState::PreambleOne;
+
+			// CRC covers everything after the direction indicator
+			const size_t CrcStartOffset = 3;
+			uint8_t calculatedCrc = Crc::crc8_dvb_s2_update(0, RequestScratchPad.MessageBytes + CrcStartOffset, RequestScratchPad.MessageBytesRead - CrcStartOffset);
+			if (calculatedCrc != receivedByte)
+			{
+				RejectedRequestCount++;
+				return;
+			}
+
+			RequestCount++;
+			ProcessRequest(RequestScratchPad, receiveTime);
+			return;
+		}
+
+		bool byteAccepted = true;
+		RequestScratchPad.AppendMessageByte(receivedByte);
+
+		switch (RequestReadState)
+		{
+			case MessageReadState::PreambleTwo:
+				byteAccepted = (receivedByte == 'X');
+				RequestReadState = MessageReadState::Direction;
+				break;
+
+			case MessageReadState::Direction:
+				byteAccepted = (receivedByte == '<');
+				RequestScratchPad.MessageDirectionCharacter = receivedByte;
+				RequestReadState = MessageReadState::ZeroFlag;
+				break;
+
+			case MessageReadState::ZeroFlag:
+				RequestReadState = MessageReadState::MessageIDLowByte;
+				break;
+
+			case MessageReadState::MessageIDLowByte:
+				RequestScratchPad.MessageIDLowByte = receivedByte;
+				RequestReadState = MessageReadState::MessageIDHighByte;
+				break;
+
+			case MessageReadState::MessageIDHighByte:
+				RequestScratchPad.MessageIDHighByte = receivedByte;
+				RequestScratchPad.InitMessageID();
+				RequestReadState = MessageReadState::DataPayloadLengthLowByte;
+				break;
+
+			case MessageReadState::DataPayloadLengthLowByte:
+				RequestScratchPad.DataPayloadLengthLowByte = receivedByte;
+				RequestReadState = MessageReadState::DataPayloadLengthHighByte;
+				break;
+
+			case MessageReadState::DataPayloadLengthHighByte:
+				RequestScratchPad.DataPayloadLengthHighByte = receivedByte;
+				byteAccepted = RequestScratchPad.InitDataPayload();
+				RequestReadState = (RequestScratchPad.DataPayloadLength == 0) ? MessageReadState::CrcByte : MessageReadState::DataPayload;
+				break;
+
+			case MessageReadState::DataPayload:
+				RequestScratchPad.DataPayloadBytesRead++;
+				if (RequestScratchPad.DataPayloadBytesRead == RequestScratchPad.DataPayloadLength)
+				{
+					RequestReadState = MessageReadState::CrcByte;
+				}
+				break;
+
+			default:
+				break;
+		}
+
+		if (!byteAccepted)
+		{
+			RejectedRequestCount++;
+			RequestReadState = MessageReadState::PreambleOne;
+			// The bad byte may itself be the start of the next request
+			ProcessReceivedByte(receivedByte, receiveTime);
+		}
+	}
+
+	void MspEmulatedFlightController::ProcessRequest(const MspMessageScratchPad & requestScratchPad, EmulatorTime requestTime)
+	{
+		pEmulatorLogger->trace("{}: Emulated flight controller {} got request - MessageID {} - {} byte payload", PortName, CraftName, requestScratchPad.MessageID, requestScratchPad.DataPayloadLength);
+
+		switch ((CraftServices::ID)requestScratchPad.MessageID)
+		{
+			case ID::MSP_API_VERSION:
+			{
+				msg::ApiVersion apiVersionMessage;
+				apiVersionMessage.Protocol = (uint8_t)ExpectedMspProtocolVersion;
+				apiVersionMessage.Major = (uint8_t)MinimumMspApiMajorVersionForCraftServicesMessages;
+				apiVersionMessage.Minor = (uint8_t)MinimumMspApiMinorVersionForCraftServicesMessages;
+				QueueReply(apiVersionMessage, requestTime);
+				break;
+			}
+
+			case ID::MSP_FC_VARIANT:
+			{
+				msg::FcVariant fcVariantMessage;
+				fcVariantMessage.CraftIdentifier = INAV_IDENTIFIER;
+				QueueReply(fcVariantMessage, requestTime);
+				break;
+			}
+
+			case ID::MSP_UID:
+			{
+				msg::UidMessage uidMessage;
+				uidMessage.UID_0 = UID_0;
+				uidMessage.UID_1 = UID_1;
+				uidMessage.UID_2 = UID_2;
+				QueueReply(uidMessage, requestTime);
+				break;
+			}
+
+			case ID::MSP_NAME:
+			{
+				msg::CraftNameMessage craftNameMessage;
+				craftNameMessage.CraftName = CraftName;
+				QueueReply(craftNameMessage, requestTime);
+				break;
+			}
+
+			case ID::MSP_RAW_GPS:
+			{
+				msg::RawGPS rawGpsMessage;
+				FillInRawGps(rawGpsMessage, requestTime);
+				QueueReply(rawGpsMessage, requestTime);
+				break;
+			}
+
+			case ID::MSP2_INAV_OTHER_CRAFT_POSITION_SETTING:
+			{
+				// The session tells us its own setting; we answer with ours. Emulated crafts always want the other
+				// crafts' positions, since carrying them is most of the load being tested.
+				msg::OtherCraftPositionSettingMessage otherCraftPositionSettingMessage(true);
+				QueueReply(otherCraftPositionSettingMessage, requestTime);
+				break;
+			}
+
+			case ID::MSP2_INAV_OTHER_CRAFT_POSITION:
+			{
+				// Decoded only to check it is whole; acknowledged with an empty reply either way, as iNav does
+				try
+				{
+					msg::OtherCraftPositionMessage otherCraftPositionMessage(requestScratchPad.GetPayloadData());
+					OtherCraftPositionCount++;
+				}
+				catch (PayloadOverrunException &)
+				{
+					MalformedOtherCraftPositionCount++;
+				}
+				QueueReply(requestScratchPad.MessageID, '>', ByteSpan(), requestTime);
+				break;
+			}
+
+			default:
+			{
+				// iNav answers anything it doesn't know with an error reply
+				UnsupportedRequestCount++;
+				QueueReply(requestScratchPad.MessageID, '!', ByteSpan(), requestTime);
+				break;
+			}
+		}
+	}
+
+	void MspEmulatedFlightController::FillInRawGps(msg::RawGPS & rawGps, EmulatorTime requestTime) const
+	{
+		double secondsFlown = std::chrono::duration<double>(requestTime - FlightStartTime).count();
+		double groundCourseInDegrees = 0;
+		CraftServices::GeoSpatialPoint currentPosition = Settings.FlightPath.GetPosition(FlightPathPhase, secondsFlown, groundCourseInDegrees);
+		bool isMoving = Settings.FlightPath.Shape != MspEmulatedFlightPathShape::Stationary;
+
+		rawGps.FixType = CraftServices::GPSFixType::GPS_FIX_3D;
+		rawGps.NumSat = EmulatedSatelliteCount;
+		rawGps.MspLat = currentPosition.MspLat;
+		rawGps.MspLon = currentPosition.MspLon;
+		// Signed on the wire, like the rest of the position
+		rawGps.AltitudeInMeters = (uint16_t)(int16_t)std::lround(Settings.FlightPath.AltitudeInMeters);
+		// Centimeters per second
+		rawGps.Speed = isMoving ? (uint16_t)std::lround(Settings.FlightPath.SpeedInMetersPerSecond * CENTIMETERS_PER_METER) : 0;
+		rawGps.GroundCourseInDecidegrees = (uint16_t)(std::lround(groundCourseInDegrees * 10) % 3600);
+		rawGps.HDOP = EmulatedHdop;
+	}
+
+	template <typename MessageType>
+	void MspEmulatedFlightController::QueueReply(const MessageType & replyMessage, EmulatorTime requestTime)
+	{
+		uint8_t payloadBuffer[MspMessageScratchPad::MaxDataPayloadLength];
+		CraftServices::PayloadWriter payloadWriter(payloadBuffer, sizeof(payloadBuffer));
+		replyMessage.EncodePayload(payloadWriter);
+		QueueReply((uint16_t)replyMessage.MessageID(), '>', payloadWriter.GetWrittenData(), requestTime);
+	}
+
+	// Replies go out in the order their requests came in, each starting once the response delay is up and
+	// the one before it has finished going out.
+	void MspEmulatedFlightController::QueueReply(uint16_t messageID, uint8_t directionCharacter, const ByteSpan & payloadData, EmulatorTime requestTime)
+	{
+		const uint8_t ZeroFlag = 0;
+
+		ByteVector replyBytes(MspMessageScratchPad::HeaderLength + payloadData.size() + 1);
+		CraftServices::PayloadWriter replyWriter(replyBytes.data(), replyBytes.size());
+		replyWriter.WriteUint8('$');
+		replyWriter.WriteUint8('X');
+		replyWriter.WriteUint8(directionCharacter);
+		replyWriter.WriteUint8(ZeroFlag);
+		replyWriter.WriteUint16(messageID);
+		replyWriter.WriteUint16((uint16_t)payloadData.size());
+		replyWriter.WriteBytes(payloadData.data(), payloadData.size());
+		// CRC covers everything after the direction indicator
+		replyWriter.WriteUint8(Crc::crc8_dvb_s2_update(0, replyBytes.data() + 3, replyBytes.size() - 4));
+
+		EmulatorTime replyStartTime = std::max(requestTime + std::chrono::milliseconds(Settings.ResponseDelayInMilliseconds), TransmitLinkFreeTime);
+		TransmitLinkFreeTime = replyStartTime + GetTransmitTimeForByteCount(replyBytes.size());
+
+		PendingReply pendingReply = { TransmitLinkFreeTime, std::move(replyBytes) };
+		PendingReplies.push_back(std::move(pendingReply));
+		ScheduleNextWrite();
+	}
+
+	void MspEmulatedFlightController::ScheduleNextWrite()
+	{
+		if (WriteInProgress || WriteTimerArmed || PendingReplies.empty())
+		{
+			return;
+		}
+
+		WriteTimerArmed = true;
+		pWriteTimer->expires_at(PendingReplies.front().DueTime);
+		pWriteTimer->async_wait([this](const boost::system::error_code & error)
+		{
+			WriteDueReplies(error);
+		});
+	}
+
+	// Everything that has finished arriving over the emulated link goes out in one write
+	void MspEmulatedFlightController::WriteDueReplies(const boost::system::error_code & error)
+	{
+		WriteTimerArmed = false;
+		if (error == boost::asio::error::operation_aborted || !IsOpen())
+		{
+			return;
+		}
+
+		WriteBuffer.clear();
+		EmulatorTime now = std::chrono::steady_clock::now();
+		while (!PendingReplies.empty() && PendingReplies.front().DueTime <= now)
+		{
+			const ByteVector & replyBytes = PendingReplies.front().ReplyBytes;
+			WriteBuffer.insert(WriteBuffer.end(), replyBytes.begin(), replyBytes.end());
+			PendingReplies.pop_front();
+		}
+
+		if (WriteBuffer.empty())
+		{
+			ScheduleNextWrite();
+			return;
+		}
+
+		// The in-memory link takes the whole write straight away
+		if (pMemoryLink)
+		{
+			pMemoryLink->SendToSession(WriteBuffer.data(), WriteBuffer.size());
+			WriteCallback(boost::system::error_code(), WriteBuffer.size());
+			return;
+		}
+
+		WriteInProgress = true;
+		boost::asio::async_write(*pMasterDescriptor, boost::asio::buffer(WriteBuffer), [this](const boost::system::error_code & error, size_t sizeWritten)
+		{
+			WriteCallback(error, sizeWritten);
+		});
+	}
+
+	void MspEmulatedFlightController::WriteCallback(const boost::system::error_code & error, size_t sizeWritten)
+	{
+		WriteInProgress = false;
+		if (error == boost::asio::error::operation_aborted)
+		{
+			return;
+		}
+
+		if (error)
+		{
+			pEmulatorLogger->warn("{}: Emulated flight controller {} could not send replies: {}", PortName, CraftName, error.message());
+		}
+		ReplyByteCount += sizeWritten;
+
+		ScheduleNextWrite();
+	}
+
+	MspEmulatedFlightController::EmulatorTime::duration MspEmulatedFlightController::GetTransmitTimeForByteCount(size_t byteCount) const
+	{
+		if (Settings.BaudRate == 0)
+		{
+			return EmulatorTime::duration::zero();
+		}
+
+		// Assumes 1 start, 1 stop bit
+		const int64_t BitsToSendAByte = 10;
+		const int64_t NanosecondsInSecond = 1000000000;
+		return std::chrono::duration_cast<EmulatorTime::duration>(std::chrono::nanoseconds((int64_t)byteCount * BitsToSendAByte * NanosecondsInSecond / Settings.BaudRate));
+	}
+
+	/////////////////////////////////////////////////////////////////////
+
+	// Constructor
+	MspFlightControllerEmulator::MspFlightControllerEmulator(const MspFlightControllerEmulatorSettings & settings, spdlog::logger * pLogger) :
+		Settings(settings), pEmulatorLogger(pLogger), pEmulatorThread(NULL)
+	{
+	}
+
+	// Destructor
+	MspFlightControllerEmulator::~MspFlightControllerEmulator()
+	{
+		Stop();
+
+		for (auto pEmulatedFlightController : EmulatedFlightControllers)
+		{
+			delete pEmulatedFlightController;
+		}
+		EmulatedFlightControllers.clear();
+	}
+
+	bool MspFlightControllerEmulator::Open(std::string & errorMessage)
+	{
+		pEmulatorLogger->info("Emulating {} flight controller(s) on {}: {} - {} baud - {} ms response delay", Settings.FlightControllerCount,
+			(Settings.LinkType == MspEmulatedLinkType::Memory) ? "in-memory links" : "pseudo-terminals",
+			Settings.FlightPath.GetParametersAsString(), Settings.BaudRate, Settings.ResponseDelayInMilliseconds);
+
+		for (uint32_t emulatorIndex = 0; emulatorIndex < Settings.FlightControllerCount; emulatorIndex++)
+		{
+			// Spread evenly along the flight path
+			double flightPathPhase = (double)emulatorIndex / (double)Settings.FlightControllerCount;
+			MspEmulatedFlightController * pEmulatedFlightController = new MspEmulatedFlightController(&EmulatorIoContext, emulatorIndex, flightPathPhase, Settings, pEmulatorLogger);
+			EmulatedFlightControllers.push_back(pEmulatedFlightController);
+
+			if (!pEmulatedFlightController->Open(errorMessage))
+			{
+				return false;
+			}
+			pEmulatorLogger->debug("Emulated flight controller {} on {}", pEmulatedFlightController->GetCraftName(), pEmulatedFlightController->GetPortName());
+		}
+
+		return true;
+	}
+
+	std::vector<std::string> MspFlightControllerEmulator::GetPortNames() const
+	{
+		std::vector<std::string> portNames;
+		for (auto pEmulatedFlightController : EmulatedFlightControllers)
+		{
+			portNames.push_back(pEmulatedFlightController->GetPortName());
+		}
+		return portNames;
+	}
+
+	void MspFlightControllerEmulator::Start()
+	{
+		if (pEmulatorThread != NULL)
+		{
+			return;
+		}
+
+		pEmulatorThread = new boost::thread([this]() { RunEmulatorThread(); });
+	}
+
+	void MspFlightControllerEmulator::Stop()
+	{
+		if (pEmulatorThread == NULL)
+		{
+			return;
+		}
+
+		EmulatorIoContext.stop();
+		pEmulatorThread->join();
+		delete pEmulatorThread;
+		pEmulatorThread = NULL;
+	}
+
+	void MspFlightControllerEmulator::OutputSummary()
+	{
+		pEmulatorLogger->info("Flight controller emulator:");
+		for (auto pEmulatedFlightController : EmulatedFlightControllers)
+		{
+			pEmulatorLogger->info("  {}", pEmulatedFlightController->GetSummaryString());
+		}
+	}
+
+	void MspFlightControllerEmulator::RunEmulatorThread()
+	{
+		// Emulators on in-memory links have nothing outstanding between requests (they are posted to us as they
+		// come), so the IO context would return straight away without this
+		auto workGuard = boost::asio::make_work_guard(EmulatorIoContext);
+
+		try
+		{
+			EmulatorIoContext.run();
+		}
+		catch (std::exception & e)
+		{
+			pEmulatorLogger->error("Flight controller emulator stopped: {}", e.what());
+		}
+	}
+
+#endif // CRAFT_SERVICES_HAS_FLIGHT_CONTROLLER_EMULATOR
+
+} // Namespace CraftServices
@@ -0,0 +1,266 @@
+/*
+ * This file is part of CraftServices.
+ *
+ * CraftServices is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CraftServices is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CraftServices. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MSPFLIGHTCONTROLLEREMULATOR_HPP
+#define MSPFLIGHTCONTROLLEREMULATOR_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+#include <boost/asio.hpp>
+#include <boost/thread.hpp>
+
+#include "spdlog/spdlog.h"
+#include "spdlog/sinks/stdout_color_sinks.h"
+#include "spdlog/sinks/basic_file_sink.h"
+
+#include "GeoSpatialPoint.hpp"
+#include "MspFlightControllerAsync.hpp"
+#include "MspMessageAsyncs.hpp"
+#include "MspMemoryTransport.hpp"
+
+// Emulated flight controllers are built around pseudo-terminals, which only POSIX systems have (in-memory links
+// included, as they share everything else)
+#ifdef BOOST_ASIO_HAS_POSIX_STREAM_DESCRIPTOR
+#define CRAFT_SERVICES_HAS_FLIGHT_CONTROLLER_EMULATOR
+#endif // BOOST_ASIO_HAS_POSIX_STREAM_DESCRIPTOR
+
+namespace CraftServices
+{
+	enum class MspEmulatedFlightPathShape
+	{
+		// Each craft holds still, spread evenly on a ring around the centre
+		Stationary,
+		// Each craft flies a circle around the centre, spread evenly around it
+		Circle,
+		// Each craft flies out from the centre and back again, each on its own heading
+		OutAndBack
+	};
+
+	const char * MspEmulatedFlightPathShapeAsString(MspEmulatedFlightPathShape flightPathShape);
+
+	// What a session talks to an emulated flight controller over
+	enum class MspEmulatedLinkType
+	{
+		// A pseudo-terminal, opened by the session as a serial port, so the whole serial path gets exercised
+		PseudoTerminal,
+		// An in-memory link (port "memory:<craft name>"), which never touches the OS. At a high baud rate with no
+		// response delay, it runs about as fast as the sessions can go, which makes for repeatable benchmarks.
+		Memory
+	};
+
+	// Where emulated crafts fly. Every craft flies the same path, but starts at a different point on it, so
+	// they don't all sit on top of each other.
+	struct MspEmulatedFlightPath
+	{
+		MspEmulatedFlightPathShape Shape;
+
+		double CenterLatInDecimalDegrees;
+		double CenterLonInDecimalDegrees;
+
+		// Radius of the ring or circle, or length of the out-and-back leg
+		double SizeInMeters;
+
+		double SpeedInMetersPerSecond;
+		double AltitudeInMeters;
+
+		// Where a craft is, secondsFlown into the flight. phase (0..1) is how far along the path it started.
+		CraftServices::GeoSpatialPoint GetPosition(double phase, double secondsFlown, double & groundCourseInDegrees) const;
+
+		std::string GetParametersAsString() const;
+	};
+
+	struct MspFlightControllerEmulatorSettings
+	{
+		// How many flight controllers to emulate, each on its own link
+		uint32_t FlightControllerCount;
+
+		MspEmulatedLinkType LinkType;
+
+		// Speed of the emulated link, in both directions. A request is only answered once all of it would have
+		// arrived at this speed, and a reply takes as long to come back as it would at this speed. Zero doesn't
+		// hold anything up.
+		uint32_t BaudRate;
+
+		// How long the emulated flight controller takes to start replying, once a request has arrived
+		uint32_t ResponseDelayInMilliseconds;
+
+		MspEmulatedFlightPath FlightPath;
+	};
+
+#ifdef CRAFT_SERVICES_HAS_FLIGHT_CONTROLLER_EMULATOR
+
+	// A pretend iNav flight controller on the far end of a pseudo-terminal or an in-memory link.
+	//
+	// It answers the requests CraftServices makes of a real one (API version, variant, UID, name, GPS position, and
+	// the other craft position messages), so a session on its port runs just as it would on a COM port with a
+	// board on the end.
+	class MspEmulatedFlightController
+	{
+		public:
+
+			MspEmulatedFlightController(boost::asio::io_context * pIo_context, uint32_t emulatorIndex, double flightPathPhase,
+										const MspFlightControllerEmulatorSettings & settings, spdlog::logger * pLogger);
+			~MspEmulatedFlightController();
+
+			// Create the link and start answering requests on it. False (with why) if it couldn't be created.
+			bool Open(std::string & errorMessage);
+
+			void Close();
+
+			// The port for a session to open to reach us: the far end of the pseudo-terminal (i.e. /dev/pts/7), or
+			// the in-memory link (i.e. memory:EMU001)
+			const std::string & GetPortName() const
+			{
+				return PortName;
+			}
+
+			const std::string & GetCraftName() const
+			{
+				return CraftName;
+			}
+
+			std::string GetSummaryString() const;
+
+		private:
+
+			typedef std::chrono::steady_clock::time_point EmulatorTime;
+
+			struct PendingReply
+			{
+				// When the last byte of the reply would have arrived over the emulated link
+				EmulatorTime DueTime;
+				ByteVector ReplyBytes;
+			};
+
+			bool OpenPseudoTerminal(std::string & errorMessage);
+			void OpenMemoryLink();
+			bool IsOpen() const;
+
+			void StartRead();
+			void ReadCallback(const boost::system::error_code & error, size_t sizeRead);
+			void ProcessReceivedBytes(const uint8_t * pReceivedBytes, size_t receivedByteCount);
+			void ProcessReceivedByte(uint8_t receivedByte, EmulatorTime receiveTime);
+			void ProcessRequest(const MspMessageScratchPad & requestScratchPad, EmulatorTime requestTime);
+			void FillInRawGps(msg::RawGPS & rawGps, EmulatorTime requestTime) const;
+
+			template <typename MessageType>
+			void QueueReply(const MessageType & replyMessage, EmulatorTime requestTime);
+			void QueueReply(uint16_t messageID, uint8_t directionCharacter, const ByteSpan & payloadData, EmulatorTime requestTime);
+			void ScheduleNextWrite();
+			void WriteDueReplies(const boost::system::error_code & error);
+			void WriteCallback(const boost::system::error_code & error, size_t sizeWritten);
+
+			EmulatorTime::duration GetTransmitTimeForByteCount(size_t byteCount) const;
+
+			// Non-owning pointers
+			boost::asio::io_context * pIoContext;
+			spdlog::logger * pEmulatorLogger;
+
+			uint32_t EmulatorIndex;
+			double FlightPathPhase;
+			MspFlightControllerEmulatorSettings Settings;
+
+			std::string PortName;
+			std::string CraftName;
+			uint32_t UID_0;
+			uint32_t UID_1;
+			uint32_t UID_2;
+
+			// Our end of the pseudo-terminal
+			boost::asio::posix::stream_descriptor * pMasterDescriptor;
+			// Far end, held open so our end stays usable while no session has the port open
+			int SlaveFileDescriptor;
+			// Or our end of the in-memory link, if that's what we're on
+			std::shared_ptr<MspMemoryLink> pMemoryLink;
+
+			EmulatorTime FlightStartTime;
+
+			std::array<uint8_t, 256> ReadBuffer;
+			MessageReadState RequestReadState;
+			MspMessageScratchPad RequestScratchPad;
+			// When the emulated link is next free to carry a byte, each way
+			EmulatorTime ReceiveLinkFreeTime;
+			EmulatorTime TransmitLinkFreeTime;
+
+			std::deque<PendingReply> PendingReplies;
+			boost::asio::steady_timer * pWriteTimer;
+			bool WriteTimerArmed;
+			bool WriteInProgress;
+			// Replies being written; must stay put until the write completes
+			ByteVector WriteBuffer;
+
+			// Running totals
+			uint64_t RequestCount;
+			uint64_t RejectedRequestCount;
+			uint64_t UnsupportedRequestCount;
+			uint64_t OtherCraftPositionCount;
+			uint64_t MalformedOtherCraftPositionCount;
+			uint64_t ReplyByteCount;
+	};
+
+	// A bank of emulated flight controllers, each on its own pseudo-terminal or in-memory link, for testing many
+	// links at once without any hardware.
+	//
+	// The emulators run their own IO context on their own thread, so they answer in their own time, not whenever
+	// the sessions talking to them get round to it.
+	class MspFlightControllerEmulator
+	{
+		public:
+
+			// The logger is not owned, and must outlive the emulator
+			MspFlightControllerEmulator(const MspFlightControllerEmulatorSettings & settings, spdlog::logger * pLogger);
+			~MspFlightControllerEmulator();
+
+			// Create every emulated flight controller's link. False (with why) if any couldn't be created.
+			bool Open(std::string & errorMessage);
+
+			// Ports to open to reach the emulated flight controllers, in order
+			std::vector<std::string> GetPortNames() const;
+
+			// Start answering requests on the emulator's thread
+			void Start();
+
+			// Stop answering, and wait for the emulator's thread to finish. Safe to call more than once.
+			void Stop();
+
+			// Log what each emulated flight controller was asked for
+			void OutputSummary();
+
+		private:
+
+			void RunEmulatorThread();
+
+			MspFlightControllerEmulatorSettings Settings;
+
+			// Non-owning pointer
+			spdlog::logger * pEmulatorLogger;
+
+			boost::asio::io_context EmulatorIoContext;
+			std::vector<MspEmulatedFlightController *> EmulatedFlightControllers;
+			boost::thread * pEmulatorThread;
+	};
+
+#endif // CRAFT_SERVICES_HAS_FLIGHT_CONTROLLER_EMULATOR
+
+} // Namespace CraftServices
+
+#endif // MSPFLIGHTCONTROLLEREMULATOR_HPP
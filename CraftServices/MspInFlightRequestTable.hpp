@@ -0,0 +1,200 @@
+/*
+ * This file is part of CraftServices.
+ *
+ * CraftServices is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CraftServices is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CraftServices. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MSPINFLIGHTREQUESTTABLE_HPP
+#define MSPINFLIGHTREQUESTTABLE_HPP
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "CraftServicesTypes.hpp"
+#include "MspTransmitBatch.hpp"
+#include "MspTransmitQueue.hpp"
+
+namespace CraftServices
+{
+	// How requests to a Flight Controller are paced and followed up on
+	struct MspRequestTrackingSettings
+	{
+		// How long to wait for a reply before giving up on a request
+		uint32_t ResponseTimeoutInMilliseconds;
+
+		// How many times a request that got no reply is sent again. Zero never resends.
+		uint32_t MaxRetryCount;
+
+		// Most requests allowed to be awaiting a reply at once. Zero means no limit.
+		uint32_t WindowSize;
+	};
+
+	// A request that has been sent, and is waiting on its reply
+	struct MspInFlightRequest
+	{
+		MspTransmitKey Key;
+
+		// The request itself, kept so it can be sent again if no reply comes
+		MspTransmitFrame Frame;
+
+		// When the last byte of the request should have left the port, going by baud rate
+		boost::posix_time::ptime SendTime;
+
+		// How many times this request has been resent already
+		uint32_t RetryCount;
+	};
+
+	// Requests sent to one Flight Controller that have not been answered yet, oldest first.
+	//
+	// MSP answers every request, in the order it was received, with a reply carrying the same message ID
+	// (or an error reply, direction '!', carrying the same ID). So a reply always belongs to the oldest
+	// outstanding request with its ID, even when several requests of the same kind are in flight.
+	//
+	// The window size caps how many requests can be outstanding at once. Keeping several in flight
+	// lets us keep the link busy, rather than waiting out each reply before sending the next request.
+	class MspInFlightRequestTable
+	{
+		public:
+
+			MspInFlightRequestTable() : WindowSize(0), MatchedResponseCount(0), UnmatchedResponseCount(0), TimedOutRequestCount(0)
+			{
+			}
+
+			void SetWindowSize(size_t windowSize)
+			{
+				WindowSize = windowSize;
+			}
+
+			size_t GetWindowSize() const
+			{
+				return WindowSize;
+			}
+
+			// How many more requests can be sent before the window is full
+			size_t GetOpenSlotCount() const
+			{
+				if (WindowSize == 0)
+				{
+					return SIZE_MAX;
+				}
+
+				return (InFlightRequests.size() >= WindowSize) ? 0 : WindowSize - InFlightRequests.size();
+			}
+
+			void Add(MspInFlightRequest inFlightRequest)
+			{
+				InFlightRequests.push_back(std::move(inFlightRequest));
+			}
+
+			// Match a reply to the request it answers, taking that request out of the table.
+			// Returns false if nothing was waiting on a reply with this ID (i.e. the request had already timed out).
+			bool MatchResponse(uint16_t messageID, const boost::posix_time::ptime & receiveTime, int64_t & roundTripTimeInMilliseconds)
+			{
+				for (auto inFlightIterator = InFlightRequests.begin(); inFlightIterator != InFlightRequests.end(); ++inFlightIterator)
+				{
+					if (inFlightIterator->Key.MessageID == messageID)
+					{
+						// SendTime is an estimate; a quick reply can appear to beat it
+						roundTripTimeInMilliseconds = std::max((int64_t)0, (int64_t)(receiveTime - inFlightIterator->SendTime).total_milliseconds());
+						InFlightRequests.erase(inFlightIterator);
+						MatchedResponseCount++;
+						return true;
+					}
+				}
+
+				UnmatchedResponseCount++;
+				return false;
+			}
+
+			// Take out every request that has waited longer than the timeout, handing them back oldest first
+			size_t TakeTimedOutRequests(const boost::posix_time::ptime & now, uint32_t timeoutInMilliseconds, std::vector<MspInFlightRequest> & timedOutRequests)
+			{
+				boost::posix_time::ptime oldestAllowedSendTime = now - boost::posix_time::milliseconds(timeoutInMilliseconds);
+
+				size_t timedOutCount = 0;
+				auto inFlightIterator = InFlightRequests.begin();
+				while (inFlightIterator != InFlightRequests.end())
+				{
+					if (inFlightIterator->SendTime < oldestAllowedSendTime)
+					{
+						timedOutRequests.push_back(std::move(*inFlightIterator));
+						inFlightIterator = InFlightRequests.erase(inFlightIterator);
+						timedOutCount++;
+					}
+					else
+					{
+						++inFlightIterator;
+					}
+				}
+
+				TimedOutRequestCount += timedOutCount;
+				return timedOutCount;
+			}
+
+			// Call visitor(request) for each request awaiting a reply, oldest first
+			template <typename Visitor>
+			void VisitInFlightRequests(Visitor visitor) const
+			{
+				for (const auto & inFlightRequest : InFlightRequests)
+				{
+					visitor(inFlightRequest);
+				}
+			}
+
+			bool IsEmpty() const
+			{
+				return InFlightRequests.empty();
+			}
+
+			size_t GetCount() const
+			{
+				return InFlightRequests.size();
+			}
+
+			void Clear()
+			{
+				InFlightRequests.clear();
+			}
+
+			// Running totals, for diagnostics
+			uint64_t GetMatchedResponseCount() const
+			{
+				return MatchedResponseCount;
+			}
+
+			uint64_t GetUnmatchedResponseCount() const
+			{
+				return UnmatchedResponseCount;
+			}
+
+			uint64_t GetTimedOutRequestCount() const
+			{
+				return TimedOutRequestCount;
+			}
+
+		private:
+
+			std::vector<MspInFlightRequest> InFlightRequests;
+			size_t WindowSize;
+			uint64_t MatchedResponseCount;
+			uint64_t UnmatchedResponseCount;
+			uint64_t TimedOutRequestCount;
+	};
+
+} // Namespace CraftServices
+
+#endif // MSPINFLIGHTREQUESTTABLE_HPP
@@ -0,0 +1,512 @@
+/*
+ * This file is part of CraftServices.
+ *
+ * CraftServices is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CraftServices is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CraftServices. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <atomic>
+#include <algorithm>
+#include <cctype>
+
+#include "MspLinkCapture.hpp"
+
+namespace CraftServices
+{
+	static_assert(sizeof(MspCaptureSegmentHeader) == 128, "Capture segment header must stay 128 bytes");
+
+	// Constructor
+	MspLinkCaptureRecorder::MspLinkCaptureRecorder(const std::string & filePathPrefix, const std::string & portName, uint32_t baudRate, uint64_t segmentByteCount) :
+		FilePathPrefix(filePathPrefix), PortName(portName), BaudRate(baudRate), SegmentByteCount(segmentByteCount)
+	{
+		Recording = false;
+		CaptureStartUnixTimeInMicroseconds = 0;
+		pCurrentSegmentRegion = NULL;
+		pCurrentSegmentBytes = NULL;
+		CurrentSegmentOffset = 0;
+		NextSegmentIndex = 0;
+		pSegmentPreparationThread = NULL;
+		pPreparedSegmentRegion = NULL;
+		PreparedSegmentReady = false;
+		RecordedByteCount = 0;
+	}
+
+	// Destructor
+	MspLinkCaptureRecorder::~MspLinkCaptureRecorder()
+	{
+		FinishCurrentSegment();
+		DiscardPreparedSegment();
+	}
+
+	std::string MspLinkCaptureRecorder::GetFileSafePortName(const std::string & portName)
+	{
+		std::string fileSafePortName = portName;
+		std::replace_if(fileSafePortName.begin(), fileSafePortName.end(), [](char portNameCharacter) { 
+			return portNameCharacter == '/' || portNameCharacter == '\\' || portNameCharacter == ':'; 
+		}, '_');
+		return fileSafePortName;
+	}
+
+	std::string MspLinkCaptureRecorder::GetSegmentFilePath(const std::string & filePathPrefix, const std::string & portName, uint32_t segmentIndex)
+	{
+		char segmentIndexString[16];
+		std::snprintf(segmentIndexString, sizeof(segmentIndexString), "%04u", segmentIndex);
+		return filePathPrefix + "--Capture_" + GetFileSafePortName(portName) + "_" + segmentIndexString + ".cscap";
+	}
+
+	bool MspLinkCaptureRecorder::Start(std::string & errorMessage)
+	{
+		CaptureStartSteadyTime = std::chrono::steady_clock::now();
+		CaptureStartUnixTimeInMicroseconds = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+		Recording = true;
+		Recording = StartNextSegment();
+		errorMessage = ErrorMessage;
+		return Recording;
+	}
+
+	void MspLinkCaptureRecorder::RecordReceived(const uint8_t * pReceivedBytes, size_t byteCount)
+	{
+		// A read never comes close to the record limit, but split it up anyway rather than lose any of it
+		while (byteCount > 0)
+		{
+			size_t recordByteCount = std::min(byteCount, MspCaptureFormat::MaxRecordDataByteCount);
+			if (!MakeRoomForRecord(recordByteCount))
+			{
+				return;
+			}
+
+			std::memcpy(BeginRecord(recordByteCount), pReceivedBytes, recordByteCount);
+			EndRecord(MspCaptureRecordType::Received, recordByteCount);
+
+			pReceivedBytes += recordByteCount;
+			byteCount -= recordByteCount;
+		}
+	}
+
+	// A write goes out as one gather list, so it's recorded as one record (or more, if it's very large)
+	void MspLinkCaptureRecorder::RecordTransmitted(const std::vector<boost::asio::const_buffer> & transmittedBuffers)
+	{
+		size_t byteCountLeft = boost::asio::buffer_size(transmittedBuffers);
+		size_t bufferIndex = 0;
+		size_t bufferOffset = 0;
+
+		while (byteCountLeft > 0)
+		{
+			size_t recordByteCount = std::min(byteCountLeft, MspCaptureFormat::MaxRecordDataByteCount);
+			if (!MakeRoomForRecord(recordByteCount))
+			{
+				return;
+			}
+
+			uint8_t * pRecordData = BeginRecord(recordByteCount);
+			size_t copiedByteCount = 0;
+			while (copiedByteCount < recordByteCount)
+			{
+				const boost::asio::const_buffer & transmittedBuffer = transmittedBuffers[bufferIndex];
+				size_t copyByteCount = std::min(transmittedBuffer.size() - bufferOffset, recordByteCount - copiedByteCount);
+				std::memcpy(pRecordData + copiedByteCount, (const uint8_t *)transmittedBuffer.data() + bufferOffset, copyByteCount);
+				copiedByteCount += copyByteCount;
+				bufferOffset += copyByteCount;
+				if (bufferOffset == transmittedBuffer.size())
+				{
+					bufferIndex++;
+					bufferOffset = 0;
+				}
+			}
+			EndRecord(MspCaptureRecordType::Transmitted, recordByteCount);
+
+			byteCountLeft -= recordByteCount;
+		}
+	}
+
+	void MspLinkCaptureRecorder::RecordPortEvent(const std::string & portEventDescription)
+	{
+		size_t recordByteCount = std::min(portEventDescription.size(), MspCaptureFormat::MaxRecordDataByteCount);
+		if (!MakeRoomForRecord(recordByteCount))
+		{
+			return;
+		}
+
+		std::memcpy(BeginRecord(recordByteCount), portEventDescription.data(), recordByteCount);
+		EndRecord(MspCaptureRecordType::PortEvent, recordByteCount);
+	}
+
+	bool MspLinkCaptureRecorder::MakeRoomForRecord(size_t dataByteCount)
+	{
+		if (!Recording)
+		{
+			return false;
+		}
+
+		size_t recordByteCount = MspCaptureFormat::RecordHeaderByteCount + dataByteCount;
+		if (CurrentSegmentOffset + recordByteCount <= SegmentByteCount)
+		{
+			// Half full; time to get the next one ready
+			if (pSegmentPreparationThread == NULL && CurrentSegmentOffset + recordByteCount > SegmentByteCount / 2)
+			{
+				StartPreparingNextSegment();
+			}
+			return true;
+		}
+
+		if (sizeof(MspCaptureSegmentHeader) + recordByteCount > SegmentByteCount)
+		{
+			ErrorMessage = "Capture segments are too small to hold a " + std::to_string(dataByteCount) + " byte record";
+			Recording = false;
+			return false;
+		}
+
+		Recording = StartNextSegment();
+		return Recording;
+	}
+
+	bool MspLinkCaptureRecorder::CreateZeroFilledSegmentFile(const std::string & segmentFilePath) const
+	{
+		std::filebuf segmentFile;
+		if (segmentFile.open(segmentFilePath, std::ios::out | std::ios::binary | std::ios::trunc) == NULL)
+		{
+			return false;
+		}
+
+		static const char ZeroBytes[64 * 1024] = { 0 };
+		uint64_t byteCountLeft = SegmentByteCount;
+		while (byteCountLeft > 0)
+		{
+			std::streamsize writeByteCount = (std::streamsize)std::min(byteCountLeft, (uint64_t)sizeof(ZeroBytes));
+			if (segmentFile.sputn(ZeroBytes, writeByteCount) != writeByteCount)
+			{
+				return false;
+			}
+			byteCountLeft -= (uint64_t)writeByteCount;
+		}
+
+		// Anything still buffered has to make it out too; close() reports whether it did
+		return segmentFile.pubsync() != -1 && segmentFile.close() != NULL;
+	}
+
+	bool MspLinkCaptureRecorder::CreateAndMapSegment(const std::string & segmentFilePath, boost::interprocess::mapped_region * & pSegmentRegion, std::string & errorMessage) const
+	{
+		try
+		{
+			// Create the file at full size, all zeroes (so every record after the last one written reads as the end).
+			// The zeroes are written out, not just seeked past: that way the disk space is really taken up front,
+			// and a full disk fails the segment here. A sparse file would only find out when a record is copied
+			// into the mapping - which kills the process (SIGBUS, or an in-page exception on Windows).
+			if (!CreateZeroFilledSegmentFile(segmentFilePath))
+			{
+				errorMessage = "Could not create capture segment " + segmentFilePath + " (is the disk full?)";
+				std::remove(segmentFilePath.c_str());
+				return false;
+			}
+
+			boost::interprocess::file_mapping segmentMapping(segmentFilePath.c_str(), boost::interprocess::read_write);
+			pSegmentRegion = new boost::interprocess::mapped_region(segmentMapping, boost::interprocess::read_write, 0, (size_t)SegmentByteCount);
+		}
+		catch (const boost::interprocess::interprocess_exception & e)
+		{
+			errorMessage = "Could not map capture segment " + segmentFilePath + ": " + e.what();
+			return false;
+		}
+
+		return true;
+	}
+
+	void MspLinkCaptureRecorder::StartPreparingNextSegment()
+	{
+		PreparedSegmentFilePath = GetSegmentFilePath(FilePathPrefix, PortName, NextSegmentIndex);
+		pPreparedSegmentRegion = NULL;
+		PreparedSegmentReady = false;
+		PreparedSegmentErrorMessage.clear();
+
+		pSegmentPreparationThread = new boost::thread([this]()
+		{
+			PreparedSegmentReady = CreateAndMapSegment(PreparedSegmentFilePath, pPreparedSegmentRegion, PreparedSegmentErrorMessage);
+		});
+	}
+
+	bool MspLinkCaptureRecorder::TakePreparedSegment()
+	{
+		pSegmentPreparationThread->join();
+		delete pSegmentPreparationThread;
+		pSegmentPreparationThread = NULL;
+
+		if (!PreparedSegmentReady)
+		{
+			ErrorMessage = PreparedSegmentErrorMessage;
+			return false;
+		}
+
+		pCurrentSegmentRegion = pPreparedSegmentRegion;
+		pPreparedSegmentRegion = NULL;
+		PreparedSegmentReady = false;
+		CurrentSegmentFilePath = PreparedSegmentFilePath;
+		return true;
+	}
+
+	void MspLinkCaptureRecorder::DiscardPreparedSegment()
+	{
+		if (pSegmentPreparationThread == NULL)
+		{
+			return;
+		}
+
+		pSegmentPreparationThread->join();
+		delete pSegmentPreparationThread;
+		pSegmentPreparationThread = NULL;
+
+		// Never written to, so there's nothing in it worth keeping
+		if (PreparedSegmentReady)
+		{
+			delete pPreparedSegmentRegion;
+			pPreparedSegmentRegion = NULL;
+			PreparedSegmentReady = false;
+			std::remove(PreparedSegmentFilePath.c_str());
+		}
+	}
+
+	bool MspLinkCaptureRecorder::StartNextSegment()
+	{
+		FinishCurrentSegment();
+
+		// Only not already under way for the first segment, or a record too big to have passed half way first
+		if (pSegmentPreparationThread == NULL)
+		{
+			StartPreparingNextSegment();
+		}
+		if (!TakePreparedSegment())
+		{
+			return false;
+		}
+
+		pCurrentSegmentBytes = (uint8_t *)pCurrentSegmentRegion->get_address();
+
+		MspCaptureSegmentHeader segmentHeader;
+		std::memset(&segmentHeader, 0, sizeof(segmentHeader));
+		std::memcpy(segmentHeader.Magic, MspCaptureFormat::Magic, sizeof(segmentHeader.Magic));
+		segmentHeader.FormatVersion = MspCaptureSegmentHeader::CurrentFormatVersion;
+		segmentHeader.HeaderByteCount = sizeof(MspCaptureSegmentHeader);
+		segmentHeader.SegmentByteCount = SegmentByteCount;
+		segmentHeader.SegmentIndex = NextSegmentIndex;
+		segmentHeader.BaudRate = BaudRate;
+		segmentHeader.CaptureStartUnixTimeInMicroseconds = CaptureStartUnixTimeInMicroseconds;
+		segmentHeader.SegmentStartTimeInMicroseconds = GetCaptureTimeInMicroseconds();
+		std::strncpy(segmentHeader.PortName, PortName.c_str(), sizeof(segmentHeader.PortName) - 1);
+		std::memcpy(pCurrentSegmentBytes, &segmentHeader, sizeof(segmentHeader));
+
+		CurrentSegmentOffset = sizeof(MspCaptureSegmentHeader);
+		NextSegmentIndex++;
+		return true;
+	}
+
+	// Ask the OS to write the finished segment out (without waiting on it), and let it go
+	void MspLinkCaptureRecorder::FinishCurrentSegment()
+	{
+		if (pCurrentSegmentRegion == NULL)
+		{
+			return;
+		}
+
+		pCurrentSegmentRegion->flush(0, CurrentSegmentOffset, true);
+		delete pCurrentSegmentRegion;
+		pCurrentSegmentRegion = NULL;
+		pCurrentSegmentBytes = NULL;
+	}
+
+	uint8_t * MspLinkCaptureRecorder::BeginRecord(size_t dataByteCount)
+	{
+		uint8_t * pRecord = pCurrentSegmentBytes + CurrentSegmentOffset;
+		uint16_t recordByteCount = (uint16_t)dataByteCount;
+		uint64_t recordTimeInMicroseconds = GetCaptureTimeInMicroseconds();
+		std::memcpy(pRecord + MspCaptureFormat::RecordByteCountOffset, &recordByteCount, sizeof(recordByteCount));
+		std::memcpy(pRecord + MspCaptureFormat::RecordTimeOffset, &recordTimeInMicroseconds, sizeof(recordTimeInMicroseconds));
+		return pRecord + MspCaptureFormat::RecordHeaderByteCount;
+	}
+
+	void MspLinkCaptureRecorder::EndRecord(MspCaptureRecordType recordType, size_t dataByteCount)
+	{
+		uint8_t * pRecord = pCurrentSegmentBytes + CurrentSegmentOffset;
+
+		// Everything else in the record has to be in place before the type marks it as there
+		std::atomic_thread_fence(std::memory_order_release);
+		pRecord[MspCaptureFormat::RecordTypeOffset] = (uint8_t)recordType;
+
+		CurrentSegmentOffset += MspCaptureFormat::RecordHeaderByteCount + dataByteCount;
+		RecordedByteCount += dataByteCount;
+	}
+
+	uint64_t MspLinkCaptureRecorder::GetCaptureTimeInMicroseconds() const
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - CaptureStartSteadyTime).count();
+	}
+
+	// Constructor
+	MspLinkCaptureReader::MspLinkCaptureReader()
+	{
+		CurrentSegmentIndex = 0;
+		std::memset(&FirstSegmentHeader, 0, sizeof(FirstSegmentHeader));
+		pCurrentSegmentRegion = NULL;
+		pCurrentSegmentBytes = NULL;
+		CurrentSegmentByteCount = 0;
+		CurrentSegmentOffset = 0;
+		SegmentCount = 0;
+	}
+
+	// Destructor
+	MspLinkCaptureReader::~MspLinkCaptureReader()
+	{
+		CloseSegment();
+	}
+
+	bool MspLinkCaptureReader::Open(const std::string & segmentFilePath, std::string & errorMessage)
+	{
+		// Work out where the later segments will be, if this one is named the way the recorder names them
+		const std::string SegmentFileExtension = ".cscap";
+		SegmentFilePathBase.clear();
+		size_t indexSeparatorPosition = segmentFilePath.rfind('_');
+		if (indexSeparatorPosition != std::string::npos && 
+			segmentFilePath.size() > SegmentFileExtension.size() &&
+			segmentFilePath.compare(segmentFilePath.size() - SegmentFileExtension.size(), SegmentFileExtension.size(), SegmentFileExtension) == 0)
+		{
+			std::string segmentIndexString = segmentFilePath.substr(indexSeparatorPosition + 1, segmentFilePath.size() - SegmentFileExtension.size() - indexSeparatorPosition - 1);
+			if (!segmentIndexString.empty() && std::all_of(segmentIndexString.begin(), segmentIndexString.end(), ::isdigit))
+			{
+				SegmentFilePathBase = segmentFilePath.substr(0, indexSeparatorPosition);
+				CurrentSegmentIndex = (uint32_t)std::stoul(segmentIndexString);
+			}
+		}
+
+		if (!OpenSegment(segmentFilePath, errorMessage))
+		{
+			return false;
+		}
+
+		std::memcpy(&FirstSegmentHeader, pCurrentSegmentBytes, sizeof(FirstSegmentHeader));
+		return true;
+	}
+
+	std::string MspLinkCaptureReader::GetPortName() const
+	{
+		return std::string(FirstSegmentHeader.PortName, strnlen(FirstSegmentHeader.PortName, sizeof(FirstSegmentHeader.PortName)));
+	}
+
+	bool MspLinkCaptureReader::ReadNextRecord(MspCaptureRecord & record)
+	{
+		while (pCurrentSegmentBytes != NULL)
+		{
+			if (CurrentSegmentOffset + MspCaptureFormat::RecordHeaderByteCount <= CurrentSegmentByteCount)
+			{
+				const uint8_t * pRecord = pCurrentSegmentBytes + CurrentSegmentOffset;
+				uint16_t recordByteCount = 0;
+				std::memcpy(&recordByteCount, pRecord + MspCaptureFormat::RecordByteCountOffset, sizeof(recordByteCount));
+
+				if (pRecord[MspCaptureFormat::RecordTypeOffset] != (uint8_t)MspCaptureRecordType::End &&
+					CurrentSegmentOffset + MspCaptureFormat::RecordHeaderByteCount + recordByteCount <= CurrentSegmentByteCount)
+				{
+					record.Type = (MspCaptureRecordType)pRecord[MspCaptureFormat::RecordTypeOffset];
+					std::memcpy(&record.TimeInMicroseconds, pRecord + MspCaptureFormat::RecordTimeOffset, sizeof(record.TimeInMicroseconds));
+					record.pData = pRecord + MspCaptureFormat::RecordHeaderByteCount;
+					record.ByteCount = recordByteCount;
+
+					CurrentSegmentOffset += MspCaptureFormat::RecordHeaderByteCount + recordByteCount;
+					return true;
+				}
+			}
+
+			// This segment is done; on to the next, if there is one
+			if (!OpenNextSegment())
+			{
+				break;
+			}
+		}
+
+		return false;
+	}
+
+	bool MspLinkCaptureReader::OpenSegment(const std::string & segmentFilePath, std::string & errorMessage)
+	{
+		CloseSegment();
+
+		try
+		{
+			boost::interprocess::file_mapping segmentMapping(segmentFilePath.c_str(), boost::interprocess::read_only);
+			pCurrentSegmentRegion = new boost::interprocess::mapped_region(segmentMapping, boost::interprocess::read_only);
+		}
+		catch (const boost::interprocess::interprocess_exception & e)
+		{
+			errorMessage = "Could not open capture segment " + segmentFilePath + ": " + e.what();
+			return false;
+		}
+
+		pCurrentSegmentBytes = (const uint8_t *)pCurrentSegmentRegion->get_address();
+		CurrentSegmentByteCount = pCurrentSegmentRegion->get_size();
+
+		MspCaptureSegmentHeader segmentHeader;
+		if (CurrentSegmentByteCount < sizeof(segmentHeader))
+		{
+			errorMessage = segmentFilePath + " is too small to be a capture segment";
+			CloseSegment();
+			return false;
+		}
+
+		std::memcpy(&segmentHeader, pCurrentSegmentBytes, sizeof(segmentHeader));
+		if (std::memcmp(segmentHeader.Magic, MspCaptureFormat::Magic, sizeof(segmentHeader.Magic)) != 0)
+		{
+			errorMessage = segmentFilePath + " is not a capture segment";
+			CloseSegment();
+			return false;
+		}
+		if (segmentHeader.FormatVersion != MspCaptureSegmentHeader::CurrentFormatVersion || 
+			segmentHeader.HeaderByteCount < sizeof(segmentHeader) || segmentHeader.HeaderByteCount > CurrentSegmentByteCount)
+		{
+			errorMessage = segmentFilePath + " is capture format version " + std::to_string(segmentHeader.FormatVersion) + 
+				", which this version can't read";
+			CloseSegment();
+			return false;
+		}
+
+		CurrentSegmentOffset = segmentHeader.HeaderByteCount;
+		SegmentCount++;
+		return true;
+	}
+
+	void MspLinkCaptureReader::CloseSegment()
+	{
+		delete pCurrentSegmentRegion;
+		pCurrentSegmentRegion = NULL;
+		pCurrentSegmentBytes = NULL;
+		CurrentSegmentByteCount = 0;
+		CurrentSegmentOffset = 0;
+	}
+
+	bool MspLinkCaptureReader::OpenNextSegment()
+	{
+		CloseSegment();
+		if (SegmentFilePathBase.empty())
+		{
+			return false;
+		}
+
+		CurrentSegmentIndex++;
+		char segmentIndexString[16];
+		std::snprintf(segmentIndexString, sizeof(segmentIndexString), "%04u", CurrentSegmentIndex);
+
+		// A segment that isn't there just means the capture ended with the one before it
+		std::string ignoredErrorMessage;
+		return OpenSegment(SegmentFilePathBase + "_" + segmentIndexString + ".cscap", ignoredErrorMessage);
+	}
+
+} // Namespace CraftServices
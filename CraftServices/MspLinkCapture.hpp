@@ -0,0 +1,281 @@
+/*
+ * This file is part of CraftServices.
+ *
+ * CraftServices is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CraftServices is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CraftServices. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Raw capture of everything that goes over a port, for working out afterwards what a link was actually doing.
+//
+// A capture is a series of segment files per port. Each segment is created at full size ahead of time (off the IO
+// path) and mapped into memory, so recording a chunk of bytes is a copy into memory -- no system calls on the IO
+// path. If the program dies, whatever was copied in is still in the (shared) mapping, and the operating system
+// writes it out.
+//
+// Segment layout (all values little-endian):
+//
+//   MspCaptureSegmentHeader (128 bytes)
+//   Records, one after another, each:
+//     uint8_t   Record type (MspCaptureRecordType)
+//     uint8_t   Reserved, zero
+//     uint16_t  Byte count of the data that follows
+//     uint64_t  Time, in microseconds since the capture started (steady clock, so never goes backwards)
+//     uint8_t[] The data
+//   Zeroes to the end of the segment
+//
+// The type byte is written last, after the rest of the record is in place. The file starts out all zeroes, and
+// a zero type marks the end of the records, so a record cut short by a crash is never mistaken for a whole one.
+
+#ifndef MSPLINKCAPTURE_HPP
+#define MSPLINKCAPTURE_HPP
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+#include <boost/asio.hpp>
+#include <boost/thread.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+namespace CraftServices
+{
+	enum class MspCaptureRecordType : uint8_t
+	{
+		// No more records in this segment
+		End = 0,
+		// Bytes read from the port
+		Received = 1,
+		// Bytes written to the port
+		Transmitted = 2,
+		// Something happened to the port (opened, reset, etc); the data is a short text description
+		PortEvent = 3
+	};
+
+	// At the start of every segment file
+	struct MspCaptureSegmentHeader
+	{
+		static const uint32_t CurrentFormatVersion = 1;
+
+		// "CSCAPTUR"
+		char Magic[8];
+		uint32_t FormatVersion;
+		uint32_t HeaderByteCount;
+		uint64_t SegmentByteCount;
+		// 0 for the first segment of a capture, and so on
+		uint32_t SegmentIndex;
+		uint32_t BaudRate;
+		// Wall clock time the capture started, in microseconds since 1970 (UTC). Record times are relative to this.
+		uint64_t CaptureStartUnixTimeInMicroseconds;
+		// When this segment was started, in microseconds since the capture started
+		uint64_t SegmentStartTimeInMicroseconds;
+		// Port the capture is of, zero terminated
+		char PortName[64];
+		uint8_t Reserved[16];
+	};
+
+	namespace MspCaptureFormat
+	{
+		static const char Magic[8] = { 'C', 'S', 'C', 'A', 'P', 'T', 'U', 'R' };
+
+		static const size_t RecordHeaderByteCount = 12;
+		static const size_t RecordTypeOffset = 0;
+		static const size_t RecordByteCountOffset = 2;
+		static const size_t RecordTimeOffset = 4;
+
+		// Largest amount of data a single record can hold
+		static const size_t MaxRecordDataByteCount = 0xFFFF;
+	}
+
+	// How (and whether) to capture raw traffic
+	struct MspLinkCaptureSettings
+	{
+		bool Enabled;
+
+		// Size of each segment file. A new segment is started when one fills up.
+		uint64_t SegmentByteCount;
+	};
+
+	// Records one port's traffic into capture segments. Not thread safe; each session records from its own strand.
+	//
+	// Writing out a whole segment's worth of zeroes takes a while, so once the current segment is half full, the
+	// next one is created and mapped on a helper thread. Moving on to it is then just a swap of mappings.
+	//
+	// Should a segment file fail to be created, recording stops (and says why) rather than taking the session down.
+	class MspLinkCaptureRecorder
+	{
+		public:
+
+			// Segment files are named "<filePathPrefix>--Capture_<port>_<segment index>.cscap"
+			MspLinkCaptureRecorder(const std::string & filePathPrefix, const std::string & portName, uint32_t baudRate, uint64_t segmentByteCount);
+			~MspLinkCaptureRecorder();
+
+			// Create the first segment. Returns false (with errorMessage set) if it couldn't be.
+			bool Start(std::string & errorMessage);
+
+			void RecordReceived(const uint8_t * pReceivedBytes, size_t byteCount);
+			void RecordTransmitted(const std::vector<boost::asio::const_buffer> & transmittedBuffers);
+			void RecordPortEvent(const std::string & portEventDescription);
+
+			bool IsRecording() const
+			{
+				return Recording;
+			}
+
+			// Why recording stopped, if it did
+			const std::string & GetErrorMessage() const
+			{
+				return ErrorMessage;
+			}
+
+			const std::string & GetCurrentSegmentFilePath() const
+			{
+				return CurrentSegmentFilePath;
+			}
+
+			// Running totals, for diagnostics
+			uint64_t GetRecordedByteCount() const
+			{
+				return RecordedByteCount;
+			}
+
+			uint32_t GetSegmentCount() const
+			{
+				return NextSegmentIndex;
+			}
+
+			static std::string GetSegmentFilePath(const std::string & filePathPrefix, const std::string & portName, uint32_t segmentIndex);
+			// The port name with anything that can't go in a file name (i.e. the slashes in "/dev/ttyUSB0") replaced
+			static std::string GetFileSafePortName(const std::string & portName);
+
+		private:
+
+			// Room for a record holding this much data, starting a new segment if need be. False if recording has stopped.
+			bool MakeRoomForRecord(size_t dataByteCount);
+			bool StartNextSegment();
+			void FinishCurrentSegment();
+
+			// Create and map the next segment on the helper thread
+			void StartPreparingNextSegment();
+			// Wait for the next segment to be ready (normally it long since is), and make it the current one.
+			// False (with ErrorMessage set) if it couldn't be created.
+			bool TakePreparedSegment();
+			// Stop waiting for a segment that won't be used, and clean up after it
+			void DiscardPreparedSegment();
+
+			// These run on the helper thread, so only use what doesn't change once recording starts
+			// Full size, all zeroes, and mapped. False (with errorMessage set) if it couldn't be.
+			bool CreateAndMapSegment(const std::string & segmentFilePath, boost::interprocess::mapped_region * & pSegmentRegion, std::string & errorMessage) const;
+			// Full size, with the disk space actually taken. False if it couldn't be.
+			bool CreateZeroFilledSegmentFile(const std::string & segmentFilePath) const;
+
+			// Write a record's header (all but its type), returning where its data goes
+			uint8_t * BeginRecord(size_t dataByteCount);
+			// Mark the record written by BeginRecord() as complete
+			void EndRecord(MspCaptureRecordType recordType, size_t dataByteCount);
+
+			uint64_t GetCaptureTimeInMicroseconds() const;
+
+			const std::string FilePathPrefix;
+			const std::string PortName;
+			const uint32_t BaudRate;
+			const uint64_t SegmentByteCount;
+
+			bool Recording;
+			std::string ErrorMessage;
+
+			std::chrono::steady_clock::time_point CaptureStartSteadyTime;
+			uint64_t CaptureStartUnixTimeInMicroseconds;
+
+			boost::interprocess::mapped_region * pCurrentSegmentRegion;
+			std::string CurrentSegmentFilePath;
+			uint8_t * pCurrentSegmentBytes;
+			size_t CurrentSegmentOffset;
+			uint32_t NextSegmentIndex;
+
+			// The next segment, while (and after) the helper thread prepares it. Only touched by the helper
+			// thread until it has been joined.
+			boost::thread * pSegmentPreparationThread;
+			std::string PreparedSegmentFilePath;
+			boost::interprocess::mapped_region * pPreparedSegmentRegion;
+			bool PreparedSegmentReady;
+			std::string PreparedSegmentErrorMessage;
+
+			uint64_t RecordedByteCount;
+	};
+
+	// One record read back from a capture. The data points into the mapped segment, and is only good until the next read.
+	struct MspCaptureRecord
+	{
+		MspCaptureRecordType Type;
+		// Microseconds since the capture started
+		uint64_t TimeInMicroseconds;
+		const uint8_t * pData;
+		size_t ByteCount;
+	};
+
+	// Reads a capture back, record by record, moving on through its segment files in order.
+	//
+	// A capture cut short by a crash reads back up to the last complete record. A segment that is missing ends
+	// the capture there.
+	class MspLinkCaptureReader
+	{
+		public:
+
+			MspLinkCaptureReader();
+			~MspLinkCaptureReader();
+
+			// Open a capture at the given segment file (normally the first, "..._0000.cscap"). Returns false
+			// (with errorMessage set) if it isn't a capture segment this version can read.
+			bool Open(const std::string & segmentFilePath, std::string & errorMessage);
+
+			// Returns false once there are no more records
+			bool ReadNextRecord(MspCaptureRecord & record);
+
+			// Header of the segment the capture was opened at
+			const MspCaptureSegmentHeader & GetHeader() const
+			{
+				return FirstSegmentHeader;
+			}
+
+			std::string GetPortName() const;
+
+			uint32_t GetSegmentCount() const
+			{
+				return SegmentCount;
+			}
+
+		private:
+
+			bool OpenSegment(const std::string & segmentFilePath, std::string & errorMessage);
+			void CloseSegment();
+			// False if the capture has no more segments
+			bool OpenNextSegment();
+
+			// Segment paths are "<base>_<index>.cscap"; base is empty if the file wasn't named that way
+			std::string SegmentFilePathBase;
+			uint32_t CurrentSegmentIndex;
+
+			MspCaptureSegmentHeader FirstSegmentHeader;
+
+			boost::interprocess::mapped_region * pCurrentSegmentRegion;
+			const uint8_t * pCurrentSegmentBytes;
+			size_t CurrentSegmentByteCount;
+			size_t CurrentSegmentOffset;
+			uint32_t SegmentCount;
+	};
+
+} // Namespace CraftServices
+
+#endif // MSPLINKCAPTURE_HPP
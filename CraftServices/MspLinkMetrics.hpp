@@ -0,0 +1,442 @@
+/*
+ * This file is part of CraftServices.
+ *
+ * CraftServices is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CraftServices is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CraftServices. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Link quality metrics, per port and per message ID.
+//
+// Everything here is updated from a session's own strand and may be read at any time from any other thread
+// (i.e. by an exporter), so the counters are relaxed atomics: no locks on the paths that update them, and
+// a reader sees each value whole, if not every value from the same instant.
+
+#ifndef MSPLINKMETRICS_HPP
+#define MSPLINKMETRICS_HPP
+
+#include <atomic>
+#include <array>
+#include <vector>
+#include <map>
+#include <memory>
+#include <string>
+#include <cstdint>
+
+#include <boost/thread/mutex.hpp>
+
+namespace CraftServices
+{
+	// A count that only goes up
+	class MetricCounter
+	{
+		public:
+
+			MetricCounter() : Value(0)
+			{
+			}
+
+			void Add(uint64_t amount = 1)
+			{
+				Value.fetch_add(amount, std::memory_order_relaxed);
+			}
+
+			uint64_t Get() const
+			{
+				return Value.load(std::memory_order_relaxed);
+			}
+
+		private:
+			std::atomic<uint64_t> Value;
+	};
+
+	// A value that can go up and down (i.e. the current refresh interval)
+	class MetricGauge
+	{
+		public:
+
+			MetricGauge() : Value(0)
+			{
+			}
+
+			void Set(int64_t value)
+			{
+				Value.store(value, std::memory_order_relaxed);
+			}
+
+			int64_t Get() const
+			{
+				return Value.load(std::memory_order_relaxed);
+			}
+
+		private:
+			std::atomic<int64_t> Value;
+	};
+
+	// Distribution of a time in milliseconds, in fixed buckets. Each bucket counts the samples at or below its
+	// upper bound and above the bound before it; the last counts everything past the largest bound.
+	class LatencyHistogram
+	{
+		public:
+
+			static const size_t BoundedBucketCount = 12;
+			static const size_t BucketCount = BoundedBucketCount + 1;
+
+			// Upper bound of each bucket, in milliseconds. 1-2-5 steps cover everything from a wired link at speed
+			// to a radio link about to give up.
+			static uint32_t GetBucketUpperBoundInMilliseconds(size_t bucketIndex)
+			{
+				static const uint32_t BucketUpperBoundsInMilliseconds[BoundedBucketCount] = { 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000 };
+				return BucketUpperBoundsInMilliseconds[bucketIndex];
+			}
+
+			LatencyHistogram() : SampleCount(0), SumInMilliseconds(0)
+			{
+				for (auto & bucketCount : BucketCounts)
+				{
+					bucketCount.store(0, std::memory_order_relaxed);
+				}
+			}
+
+			void Record(int64_t milliseconds)
+			{
+				uint64_t sampleInMilliseconds = (milliseconds < 0) ? 0 : (uint64_t)milliseconds;
+
+				size_t bucketIndex = 0;
+				while (bucketIndex < BoundedBucketCount && sampleInMilliseconds > GetBucketUpperBoundInMilliseconds(bucketIndex))
+				{
+					bucketIndex++;
+				}
+
+				BucketCounts[bucketIndex].fetch_add(1, std::memory_order_relaxed);
+				SumInMilliseconds.fetch_add(sampleInMilliseconds, std::memory_order_relaxed);
+				SampleCount.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			// Samples in this one bucket (not cumulative)
+			uint64_t GetBucketCount(size_t bucketIndex) const
+			{
+				return BucketCounts[bucketIndex].load(std::memory_order_relaxed);
+			}
+
+			uint64_t GetSampleCount() const
+			{
+				return SampleCount.load(std::memory_order_relaxed);
+			}
+
+			uint64_t GetSumInMilliseconds() const
+			{
+				return SumInMilliseconds.load(std::memory_order_relaxed);
+			}
+
+			// Estimate of the time below which this fraction (0 to 1) of samples fall, interpolating within the
+			// bucket it lands in. Samples past the largest bound are reported as that bound. Zero if there are no samples.
+			uint32_t GetPercentileInMilliseconds(double fraction) const
+			{
+				std::array<uint64_t, BucketCount> bucketCounts;
+				uint64_t totalCount = 0;
+				for (size_t bucketIndex = 0; bucketIndex < BucketCount; bucketIndex++)
+				{
+					bucketCounts[bucketIndex] = GetBucketCount(bucketIndex);
+					totalCount += bucketCounts[bucketIndex];
+				}
+				if (totalCount == 0)
+				{
+					return 0;
+				}
+
+				double targetCount = fraction * (double)totalCount;
+				uint64_t countBelowBucket = 0;
+				for (size_t bucketIndex = 0; bucketIndex < BoundedBucketCount; bucketIndex++)
+				{
+					if ((double)(countBelowBucket + bucketCounts[bucketIndex]) >= targetCount && bucketCounts[bucketIndex] > 0)
+					{
+						double bucketLowerBound = (bucketIndex == 0) ? 0.0 : (double)GetBucketUpperBoundInMilliseconds(bucketIndex - 1);
+						double bucketUpperBound = (double)GetBucketUpperBoundInMilliseconds(bucketIndex);
+						double fractionIntoBucket = (targetCount - (double)countBelowBucket) / (double)bucketCounts[bucketIndex];
+						return (uint32_t)(bucketLowerBound + fractionIntoBucket * (bucketUpperBound - bucketLowerBound) + 0.5);
+					}
+					countBelowBucket += bucketCounts[bucketIndex];
+				}
+				return GetBucketUpperBoundInMilliseconds(BoundedBucketCount - 1);
+			}
+
+		private:
+			std::array<std::atomic<uint64_t>, BucketCount> BucketCounts;
+			std::atomic<uint64_t> SampleCount;
+			std::atomic<uint64_t> SumInMilliseconds;
+	};
+
+	// How one kind of message is faring on a link
+	struct MspMessageMetrics
+	{
+		// Requests of this kind written to the port
+		MetricCounter SentCount;
+		// Replies matched to one of those requests
+		MetricCounter ReplyCount;
+		// Replies with the '!' direction; the Flight Controller didn't like the request
+		MetricCounter ErrorReplyCount;
+		// Requests given up on for want of a reply
+		MetricCounter TimedOutCount;
+		LatencyHistogram RoundTripTime;
+	};
+
+	// A fixed table of metrics, one slot per key (i.e. per message ID). Fixed so it never moves or grows while
+	// being read; slots are claimed the first time a key is used, without locking.
+	template <typename SlotMetrics, size_t SlotCapacity>
+	class MetricsSlotTable
+	{
+		public:
+
+			static const size_t Capacity = SlotCapacity;
+
+			MetricsSlotTable() : OverflowSlotUsed(false)
+			{
+				for (auto & slotKey : SlotKeys)
+				{
+					slotKey.store(EmptySlotKey, std::memory_order_relaxed);
+				}
+			}
+
+			// Metrics for this key. If the table is somehow full, every key without a slot shares a separate
+			// overflow slot, so no key's own slot ever reports another key's numbers.
+			SlotMetrics & Get(uint32_t slotKey)
+			{
+				size_t startIndex = (slotKey * 7) % Capacity;
+				for (size_t probeCount = 0; probeCount < Capacity; probeCount++)
+				{
+					size_t slotIndex = (startIndex + probeCount) % Capacity;
+					uint32_t existingKey = SlotKeys[slotIndex].load(std::memory_order_acquire);
+					if (existingKey == slotKey)
+					{
+						return Slots[slotIndex];
+					}
+					if (existingKey == EmptySlotKey)
+					{
+						if (SlotKeys[slotIndex].compare_exchange_strong(existingKey, slotKey, std::memory_order_acq_rel) || existingKey == slotKey)
+						{
+							return Slots[slotIndex];
+						}
+					}
+				}
+				OverflowSlotUsed.store(true, std::memory_order_relaxed);
+				return OverflowSlot;
+			}
+
+			// Call visitor(key, metrics) for each key seen so far
+			template <typename Visitor>
+			void VisitSlots(Visitor visitor) const
+			{
+				for (size_t slotIndex = 0; slotIndex < Capacity; slotIndex++)
+				{
+					uint32_t slotKey = SlotKeys[slotIndex].load(std::memory_order_acquire);
+					if (slotKey != EmptySlotKey)
+					{
+						visitor(slotKey, Slots[slotIndex]);
+					}
+				}
+			}
+
+			// Call visitor(metrics) for the keys that didn't get a slot of their own, if there have been any
+			template <typename Visitor>
+			void VisitOverflowSlot(Visitor visitor) const
+			{
+				if (OverflowSlotUsed.load(std::memory_order_relaxed))
+				{
+					visitor(OverflowSlot);
+				}
+			}
+
+		private:
+			// Never a message ID (they're 16 bit) or a session ID
+			static const uint32_t EmptySlotKey = 0xFFFFFFFF;
+
+			std::array<std::atomic<uint32_t>, Capacity> SlotKeys;
+			std::array<SlotMetrics, Capacity> Slots;
+			SlotMetrics OverflowSlot;
+			std::atomic<bool> OverflowSlotUsed;
+	};
+
+	// Metrics for every message ID seen on a link
+	typedef MetricsSlotTable<MspMessageMetrics, 32> MspMessageMetricsTable;
+
+	// How old positions from each other session were by the time they had been written to this one, keyed by
+	// the other session's ID. Together, every session's table makes up the source -> destination matrix.
+	//
+	// Unlike the message table, this needs a slot for every other session, however many there are (an emulated
+	// group flight can have hundreds), so it grows as sources turn up, under a lock. Slots never move once made,
+	// and the histograms in them are updated without the lock, as usual.
+	class MspPositionAgeTable
+	{
+		public:
+
+			LatencyHistogram & Get(uint32_t sourceSessionID)
+			{
+				boost::mutex::scoped_lock slotsLock(SlotsMutex);
+				return Slots[sourceSessionID];
+			}
+
+			// Call visitor(sourceSessionID, histogram) for each source seen so far, in session ID order
+			template <typename Visitor>
+			void VisitSlots(Visitor visitor) const
+			{
+				boost::mutex::scoped_lock slotsLock(SlotsMutex);
+				for (const auto & slot : Slots)
+				{
+					visitor(slot.first, slot.second);
+				}
+			}
+
+		private:
+
+			mutable boost::mutex SlotsMutex;
+			std::map<uint32_t, LatencyHistogram> Slots;
+	};
+
+	// Everything we measure about one port's link to its Flight Controller
+	class MspSessionMetrics
+	{
+		public:
+
+			MspSessionMetrics(uint32_t sessionID, const std::string & portName) : SessionID(sessionID), PortName(portName)
+			{
+			}
+
+			// Unique for the life of the program, even across sessions coming and going
+			uint32_t GetSessionID() const
+			{
+				return SessionID;
+			}
+
+			const std::string & GetPortName() const
+			{
+				return PortName;
+			}
+
+			// The craft name arrives after the port opens (and may change), so it is kept under a lock
+			void SetCraftName(const std::string & craftName)
+			{
+				boost::mutex::scoped_lock craftNameLock(CraftNameMutex);
+				CraftName = craftName;
+			}
+
+			std::string GetCraftName() const
+			{
+				boost::mutex::scoped_lock craftNameLock(CraftNameMutex);
+				return CraftName;
+			}
+
+			// Traffic
+			MetricCounter BytesReceived;
+			MetricCounter BytesSent;
+			MetricCounter FramesSent;
+
+			// Polling. A refresh cycle succeeds when every reply comes in before the next refresh is due.
+			MetricCounter RefreshCycleCount;
+			MetricCounter RefreshCycleCompleteCount;
+			LatencyHistogram RefreshCycleDuration;
+
+			// Replies
+			MetricCounter RepliesMatched;
+			// Replies that answered nothing we were waiting on (most likely arriving after their timeout)
+			MetricCounter RepliesUnmatched;
+			MetricCounter RequestsTimedOut;
+			LatencyHistogram RoundTripTime;
+
+			// Why received bytes didn't make it to being a message
+			// Bytes thrown away while looking for the start of a message (bad preamble, line noise)
+			MetricCounter DiscardedByteCount;
+			// Messages that started with a '$' but went bad before they were complete
+			MetricCounter RejectedMessageCount;
+			// Of those, how many made it all the way to the CRC before failing it
+			MetricCounter CrcMismatchCount;
+			// Good messages that were '!' error replies
+			MetricCounter ErrorReplyCount;
+			// Good messages with an ID we don't handle
+			MetricCounter UnknownMessageIdCount;
+
+			// How old other craft positions were when we chose to send them on to this craft
+			LatencyHistogram ForwardedPositionAge;
+			// How old they were once actually written to this craft's port, from when each source decoded it.
+			// This is the delay the pilot sees.
+			MspPositionAgeTable DeliveredPositionAgeBySource;
+
+			// Current state
+			MetricGauge RefreshIntervalInMilliseconds;
+			MetricGauge RequestsInFlight;
+
+			// Per message ID
+			MspMessageMetricsTable Messages;
+
+		private:
+			const uint32_t SessionID;
+			const std::string PortName;
+			std::string CraftName;
+			mutable boost::mutex CraftNameMutex;
+	};
+
+	// Every session's metrics, for whoever wants to read them.
+	//
+	// Sessions register once, when they are created; the lock here only guards the list itself. Metrics stay
+	// alive for as long as anyone holds them, so a reader is never left with a session that was just torn down.
+	class MspMetricsRegistry
+	{
+		public:
+
+			static MspMetricsRegistry & GetInstance()
+			{
+				static MspMetricsRegistry metricsRegistry;
+				return metricsRegistry;
+			}
+
+			std::shared_ptr<MspSessionMetrics> RegisterSession(const std::string & portName)
+			{
+				boost::mutex::scoped_lock sessionsLock(SessionsMutex);
+				std::shared_ptr<MspSessionMetrics> pSessionMetrics = std::make_shared<MspSessionMetrics>(NextSessionID++, portName);
+				Sessions.push_back(pSessionMetrics);
+				return pSessionMetrics;
+			}
+
+			void UnregisterSession(const std::shared_ptr<MspSessionMetrics> & pSessionMetrics)
+			{
+				boost::mutex::scoped_lock sessionsLock(SessionsMutex);
+				for (auto sessionIterator = Sessions.begin(); sessionIterator != Sessions.end(); ++sessionIterator)
+				{
+					if (*sessionIterator == pSessionMetrics)
+					{
+						Sessions.erase(sessionIterator);
+						break;
+					}
+				}
+			}
+
+			// A copy of the list of sessions, so the caller can take its time reading them
+			std::vector<std::shared_ptr<const MspSessionMetrics>> GetSessions() const
+			{
+				boost::mutex::scoped_lock sessionsLock(SessionsMutex);
+				return std::vector<std::shared_ptr<const MspSessionMetrics>>(Sessions.begin(), Sessions.end());
+			}
+
+		private:
+
+			MspMetricsRegistry() : NextSessionID(0)
+			{
+			}
+
+			std::vector<std::shared_ptr<MspSessionMetrics>> Sessions;
+			uint32_t NextSessionID;
+			mutable boost::mutex SessionsMutex;
+	};
+
+} // Namespace CraftServices
+
+#endif // MSPLINKMETRICS_HPP
@@ -0,0 +1,220 @@
+/*
+ * This file is part of CraftServices.
+ *
+ * CraftServices is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CraftServices is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CraftServices. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <map>
+#include <algorithm>
+
+#include "MspMemoryTransport.hpp"
+
+namespace CraftServices
+{
+	std::shared_ptr<MspMemoryLink> MspMemoryLink::GetNamedLink(const std::string & linkName)
+	{
+		static boost::mutex NamedLinksMutex;
+		static std::map<std::string, std::shared_ptr<MspMemoryLink>> NamedLinks;
+
+		boost::mutex::scoped_lock namedLinksLock(NamedLinksMutex);
+		std::shared_ptr<MspMemoryLink> & pNamedLink = NamedLinks[linkName];
+		if (!pNamedLink)
+		{
+			pNamedLink = std::make_shared<MspMemoryLink>();
+		}
+		return pNamedLink;
+	}
+
+	void MspMemoryLink::SendToSession(const uint8_t * pBytes, size_t byteCount)
+	{
+		boost::mutex::scoped_lock linkLock(LinkMutex);
+		BytesToSession.insert(BytesToSession.end(), pBytes, pBytes + byteCount);
+		BytesSentToSessionCount += byteCount;
+		CompletePendingRead();
+	}
+
+	void MspMemoryLink::SetFarEndReceiver(FarEndReceiver farEndReceiver)
+	{
+		boost::mutex::scoped_lock linkLock(LinkMutex);
+		pFarEndReceiver = farEndReceiver ? std::make_shared<FarEndReceiver>(std::move(farEndReceiver)) : NULL;
+	}
+
+	uint64_t MspMemoryLink::GetBytesSentToSessionCount()
+	{
+		boost::mutex::scoped_lock linkLock(LinkMutex);
+		return BytesSentToSessionCount;
+	}
+
+	uint64_t MspMemoryLink::GetBytesReceivedFromSessionCount()
+	{
+		boost::mutex::scoped_lock linkLock(LinkMutex);
+		return BytesReceivedFromSessionCount;
+	}
+
+	void MspMemoryLink::Attach(MspMemoryTransport * pTransport)
+	{
+		boost::mutex::scoped_lock linkLock(LinkMutex);
+		pAttachedTransport = pTransport;
+		ReadPending = false;
+	}
+
+	void MspMemoryLink::Detach(MspMemoryTransport * pTransport)
+	{
+		boost::mutex::scoped_lock linkLock(LinkMutex);
+		if (pAttachedTransport != pTransport)
+		{
+			return;
+		}
+
+		if (ReadPending)
+		{
+			ReadPending = false;
+			pAttachedTransport->PostRead(boost::asio::error::operation_aborted, 0);
+		}
+		pAttachedTransport = NULL;
+	}
+
+	void MspMemoryLink::StartRead(MspMemoryTransport * pTransport, const boost::asio::mutable_buffer & readBuffer)
+	{
+		boost::mutex::scoped_lock linkLock(LinkMutex);
+		if (pAttachedTransport != pTransport)
+		{
+			pTransport->PostRead(boost::asio::error::not_connected, 0);
+			return;
+		}
+
+		ReadPending = true;
+		PendingReadBuffer = readBuffer;
+		CompletePendingRead();
+	}
+
+	void MspMemoryLink::CancelRead(MspMemoryTransport * pTransport)
+	{
+		boost::mutex::scoped_lock linkLock(LinkMutex);
+		if (pAttachedTransport == pTransport && ReadPending)
+		{
+			ReadPending = false;
+			pAttachedTransport->PostRead(boost::asio::error::operation_aborted, 0);
+		}
+	}
+
+	void MspMemoryLink::DiscardBytesToSession()
+	{
+		boost::mutex::scoped_lock linkLock(LinkMutex);
+		BytesToSession.clear();
+	}
+
+	void MspMemoryLink::ReceiveFromSession(const std::vector<boost::asio::const_buffer> & writeBuffers)
+	{
+		std::shared_ptr<FarEndReceiver> pReceiver;
+		{
+			boost::mutex::scoped_lock linkLock(LinkMutex);
+			BytesReceivedFromSessionCount += boost::asio::buffer_size(writeBuffers);
+			pReceiver = pFarEndReceiver;
+		}
+
+		if (pReceiver)
+		{
+			for (const auto & writeBuffer : writeBuffers)
+			{
+				(*pReceiver)((const uint8_t *)writeBuffer.data(), writeBuffer.size());
+			}
+		}
+	}
+
+	void MspMemoryLink::CompletePendingRead()
+	{
+		if (!ReadPending || pAttachedTransport == NULL || BytesToSession.empty())
+		{
+			return;
+		}
+
+		size_t sizeRead = std::min(BytesToSession.size(), PendingReadBuffer.size());
+		std::copy(BytesToSession.begin(), BytesToSession.begin() + sizeRead, (uint8_t *)PendingReadBuffer.data());
+		BytesToSession.erase(BytesToSession.begin(), BytesToSession.begin() + sizeRead);
+
+		ReadPending = false;
+		pAttachedTransport->PostRead(boost::system::error_code(), sizeRead);
+	}
+
+	MspMemoryTransport::MspMemoryTransport(boost::asio::io_context::strand * pSessionStrand, MspTransportListener * pTransportListener, 
+										   std::shared_ptr<MspMemoryLink> pMemoryLink, const std::string & linkName) :
+		MspTransport(pSessionStrand, pTransportListener), pLink(pMemoryLink), LinkName(linkName), Opened(false)
+	{
+	}
+
+	MspMemoryTransport::~MspMemoryTransport()
+	{
+		Close();
+	}
+
+	void MspMemoryTransport::Open()
+	{
+		pLink->Attach(this);
+		Opened = true;
+	}
+
+	void MspMemoryTransport::StartOpen()
+	{
+		Open();
+		PostOpened(boost::system::error_code());
+	}
+
+	void MspMemoryTransport::Close()
+	{
+		if (Opened)
+		{
+			pLink->Detach(this);
+			Opened = false;
+		}
+	}
+
+	bool MspMemoryTransport::IsOpen() const
+	{
+		return Opened;
+	}
+
+	void MspMemoryTransport::Cancel()
+	{
+		pLink->CancelRead(this);
+	}
+
+	void MspMemoryTransport::Flush()
+	{
+		pLink->DiscardBytesToSession();
+	}
+
+	void MspMemoryTransport::StartRead(const boost::asio::mutable_buffer & readBuffer)
+	{
+		pLink->StartRead(this, readBuffer);
+	}
+
+	void MspMemoryTransport::StartWrite(const std::vector<boost::asio::const_buffer> & writeBuffers)
+	{
+		if (!Opened)
+		{
+			PostWritten(boost::asio::error::not_connected, 0);
+			return;
+		}
+
+		pLink->ReceiveFromSession(writeBuffers);
+		PostWritten(boost::system::error_code(), boost::asio::buffer_size(writeBuffers));
+	}
+
+	std::string MspMemoryTransport::GetDescription() const
+	{
+		return "in-memory link " + LinkName;
+	}
+
+} // Namespace CraftServices
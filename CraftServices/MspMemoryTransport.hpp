@@ -0,0 +1,128 @@
+/*
+ * This file is part of CraftServices.
+ *
+ * CraftServices is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CraftServices is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CraftServices. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MSPMEMORYTRANSPORT_HPP
+#define MSPMEMORYTRANSPORT_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <cstdint>
+
+#include <boost/asio.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "MspTransport.hpp"
+
+namespace CraftServices
+{
+	class MspMemoryTransport;
+
+	// A link that lives entirely in memory, between a session and whatever stands in for its flight controller (an
+	// emulated one, see --emulatelink memory). Nothing goes through the OS and nothing waits on a baud rate, so a
+	// run is quick, and goes the same way every time.
+	//
+	// The session's end is an MspMemoryTransport. The far end is driven directly, and can be driven from any thread.
+	class MspMemoryLink
+	{
+		public:
+
+			// Called with each write the session makes, on the session's strand, as it's made
+			typedef std::function<void(const uint8_t * pBytes, size_t byteCount)> FarEndReceiver;
+
+			MspMemoryLink() : pAttachedTransport(NULL), ReadPending(false), BytesSentToSessionCount(0), BytesReceivedFromSessionCount(0)
+			{
+			}
+
+			// The link a port name of "memory:linkName" connects to, made the first time either end asks for it
+			static std::shared_ptr<MspMemoryLink> GetNamedLink(const std::string & linkName);
+
+			// Far end: bytes for the session, as if they had just come in over the link. They wait on the link until
+			// the session reads them (even if it hasn't opened its end yet).
+			void SendToSession(const uint8_t * pBytes, size_t byteCount);
+
+			// Far end: where the session's writes go. Writes made while there's no receiver are dropped.
+			void SetFarEndReceiver(FarEndReceiver farEndReceiver);
+
+			// Running totals, each way
+			uint64_t GetBytesSentToSessionCount();
+			uint64_t GetBytesReceivedFromSessionCount();
+
+		private:
+
+			friend class MspMemoryTransport;
+
+			// Session's end
+			void Attach(MspMemoryTransport * pTransport);
+			void Detach(MspMemoryTransport * pTransport);
+			void StartRead(MspMemoryTransport * pTransport, const boost::asio::mutable_buffer & readBuffer);
+			void CancelRead(MspMemoryTransport * pTransport);
+			void DiscardBytesToSession();
+			void ReceiveFromSession(const std::vector<boost::asio::const_buffer> & writeBuffers);
+
+			// Hand the waiting read as many bytes as it can take. Called with the link locked.
+			void CompletePendingRead();
+
+			boost::mutex LinkMutex;
+			std::deque<uint8_t> BytesToSession;
+			// Shared, so the receiver can be called outside the lock (it may well send something straight back)
+			std::shared_ptr<FarEndReceiver> pFarEndReceiver;
+
+			MspMemoryTransport * pAttachedTransport;
+			// A read waiting on bytes from the far end
+			bool ReadPending;
+			boost::asio::mutable_buffer PendingReadBuffer;
+
+			uint64_t BytesSentToSessionCount;
+			uint64_t BytesReceivedFromSessionCount;
+	};
+
+	// The session's end of an MspMemoryLink. Writes complete as soon as they're made.
+	class MspMemoryTransport : public MspTransport
+	{
+		public:
+
+			MspMemoryTransport(boost::asio::io_context::strand * pSessionStrand, MspTransportListener * pTransportListener, 
+							   std::shared_ptr<MspMemoryLink> pMemoryLink, const std::string & linkName);
+			~MspMemoryTransport();
+
+			// Open right away, without telling the listener. For the session that is setting up its own transport.
+			void Open();
+
+			void StartOpen() override;
+			void Close() override;
+			bool IsOpen() const override;
+			void Cancel() override;
+			void Flush() override;
+			void StartRead(const boost::asio::mutable_buffer & readBuffer) override;
+			void StartWrite(const std::vector<boost::asio::const_buffer> & writeBuffers) override;
+			std::string GetDescription() const override;
+
+		private:
+
+			friend class MspMemoryLink;
+
+			std::shared_ptr<MspMemoryLink> pLink;
+			std::string LinkName;
+			bool Opened;
+	};
+
+} // Namespace CraftServices
+
+#endif // MSPMEMORYTRANSPORT_HPP
@@ -30,8 +30,8 @@
 
 //#include "types.hpp"
 
-#include "deserialise.hpp"
 #include "AsyncMspMessageTypes.hpp"
+#include "MspMessageSchema.hpp"
 // Unsure this will be includable
 #include "MspFlightControllerAsync.hpp"
 
@@ -121,21 +121,30 @@ static const std::vector<std::string> FEATURES = {
 // be grabbed off the shelf if needed as a starting point.
 //
 // -- SLG 7/5/2018
+//
+// Messages in use describe their payload once, as a PayloadFields list, and get
+// their encode/decode from MspSchemaMessage. See MspMessageSchema.hpp.
 
 // MSP_API_VERSION: 1
-struct ApiVersion : public CraftServices::MspMessageAsync
+struct ApiVersion : public CraftServices::MspSchemaMessage<ApiVersion>
 {
     ID MessageID() const 
 	{ 
 		return ID::MSP_API_VERSION; 
 	}
 
-	size_t Protocol;
-	size_t Major;
-	size_t Minor;
+	uint8_t Protocol;
+	uint8_t Major;
+	uint8_t Minor;
+
+	typedef MspFieldList<
+		MspField<ApiVersion, uint8_t, &ApiVersion::Protocol>,
+		MspField<ApiVersion, uint8_t, &ApiVersion::Major>,
+		MspField<ApiVersion, uint8_t, &ApiVersion::Minor>
+	> PayloadFields;
 
 	// Default constructor
-	ApiVersion() : MspMessageAsync()
+	ApiVersion()
 	{
 		// TODO Default to the Protocol version we know about
 		Protocol = 0;
@@ -144,31 +153,14 @@ struct ApiVersion : public CraftServices::MspMessageAsync
 	}
 
 	// Payload constructor
-	ApiVersion(const ByteVector & payloadData)
+	ApiVersion(const ByteSpan & payloadData)
 	{
 		DecodePayload(payloadData);
 	}
-
-	ByteVector EncodePayload() const
-	{
-		ByteVector encodedPayload;
-		encodedPayload.push_back((uint8_t)Protocol);
-		encodedPayload.push_back((uint8_t)Major);
-		encodedPayload.push_back((uint8_t)Minor);
-		return encodedPayload;
-	}
-
-	void DecodePayload(const ByteVector & payloadData)
-	{
-		assert(payloadData.size() == 3);
-        Protocol = payloadData[0];
-        Major = payloadData[1];
-        Minor = payloadData[2];
-    }
 };
 
 // MSP_FC_VARIANT: 2
-struct FcVariant : public CraftServices::MspMessageAsync
+struct FcVariant : public CraftServices::MspSchemaMessage<FcVariant>
 {
     ID MessageID() const
 	{ 
@@ -178,26 +170,20 @@ struct FcVariant : public CraftServices::MspMessageAsync
 	// e.g. "INAV"
     std::string CraftIdentifier;
 
+	typedef MspFieldList<
+		MspStringTailField<FcVariant, &FcVariant::CraftIdentifier>
+	> PayloadFields;
+
 	// Default constructor
-	FcVariant() : MspMessageAsync()
+	FcVariant()
 	{
 	}
 
 	// Payload constructor
-	FcVariant(const ByteVector & payloadData)
+	FcVariant(const ByteSpan & payloadData)
 	{
 		DecodePayload(payloadData);
 	}
-	
-	ByteVector EncodePayload() const
-	{
-		return ByteVector(CraftIdentifier.begin(), CraftIdentifier.end());
-	}
-
-    void DecodePayload(const ByteVector & payloadData)
-	{
-        CraftIdentifier = std::string(payloadData.begin(), payloadData.end());
-    }	
 };
 
 //// MSP_FC_VERSION: 3
@@ -239,7 +225,7 @@ struct FcVariant : public CraftServices::MspMessageAsync
 
 // MSP_NAME: 10
 // Request for the Craft Name
-struct CraftNameMessage : public CraftServices::MspMessageAsync
+struct CraftNameMessage : public CraftServices::MspSchemaMessage<CraftNameMessage>
 {
 	ID MessageID() const
 	{
@@ -249,26 +235,20 @@ struct CraftNameMessage : public CraftServices::MspMessageAsync
 	// e.g. "Bob's Quad"
 	std::string CraftName;
 
+	typedef MspFieldList<
+		MspStringTailField<CraftNameMessage, &CraftNameMessage::CraftName>
+	> PayloadFields;
+
 	// Default constructor
-	CraftNameMessage() : MspMessageAsync()
+	CraftNameMessage()
 	{
 	}
 
 	// Payload constructor
-	CraftNameMessage(const ByteVector & payloadData)
+	CraftNameMessage(const ByteSpan & payloadData)
 	{
 		DecodePayload(payloadData);
 	}
-
-	ByteVector EncodePayload() const
-	{
-		return ByteVector(CraftName.begin(), CraftName.end());
-	}
-
-	void DecodePayload(const ByteVector & payloadData)
-	{
-		CraftName = std::string(payloadData.begin(), payloadData.end());
-	}
 };
 
 
@@ -435,7 +415,7 @@ struct CraftNameMessage : public CraftServices::MspMessageAsync
 
 
 
-struct RawGPS : public CraftServices::MspMessageAsync
+struct RawGPS : public CraftServices::MspSchemaMessage<RawGPS>
 {
 	public:
 		ID MessageID() const
@@ -458,17 +438,31 @@ struct RawGPS : public CraftServices::MspMessageAsync
 		uint32_t MspLon;
 		uint16_t AltitudeInMeters;
 		uint16_t Speed;
+		// This is the GPS heading, and may not be the definitive word on what the
+		// true direction/attitude of the craft may actually be. I also think it
+		// may not be accurate until the craft is actually moving. Is this correct?
 		uint16_t GroundCourseInDecidegrees;
 		uint16_t HDOP;
 
+		typedef MspFieldList<
+			MspField<RawGPS, uint8_t, &RawGPS::FixType>,
+			MspField<RawGPS, uint8_t, &RawGPS::NumSat>,
+			MspField<RawGPS, uint32_t, &RawGPS::MspLat>,
+			MspField<RawGPS, uint32_t, &RawGPS::MspLon>,
+			MspField<RawGPS, uint16_t, &RawGPS::AltitudeInMeters>,
+			MspField<RawGPS, uint16_t, &RawGPS::Speed>,
+			MspField<RawGPS, uint16_t, &RawGPS::GroundCourseInDecidegrees>,
+			MspField<RawGPS, uint16_t, &RawGPS::HDOP>
+		> PayloadFields;
+
 		// Default constructor
-		RawGPS() : MspMessageAsync()
+		RawGPS()
 		{
 			ClearValues();
 		}
 
 		// Payload constructor
-		RawGPS(const ByteVector & payloadData)
+		RawGPS(const ByteSpan & payloadData)
 		{
 			DecodePayload(payloadData);
 		}
@@ -484,95 +478,103 @@ struct RawGPS : public CraftServices::MspMessageAsync
 			GroundCourseInDecidegrees = 0;
 			HDOP = 0;
 		}
+};
 
-		ByteVector EncodePayload() const
-		{
-			ByteVector encodedPayload;
-
-			serialize_uint8(FixType, encodedPayload);
-			serialize_uint8(NumSat, encodedPayload);
-			serialize_uint32(MspLat, encodedPayload);
-			serialize_uint32(MspLon, encodedPayload);
-			serialize_uint16(AltitudeInMeters, encodedPayload);
-			serialize_uint16(Speed, encodedPayload);
-			serialize_uint16(GroundCourseInDecidegrees, encodedPayload);
-			serialize_uint16(HDOP, encodedPayload);
-	
-			return encodedPayload;
-		}
 
-		void DecodePayload(const ByteVector & payloadData)
-		{
-			assert(payloadData.size() == 18);
-			ClearValues();
 
-			FixType = CraftServices::deserialize_uint8(payloadData, 0);
-			NumSat = CraftServices::deserialize_uint8(payloadData, 1);
-			MspLat = CraftServices::deserialize_uint32(payloadData, 2);
-			MspLon = CraftServices::deserialize_uint32(payloadData, 6);
-			AltitudeInMeters = CraftServices::deserialize_uint16(payloadData, 10);
-			Speed = CraftServices::deserialize_uint16(payloadData, 12);
-			// This is the GPS heading, and may not be the definitive word on what the
-			// true direction/attitude of the craft may actually be. I also think it
-			// may not be accurate until the craft is actually moving. Is this correct?
-			GroundCourseInDecidegrees = CraftServices::deserialize_uint16(payloadData, 14);
-			HDOP = CraftServices::deserialize_uint16(payloadData, 16);
-		}
+//
+// MSP_COMP_GPS: 107
+// Distance and direction home
+struct CompGPS : public CraftServices::MspSchemaMessage<CompGPS>
+{
+	ID MessageID() const
+	{
+		return ID::MSP_COMP_GPS;
+	}
 
+	uint16_t DistanceToHomeInMeters;
+	uint16_t DirectionToHomeInDegrees;
+	uint8_t Update;
+
+	typedef MspFieldList<
+		MspField<CompGPS, uint16_t, &CompGPS::DistanceToHomeInMeters>,
+		MspField<CompGPS, uint16_t, &CompGPS::DirectionToHomeInDegrees>,
+		MspField<CompGPS, uint8_t, &CompGPS::Update>
+	> PayloadFields;
+
+	// Default constructor
+	CompGPS() : DistanceToHomeInMeters(0), DirectionToHomeInDegrees(0), Update(0)
+	{
+	}
+
+	// Payload constructor
+	CompGPS(const ByteSpan & payloadData)
+	{
+		DecodePayload(payloadData);
+	}
 };
 
+// MSP_ATTITUDE: 108
+struct Attitude : public CraftServices::MspSchemaMessage<Attitude>
+{
+	ID MessageID() const
+	{
+		return ID::MSP_ATTITUDE;
+	}
+
+	// Roll and pitch
+	int16_t AngleXInDecidegrees;
+	int16_t AngleYInDecidegrees;
+	int16_t HeadingInDegrees;
+
+	typedef MspFieldList<
+		MspField<Attitude, int16_t, &Attitude::AngleXInDecidegrees>,
+		MspField<Attitude, int16_t, &Attitude::AngleYInDecidegrees>,
+		MspField<Attitude, int16_t, &Attitude::HeadingInDegrees>
+	> PayloadFields;
+
+	// Default constructor
+	Attitude() : AngleXInDecidegrees(0), AngleYInDecidegrees(0), HeadingInDegrees(0)
+	{
+	}
+
+	// Payload constructor
+	Attitude(const ByteSpan & payloadData)
+	{
+		DecodePayload(payloadData);
+	}
+};
+
+// MSP_ALTITUDE: 109
+// Estimated altitude, from the barometer and GPS
+struct Altitude : public CraftServices::MspSchemaMessage<Altitude>
+{
+	ID MessageID() const
+	{
+		return ID::MSP_ALTITUDE;
+	}
+
+	int32_t AltitudeInCentimeters;
+	int16_t VarioInCentimetersPerSecond;
+
+	typedef MspFieldList<
+		MspField<Altitude, int32_t, &Altitude::AltitudeInCentimeters>,
+		MspField<Altitude, int16_t, &Altitude::VarioInCentimetersPerSecond>
+	> PayloadFields;
+
+	// Default constructor
+	Altitude() : AltitudeInCentimeters(0), VarioInCentimetersPerSecond(0)
+	{
+	}
+
+	// Payload constructor
+	Altitude(const ByteSpan & payloadData)
+	{
+		DecodePayload(payloadData);
+	}
+};
 
 
-//
-//// MSP_COMP_GPS: 107
-//struct CompGPS : public CraftServices::MspMessageAsync 
-//{
-//    ID id() const 
-//	{ 
-//		return ID::MSP_COMP_GPS; 
-//	}
-//
-//    uint16_t distanceToHome;    // meter
-//    uint16_t directionToHome;   // degree
-//    uint8_t update;
-//
-//    void decode(const std::vector<uint8_t> &data) 
-//	{
-//        distanceToHome  = CraftServices::deserialise_uint16(data, 0);
-//        directionToHome = CraftServices::deserialise_uint16(data, 2);
-//        update          = data[4];
-//    }
-//};
-//
-//// MSP_ATTITUDE: 108
-//struct Attitude : public CraftServices::MspMessageAsync {
-//    ID id() const { return ID::MSP_ATTITUDE; }
-//
-//    float ang_x;        // degree
-//    float ang_y;        // degree
-//    int16_t heading;    // degree
-//
-//    void decode(const std::vector<uint8_t> &data) {
-//        ang_x   = CraftServices::deserialise_int16(data, 0)/10.0f;
-//        ang_y   = CraftServices::deserialise_int16(data, 2)/10.0f;
-//        heading = CraftServices::deserialise_int16(data, 4);
-//    }
-//};
-//
-//// MSP_ALTITUDE: 109
-//struct Altitude : public CraftServices::MspMessageAsync {
-//    ID id() const { return ID::MSP_ALTITUDE; }
-//
-//    float altitude; // m
-//    float vario;    // m/s
-//
-//    void decode(const std::vector<uint8_t> &data) {
-//        altitude = CraftServices::deserialise_int32(data, 0)/100.0f;
-//        vario    = CraftServices::deserialise_int16(data, 4)/100.0f;
-//    }
-//};
-//
-//
 //// MSP_ANALOG: 110
 //struct Analog : public CraftServices::MspMessageAsync {
 //    ID id() const { return ID::MSP_ANALOG; }
@@ -621,30 +623,45 @@ struct RawGPS : public CraftServices::MspMessageAsync
 
 
 
-//// MSP_NAV_STATUS: 121
-//struct NavStatus: public CraftServices::MspMessageAsync {
-//    ID id() const { return ID::MSP_NAV_STATUS; }
-//
-//    uint8_t GPS_mode;
-//    uint8_t NAV_state;
-//    uint8_t mission_action;
-//    uint8_t mission_number;
-//    uint8_t NAV_error;
-//    int16_t target_bearing; // degrees
-//
-//    void decode(const std::vector<uint8_t> &data) {
-//        GPS_mode = data[0];
-//        NAV_state = data[1];
-//        mission_action = data[2];
-//        mission_number = data[3];
-//        NAV_error = data[4];
-//        target_bearing = CraftServices::deserialise_int16(data, 5);
-//    }
-//};
+// MSP_NAV_STATUS: 121
+struct NavStatus : public CraftServices::MspSchemaMessage<NavStatus>
+{
+	ID MessageID() const
+	{
+		return ID::MSP_NAV_STATUS;
+	}
+
+	uint8_t GpsMode;
+	uint8_t NavState;
+	uint8_t MissionAction;
+	uint8_t MissionNumber;
+	uint8_t NavError;
+	int16_t TargetBearingInDegrees;
+
+	typedef MspFieldList<
+		MspField<NavStatus, uint8_t, &NavStatus::GpsMode>,
+		MspField<NavStatus, uint8_t, &NavStatus::NavState>,
+		MspField<NavStatus, uint8_t, &NavStatus::MissionAction>,
+		MspField<NavStatus, uint8_t, &NavStatus::MissionNumber>,
+		MspField<NavStatus, uint8_t, &NavStatus::NavError>,
+		MspField<NavStatus, int16_t, &NavStatus::TargetBearingInDegrees>
+	> PayloadFields;
+
+	// Default constructor
+	NavStatus() : GpsMode(0), NavState(0), MissionAction(0), MissionNumber(0), NavError(0), TargetBearingInDegrees(0)
+	{
+	}
+
+	// Payload constructor
+	NavStatus(const ByteSpan & payloadData)
+	{
+		DecodePayload(payloadData);
+	}
+};
 
 
 // MSP_UID: 160
-struct UidMessage : public CraftServices::MspMessageAsync
+struct UidMessage : public CraftServices::MspSchemaMessage<UidMessage>
 {
 	ID MessageID() const
 	{
@@ -656,8 +673,14 @@ struct UidMessage : public CraftServices::MspMessageAsync
 	uint32_t UID_1;
 	uint32_t UID_2;
 
+	typedef MspFieldList<
+		MspField<UidMessage, uint32_t, &UidMessage::UID_0>,
+		MspField<UidMessage, uint32_t, &UidMessage::UID_1>,
+		MspField<UidMessage, uint32_t, &UidMessage::UID_2>
+	> PayloadFields;
+
 	// Default constructor
-	UidMessage() : MspMessageAsync()
+	UidMessage()
 	{
 		// Synthetic marker for now; should probably use something actually unique.
 		UID_0 = 1111;
@@ -666,36 +689,17 @@ struct UidMessage : public CraftServices::MspMessageAsync
 	}
 
 	// Payload constructor
-	UidMessage(const ByteVector & payloadData)
+	UidMessage(const ByteSpan & payloadData)
 	{
 		DecodePayload(payloadData);
 	}
-
-	ByteVector EncodePayload() const
-	{
-		ByteVector encodedPayload;
-
-		serialize_uint32(UID_0, encodedPayload);
-		serialize_uint32(UID_1, encodedPayload);
-		serialize_uint16(UID_2, encodedPayload);
-
-		return encodedPayload;
-	}
-
-	void DecodePayload(const ByteVector & payloadData)
-	{
-		UID_0 = CraftServices::deserialize_uint32(payloadData, 0);
-		UID_1 = CraftServices::deserialize_uint32(payloadData, 4);
-		UID_2 = CraftServices::deserialize_uint32(payloadData, 8);
-	}
-
 };
 
 
 // Settings the sender has for receiving regular Craft Position updates. 
 //
 // MSP2_INAV_OTHER_CRAFT_POSITION_SETTING = 0x201A,
-struct OtherCraftPositionSettingMessage : public CraftServices::MspMessageAsync
+struct OtherCraftPositionSettingMessage : public CraftServices::MspSchemaMessage<OtherCraftPositionSettingMessage>
 {
 	ID MessageID() const
 	{
@@ -705,35 +709,27 @@ struct OtherCraftPositionSettingMessage : public CraftServices::MspMessageAsync
 	// Boolean - should other Craft Position updates be sent to this Flight Controller? 
 	uint8_t ShouldSendUpdates;
 
+	typedef MspFieldList<
+		MspField<OtherCraftPositionSettingMessage, uint8_t, &OtherCraftPositionSettingMessage::ShouldSendUpdates>
+	> PayloadFields;
+
 	// Default constructor
-	OtherCraftPositionSettingMessage() : MspMessageAsync()
+	OtherCraftPositionSettingMessage()
 	{
 		ShouldSendUpdates = (uint8_t)false;
 	}
 
 	// Boolean constructor
-	OtherCraftPositionSettingMessage(bool shouldSendUpdates) : MspMessageAsync()
+	OtherCraftPositionSettingMessage(bool shouldSendUpdates)
 	{
 		ShouldSendUpdates = (uint8_t)shouldSendUpdates;
 	}
 
 	// Payload constructor
-	OtherCraftPositionSettingMessage(const ByteVector & payloadData)
+	OtherCraftPositionSettingMessage(const ByteSpan & payloadData)
 	{
 		DecodePayload(payloadData);
 	}
-
-	ByteVector EncodePayload() const
-	{
-		ByteVector encodedPayload;
-		encodedPayload.push_back(ShouldSendUpdates);
-		return encodedPayload;
-	}
-
-	void DecodePayload(const ByteVector & payloadData)
-	{
-		ShouldSendUpdates = payloadData[0];
-	}
 };
 
 
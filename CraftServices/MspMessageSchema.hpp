@@ -0,0 +1,278 @@
+/*
+ * This file is part of CraftServices.
+ *
+ * CraftServices is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CraftServices is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CraftServices. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Declarative payload layouts for MSP messages.
+//
+// A message lists its payload fields once, in wire order:
+//
+//	typedef MspFieldList<
+//		MspField<RawGPS, uint8_t, &RawGPS::FixType>,
+//		MspField<RawGPS, uint8_t, &RawGPS::NumSat>,
+//		...
+//	> PayloadFields;
+//
+// and MspPayloadCodec generates encode, decode, payload length and length validation from that
+// list at compile time. Everything is resolved statically; there are no virtual calls and no
+// allocation inside the codec. Deriving from MspSchemaMessage plugs the codec into the
+// MspMessageAsync interface.
+
+#ifndef MSPMESSAGESCHEMA_HPP
+#define MSPMESSAGESCHEMA_HPP
+
+#include <string>
+#include <stdint.h>
+
+#include "AsyncMspMessageTypes.hpp"
+#include "PayloadSerialization.hpp"
+#include "PayloadOverrunException.hpp"
+
+namespace CraftServices
+{
+	/////////////////////////////////////////////////////////////////////
+	/// How each fixed-size value type goes on the wire
+
+	template <typename ValueType>
+	struct MspWireFormat;
+
+	template <>
+	struct MspWireFormat<uint8_t>
+	{
+		static const size_t Length = 1;
+		static void Write(PayloadWriter & payloadWriter, uint8_t value) { payloadWriter.WriteUint8(value); }
+		static uint8_t Read(PayloadReader & payloadReader) { return payloadReader.ReadUint8(); }
+	};
+
+	template <>
+	struct MspWireFormat<uint16_t>
+	{
+		static const size_t Length = 2;
+		static void Write(PayloadWriter & payloadWriter, uint16_t value) { payloadWriter.WriteUint16(value); }
+		static uint16_t Read(PayloadReader & payloadReader) { return payloadReader.ReadUint16(); }
+	};
+
+	template <>
+	struct MspWireFormat<uint32_t>
+	{
+		static const size_t Length = 4;
+		static void Write(PayloadWriter & payloadWriter, uint32_t value) { payloadWriter.WriteUint32(value); }
+		static uint32_t Read(PayloadReader & payloadReader) { return payloadReader.ReadUint32(); }
+	};
+
+	template <>
+	struct MspWireFormat<int16_t>
+	{
+		static const size_t Length = 2;
+		static void Write(PayloadWriter & payloadWriter, int16_t value) { payloadWriter.WriteInt16(value); }
+		static int16_t Read(PayloadReader & payloadReader) { return payloadReader.ReadInt16(); }
+	};
+
+	template <>
+	struct MspWireFormat<int32_t>
+	{
+		static const size_t Length = 4;
+		static void Write(PayloadWriter & payloadWriter, int32_t value) { payloadWriter.WriteInt32(value); }
+		static int32_t Read(PayloadReader & payloadReader) { return payloadReader.ReadInt32(); }
+	};
+
+	/////////////////////////////////////////////////////////////////////
+	/// Field kinds
+
+	// A fixed-size value held in a member of the message
+	template <typename MessageType, typename ValueType, ValueType MessageType::*Member>
+	struct MspField
+	{
+		static const size_t MinimumLength = MspWireFormat<ValueType>::Length;
+		static const bool IsVariableLength = false;
+
+		static size_t GetLength(const MessageType & /*message*/)
+		{
+			return MinimumLength;
+		}
+
+		static void Encode(const MessageType & message, PayloadWriter & payloadWriter)
+		{
+			MspWireFormat<ValueType>::Write(payloadWriter, message.*Member);
+		}
+
+		static void Decode(MessageType & message, PayloadReader & payloadReader)
+		{
+			message.*Member = MspWireFormat<ValueType>::Read(payloadReader);
+		}
+	};
+
+	// A string that takes up the rest of the payload (i.e. a name). No length prefix or terminator,
+	// so it can only be the last field.
+	template <typename MessageType, std::string MessageType::*Member>
+	struct MspStringTailField
+	{
+		static const size_t MinimumLength = 0;
+		static const bool IsVariableLength = true;
+
+		static size_t GetLength(const MessageType & message)
+		{
+			return (message.*Member).size();
+		}
+
+		static void Encode(const MessageType & message, PayloadWriter & payloadWriter)
+		{
+			payloadWriter.WriteString(message.*Member);
+		}
+
+		static void Decode(MessageType & message, PayloadReader & payloadReader)
+		{
+			message.*Member = payloadReader.ReadRemainingAsString();
+		}
+	};
+
+	// All the fields of a struct held in a member of the message, laid out by that struct's own field list
+	template <typename MessageType, typename InnerType, InnerType MessageType::*Member, typename InnerFieldList>
+	struct MspNestedFields
+	{
+		static const size_t MinimumLength = InnerFieldList::MinimumLength;
+		static const bool IsVariableLength = InnerFieldList::IsVariableLength;
+
+		static size_t GetLength(const MessageType & message)
+		{
+			return InnerFieldList::GetLength(message.*Member);
+		}
+
+		static void Encode(const MessageType & message, PayloadWriter & payloadWriter)
+		{
+			InnerFieldList::Encode(message.*Member, payloadWriter);
+		}
+
+		static void Decode(MessageType & message, PayloadReader & payloadReader)
+		{
+			InnerFieldList::Decode(message.*Member, payloadReader);
+		}
+	};
+
+	/////////////////////////////////////////////////////////////////////
+	/// The field list itself; fields in wire order
+
+	template <typename... Fields>
+	struct MspFieldList;
+
+	template <>
+	struct MspFieldList<>
+	{
+		static const size_t MinimumLength = 0;
+		static const bool IsVariableLength = false;
+
+		template <typename MessageType>
+		static size_t GetLength(const MessageType & /*message*/)
+		{
+			return 0;
+		}
+
+		template <typename MessageType>
+		static void Encode(const MessageType & /*message*/, PayloadWriter & /*payloadWriter*/)
+		{
+		}
+
+		template <typename MessageType>
+		static void Decode(MessageType & /*message*/, PayloadReader & /*payloadReader*/)
+		{
+		}
+	};
+
+	template <typename FirstField, typename... RemainingFields>
+	struct MspFieldList<FirstField, RemainingFields...>
+	{
+		typedef MspFieldList<RemainingFields...> RemainingFieldList;
+
+		static_assert(!FirstField::IsVariableLength || sizeof...(RemainingFields) == 0, "Only the last field of a message can be variable length");
+
+		static const size_t MinimumLength = FirstField::MinimumLength + RemainingFieldList::MinimumLength;
+		static const bool IsVariableLength = FirstField::IsVariableLength || RemainingFieldList::IsVariableLength;
+
+		template <typename MessageType>
+		static size_t GetLength(const MessageType & message)
+		{
+			return FirstField::GetLength(message) + RemainingFieldList::GetLength(message);
+		}
+
+		template <typename MessageType>
+		static void Encode(const MessageType & message, PayloadWriter & payloadWriter)
+		{
+			FirstField::Encode(message, payloadWriter);
+			RemainingFieldList::Encode(message, payloadWriter);
+		}
+
+		template <typename MessageType>
+		static void Decode(MessageType & message, PayloadReader & payloadReader)
+		{
+			FirstField::Decode(message, payloadReader);
+			RemainingFieldList::Decode(message, payloadReader);
+		}
+	};
+
+	/////////////////////////////////////////////////////////////////////
+	/// Codec for a message type, generated from its PayloadFields
+
+	template <typename MessageType>
+	struct MspPayloadCodec
+	{
+		typedef typename MessageType::PayloadFields Fields;
+
+		static_assert(Fields::MinimumLength <= MspMessageScratchPad::MaxDataPayloadLength, "Message payload is longer than MSP allows");
+
+		// Exact length of this message's payload with its current values
+		static size_t GetPayloadLength(const MessageType & message)
+		{
+			return Fields::GetLength(message);
+		}
+
+		static void Encode(const MessageType & message, PayloadWriter & payloadWriter)
+		{
+			Fields::Encode(message, payloadWriter);
+		}
+
+		// The payload must hold at least every fixed-size field. Longer is fine; newer firmware
+		// sometimes appends fields, and we just don't read them.
+		static void Decode(MessageType & message, const ByteSpan & payloadData)
+		{
+			if (payloadData.size() < Fields::MinimumLength)
+			{
+				throw PayloadOverrunException("Payload too short: " + std::to_string(payloadData.size()) + " bytes, message needs at least " +
+											  std::to_string((size_t)Fields::MinimumLength));
+			}
+
+			PayloadReader payloadReader(payloadData);
+			Fields::Decode(message, payloadReader);
+		}
+	};
+
+	// Base for messages described by a PayloadFields list. Implements the MspMessageAsync
+	// encode/decode in terms of the generated codec.
+	template <typename MessageType>
+	struct MspSchemaMessage : public CraftServices::MspMessageAsync
+	{
+		void EncodePayload(PayloadWriter & payloadWriter) const
+		{
+			MspPayloadCodec<MessageType>::Encode(static_cast<const MessageType &>(*this), payloadWriter);
+		}
+
+		void DecodePayload(const ByteSpan & payloadData)
+		{
+			MspPayloadCodec<MessageType>::Decode(static_cast<MessageType &>(*this), payloadData);
+		}
+	};
+
+} // namespace CraftServices
+
+#endif // MSPMESSAGESCHEMA_HPP
@@ -0,0 +1,548 @@
+/*
+ * This file is part of CraftServices.
+ *
+ * CraftServices is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CraftServices is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CraftServices. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sstream>
+#include <algorithm>
+#include <cstdio>
+
+#include "MspMetricsExporter.hpp"
+#include "UidUtil.hpp"
+
+namespace CraftServices
+{
+	namespace
+	{
+		typedef std::vector<std::shared_ptr<const MspSessionMetrics>> SessionMetricsList;
+
+		// How long a scraper gets to send its request and take the reply before we hang up on it
+		const uint32_t ScrapeConnectionTimeoutInMilliseconds = 5000;
+
+		// Requests bigger than this aren't from a scraper
+		const size_t MaxScrapeRequestByteCount = 8192;
+
+		// How long to wait before accepting again after an accept fails, doubling up to the maximum while it keeps failing
+		const uint32_t InitialAcceptRetryDelayInMilliseconds = 100;
+		const uint32_t MaxAcceptRetryDelayInMilliseconds = 10000;
+
+		// Label values may hold anything (port paths, craft names), so backslashes, quotes and newlines are escaped
+		std::string EscapeLabelValue(const std::string & labelValue)
+		{
+			std::string escapedLabelValue;
+			escapedLabelValue.reserve(labelValue.size());
+			for (char labelCharacter : labelValue)
+			{
+				switch (labelCharacter)
+				{
+					case '\\': escapedLabelValue += "\\\\"; break;
+					case '"': escapedLabelValue += "\\\""; break;
+					case '\n': escapedLabelValue += "\\n"; break;
+					default: escapedLabelValue += labelCharacter; break;
+				}
+			}
+			return escapedLabelValue;
+		}
+
+		std::string GetSessionLabels(const MspSessionMetrics & sessionMetrics, const char * labelPrefix = "")
+		{
+			return std::string(labelPrefix) + "port=\"" + EscapeLabelValue(sessionMetrics.GetPortName()) + "\"," + 
+				   labelPrefix + "craft=\"" + EscapeLabelValue(sessionMetrics.GetCraftName()) + "\"";
+		}
+
+		// i.e. "COM4 (Wing 1)"
+		std::string GetSessionDescription(const MspSessionMetrics & sessionMetrics)
+		{
+			std::string craftName = sessionMetrics.GetCraftName();
+			return craftName.empty() ? sessionMetrics.GetPortName() : sessionMetrics.GetPortName() + " (" + craftName + ")";
+		}
+
+		// Find a session by its ID. NULL if it is no longer registered.
+		const MspSessionMetrics * FindSession(const SessionMetricsList & sessions, uint32_t sessionID)
+		{
+			for (const auto & pSessionMetrics : sessions)
+			{
+				if (pSessionMetrics->GetSessionID() == sessionID)
+				{
+					return pSessionMetrics.get();
+				}
+			}
+			return NULL;
+		}
+
+		void WriteFamilyHeader(std::ostringstream & metricsText, const char * familyName, const char * familyType, const char * familyHelp)
+		{
+			metricsText << "# HELP " << familyName << ' ' << familyHelp << '\n';
+			metricsText << "# TYPE " << familyName << ' ' << familyType << '\n';
+		}
+
+		// One sample per session. getValue(sessionMetrics) reads the value.
+		template <typename ValueGetter>
+		void WriteSessionFamily(std::ostringstream & metricsText, const SessionMetricsList & sessions, const std::vector<std::string> & sessionLabels,
+								const char * familyName, const char * familyType, const char * familyHelp, ValueGetter getValue)
+		{
+			WriteFamilyHeader(metricsText, familyName, familyType, familyHelp);
+			for (size_t sessionIndex = 0; sessionIndex < sessions.size(); sessionIndex++)
+			{
+				metricsText << familyName << '{' << sessionLabels[sessionIndex] << "} " << getValue(*sessions[sessionIndex]) << '\n';
+			}
+		}
+
+		// The buckets are read one at a time while they may still be changing, so the total is taken from the
+		// buckets actually read; that way +Inf and _count always agree, as Prometheus expects.
+		void WriteHistogramSamples(std::ostringstream & metricsText, const char * familyName, const std::string & labels, const LatencyHistogram & histogram)
+		{
+			uint64_t cumulativeCount = 0;
+			for (size_t bucketIndex = 0; bucketIndex < LatencyHistogram::BoundedBucketCount; bucketIndex++)
+			{
+				cumulativeCount += histogram.GetBucketCount(bucketIndex);
+				metricsText << familyName << "_bucket{" << labels << ",le=\"" << LatencyHistogram::GetBucketUpperBoundInMilliseconds(bucketIndex) << "\"} " << cumulativeCount << '\n';
+			}
+			cumulativeCount += histogram.GetBucketCount(LatencyHistogram::BoundedBucketCount);
+			metricsText << familyName << "_bucket{" << labels << ",le=\"+Inf\"} " << cumulativeCount << '\n';
+			metricsText << familyName << "_sum{" << labels << "} " << histogram.GetSumInMilliseconds() << '\n';
+			metricsText << familyName << "_count{" << labels << "} " << cumulativeCount << '\n';
+		}
+
+		// One histogram per session. getHistogram(sessionMetrics) picks it out.
+		template <typename HistogramGetter>
+		void WriteSessionHistogramFamily(std::ostringstream & metricsText, const SessionMetricsList & sessions, const std::vector<std::string> & sessionLabels,
+										 const char * familyName, const char * familyHelp, HistogramGetter getHistogram)
+		{
+			WriteFamilyHeader(metricsText, familyName, "histogram", familyHelp);
+			for (size_t sessionIndex = 0; sessionIndex < sessions.size(); sessionIndex++)
+			{
+				WriteHistogramSamples(metricsText, familyName, sessionLabels[sessionIndex], getHistogram(*sessions[sessionIndex]));
+			}
+		}
+
+		// Call visitor(messageIDLabel, messageMetrics) for each message ID a session has seen, then for the
+		// message IDs that didn't get a slot of their own (labelled "other"), if there were any
+		template <typename Visitor>
+		void VisitMessageMetrics(const MspSessionMetrics & sessionMetrics, Visitor visitor)
+		{
+			sessionMetrics.Messages.VisitSlots([&](uint16_t messageID, const MspMessageMetrics & messageMetrics)
+			{
+				visitor("message_id=\"" + UidUtil::IntToHex(messageID) + "\"", messageMetrics);
+			});
+			sessionMetrics.Messages.VisitOverflowSlot([&](const MspMessageMetrics & messageMetrics)
+			{
+				visitor(std::string("message_id=\"other\""), messageMetrics);
+			});
+		}
+
+		// One sample per message ID per session. getValue(messageMetrics) reads the value.
+		template <typename ValueGetter>
+		void WriteMessageFamily(std::ostringstream & metricsText, const SessionMetricsList & sessions, const std::vector<std::string> & sessionLabels,
+								const char * familyName, const char * familyHelp, ValueGetter getValue)
+		{
+			WriteFamilyHeader(metricsText, familyName, "counter", familyHelp);
+			for (size_t sessionIndex = 0; sessionIndex < sessions.size(); sessionIndex++)
+			{
+				const std::string & labels = sessionLabels[sessionIndex];
+				VisitMessageMetrics(*sessions[sessionIndex], [&](const std::string & messageIDLabel, const MspMessageMetrics & messageMetrics)
+				{
+					metricsText << familyName << '{' << labels << ',' << messageIDLabel << "} " << getValue(messageMetrics) << '\n';
+				});
+			}
+		}
+
+		// One connection from a scraper: read the request, send the metrics back, hang up.
+		// Works the same whether the scraper came in over TCP or a Unix domain socket.
+		template <typename Socket>
+		class MetricsScrapeConnection : public std::enable_shared_from_this<MetricsScrapeConnection<Socket>>
+		{
+			public:
+
+				MetricsScrapeConnection(boost::asio::io_context & exporterIoContext) :
+					ConnectionSocket(exporterIoContext), ConnectionDeadlineTimer(exporterIoContext), RequestBuffer(MaxScrapeRequestByteCount)
+				{
+				}
+
+				Socket & GetSocket()
+				{
+					return ConnectionSocket;
+				}
+
+				void Start()
+				{
+					std::shared_ptr<MetricsScrapeConnection> pThisConnection = this->shared_from_this();
+
+					ConnectionDeadlineTimer.expires_after(boost::asio::chrono::milliseconds(ScrapeConnectionTimeoutInMilliseconds));
+					ConnectionDeadlineTimer.async_wait([pThisConnection](const boost::system::error_code & error)
+					{
+						if (!error)
+						{
+							boost::system::error_code closeError;
+							pThisConnection->ConnectionSocket.close(closeError);
+						}
+					});
+
+					boost::asio::async_read_until(ConnectionSocket, RequestBuffer, "\r\n\r\n", [pThisConnection](const boost::system::error_code & error, size_t)
+					{
+						if (!error)
+						{
+							pThisConnection->SendResponse();
+						}
+					});
+				}
+
+			private:
+
+				void SendResponse()
+				{
+					std::istream requestStream(&RequestBuffer);
+					std::string requestMethod;
+					std::string requestPath;
+					requestStream >> requestMethod >> requestPath;
+
+					std::string statusLine;
+					std::string responseBody;
+					if (requestMethod != "GET" && requestMethod != "HEAD")
+					{
+						statusLine = "405 Method Not Allowed";
+						responseBody = "Only GET is supported.\n";
+					}
+					else if (requestPath == "/positionage")
+					{
+						statusLine = "200 OK";
+						responseBody = FormatPositionAgeMatrixAsText(MspMetricsRegistry::GetInstance());
+					}
+					else if (requestPath != "/metrics" && requestPath != "/")
+					{
+						statusLine = "404 Not Found";
+						responseBody = "Metrics are at /metrics, the position age matrix at /positionage.\n";
+					}
+					else
+					{
+						statusLine = "200 OK";
+						responseBody = FormatMetricsAsPrometheusText(MspMetricsRegistry::GetInstance());
+					}
+
+					std::ostringstream responseText;
+					responseText << "HTTP/1.1 " << statusLine << "\r\n"
+								 << "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+								 << "Content-Length: " << responseBody.size() << "\r\n"
+								 << "Connection: close\r\n\r\n";
+					if (requestMethod != "HEAD")
+					{
+						responseText << responseBody;
+					}
+					ResponseText = responseText.str();
+
+					std::shared_ptr<MetricsScrapeConnection> pThisConnection = this->shared_from_this();
+					boost::asio::async_write(ConnectionSocket, boost::asio::buffer(ResponseText), [pThisConnection](const boost::system::error_code &, size_t)
+					{
+						boost::system::error_code shutdownError;
+						pThisConnection->ConnectionSocket.shutdown(Socket::shutdown_both, shutdownError);
+						pThisConnection->ConnectionDeadlineTimer.cancel();
+					});
+				}
+
+				Socket ConnectionSocket;
+				boost::asio::steady_timer ConnectionDeadlineTimer;
+				boost::asio::streambuf RequestBuffer;
+				std::string ResponseText;
+		};
+
+	} // Anonymous namespace
+
+	std::string FormatMetricsAsPrometheusText(const MspMetricsRegistry & metricsRegistry)
+	{
+		SessionMetricsList sessions = metricsRegistry.GetSessions();
+		std::vector<std::string> sessionLabels;
+		for (const auto & pSessionMetrics : sessions)
+		{
+			sessionLabels.push_back(GetSessionLabels(*pSessionMetrics));
+		}
+
+		std::ostringstream metricsText;
+
+		WriteFamilyHeader(metricsText, "craftservices_sessions", "gauge", "Flight controller sessions being monitored.");
+		metricsText << "craftservices_sessions " << sessions.size() << '\n';
+
+		// Traffic
+		WriteSessionFamily(metricsText, sessions, sessionLabels, "craftservices_link_received_bytes_total", "counter", "Bytes read from the port.",
+			[](const MspSessionMetrics & sessionMetrics) { return sessionMetrics.BytesReceived.Get(); });
+		WriteSessionFamily(metricsText, sessions, sessionLabels, "craftservices_link_sent_bytes_total", "counter", "Bytes written to the port.",
+			[](const MspSessionMetrics & sessionMetrics) { return sessionMetrics.BytesSent.Get(); });
+		WriteSessionFamily(metricsText, sessions, sessionLabels, "craftservices_link_sent_frames_total", "counter", "MSP messages written to the port.",
+			[](const MspSessionMetrics & sessionMetrics) { return sessionMetrics.FramesSent.Get(); });
+
+		// Polling
+		WriteSessionFamily(metricsText, sessions, sessionLabels, "craftservices_link_refresh_cycles_total", "counter", "Refresh cycles that sent something.",
+			[](const MspSessionMetrics & sessionMetrics) { return sessionMetrics.RefreshCycleCount.Get(); });
+		WriteSessionFamily(metricsText, sessions, sessionLabels, "craftservices_link_refresh_cycles_complete_total", "counter", "Refresh cycles whose replies all came in before the next refresh.",
+			[](const MspSessionMetrics & sessionMetrics) { return sessionMetrics.RefreshCycleCompleteCount.Get(); });
+		WriteSessionFamily(metricsText, sessions, sessionLabels, "craftservices_link_refresh_interval_milliseconds", "gauge", "Current refresh interval.",
+			[](const MspSessionMetrics & sessionMetrics) { return sessionMetrics.RefreshIntervalInMilliseconds.Get(); });
+		WriteSessionHistogramFamily(metricsText, sessions, sessionLabels, "craftservices_link_refresh_cycle_duration_milliseconds", "Time from the start of a refresh cycle to its last reply.",
+			[](const MspSessionMetrics & sessionMetrics) -> const LatencyHistogram & { return sessionMetrics.RefreshCycleDuration; });
+
+		// Replies
+		WriteSessionFamily(metricsText, sessions, sessionLabels, "craftservices_link_requests_in_flight", "gauge", "Requests awaiting a reply.",
+			[](const MspSessionMetrics & sessionMetrics) { return sessionMetrics.RequestsInFlight.Get(); });
+		WriteSessionFamily(metricsText, sessions, sessionLabels, "craftservices_link_replies_matched_total", "counter", "Replies matched to an outstanding request.",
+			[](const MspSessionMetrics & sessionMetrics) { return sessionMetrics.RepliesMatched.Get(); });
+		WriteSessionFamily(metricsText, sessions, sessionLabels, "craftservices_link_replies_unmatched_total", "counter", "Replies that matched no outstanding request (usually late).",
+			[](const MspSessionMetrics & sessionMetrics) { return sessionMetrics.RepliesUnmatched.Get(); });
+		WriteSessionFamily(metricsText, sessions, sessionLabels, "craftservices_link_requests_timed_out_total", "counter", "Requests given up on for want of a reply.",
+			[](const MspSessionMetrics & sessionMetrics) { return sessionMetrics.RequestsTimedOut.Get(); });
+		WriteSessionHistogramFamily(metricsText, sessions, sessionLabels, "craftservices_link_round_trip_time_milliseconds", "Time from a request leaving the port to its reply arriving.",
+			[](const MspSessionMetrics & sessionMetrics) -> const LatencyHistogram & { return sessionMetrics.RoundTripTime; });
+
+		// Receive errors
+		WriteSessionFamily(metricsText, sessions, sessionLabels, "craftservices_link_discarded_bytes_total", "counter", "Bytes thrown away looking for the start of a message (bad preamble, line noise).",
+			[](const MspSessionMetrics & sessionMetrics) { return sessionMetrics.DiscardedByteCount.Get(); });
+		WriteSessionFamily(metricsText, sessions, sessionLabels, "craftservices_link_rejected_messages_total", "counter", "Messages that went bad before they were complete, CRC mismatches included.",
+			[](const MspSessionMetrics & sessionMetrics) { return sessionMetrics.RejectedMessageCount.Get(); });
+		WriteSessionFamily(metricsText, sessions, sessionLabels, "craftservices_link_crc_mismatches_total", "counter", "Messages that failed their CRC.",
+			[](const MspSessionMetrics & sessionMetrics) { return sessionMetrics.CrcMismatchCount.Get(); });
+		WriteSessionFamily(metricsText, sessions, sessionLabels, "craftservices_link_error_replies_total", "counter", "Error ('!') replies from the flight controller.",
+			[](const MspSessionMetrics & sessionMetrics) { return sessionMetrics.ErrorReplyCount.Get(); });
+		WriteSessionFamily(metricsText, sessions, sessionLabels, "craftservices_link_unknown_message_ids_total", "counter", "Good messages with a message ID we don't handle.",
+			[](const MspSessionMetrics & sessionMetrics) { return sessionMetrics.UnknownMessageIdCount.Get(); });
+
+		// Positions
+		WriteSessionHistogramFamily(metricsText, sessions, sessionLabels, "craftservices_forwarded_position_age_milliseconds", "Age of other craft positions when sent on to this craft.",
+			[](const MspSessionMetrics & sessionMetrics) -> const LatencyHistogram & { return sessionMetrics.ForwardedPositionAge; });
+
+		// Per message ID
+		WriteMessageFamily(metricsText, sessions, sessionLabels, "craftservices_message_sent_total", "Requests of this message ID written to the port.",
+			[](const MspMessageMetrics & messageMetrics) { return messageMetrics.SentCount.Get(); });
+		WriteMessageFamily(metricsText, sessions, sessionLabels, "craftservices_message_replies_total", "Replies to this message ID matched to a request.",
+			[](const MspMessageMetrics & messageMetrics) { return messageMetrics.ReplyCount.Get(); });
+		WriteMessageFamily(metricsText, sessions, sessionLabels, "craftservices_message_error_replies_total", "Error ('!') replies to this message ID.",
+			[](const MspMessageMetrics & messageMetrics) { return messageMetrics.ErrorReplyCount.Get(); });
+		WriteMessageFamily(metricsText, sessions, sessionLabels, "craftservices_message_timed_out_total", "Requests of this message ID given up on for want of a reply.",
+			[](const MspMessageMetrics & messageMetrics) { return messageMetrics.TimedOutCount.Get(); });
+
+		// Position age, source -> destination
+		const char * deliveredPositionAgeFamilyName = "craftservices_position_age_delivered_milliseconds";
+		WriteFamilyHeader(metricsText, deliveredPositionAgeFamilyName, "histogram", "Age of positions from the source craft once written to this craft, from when the source decoded them.");
+		for (size_t sessionIndex = 0; sessionIndex < sessions.size(); sessionIndex++)
+		{
+			const std::string & labels = sessionLabels[sessionIndex];
+			sessions[sessionIndex]->DeliveredPositionAgeBySource.VisitSlots([&](uint32_t sourceSessionID, const LatencyHistogram & positionAgeHistogram)
+			{
+				const MspSessionMetrics * pSourceSessionMetrics = FindSession(sessions, sourceSessionID);
+				std::string sourceLabels = (pSourceSessionMetrics != NULL) ? GetSessionLabels(*pSourceSessionMetrics, "source_") : "source_port=\"\",source_craft=\"\"";
+				WriteHistogramSamples(metricsText, deliveredPositionAgeFamilyName, labels + "," + sourceLabels, positionAgeHistogram);
+			});
+		}
+
+		const char * messageRoundTripFamilyName = "craftservices_message_round_trip_time_milliseconds";
+		WriteFamilyHeader(metricsText, messageRoundTripFamilyName, "histogram", "Round trip time for this message ID.");
+		for (size_t sessionIndex = 0; sessionIndex < sessions.size(); sessionIndex++)
+		{
+			const std::string & labels = sessionLabels[sessionIndex];
+			VisitMessageMetrics(*sessions[sessionIndex], [&](const std::string & messageIDLabel, const MspMessageMetrics & messageMetrics)
+			{
+				WriteHistogramSamples(metricsText, messageRoundTripFamilyName, labels + "," + messageIDLabel, messageMetrics.RoundTripTime);
+			});
+		}
+
+		return metricsText.str();
+	}
+
+	std::string FormatPositionAgeMatrixAsText(const MspMetricsRegistry & metricsRegistry)
+	{
+		SessionMetricsList sessions = metricsRegistry.GetSessions();
+
+		std::ostringstream matrixText;
+		matrixText << "Position age, source -> destination, from GPS reply decoded to position written (ms):\n";
+		size_t pairCount = 0;
+		for (const auto & pDestinationSessionMetrics : sessions)
+		{
+			pDestinationSessionMetrics->DeliveredPositionAgeBySource.VisitSlots([&](uint32_t sourceSessionID, const LatencyHistogram & positionAgeHistogram)
+			{
+				const MspSessionMetrics * pSourceSessionMetrics = FindSession(sessions, sourceSessionID);
+				matrixText << "  " << ((pSourceSessionMetrics != NULL) ? GetSessionDescription(*pSourceSessionMetrics) : std::string("(gone)"))
+						   << " -> " << GetSessionDescription(*pDestinationSessionMetrics) << ": "
+						   << positionAgeHistogram.GetSampleCount() << " positions, "
+						   << "p50 " << positionAgeHistogram.GetPercentileInMilliseconds(0.50) << ", "
+						   << "p90 " << positionAgeHistogram.GetPercentileInMilliseconds(0.90) << ", "
+						   << "p99 " << positionAgeHistogram.GetPercentileInMilliseconds(0.99) << "\n";
+				pairCount++;
+			});
+		}
+		if (pairCount == 0)
+		{
+			matrixText << "  (no positions forwarded yet)\n";
+		}
+
+		return matrixText.str();
+	}
+
+	// Constructor
+	MspMetricsExporter::MspMetricsExporter(spdlog::logger * pLogger) : pExporterLogger(pLogger), pTcpAcceptor(NULL), TcpAcceptRetryTimer(ExporterIoContext),
+		TcpAcceptRetryDelayInMilliseconds(InitialAcceptRetryDelayInMilliseconds),
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+		pUnixAcceptor(NULL), UnixAcceptRetryTimer(ExporterIoContext), UnixAcceptRetryDelayInMilliseconds(InitialAcceptRetryDelayInMilliseconds),
+#endif // BOOST_ASIO_HAS_LOCAL_SOCKETS
+		pExporterThread(NULL)
+	{
+	}
+
+	// Destructor
+	MspMetricsExporter::~MspMetricsExporter()
+	{
+		Stop();
+
+		delete pTcpAcceptor;
+		pTcpAcceptor = NULL;
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+		delete pUnixAcceptor;
+		pUnixAcceptor = NULL;
+#endif // BOOST_ASIO_HAS_LOCAL_SOCKETS
+	}
+
+	void MspMetricsExporter::ListenOnLoopbackPort(uint16_t port)
+	{
+		boost::asio::ip::tcp::endpoint loopbackEndpoint(boost::asio::ip::address_v4::loopback(), port);
+		pTcpAcceptor = new boost::asio::ip::tcp::acceptor(ExporterIoContext, loopbackEndpoint);
+		pExporterLogger->info("Serving metrics at http://{}:{}/metrics", loopbackEndpoint.address().to_string(), port);
+	}
+
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+	void MspMetricsExporter::ListenOnUnixSocket(const std::string & socketPath)
+	{
+		// A socket file left behind by an earlier run would stop us binding
+		std::remove(socketPath.c_str());
+		pUnixAcceptor = new boost::asio::local::stream_protocol::acceptor(ExporterIoContext, boost::asio::local::stream_protocol::endpoint(socketPath));
+		UnixSocketPath = socketPath;
+		pExporterLogger->info("Serving metrics on Unix socket {}", socketPath);
+	}
+#endif // BOOST_ASIO_HAS_LOCAL_SOCKETS
+
+	void MspMetricsExporter::Start()
+	{
+		if (pExporterThread != NULL)
+		{
+			return;
+		}
+
+		if (pTcpAcceptor != NULL)
+		{
+			AcceptNextTcpConnection();
+		}
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+		if (pUnixAcceptor != NULL)
+		{
+			AcceptNextUnixConnection();
+		}
+#endif // BOOST_ASIO_HAS_LOCAL_SOCKETS
+
+		pExporterThread = new boost::thread([this]() { RunExporterThread(); });
+	}
+
+	void MspMetricsExporter::Stop()
+	{
+		if (pExporterThread == NULL)
+		{
+			return;
+		}
+
+		ExporterIoContext.stop();
+		pExporterThread->join();
+		delete pExporterThread;
+		pExporterThread = NULL;
+
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+		if (!UnixSocketPath.empty())
+		{
+			std::remove(UnixSocketPath.c_str());
+			UnixSocketPath.clear();
+		}
+#endif // BOOST_ASIO_HAS_LOCAL_SOCKETS
+	}
+
+	void MspMetricsExporter::AcceptNextTcpConnection()
+	{
+		typedef MetricsScrapeConnection<boost::asio::ip::tcp::socket> TcpScrapeConnection;
+		std::shared_ptr<TcpScrapeConnection> pConnection = std::make_shared<TcpScrapeConnection>(ExporterIoContext);
+		pTcpAcceptor->async_accept(pConnection->GetSocket(), [this, pConnection](const boost::system::error_code & error)
+		{
+			if (error == boost::asio::error::operation_aborted)
+			{
+				return;
+			}
+			if (error)
+			{
+				RetryAcceptLater(TcpAcceptRetryTimer, TcpAcceptRetryDelayInMilliseconds, error, [this]() { AcceptNextTcpConnection(); });
+				return;
+			}
+
+			TcpAcceptRetryDelayInMilliseconds = InitialAcceptRetryDelayInMilliseconds;
+			pConnection->Start();
+			AcceptNextTcpConnection();
+		});
+	}
+
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+	void MspMetricsExporter::AcceptNextUnixConnection()
+	{
+		typedef MetricsScrapeConnection<boost::asio::local::stream_protocol::socket> UnixScrapeConnection;
+		std::shared_ptr<UnixScrapeConnection> pConnection = std::make_shared<UnixScrapeConnection>(ExporterIoContext);
+		pUnixAcceptor->async_accept(pConnection->GetSocket(), [this, pConnection](const boost::system::error_code & error)
+		{
+			if (error == boost::asio::error::operation_aborted)
+			{
+				return;
+			}
+			if (error)
+			{
+				RetryAcceptLater(UnixAcceptRetryTimer, UnixAcceptRetryDelayInMilliseconds, error, [this]() { AcceptNextUnixConnection(); });
+				return;
+			}
+
+			UnixAcceptRetryDelayInMilliseconds = InitialAcceptRetryDelayInMilliseconds;
+			pConnection->Start();
+			AcceptNextUnixConnection();
+		});
+	}
+#endif // BOOST_ASIO_HAS_LOCAL_SOCKETS
+
+	void MspMetricsExporter::RetryAcceptLater(boost::asio::steady_timer & acceptRetryTimer, uint32_t & acceptRetryDelayInMilliseconds,
+											  const boost::system::error_code & acceptError, std::function<void()> acceptNext)
+	{
+		pExporterLogger->warn("Metrics exporter could not accept a connection ({}), trying again in {}ms", acceptError.message(), acceptRetryDelayInMilliseconds);
+
+		acceptRetryTimer.expires_after(boost::asio::chrono::milliseconds(acceptRetryDelayInMilliseconds));
+		acceptRetryTimer.async_wait([acceptNext](const boost::system::error_code & error)
+		{
+			if (!error)
+			{
+				acceptNext();
+			}
+		});
+
+		acceptRetryDelayInMilliseconds = std::min(acceptRetryDelayInMilliseconds * 2, MaxAcceptRetryDelayInMilliseconds);
+	}
+
+	void MspMetricsExporter::RunExporterThread()
+	{
+		try
+		{
+			ExporterIoContext.run();
+		}
+		catch (std::exception & e)
+		{
+			// Losing the exporter is no reason to stop talking to the craft
+			pExporterLogger->error("Metrics exporter stopped: {}", e.what());
+		}
+	}
+
+} // Namespace CraftServices
@@ -0,0 +1,99 @@
+/*
+ * This file is part of CraftServices.
+ *
+ * CraftServices is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CraftServices is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CraftServices. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MSPMETRICSEXPORTER_HPP
+#define MSPMETRICSEXPORTER_HPP
+
+#include <string>
+#include <functional>
+#include <cstdint>
+
+#include <boost/asio.hpp>
+#include <boost/thread.hpp>
+
+#include "spdlog/spdlog.h"
+
+#include "MspLinkMetrics.hpp"
+
+namespace CraftServices
+{
+	// Every registered session's link metrics, in the Prometheus text exposition format
+	std::string FormatMetricsAsPrometheusText(const MspMetricsRegistry & metricsRegistry);
+
+	// How old positions are by the time they reach each craft, for every source -> destination pair, as
+	// readable text with percentiles
+	std::string FormatPositionAgeMatrixAsText(const MspMetricsRegistry & metricsRegistry);
+
+	// Serves the link metrics over HTTP, for dashboards to scrape, on a loopback TCP port and/or a Unix domain
+	// socket. Nothing is reachable from off the machine.
+	//
+	// The exporter runs its own IO context on its own thread, so a scrape never holds up serial traffic; it
+	// only ever reads the metrics, which the sessions update without locking.
+	class MspMetricsExporter
+	{
+		public:
+
+			// The logger is not owned, and must outlive the exporter
+			explicit MspMetricsExporter(spdlog::logger * pLogger);
+			~MspMetricsExporter();
+
+			// Listen on 127.0.0.1 on this port. Throws if the port can't be bound.
+			void ListenOnLoopbackPort(uint16_t port);
+
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+			// Listen on a Unix domain socket at this path, replacing any socket file left there.
+			// Throws if the socket can't be bound.
+			void ListenOnUnixSocket(const std::string & socketPath);
+#endif // BOOST_ASIO_HAS_LOCAL_SOCKETS
+
+			// Start serving scrapes on the exporter's thread
+			void Start();
+
+			// Stop serving, and wait for the exporter's thread to finish. Safe to call more than once.
+			void Stop();
+
+		private:
+
+			void AcceptNextTcpConnection();
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+			void AcceptNextUnixConnection();
+#endif // BOOST_ASIO_HAS_LOCAL_SOCKETS
+			// After an accept fails, wait before calling acceptNext, waiting longer each time it keeps failing
+			// (i.e. out of file descriptors) rather than spinning on the error
+			void RetryAcceptLater(boost::asio::steady_timer & acceptRetryTimer, uint32_t & acceptRetryDelayInMilliseconds,
+								  const boost::system::error_code & acceptError, std::function<void()> acceptNext);
+			void RunExporterThread();
+
+			// Non-owning pointer
+			spdlog::logger * pExporterLogger;
+
+			boost::asio::io_context ExporterIoContext;
+			boost::asio::ip::tcp::acceptor * pTcpAcceptor;
+			boost::asio::steady_timer TcpAcceptRetryTimer;
+			uint32_t TcpAcceptRetryDelayInMilliseconds;
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+			boost::asio::local::stream_protocol::acceptor * pUnixAcceptor;
+			boost::asio::steady_timer UnixAcceptRetryTimer;
+			uint32_t UnixAcceptRetryDelayInMilliseconds;
+			std::string UnixSocketPath;
+#endif // BOOST_ASIO_HAS_LOCAL_SOCKETS
+			boost::thread * pExporterThread;
+	};
+
+} // Namespace CraftServices
+
+#endif // MSPMETRICSEXPORTER_HPP
@@ -0,0 +1,340 @@
+/*
+ * This file is part of CraftServices.
+ *
+ * CraftServices is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CraftServices is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CraftServices. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "MspNetworkTransport.hpp"
+
+namespace CraftServices
+{
+	// How long a bridge gets to accept a connection
+	const uint32_t TCP_CONNECT_TIMEOUT_IN_MILLISECONDS = 5000;
+
+	bool SplitNetworkAddress(const std::string & address, std::string & host, std::string & port)
+	{
+		size_t portSeparatorPosition = address.rfind(':');
+		if (portSeparatorPosition == std::string::npos)
+		{
+			return false;
+		}
+
+		host = address.substr(0, portSeparatorPosition);
+		port = address.substr(portSeparatorPosition + 1);
+
+		// IPv6 addresses are bracketed, to keep their colons apart from the port's
+		if (host.size() >= 2 && host.front() == '[' && host.back() == ']')
+		{
+			host = host.substr(1, host.size() - 2);
+		}
+
+		return !host.empty() && !port.empty();
+	}
+
+	// ---- TCP ----
+
+	MspTcpTransport::MspTcpTransport(boost::asio::io_context * pIoContext, boost::asio::io_context::strand * pSessionStrand, MspTransportListener * pTransportListener,
+									 const std::string & address) :
+		MspTransport(pSessionStrand, pTransportListener), Address(address), Resolver(*pIoContext), Socket(*pIoContext), ConnectTimer(*pIoContext), OpenInProgress(false), OpenAttemptCount(0)
+	{
+	}
+
+	// Look the bridge up, then connect to it. Whichever of that and the connect timeout finishes first decides
+	// how the open went.
+	void MspTcpTransport::StartOpen()
+	{
+		std::string host;
+		std::string port;
+		if (!SplitNetworkAddress(Address, host, port))
+		{
+			PostOpened(boost::asio::error::invalid_argument);
+			return;
+		}
+
+		OpenInProgress = true;
+		OpenAttemptCount++;
+
+		ConnectTimer.expires_after(boost::asio::chrono::milliseconds(TCP_CONNECT_TIMEOUT_IN_MILLISECONDS));
+		ConnectTimer.async_wait(boost::asio::bind_executor(*pStrand, [this, lifetimeToken = GetLifetimeToken(), openAttempt = OpenAttemptCount](const boost::system::error_code & error)
+			{
+				if (!lifetimeToken.expired() && IsCurrentOpenAttempt(openAttempt))
+				{
+					ConnectTimeoutCallback(error);
+				}
+			}));
+
+		Resolver.async_resolve(host, port, boost::asio::bind_executor(*pStrand, [this, lifetimeToken = GetLifetimeToken(), openAttempt = OpenAttemptCount](const boost::system::error_code & error, const boost::asio::ip::tcp::resolver::results_type & resolvedEndpoints)
+			{
+				if (!lifetimeToken.expired() && IsCurrentOpenAttempt(openAttempt))
+				{
+					ResolveCallback(error, resolvedEndpoints);
+				}
+			}));
+	}
+
+	// Handlers left over from an open attempt that has already finished (one way or the other) have nothing to do
+	bool MspTcpTransport::IsCurrentOpenAttempt(uint32_t openAttempt) const
+	{
+		return OpenInProgress && openAttempt == OpenAttemptCount;
+	}
+
+	void MspTcpTransport::ResolveCallback(const boost::system::error_code & error, const boost::asio::ip::tcp::resolver::results_type & resolvedEndpoints)
+	{
+		if (error)
+		{
+			FinishOpen(error);
+			return;
+		}
+
+		boost::asio::async_connect(Socket, resolvedEndpoints, boost::asio::bind_executor(*pStrand, [this, lifetimeToken = GetLifetimeToken(), openAttempt = OpenAttemptCount](const boost::system::error_code & error, const boost::asio::ip::tcp::endpoint &)
+			{
+				if (!lifetimeToken.expired() && IsCurrentOpenAttempt(openAttempt))
+				{
+					ConnectCallback(error);
+				}
+			}));
+	}
+
+	void MspTcpTransport::ConnectCallback(const boost::system::error_code & error)
+	{
+		if (!error)
+		{
+			// MSP messages are small, and each one is waited on; don't let them sit waiting to be coalesced
+			boost::system::error_code ignoredError;
+			Socket.set_option(boost::asio::ip::tcp::no_delay(true), ignoredError);
+		}
+
+		FinishOpen(error);
+	}
+
+	void MspTcpTransport::ConnectTimeoutCallback(const boost::system::error_code & error)
+	{
+		if (error == boost::asio::error::operation_aborted)
+		{
+			return;
+		}
+
+		FinishOpen(boost::asio::error::timed_out);
+	}
+
+	void MspTcpTransport::FinishOpen(const boost::system::error_code & error)
+	{
+		OpenInProgress = false;
+		ConnectTimer.cancel();
+
+		if (error)
+		{
+			Resolver.cancel();
+			Close();
+		}
+
+		// (Already on the strand)
+		pListener->OnTransportOpened(error);
+	}
+
+	void MspTcpTransport::Close()
+	{
+		boost::system::error_code ignoredError;
+		Socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignoredError);
+		Socket.close(ignoredError);
+	}
+
+	bool MspTcpTransport::IsOpen() const
+	{
+		return Socket.is_open() && !OpenInProgress;
+	}
+
+	void MspTcpTransport::Cancel()
+	{
+		boost::system::error_code ignoredError;
+		Socket.cancel(ignoredError);
+	}
+
+	// Anything the bridge has already sent us is read and dropped. (Nothing waits on our side to be sent; once
+	// written, it's the OS's.)
+	void MspTcpTransport::Flush()
+	{
+		boost::system::error_code error;
+		size_t availableByteCount = Socket.available(error);
+		while (!error && availableByteCount > 0)
+		{
+			std::array<uint8_t, 512> discardBuffer;
+			size_t discardedByteCount = Socket.read_some(boost::asio::buffer(discardBuffer, std::min(availableByteCount, discardBuffer.size())), error);
+			availableByteCount -= std::min(availableByteCount, discardedByteCount);
+		}
+	}
+
+	void MspTcpTransport::StartRead(const boost::asio::mutable_buffer & readBuffer)
+	{
+		Socket.async_read_some(readBuffer, GetReadHandler());
+	}
+
+	void MspTcpTransport::StartWrite(const std::vector<boost::asio::const_buffer> & writeBuffers)
+	{
+		boost::asio::async_write(Socket, writeBuffers, GetWriteHandler());
+	}
+
+	std::string MspTcpTransport::GetDescription() const
+	{
+		return "TCP " + Address;
+	}
+
+	// ---- UDP ----
+
+	size_t MspUdpTransport::ReceivedDatagram::TakeUnreadBytes(const boost::asio::mutable_buffer & readBuffer)
+	{
+		size_t takenByteCount = std::min(ByteCount - ReadOffset, readBuffer.size());
+		memcpy(readBuffer.data(), Bytes.data() + ReadOffset, takenByteCount);
+		ReadOffset += takenByteCount;
+		return takenByteCount;
+	}
+
+	MspUdpTransport::MspUdpTransport(boost::asio::io_context * pIoContext, boost::asio::io_context::strand * pSessionStrand, MspTransportListener * pTransportListener,
+									 const std::string & address) :
+		MspTransport(pSessionStrand, pTransportListener), Address(address), Resolver(*pIoContext), Socket(*pIoContext), 
+		pReceivedDatagram(std::make_shared<ReceivedDatagram>()), pDatagramToSend(std::make_shared<ByteVector>())
+	{
+	}
+
+	// There's no connection to make with UDP; once the bridge's address is known, the socket is set up to send to
+	// it (and only hear from it), and that's all
+	void MspUdpTransport::StartOpen()
+	{
+		std::string host;
+		std::string port;
+		if (!SplitNetworkAddress(Address, host, port))
+		{
+			PostOpened(boost::asio::error::invalid_argument);
+			return;
+		}
+
+		Resolver.async_resolve(host, port, boost::asio::bind_executor(*pStrand, [this, lifetimeToken = GetLifetimeToken()](const boost::system::error_code & error, const boost::asio::ip::udp::resolver::results_type & resolvedEndpoints)
+			{
+				if (!lifetimeToken.expired())
+				{
+					ResolveCallback(error, resolvedEndpoints);
+				}
+			}));
+	}
+
+	void MspUdpTransport::ResolveCallback(const boost::system::error_code & error, const boost::asio::ip::udp::resolver::results_type & resolvedEndpoints)
+	{
+		boost::system::error_code openError = error;
+		if (!openError && resolvedEndpoints.empty())
+		{
+			openError = boost::asio::error::host_not_found;
+		}
+		if (!openError)
+		{
+			boost::asio::ip::udp::endpoint bridgeEndpoint = resolvedEndpoints.begin()->endpoint();
+			Socket.open(bridgeEndpoint.protocol(), openError);
+			if (!openError)
+			{
+				Socket.connect(bridgeEndpoint, openError);
+			}
+		}
+
+		if (openError)
+		{
+			Close();
+		}
+		else
+		{
+			pReceivedDatagram->ByteCount = 0;
+			pReceivedDatagram->ReadOffset = 0;
+		}
+
+		// (Already on the strand)
+		pListener->OnTransportOpened(openError);
+	}
+
+	void MspUdpTransport::Close()
+	{
+		boost::system::error_code ignoredError;
+		Socket.close(ignoredError);
+	}
+
+	bool MspUdpTransport::IsOpen() const
+	{
+		return Socket.is_open();
+	}
+
+	void MspUdpTransport::Cancel()
+	{
+		boost::system::error_code ignoredError;
+		Socket.cancel(ignoredError);
+	}
+
+	void MspUdpTransport::Flush()
+	{
+		pReceivedDatagram->ByteCount = 0;
+		pReceivedDatagram->ReadOffset = 0;
+
+		boost::system::error_code error;
+		while (!error && Socket.available(error) > 0)
+		{
+			Socket.receive(boost::asio::buffer(pReceivedDatagram->Bytes), 0, error);
+		}
+	}
+
+	void MspUdpTransport::StartRead(const boost::asio::mutable_buffer & readBuffer)
+	{
+		// Still working through the last datagram
+		if (pReceivedDatagram->HasUnreadBytes())
+		{
+			PostRead(boost::system::error_code(), pReceivedDatagram->TakeUnreadBytes(readBuffer));
+			return;
+		}
+
+		Socket.async_receive(boost::asio::buffer(pReceivedDatagram->Bytes), boost::asio::bind_executor(*pStrand, 
+			[pDatagram = pReceivedDatagram, readBuffer, pCompletionListener = pListener](const boost::system::error_code & error, size_t sizeReceived)
+			{
+				size_t sizeRead = 0;
+				if (!error)
+				{
+					pDatagram->ByteCount = sizeReceived;
+					pDatagram->ReadOffset = 0;
+					sizeRead = pDatagram->TakeUnreadBytes(readBuffer);
+				}
+				pCompletionListener->OnTransportRead(error, sizeRead);
+			}));
+	}
+
+	void MspUdpTransport::StartWrite(const std::vector<boost::asio::const_buffer> & writeBuffers)
+	{
+		// Only one write is outstanding at a time, so this is normally free to reuse; if a send the transport
+		// gave up on (i.e. closed under it) still holds it, leave it be
+		if (pDatagramToSend.use_count() > 1)
+		{
+			pDatagramToSend = std::make_shared<ByteVector>();
+		}
+		pDatagramToSend->resize(boost::asio::buffer_size(writeBuffers));
+		boost::asio::buffer_copy(boost::asio::buffer(*pDatagramToSend), writeBuffers);
+
+		Socket.async_send(boost::asio::buffer(*pDatagramToSend), boost::asio::bind_executor(*pStrand,
+			[pDatagram = pDatagramToSend, pCompletionListener = pListener](const boost::system::error_code & error, size_t sizeWritten)
+			{
+				pCompletionListener->OnTransportWritten(error, sizeWritten);
+			}));
+	}
+
+	std::string MspUdpTransport::GetDescription() const
+	{
+		return "UDP " + Address;
+	}
+
+} // Namespace CraftServices
@@ -0,0 +1,124 @@
+/*
+ * This file is part of CraftServices.
+ *
+ * CraftServices is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CraftServices is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CraftServices. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MSPNETWORKTRANSPORT_HPP
+#define MSPNETWORKTRANSPORT_HPP
+
+#include <string>
+#include <vector>
+#include <array>
+#include <memory>
+#include <cstdint>
+
+#include <boost/asio.hpp>
+
+#include "CraftServicesTypes.hpp"
+#include "MspTransport.hpp"
+
+namespace CraftServices
+{
+	// Split "host:port" (or "[v6 address]:port") into its host and port. False if either is missing.
+	bool SplitNetworkAddress(const std::string & address, std::string & host, std::string & port);
+
+	// A TCP connection to a network bridge (i.e. an ESP WiFi to MSP bridge) with the flight controller on its far end.
+	// Bridges like these carry far more than a serial radio can, so the session's baud rate should be set to match
+	// the bridge's serial side, not the radio's.
+	class MspTcpTransport : public MspTransport
+	{
+		public:
+
+			// address is "host:port"
+			MspTcpTransport(boost::asio::io_context * pIoContext, boost::asio::io_context::strand * pSessionStrand, MspTransportListener * pTransportListener,
+							const std::string & address);
+
+			void StartOpen() override;
+			void Close() override;
+			bool IsOpen() const override;
+			void Cancel() override;
+			void Flush() override;
+			void StartRead(const boost::asio::mutable_buffer & readBuffer) override;
+			void StartWrite(const std::vector<boost::asio::const_buffer> & writeBuffers) override;
+			std::string GetDescription() const override;
+
+		private:
+
+			bool IsCurrentOpenAttempt(uint32_t openAttempt) const;
+			void ResolveCallback(const boost::system::error_code & error, const boost::asio::ip::tcp::resolver::results_type & resolvedEndpoints);
+			void ConnectCallback(const boost::system::error_code & error);
+			void ConnectTimeoutCallback(const boost::system::error_code & error);
+			void FinishOpen(const boost::system::error_code & error);
+
+			std::string Address;
+			boost::asio::ip::tcp::resolver Resolver;
+			boost::asio::ip::tcp::socket Socket;
+			// Gives up on a bridge that doesn't answer, rather than waiting out the OS's (very long) connect timeout
+			boost::asio::steady_timer ConnectTimer;
+			bool OpenInProgress;
+			uint32_t OpenAttemptCount;
+	};
+
+	// UDP datagrams to and from a network bridge. Each write goes out as one datagram; datagrams coming back are
+	// read as a stream of bytes, like any other link, however they happen to be split up.
+	class MspUdpTransport : public MspTransport
+	{
+		public:
+
+			// address is "host:port"
+			MspUdpTransport(boost::asio::io_context * pIoContext, boost::asio::io_context::strand * pSessionStrand, MspTransportListener * pTransportListener,
+							const std::string & address);
+
+			void StartOpen() override;
+			void Close() override;
+			bool IsOpen() const override;
+			void Cancel() override;
+			void Flush() override;
+			void StartRead(const boost::asio::mutable_buffer & readBuffer) override;
+			void StartWrite(const std::vector<boost::asio::const_buffer> & writeBuffers) override;
+			std::string GetDescription() const override;
+
+		private:
+
+			// A datagram has to be received whole, and can hold more than the session reads at once; the rest is
+			// handed out by the reads that follow. Shared with the outstanding receive, which can outlive the transport.
+			struct ReceivedDatagram
+			{
+				std::array<uint8_t, 65536> Bytes;
+				size_t ByteCount = 0;
+				size_t ReadOffset = 0;
+
+				bool HasUnreadBytes() const
+				{
+					return ReadOffset < ByteCount;
+				}
+
+				// Copy as much as fits into readBuffer, returning how much that was
+				size_t TakeUnreadBytes(const boost::asio::mutable_buffer & readBuffer);
+			};
+
+			void ResolveCallback(const boost::system::error_code & error, const boost::asio::ip::udp::resolver::results_type & resolvedEndpoints);
+
+			std::string Address;
+			boost::asio::ip::udp::resolver Resolver;
+			boost::asio::ip::udp::socket Socket;
+			std::shared_ptr<ReceivedDatagram> pReceivedDatagram;
+			// A write goes out as one datagram, gathered up here. Shared with the outstanding send, like the received datagram.
+			std::shared_ptr<ByteVector> pDatagramToSend;
+	};
+
+} // Namespace CraftServices
+
+#endif // MSPNETWORKTRANSPORT_HPP
@@ -0,0 +1,117 @@
+/*
+ * This file is part of CraftServices.
+ *
+ * CraftServices is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CraftServices is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CraftServices. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MSPPIPELINESTAGETIMES_HPP
+#define MSPPIPELINESTAGETIMES_HPP
+
+#include <chrono>
+#include <cstdint>
+
+#include "AllocationCounter.hpp"
+
+namespace CraftServices
+{
+	// The stages a session's work falls into, for profiling (see MspCaptureReplay)
+	enum class MspPipelineStage
+	{
+		// Finding and checking messages in received bytes
+		Parse = 0,
+		// Acting on a complete message: decoding it, matching it to its request, publishing positions
+		Decode,
+		// Planning a refresh cycle: working out what to request, and what to tell the craft about the others
+		Refresh,
+		// Handing queued messages to the port, and finishing up after the write
+		Transmit,
+		StageCount
+	};
+
+	// Time spent and allocations made in each stage. Stages nest (i.e. decoding happens in the middle of parsing),
+	// and each stage is only charged for its own share, not for the stages nested inside it. Only allocations made
+	// by the thread running the stage count (see AllocationCounter).
+	//
+	// Not thread safe; one set of times is shared by sessions that all run on the same thread.
+	struct MspPipelineStageTimes
+	{
+		static const size_t StageCount = (size_t)MspPipelineStage::StageCount;
+
+		uint64_t RunCount[StageCount] = {};
+		uint64_t ElapsedNanoseconds[StageCount] = {};
+		uint64_t AllocationCount[StageCount] = {};
+
+		// The stage running right now, and when it was last charged up to
+		int CurrentStage = -1;
+		std::chrono::steady_clock::time_point CurrentStageChargedUntilTime;
+		uint64_t CurrentStageChargedUntilAllocationCount = 0;
+
+		static const char * GetStageName(size_t stageIndex)
+		{
+			static const char * StageNames[StageCount] = { "Parse", "Decode", "Refresh", "Transmit" };
+			return (stageIndex < StageCount) ? StageNames[stageIndex] : "Unknown";
+		}
+
+		// Charge the running stage for everything since it was last charged
+		void ChargeCurrentStage(std::chrono::steady_clock::time_point now, uint64_t allocationCount)
+		{
+			if (CurrentStage >= 0)
+			{
+				ElapsedNanoseconds[CurrentStage] += std::chrono::duration_cast<std::chrono::nanoseconds>(now - CurrentStageChargedUntilTime).count();
+				AllocationCount[CurrentStage] += allocationCount - CurrentStageChargedUntilAllocationCount;
+			}
+			CurrentStageChargedUntilTime = now;
+			CurrentStageChargedUntilAllocationCount = allocationCount;
+		}
+	};
+
+	// Charges the time (and allocations) from here to the end of the scope to one stage. Does nothing if there are 
+	// no stage times to charge, which is the case except when profiling.
+	class MspPipelineStageStopwatch
+	{
+		public:
+
+			MspPipelineStageStopwatch(MspPipelineStageTimes * pStageTimes, MspPipelineStage stage) : pTimes(pStageTimes), OuterStage(-1)
+			{
+				if (pTimes == NULL)
+				{
+					return;
+				}
+
+				pTimes->ChargeCurrentStage(std::chrono::steady_clock::now(), AllocationCounter::GetAllocationCount());
+				OuterStage = pTimes->CurrentStage;
+				pTimes->CurrentStage = (int)stage;
+				pTimes->RunCount[(size_t)stage]++;
+			}
+
+			~MspPipelineStageStopwatch()
+			{
+				if (pTimes == NULL)
+				{
+					return;
+				}
+
+				pTimes->ChargeCurrentStage(std::chrono::steady_clock::now(), AllocationCounter::GetAllocationCount());
+				pTimes->CurrentStage = OuterStage;
+			}
+
+		private:
+
+			MspPipelineStageTimes * pTimes;
+			int OuterStage;
+	};
+
+} // Namespace CraftServices
+
+#endif // MSPPIPELINESTAGETIMES_HPP
@@ -0,0 +1,243 @@
+/*
+ * This file is part of CraftServices.
+ *
+ * CraftServices is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CraftServices is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CraftServices. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MSPREFRESHRATECONTROLLER_HPP
+#define MSPREFRESHRATECONTROLLER_HPP
+
+#include <cstdint>
+#include <algorithm>
+
+namespace CraftServices
+{
+	// Whether, and within what bounds, a port picks its own refresh interval
+	struct MspRefreshRateSettings
+	{
+		bool Automatic;
+		uint32_t MinimumIntervalInMilliseconds;
+		uint32_t MaximumIntervalInMilliseconds;
+	};
+
+	// How one refresh cycle on a port went
+	struct MspRefreshCycleOutcome
+	{
+		// Did every reply come in before the next refresh was due?
+		bool AllRepliesIn;
+
+		// Problems seen since the last cycle
+		uint64_t TimedOutRequestCount;
+		uint64_t CrcMismatchCount;
+		bool ReadOrWriteErrors;
+
+		// The interval can't usefully go below the airtime a refresh needs (see MspAirtimeScheduler)
+		uint32_t AirtimeNeededInMilliseconds;
+	};
+
+	// Why the interval last changed
+	enum class MspRefreshRateChange
+	{
+		None,
+		Tightened,
+		BackedOffForLoss,
+		BackedOffForRoundTripTime
+	};
+
+	// Picks a port's refresh interval automatically, AIMD style (additive increase, multiplicative decrease),
+	// the same way TCP finds a link's capacity.
+	//
+	// Every cycle that comes back complete and clean shaves a little off the interval. Any sign the link is past
+	// what it can carry - a request timing out, a CRC error, a read or write error, or round trip times climbing
+	// well above the best we've seen - backs the interval off by half again, then holds it there for a few
+	// cycles to let the link drain. The interval ends up hovering just under the point where trouble starts,
+	// and each port finds its own, since every link is different.
+	class MspRefreshRateController
+	{
+		public:
+
+			// Fraction of each new round trip time sample folded into the smoothed value (1/8, as TCP uses)
+			static const int64_t RoundTripTimeSmoothingDivisor = 8;
+
+			// The smoothed round trip time may grow to this many times the baseline (plus the slack below)
+			// before we take it as the link queueing up
+			static const int64_t RoundTripTimeGrowthNumerator = 3;
+			static const int64_t RoundTripTimeGrowthDenominator = 2;
+			static const int64_t RoundTripTimeSlackInMilliseconds = 5;
+
+			// Length of the windows the baseline round trip time is taken over
+			static const uint32_t BaselineWindowInCycles = 256;
+
+			// How far a clean cycle tightens the interval
+			static const uint32_t TightenStepInMilliseconds = 2;
+
+			// Cycles to hold after backing off, before tightening again
+			static const uint32_t HoldCyclesAfterBackOff = 4;
+
+			MspRefreshRateController() : Settings(), IntervalInMilliseconds(0), SmoothedRoundTripTimeInMilliseconds(-1),
+				CurrentWindowBestRoundTripTimeInMilliseconds(-1), PreviousWindowBestRoundTripTimeInMilliseconds(-1), CyclesInBaselineWindow(0), HoldCyclesRemaining(0), LastChange(MspRefreshRateChange::None)
+			{
+			}
+
+			void Start(const MspRefreshRateSettings & settings, uint32_t initialIntervalInMilliseconds)
+			{
+				Settings = settings;
+				IntervalInMilliseconds = initialIntervalInMilliseconds;
+				SmoothedRoundTripTimeInMilliseconds = -1;
+				CurrentWindowBestRoundTripTimeInMilliseconds = -1;
+				PreviousWindowBestRoundTripTimeInMilliseconds = -1;
+				CyclesInBaselineWindow = 0;
+				HoldCyclesRemaining = 0;
+				LastChange = MspRefreshRateChange::None;
+			}
+
+			bool IsAutomatic() const
+			{
+				return Settings.Automatic;
+			}
+
+			uint32_t GetIntervalInMilliseconds() const
+			{
+				return IntervalInMilliseconds;
+			}
+
+			MspRefreshRateChange GetLastChange() const
+			{
+				return LastChange;
+			}
+
+			// Negative until the first reply comes in
+			int64_t GetSmoothedRoundTripTimeInMilliseconds() const
+			{
+				return SmoothedRoundTripTimeInMilliseconds;
+			}
+
+			// Best round trip time seen lately; negative until the first reply comes in
+			int64_t GetBaselineRoundTripTimeInMilliseconds() const
+			{
+				if (PreviousWindowBestRoundTripTimeInMilliseconds < 0)
+				{
+					return CurrentWindowBestRoundTripTimeInMilliseconds;
+				}
+				if (CurrentWindowBestRoundTripTimeInMilliseconds < 0)
+				{
+					return PreviousWindowBestRoundTripTimeInMilliseconds;
+				}
+				return std::min(PreviousWindowBestRoundTripTimeInMilliseconds, CurrentWindowBestRoundTripTimeInMilliseconds);
+			}
+
+			void AddRoundTripTimeSample(int64_t roundTripTimeInMilliseconds)
+			{
+				if (SmoothedRoundTripTimeInMilliseconds < 0)
+				{
+					SmoothedRoundTripTimeInMilliseconds = roundTripTimeInMilliseconds;
+				}
+				else
+				{
+					SmoothedRoundTripTimeInMilliseconds += (roundTripTimeInMilliseconds - SmoothedRoundTripTimeInMilliseconds) / RoundTripTimeSmoothingDivisor;
+				}
+
+				if (CurrentWindowBestRoundTripTimeInMilliseconds < 0 || roundTripTimeInMilliseconds < CurrentWindowBestRoundTripTimeInMilliseconds)
+				{
+					CurrentWindowBestRoundTripTimeInMilliseconds = roundTripTimeInMilliseconds;
+				}
+			}
+
+			// Look at how the last cycle went and adjust. Returns true if the interval changed.
+			bool EndCycle(const MspRefreshCycleOutcome & cycleOutcome)
+			{
+				LastChange = MspRefreshRateChange::None;
+				if (!Settings.Automatic)
+				{
+					return false;
+				}
+
+				uint32_t previousIntervalInMilliseconds = IntervalInMilliseconds;
+
+				// The baseline is the best round trip time over the last one to two windows of cycles. That way, if
+				// the link itself gets slower for good (i.e. a radio dropping to a lower air rate), the old, better 
+				// baseline ages out rather than having us back off forever.
+				CyclesInBaselineWindow++;
+				if (CyclesInBaselineWindow >= BaselineWindowInCycles)
+				{
+					CyclesInBaselineWindow = 0;
+					PreviousWindowBestRoundTripTimeInMilliseconds = CurrentWindowBestRoundTripTimeInMilliseconds;
+					CurrentWindowBestRoundTripTimeInMilliseconds = -1;
+				}
+
+				bool lossSeen = cycleOutcome.TimedOutRequestCount > 0 || cycleOutcome.CrcMismatchCount > 0 || cycleOutcome.ReadOrWriteErrors;
+				// The smoothed round trip time is slow to come back down after a spike, so it's only looked at once
+				// the hold after the last back off is over. Otherwise one slow reply would back us off every cycle,
+				// all the way to the maximum.
+				bool roundTripTimeGrowing = HoldCyclesRemaining == 0 && IsRoundTripTimeGrowing();
+				if (lossSeen || roundTripTimeGrowing)
+				{
+					IntervalInMilliseconds = std::min(Settings.MaximumIntervalInMilliseconds, std::max(IntervalInMilliseconds + 1, (IntervalInMilliseconds * 3) / 2));
+					HoldCyclesRemaining = HoldCyclesAfterBackOff;
+					if (roundTripTimeGrowing)
+					{
+						// Start the smoothed round trip time over, from replies at the new interval
+						SmoothedRoundTripTimeInMilliseconds = -1;
+					}
+					if (IntervalInMilliseconds != previousIntervalInMilliseconds)
+					{
+						LastChange = lossSeen ? MspRefreshRateChange::BackedOffForLoss : MspRefreshRateChange::BackedOffForRoundTripTime;
+					}
+				}
+				else if (HoldCyclesRemaining > 0)
+				{
+					HoldCyclesRemaining--;
+				}
+				else if (cycleOutcome.AllRepliesIn)
+				{
+					uint32_t floorInMilliseconds = std::max(Settings.MinimumIntervalInMilliseconds, cycleOutcome.AirtimeNeededInMilliseconds);
+					if (IntervalInMilliseconds > floorInMilliseconds)
+					{
+						uint32_t tightenStepInMilliseconds = TightenStepInMilliseconds;
+						IntervalInMilliseconds = std::max(floorInMilliseconds, IntervalInMilliseconds - std::min(IntervalInMilliseconds, tightenStepInMilliseconds));
+						LastChange = MspRefreshRateChange::Tightened;
+					}
+				}
+
+				return IntervalInMilliseconds != previousIntervalInMilliseconds;
+			}
+
+		private:
+
+			bool IsRoundTripTimeGrowing() const
+			{
+				int64_t baselineRoundTripTimeInMilliseconds = GetBaselineRoundTripTimeInMilliseconds();
+				if (SmoothedRoundTripTimeInMilliseconds < 0 || baselineRoundTripTimeInMilliseconds < 0)
+				{
+					return false;
+				}
+
+				int64_t allowedRoundTripTimeInMilliseconds = (baselineRoundTripTimeInMilliseconds * RoundTripTimeGrowthNumerator) / RoundTripTimeGrowthDenominator + 
+															 RoundTripTimeSlackInMilliseconds;
+				return SmoothedRoundTripTimeInMilliseconds > allowedRoundTripTimeInMilliseconds;
+			}
+
+			MspRefreshRateSettings Settings;
+			uint32_t IntervalInMilliseconds;
+			int64_t SmoothedRoundTripTimeInMilliseconds;
+			int64_t CurrentWindowBestRoundTripTimeInMilliseconds;
+			int64_t PreviousWindowBestRoundTripTimeInMilliseconds;
+			uint32_t CyclesInBaselineWindow;
+			uint32_t HoldCyclesRemaining;
+			MspRefreshRateChange LastChange;
+	};
+
+} // Namespace CraftServices
+
+#endif // MSPREFRESHRATECONTROLLER_HPP
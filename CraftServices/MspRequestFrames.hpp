@@ -0,0 +1,90 @@
+/*
+ * This file is part of CraftServices.
+ *
+ * CraftServices is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CraftServices is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CraftServices. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MSPREQUESTFRAMES_HPP
+#define MSPREQUESTFRAMES_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+#include "CraftServicesMspID.hpp"
+#include "CRC.hpp"
+
+namespace CraftServices
+{
+	// A complete MSP V2 request with no payload: "$X<", flag, message ID, zero length, CRC.
+	//
+	// Requests like these are the same bytes every time they are sent, so they are built entirely by the
+	// compiler, CRC included, and sent straight from static storage.
+	struct MspRequestFrame
+	{
+		static const size_t FrameLength = 9;
+
+		uint8_t Bytes[FrameLength];
+
+		constexpr uint16_t GetMessageID() const
+		{
+			return (uint16_t)(Bytes[4] | (Bytes[5] << 8));
+		}
+
+		constexpr const uint8_t * data() const
+		{
+			return Bytes;
+		}
+
+		constexpr size_t size() const
+		{
+			return FrameLength;
+		}
+	};
+
+	constexpr MspRequestFrame MakeMspRequestFrame(CraftServices::ID messageID)
+	{
+		MspRequestFrame requestFrame = {};
+
+		requestFrame.Bytes[0] = '$';
+		// 'X' is used in MSP V2 instead of 'M' in MSP V1.
+		requestFrame.Bytes[1] = 'X';
+		// Direction indicator
+		requestFrame.Bytes[2] = '<';
+		// Unused flag (always 0 for now)
+		requestFrame.Bytes[3] = 0;
+		// message_id (function) - low byte, high byte
+		requestFrame.Bytes[4] = (uint8_t)((uint16_t)messageID & 0xFF);
+		requestFrame.Bytes[5] = (uint8_t)((uint16_t)messageID >> 8);
+		// data payload length - always zero
+		requestFrame.Bytes[6] = 0;
+		requestFrame.Bytes[7] = 0;
+		// CRC covers everything after the direction indicator
+		requestFrame.Bytes[8] = Crc::crc8_dvb_s2_update(0, requestFrame.Bytes + 3, 5);
+
+		return requestFrame;
+	}
+
+	// The requests we send.
+	namespace RequestFrames
+	{
+		constexpr MspRequestFrame FcVariant = MakeMspRequestFrame(CraftServices::ID::MSP_FC_VARIANT);
+		constexpr MspRequestFrame Uid = MakeMspRequestFrame(CraftServices::ID::MSP_UID);
+		constexpr MspRequestFrame ApiVersion = MakeMspRequestFrame(CraftServices::ID::MSP_API_VERSION);
+		constexpr MspRequestFrame CraftName = MakeMspRequestFrame(CraftServices::ID::MSP_NAME);
+		constexpr MspRequestFrame RawGps = MakeMspRequestFrame(CraftServices::ID::MSP_RAW_GPS);
+	}
+
+} // Namespace CraftServices
+
+#endif // MSPREQUESTFRAMES_HPP
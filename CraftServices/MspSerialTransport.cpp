@@ -0,0 +1,120 @@
+/*
+ * This file is part of CraftServices.
+ *
+ * CraftServices is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CraftServices is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CraftServices. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "MspSerialTransport.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <termios.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
+namespace CraftServices
+{
+	MspSerialTransport::MspSerialTransport(boost::asio::io_context * pIoContext, boost::asio::io_context::strand * pSessionStrand, MspTransportListener * pTransportListener,
+										   const std::string & serialPortName, uint32_t baudRate) :
+		MspTransport(pSessionStrand, pTransportListener), SerialPort(*pIoContext), SerialPortName(serialPortName), BaudRate(baudRate)
+	{
+	}
+
+	// Opening a serial port doesn't wait on anything, so this is done straight away; the listener still hears about
+	// it on the strand, as it would for any other transport.
+	void MspSerialTransport::StartOpen()
+	{
+		boost::system::error_code error;
+		SerialPort.open(SerialPortName, error);
+
+		// TODO: Try other (higher?) baud rates. Make configurable from command line.
+		if (!error)
+		{
+			SerialPort.set_option(boost::asio::serial_port::baud_rate(BaudRate), error);
+		}
+		if (!error)
+		{
+			SerialPort.set_option(boost::asio::serial_port::parity(boost::asio::serial_port::parity::none), error);
+		}
+		if (!error)
+		{
+			SerialPort.set_option(boost::asio::serial_port::character_size(8), error);
+		}
+		if (!error)
+		{
+			SerialPort.set_option(boost::asio::serial_port::stop_bits(boost::asio::serial_port::stop_bits::one), error);
+		}
+
+		if (error)
+		{
+			Close();
+		}
+		else
+		{
+			// Clear out anything left over from before, for the new session
+			Flush();
+		}
+
+		PostOpened(error);
+	}
+
+	void MspSerialTransport::Close()
+	{
+		boost::system::error_code ignoredError;
+		SerialPort.close(ignoredError);
+	}
+
+	bool MspSerialTransport::IsOpen() const
+	{
+		return SerialPort.is_open();
+	}
+
+	void MspSerialTransport::Cancel()
+	{
+		boost::system::error_code ignoredError;
+		SerialPort.cancel(ignoredError);
+	}
+
+	void MspSerialTransport::Flush()
+	{
+		if (!SerialPort.is_open())
+		{
+			return;
+		}
+
+#if defined(__unix__) || defined(__APPLE__)
+		tcflush(SerialPort.native_handle(), TCIOFLUSH);
+#elif defined(_WIN32)
+		PurgeComm(SerialPort.native_handle(), PURGE_RXCLEAR | PURGE_TXCLEAR);
+#else
+		#warning "Flush() will be unimplemented"
+#endif
+	}
+
+	void MspSerialTransport::StartRead(const boost::asio::mutable_buffer & readBuffer)
+	{
+		SerialPort.async_read_some(readBuffer, GetReadHandler());
+	}
+
+	void MspSerialTransport::StartWrite(const std::vector<boost::asio::const_buffer> & writeBuffers)
+	{
+		boost::asio::async_write(SerialPort, writeBuffers, GetWriteHandler());
+	}
+
+	std::string MspSerialTransport::GetDescription() const
+	{
+		return "serial port " + SerialPortName + " at " + std::to_string(BaudRate) + " baud";
+	}
+
+} // Namespace CraftServices
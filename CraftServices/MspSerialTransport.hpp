@@ -0,0 +1,58 @@
+/*
+ * This file is part of CraftServices.
+ *
+ * CraftServices is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CraftServices is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CraftServices. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MSPSERIALTRANSPORT_HPP
+#define MSPSERIALTRANSPORT_HPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <boost/asio.hpp>
+#include <boost/asio/serial_port.hpp>
+
+#include "MspTransport.hpp"
+
+namespace CraftServices
+{
+	// A serial port: a flight controller on a USB cable, or on the far end of a serial radio. 8N1 at the given baud rate.
+	class MspSerialTransport : public MspTransport
+	{
+		public:
+
+			MspSerialTransport(boost::asio::io_context * pIoContext, boost::asio::io_context::strand * pSessionStrand, MspTransportListener * pTransportListener,
+							   const std::string & serialPortName, uint32_t baudRate);
+
+			void StartOpen() override;
+			void Close() override;
+			bool IsOpen() const override;
+			void Cancel() override;
+			void Flush() override;
+			void StartRead(const boost::asio::mutable_buffer & readBuffer) override;
+			void StartWrite(const std::vector<boost::asio::const_buffer> & writeBuffers) override;
+			std::string GetDescription() const override;
+
+		private:
+
+			boost::asio::serial_port SerialPort;
+			std::string SerialPortName;
+			uint32_t BaudRate;
+	};
+
+} // Namespace CraftServices
+
+#endif // MSPSERIALTRANSPORT_HPP
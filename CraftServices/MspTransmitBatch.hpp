@@ -0,0 +1,162 @@
+/*
+ * This file is part of CraftServices.
+ *
+ * CraftServices is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CraftServices is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CraftServices. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MSPTRANSMITBATCH_HPP
+#define MSPTRANSMITBATCH_HPP
+
+#include <vector>
+#include <memory>
+
+#include <boost/asio.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "CraftServicesTypes.hpp"
+
+namespace CraftServices
+{
+	// Where a forwarded position came from, and when, so its age can be taken once it has actually been written
+	// out. Untraced (the default) for everything that isn't another session's position.
+	struct MspPositionTrace
+	{
+		// Metrics session ID of the session the position came from
+		uint32_t SourceSessionID = 0;
+
+		// When the source decoded the position from its Flight Controller's reply
+		boost::posix_time::ptime RetrievalTime;
+
+		bool IsTraced() const
+		{
+			return !RetrievalTime.is_not_a_date_time();
+		}
+	};
+
+	// A single complete MSP message, ready to be written out to a port
+	struct MspTransmitFrame
+	{
+		// Message ID, kept for logging and bookkeeping
+		uint16_t MessageID;
+
+		// Where the message bytes are
+		boost::asio::const_buffer FrameBuffer;
+
+		// Owner of the message bytes, if they were built at runtime. Immutable and shared, so they stay alive
+		// for as long as any write needs them. Empty for frames in static storage, which need no owner.
+		std::shared_ptr<const ByteVector> pOwnedFrameBytes;
+
+		// For other craft positions; travels with the frame through the queue, and any resends
+		MspPositionTrace PositionTrace;
+
+		size_t GetByteCount() const
+		{
+			return FrameBuffer.size();
+		}
+
+		// A frame built at runtime
+		static MspTransmitFrame FromSharedBytes(uint16_t messageID, std::shared_ptr<const ByteVector> pFrameBytes)
+		{
+			MspTransmitFrame transmitFrame;
+			transmitFrame.MessageID = messageID;
+			transmitFrame.FrameBuffer = boost::asio::buffer(*pFrameBytes);
+			transmitFrame.pOwnedFrameBytes = std::move(pFrameBytes);
+			return transmitFrame;
+		}
+
+		// A frame that lives for the life of the program (i.e. one built at compile time)
+		static MspTransmitFrame FromStaticBytes(uint16_t messageID, const uint8_t * pFrameBytes, size_t frameByteCount)
+		{
+			MspTransmitFrame transmitFrame;
+			transmitFrame.MessageID = messageID;
+			transmitFrame.FrameBuffer = boost::asio::const_buffer(pFrameBytes, frameByteCount);
+			return transmitFrame;
+		}
+	};
+
+	// All the messages going to one Flight Controller in one refresh cycle, sent with a single write.
+	//
+	// The batch keeps the bytes of every frame in it alive, and hands the port a gather list pointing at them,
+	// so frames are never copied into one big buffer. Once a write has started, the batch must be left
+	// alone until the write completes.
+	class MspTransmitBatch
+	{
+		public:
+
+			MspTransmitBatch() : ByteCount(0)
+			{
+			}
+
+			void AddFrame(MspTransmitFrame transmitFrame)
+			{
+				ByteCount += transmitFrame.GetByteCount();
+				Buffers.push_back(transmitFrame.FrameBuffer);
+				Frames.push_back(std::move(transmitFrame));
+			}
+
+			bool IsEmpty() const
+			{
+				return Frames.empty();
+			}
+
+			size_t GetFrameCount() const
+			{
+				return Frames.size();
+			}
+
+			size_t GetByteCount() const
+			{
+				return ByteCount;
+			}
+
+			// Call visitor(frame) for each frame in the batch, in the order they were added
+			template <typename Visitor>
+			void VisitFrames(Visitor visitor) const
+			{
+				for (const auto & transmitFrame : Frames)
+				{
+					visitor(transmitFrame);
+				}
+			}
+
+			// Gather list of every frame in the batch, in the order they were added
+			const std::vector<boost::asio::const_buffer> & GetBuffers() const
+			{
+				return Buffers;
+			}
+
+			// Empty the batch. Capacity is kept, so steady-state batches don't reallocate.
+			void Clear()
+			{
+				Frames.clear();
+				Buffers.clear();
+				ByteCount = 0;
+			}
+
+			void Swap(MspTransmitBatch & otherBatch)
+			{
+				Frames.swap(otherBatch.Frames);
+				Buffers.swap(otherBatch.Buffers);
+				std::swap(ByteCount, otherBatch.ByteCount);
+			}
+
+		private:
+			std::vector<CraftServices::MspTransmitFrame> Frames;
+			std::vector<boost::asio::const_buffer> Buffers;
+			size_t ByteCount;
+	};
+
+} // Namespace CraftServices
+
+#endif // MSPTRANSMITBATCH_HPP
@@ -0,0 +1,226 @@
+/*
+ * This file is part of CraftServices.
+ *
+ * CraftServices is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CraftServices is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CraftServices. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MSPTRANSMITQUEUE_HPP
+#define MSPTRANSMITQUEUE_HPP
+
+#include <vector>
+#include <memory>
+#include <tuple>
+
+#include "CraftServicesTypes.hpp"
+#include "MspTransmitBatch.hpp"
+
+namespace CraftServices
+{
+	// What a queued message is about: the kind of message, and (for messages about a craft) which craft.
+	// Two messages with the same key carry the same kind of information, so only the newer one is worth sending.
+	struct MspTransmitKey
+	{
+		uint16_t MessageID;
+
+		// UID of the craft the message is about. All zero for messages that aren't about a particular craft.
+		uint32_t UID_0;
+		uint32_t UID_1;
+		uint32_t UID_2;
+
+		MspTransmitKey(uint16_t messageID, uint32_t uid_0 = 0, uint32_t uid_1 = 0, uint32_t uid_2 = 0) :
+			MessageID(messageID), UID_0(uid_0), UID_1(uid_1), UID_2(uid_2)
+		{
+		}
+
+		bool operator==(const MspTransmitKey & otherKey) const
+		{
+			return MessageID == otherKey.MessageID &&
+				   UID_0 == otherKey.UID_0 &&
+				   UID_1 == otherKey.UID_1 &&
+				   UID_2 == otherKey.UID_2;
+		}
+
+		// So keys can index a std::map
+		bool operator<(const MspTransmitKey & otherKey) const
+		{
+			return std::tie(MessageID, UID_0, UID_1, UID_2) < std::tie(otherKey.MessageID, otherKey.UID_0, otherKey.UID_1, otherKey.UID_2);
+		}
+	};
+
+	// Messages waiting to be written to one Flight Controller.
+	//
+	// Queueing a message with the same key as one already waiting replaces the waiting message, so we never
+	// send an old position for a craft along with (or worse, after) a newer one. The queue is oldest first.
+	//
+	// The queue is also bounded by a byte budget - roughly what the link can carry in one refresh. If adding
+	// a message would go over the budget, the oldest waiting messages are dropped to make room; they are the
+	// stalest, and would only delay fresher data behind them.
+	class MspTransmitQueue
+	{
+		public:
+
+			MspTransmitQueue() : ByteBudget(0), ByteCount(0), CoalescedFrameCount(0), DroppedFrameCount(0)
+			{
+			}
+
+			// Maximum bytes allowed to wait in the queue. Zero means no limit.
+			void SetByteBudget(size_t byteBudget)
+			{
+				ByteBudget = byteBudget;
+			}
+
+			size_t GetByteBudget() const
+			{
+				return ByteBudget;
+			}
+
+			// Add a message to the back of the queue, replacing any waiting message with the same key.
+			// Returns how many older messages had to be dropped to stay inside the budget.
+			// retryCount is how many times this message has been sent before without a reply.
+			size_t Enqueue(const MspTransmitKey & key, MspTransmitFrame transmitFrame, uint32_t retryCount = 0)
+			{
+				for (auto queuedFrameIterator = QueuedFrames.begin(); queuedFrameIterator != QueuedFrames.end(); ++queuedFrameIterator)
+				{
+					if (queuedFrameIterator->Key == key)
+					{
+						// Latest value wins. The old message is taken out, and the new one goes to the back
+						// of the line with everything else that's fresh.
+						ByteCount -= queuedFrameIterator->Frame.GetByteCount();
+						QueuedFrames.erase(queuedFrameIterator);
+						CoalescedFrameCount++;
+						break;
+					}
+				}
+
+				size_t droppedCount = DropOldestFramesToFitBudget(transmitFrame.GetByteCount());
+
+				ByteCount += transmitFrame.GetByteCount();
+				QueuedFrame queuedFrame = { key, std::move(transmitFrame), retryCount };
+				QueuedFrames.push_back(std::move(queuedFrame));
+
+				return droppedCount;
+			}
+
+			// Is a message with this key waiting to be sent?
+			bool Contains(const MspTransmitKey & key) const
+			{
+				for (const auto & queuedFrame : QueuedFrames)
+				{
+					if (queuedFrame.Key == key)
+					{
+						return true;
+					}
+				}
+				return false;
+			}
+
+			bool IsEmpty() const
+			{
+				return QueuedFrames.empty();
+			}
+
+			size_t GetFrameCount() const
+			{
+				return QueuedFrames.size();
+			}
+
+			size_t GetByteCount() const
+			{
+				return ByteCount;
+			}
+
+			// Call visitor(key, frame) for each waiting message, oldest first
+			template <typename Visitor>
+			void VisitQueuedFrames(Visitor visitor) const
+			{
+				for (const auto & queuedFrame : QueuedFrames)
+				{
+					visitor(queuedFrame.Key, queuedFrame.Frame);
+				}
+			}
+
+			// Take the oldest waiting message off the front of the queue. Returns false if the queue is empty.
+			bool TakeOldest(MspTransmitKey & key, MspTransmitFrame & transmitFrame, uint32_t & retryCount)
+			{
+				if (QueuedFrames.empty())
+				{
+					return false;
+				}
+
+				QueuedFrame & oldestFrame = QueuedFrames.front();
+				key = oldestFrame.Key;
+				transmitFrame = std::move(oldestFrame.Frame);
+				retryCount = oldestFrame.RetryCount;
+				ByteCount -= transmitFrame.GetByteCount();
+				QueuedFrames.erase(QueuedFrames.begin());
+				return true;
+			}
+
+			void Clear()
+			{
+				QueuedFrames.clear();
+				ByteCount = 0;
+			}
+
+			// Running totals, for diagnostics
+			uint64_t GetCoalescedFrameCount() const
+			{
+				return CoalescedFrameCount;
+			}
+
+			uint64_t GetDroppedFrameCount() const
+			{
+				return DroppedFrameCount;
+			}
+
+		private:
+
+			struct QueuedFrame
+			{
+				MspTransmitKey Key;
+				MspTransmitFrame Frame;
+				uint32_t RetryCount;
+			};
+
+			// Drop from the front until there is room for this many more bytes. If the incoming message
+			// is bigger than the whole budget, this empties the queue and the message still gets sent.
+			size_t DropOldestFramesToFitBudget(size_t incomingByteCount)
+			{
+				if (ByteBudget == 0)
+				{
+					return 0;
+				}
+
+				size_t dropCount = 0;
+				while (dropCount < QueuedFrames.size() && ByteCount + incomingByteCount > ByteBudget)
+				{
+					ByteCount -= QueuedFrames[dropCount].Frame.GetByteCount();
+					dropCount++;
+				}
+
+				QueuedFrames.erase(QueuedFrames.begin(), QueuedFrames.begin() + dropCount);
+				DroppedFrameCount += dropCount;
+				return dropCount;
+			}
+
+			std::vector<QueuedFrame> QueuedFrames;
+			size_t ByteBudget;
+			size_t ByteCount;
+			uint64_t CoalescedFrameCount;
+			uint64_t DroppedFrameCount;
+	};
+
+} // Namespace CraftServices
+
+#endif // MSPTRANSMITQUEUE_HPP
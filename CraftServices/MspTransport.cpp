@@ -0,0 +1,66 @@
+/*
+ * This file is part of CraftServices.
+ *
+ * CraftServices is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CraftServices is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CraftServices. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <boost/algorithm/string.hpp>
+
+#include "MspTransport.hpp"
+#include "MspSerialTransport.hpp"
+#include "MspNetworkTransport.hpp"
+#include "MspMemoryTransport.hpp"
+
+namespace CraftServices
+{
+	void MspTransport::PostOpened(const boost::system::error_code & error)
+	{
+		boost::asio::post(*pStrand, [pCompletionListener = pListener, error]() { pCompletionListener->OnTransportOpened(error); });
+	}
+
+	void MspTransport::PostRead(const boost::system::error_code & error, size_t sizeRead)
+	{
+		boost::asio::post(*pStrand, [pCompletionListener = pListener, error, sizeRead]() { pCompletionListener->OnTransportRead(error, sizeRead); });
+	}
+
+	void MspTransport::PostWritten(const boost::system::error_code & error, size_t sizeWritten)
+	{
+		boost::asio::post(*pStrand, [pCompletionListener = pListener, error, sizeWritten]() { pCompletionListener->OnTransportWritten(error, sizeWritten); });
+	}
+
+	MspTransport * CreateMspTransport(const std::string & portName, uint32_t baudRate, boost::asio::io_context * pIoContext,
+									  boost::asio::io_context::strand * pSessionStrand, MspTransportListener * pTransportListener)
+	{
+		const std::string TcpPrefix = "tcp:";
+		const std::string UdpPrefix = "udp:";
+		const std::string MemoryPrefix = "memory:";
+
+		if (boost::istarts_with(portName, TcpPrefix))
+		{
+			return new MspTcpTransport(pIoContext, pSessionStrand, pTransportListener, portName.substr(TcpPrefix.size()));
+		}
+		if (boost::istarts_with(portName, UdpPrefix))
+		{
+			return new MspUdpTransport(pIoContext, pSessionStrand, pTransportListener, portName.substr(UdpPrefix.size()));
+		}
+		if (boost::istarts_with(portName, MemoryPrefix))
+		{
+			std::string linkName = portName.substr(MemoryPrefix.size());
+			return new MspMemoryTransport(pSessionStrand, pTransportListener, MspMemoryLink::GetNamedLink(linkName), linkName);
+		}
+
+		return new MspSerialTransport(pIoContext, pSessionStrand, pTransportListener, portName, baudRate);
+	}
+
+} // Namespace CraftServices
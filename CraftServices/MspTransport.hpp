@@ -0,0 +1,137 @@
+/*
+ * This file is part of CraftServices.
+ *
+ * CraftServices is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CraftServices is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CraftServices. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MSPTRANSPORT_HPP
+#define MSPTRANSPORT_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include <boost/asio.hpp>
+
+namespace CraftServices
+{
+	// Whoever is using a transport (a flight controller session), told when each thing it started has finished.
+	// Always called on the session's strand.
+	class MspTransportListener
+	{
+		public:
+
+			virtual ~MspTransportListener()
+			{
+			}
+
+			// The transport is ready for reads and writes - or, if error is set, it couldn't be opened
+			virtual void OnTransportOpened(const boost::system::error_code & error) = 0;
+
+			virtual void OnTransportRead(const boost::system::error_code & error, size_t sizeRead) = 0;
+
+			virtual void OnTransportWritten(const boost::system::error_code & error, size_t sizeWritten) = 0;
+	};
+
+	// How a session's bytes get to and from its flight controller: a serial port, a network bridge (i.e. an ESP
+	// WiFi to MSP bridge), or memory.
+	//
+	// As with a port, one read and one write can be outstanding at a time, and the session only ever deals with a
+	// stream of bytes - where the messages start and end is up to the session. Completions hold on to the listener
+	// and not to the transport, so a transport can be deleted (on a hard reset, say) with a read still outstanding.
+	class MspTransport
+	{
+		public:
+
+			MspTransport(boost::asio::io_context::strand * pSessionStrand, MspTransportListener * pTransportListener) : 
+				pStrand(pSessionStrand), pListener(pTransportListener), pLifetimeToken(std::make_shared<char>(0))
+			{
+			}
+
+			virtual ~MspTransport()
+			{
+			}
+
+			// Start opening. The listener is told how it went.
+			virtual void StartOpen() = 0;
+
+			// Close, abandoning anything outstanding. Fine to call when not open.
+			virtual void Close() = 0;
+
+			virtual bool IsOpen() const = 0;
+
+			// Abandon outstanding reads and writes, but stay open. Their completions come back with operation_aborted.
+			virtual void Cancel() = 0;
+
+			// Throw away anything received but not yet read, and anything written but not yet sent
+			virtual void Flush() = 0;
+
+			// Read whatever has arrived, waiting for at least one byte. readBuffer must stay put until the read completes.
+			virtual void StartRead(const boost::asio::mutable_buffer & readBuffer) = 0;
+
+			// Write all of writeBuffers. They must stay put until the write completes.
+			virtual void StartWrite(const std::vector<boost::asio::const_buffer> & writeBuffers) = 0;
+
+			// i.e. "serial port COM4 at 115200 baud"
+			virtual std::string GetDescription() const = 0;
+
+		protected:
+
+			// Completion handlers for asio reads and writes, run on the session's strand
+			auto GetReadHandler() const
+			{
+				return boost::asio::bind_executor(*pStrand, [pCompletionListener = pListener](const boost::system::error_code & error, size_t sizeRead) 
+					{ pCompletionListener->OnTransportRead(error, sizeRead); });
+			}
+
+			auto GetWriteHandler() const
+			{
+				return boost::asio::bind_executor(*pStrand, [pCompletionListener = pListener](const boost::system::error_code & error, size_t sizeWritten) 
+					{ pCompletionListener->OnTransportWritten(error, sizeWritten); });
+			}
+
+			// For things that finish without an asio operation to complete them
+			void PostOpened(const boost::system::error_code & error);
+			void PostRead(const boost::system::error_code & error, size_t sizeRead);
+			void PostWritten(const boost::system::error_code & error, size_t sizeWritten);
+
+			// A handler that has to get back to the transport itself holds on to this, and does nothing if the
+			// transport has gone by the time it runs
+			std::weak_ptr<char> GetLifetimeToken() const
+			{
+				return pLifetimeToken;
+			}
+
+			// Non-owning pointers
+			boost::asio::io_context::strand * pStrand;
+			MspTransportListener * pListener;
+
+		private:
+
+			std::shared_ptr<char> pLifetimeToken;
+	};
+
+	// The transport a port name asks for, not yet opened:
+	//
+	//   tcp:host:port      TCP connection to a network bridge
+	//   udp:host:port      UDP datagrams to and from a network bridge
+	//   memory:name        In-memory link, for tests and benchmarks (see MspMemoryLink)
+	//   anything else      Serial port, at baudRate
+	MspTransport * CreateMspTransport(const std::string & portName, uint32_t baudRate, boost::asio::io_context * pIoContext,
+									  boost::asio::io_context::strand * pSessionStrand, MspTransportListener * pTransportListener);
+
+} // Namespace CraftServices
+
+#endif // MSPTRANSPORT_HPP
@@ -27,8 +27,8 @@
 
 //#include "types.hpp"
 
-#include "deserialise.hpp"
 #include "AsyncMspMessageTypes.hpp"
+#include "MspMessageSchema.hpp"
 #include "MspFlightControllerAsync.hpp"
 #include "CraftInfoAndPosition.hpp"
 
@@ -36,10 +36,26 @@ namespace CraftServices
 {
 namespace msg 
 {
+		// Wire layout of a craft's info and position, as sent in an OtherCraftPositionMessage
+		typedef MspFieldList<
+			MspField<CraftInfoAndPosition, uint32_t, &CraftInfoAndPosition::U_ID_0>,
+			MspField<CraftInfoAndPosition, uint32_t, &CraftInfoAndPosition::U_ID_1>,
+			MspField<CraftInfoAndPosition, uint32_t, &CraftInfoAndPosition::U_ID_2>,
+			MspField<CraftInfoAndPosition, uint8_t, &CraftInfoAndPosition::FixType>,
+			MspField<CraftInfoAndPosition, uint8_t, &CraftInfoAndPosition::NumSat>,
+			MspField<CraftInfoAndPosition, uint32_t, &CraftInfoAndPosition::MspLat>,
+			MspField<CraftInfoAndPosition, uint32_t, &CraftInfoAndPosition::MspLon>,
+			MspField<CraftInfoAndPosition, uint16_t, &CraftInfoAndPosition::AltitudeInMeters>,
+			MspField<CraftInfoAndPosition, uint16_t, &CraftInfoAndPosition::Speed>,
+			MspField<CraftInfoAndPosition, uint16_t, &CraftInfoAndPosition::GroundCourseInDecidegrees>,
+			// Put last since it is variable in size
+			MspStringTailField<CraftInfoAndPosition, &CraftInfoAndPosition::CraftName>
+		> CraftInfoAndPositionFields;
+
 		// A position message for a single other craft.
 		//
 		// MSP2_INAV_OTHER_CRAFT_POSITION = 0x201B
-		struct OtherCraftPositionMessage : public CraftServices::MspMessageAsync
+		struct OtherCraftPositionMessage : public CraftServices::MspSchemaMessage<OtherCraftPositionMessage>
 		{
 		public:
 			ID MessageID() const
@@ -49,16 +65,20 @@ namespace msg
 
 			CraftServices::CraftInfoAndPosition MessageCraftInfoAndPosition;
 
+			typedef MspFieldList<
+				MspNestedFields<OtherCraftPositionMessage, CraftInfoAndPosition, &OtherCraftPositionMessage::MessageCraftInfoAndPosition, CraftInfoAndPositionFields>
+			> PayloadFields;
+
 			// TODO: Craft Type (Quad, Plane, Tricopter, etc.)
 
 			// Default constructor
-			OtherCraftPositionMessage() : MspMessageAsync()
+			OtherCraftPositionMessage()
 			{
 				MessageCraftInfoAndPosition.ClearValues();
 			}
 
 			// Payload constructor
-			OtherCraftPositionMessage(const ByteVector & payloadData)
+			OtherCraftPositionMessage(const ByteSpan & payloadData)
 			{
 				DecodePayload(payloadData);
 			}
@@ -104,52 +124,6 @@ namespace msg
 
 				MessageCraftInfoAndPosition.CraftName = currentCraftInfoAndPosition.CraftName;
 			}
-
-			ByteVector EncodePayload() const
-			{
-				ByteVector encodedPayload;
-
-				serialize_uint32(MessageCraftInfoAndPosition.U_ID_0, encodedPayload);
-				serialize_uint32(MessageCraftInfoAndPosition.U_ID_1, encodedPayload);
-				serialize_uint32(MessageCraftInfoAndPosition.U_ID_2, encodedPayload);
-
-				serialize_uint8(MessageCraftInfoAndPosition.FixType, encodedPayload);
-				serialize_uint8(MessageCraftInfoAndPosition.NumSat, encodedPayload);
-				serialize_uint32(MessageCraftInfoAndPosition.MspLat, encodedPayload);
-				serialize_uint32(MessageCraftInfoAndPosition.MspLon, encodedPayload);
-				serialize_uint16(MessageCraftInfoAndPosition.AltitudeInMeters, encodedPayload);
-				serialize_uint16(MessageCraftInfoAndPosition.Speed, encodedPayload);
-				serialize_uint16(MessageCraftInfoAndPosition.GroundCourseInDecidegrees, encodedPayload);
-
-				// Put last since it is variable in size
-				encodedPayload.insert(encodedPayload.end(), MessageCraftInfoAndPosition.CraftName.begin(), MessageCraftInfoAndPosition.CraftName.end());
-
-				return encodedPayload;
-			}
-
-			void DecodePayload(const ByteVector & payloadData)
-			{
-				if (payloadData.size() == 0)
-				{
-					throw new exception("No payload -- 0 bytes");
-				}
-				MessageCraftInfoAndPosition.ClearValues();				
-
-				MessageCraftInfoAndPosition.U_ID_0 = CraftServices::deserialize_uint32(payloadData, 0);
-				MessageCraftInfoAndPosition.U_ID_1 = CraftServices::deserialize_uint32(payloadData, 4);
-				MessageCraftInfoAndPosition.U_ID_2 = CraftServices::deserialize_uint32(payloadData, 8);
-
-				MessageCraftInfoAndPosition.FixType = CraftServices::deserialize_uint8(payloadData, 0);
-				MessageCraftInfoAndPosition.NumSat = CraftServices::deserialize_uint8(payloadData, 1);
-				MessageCraftInfoAndPosition.MspLat = CraftServices::deserialize_uint32(payloadData, 2);
-				MessageCraftInfoAndPosition.MspLon = CraftServices::deserialize_uint32(payloadData, 6);
-				MessageCraftInfoAndPosition.AltitudeInMeters = CraftServices::deserialize_uint16(payloadData, 10);
-				MessageCraftInfoAndPosition.Speed = CraftServices::deserialize_uint16(payloadData, 12);
-				MessageCraftInfoAndPosition.GroundCourseInDecidegrees = CraftServices::deserialize_uint16(payloadData, 14);
-
-				// Put last since it is variable in size
-				MessageCraftInfoAndPosition.CraftName = std::string(payloadData.begin() + 16, payloadData.end());
-			}
 		};
 
 	} // Namespace msg
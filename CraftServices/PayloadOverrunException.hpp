@@ -0,0 +1,33 @@
+/*
+ * This file is part of CraftServices.
+ *
+ * CraftServices is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CraftServices is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CraftServices. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PAYLOAD_OVERRUN_EXCEPTION_HPP
+#define PAYLOAD_OVERRUN_EXCEPTION_HPP
+
+#include <stdexcept>
+
+class PayloadOverrunException : public std::out_of_range
+{
+	public:
+		// Generic constructor
+		PayloadOverrunException() : std::out_of_range("Read or write past the end of a message payload") { };
+		// Constructor with specific message about the overrun
+		PayloadOverrunException(std::string message) : std::out_of_range(message) { };
+}; 
+
+
+#endif // PAYLOAD_OVERRUN_EXCEPTION_HPP
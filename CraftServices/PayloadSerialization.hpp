@@ -0,0 +1,225 @@
+/*
+ * This file is part of CraftServices.
+ *
+ * CraftServices is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CraftServices is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CraftServices. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PAYLOAD_SERIALIZATION_HPP
+#define PAYLOAD_SERIALIZATION_HPP
+
+#include <string>
+#include <cstring>
+#include <stdint.h>
+
+#include "CraftServicesTypes.hpp"
+#include "PayloadOverrunException.hpp"
+
+namespace CraftServices
+{
+	/////////////////////////////////////////////////////////////////////
+	/// Little-endian loads and stores. MSP is little-endian on the wire.
+	///
+	/// Written as byte shifts so they are correct on any host; compilers
+	/// turn them into a single load or store on little-endian machines.
+
+	inline uint16_t LoadLittleEndianUint16(const uint8_t * pBytes)
+	{
+		return (uint16_t)((uint16_t)pBytes[0] | ((uint16_t)pBytes[1] << 8));
+	}
+
+	inline uint32_t LoadLittleEndianUint32(const uint8_t * pBytes)
+	{
+		return (uint32_t)pBytes[0] | ((uint32_t)pBytes[1] << 8) | ((uint32_t)pBytes[2] << 16) | ((uint32_t)pBytes[3] << 24);
+	}
+
+	inline void StoreLittleEndianUint16(uint8_t * pBytes, uint16_t value)
+	{
+		pBytes[0] = (uint8_t)(value);
+		pBytes[1] = (uint8_t)(value >> 8);
+	}
+
+	inline void StoreLittleEndianUint32(uint8_t * pBytes, uint32_t value)
+	{
+		pBytes[0] = (uint8_t)(value);
+		pBytes[1] = (uint8_t)(value >> 8);
+		pBytes[2] = (uint8_t)(value >> 16);
+		pBytes[3] = (uint8_t)(value >> 24);
+	}
+
+	// Reads values in order from a message payload, without copying it.
+	//
+	// Every read is bounds checked against the payload; reading past the end throws
+	// PayloadOverrunException rather than reading whatever happens to follow in memory.
+	class PayloadReader
+	{
+		public:
+
+			explicit PayloadReader(const ByteSpan & payloadData) : PayloadData(payloadData), Position(0)
+			{
+			}
+
+			uint8_t ReadUint8()
+			{
+				return *Take(1);
+			}
+
+			uint16_t ReadUint16()
+			{
+				return LoadLittleEndianUint16(Take(2));
+			}
+
+			uint32_t ReadUint32()
+			{
+				return LoadLittleEndianUint32(Take(4));
+			}
+
+			// Signed values are read as unsigned and converted after, so the sign bit
+			// lands where it belongs rather than being smeared by integer promotion.
+			int16_t ReadInt16()
+			{
+				return (int16_t)ReadUint16();
+			}
+
+			int32_t ReadInt32()
+			{
+				return (int32_t)ReadUint32();
+			}
+
+			// Everything left in the payload, as a string (i.e. a variable length name at the end of a message)
+			std::string ReadRemainingAsString()
+			{
+				size_t remainingByteCount = GetBytesRemaining();
+				const uint8_t * pRemainingBytes = Take(remainingByteCount);
+				return std::string(pRemainingBytes, pRemainingBytes + remainingByteCount);
+			}
+
+			void Skip(size_t byteCount)
+			{
+				Take(byteCount);
+			}
+
+			size_t GetPosition() const
+			{
+				return Position;
+			}
+
+			size_t GetBytesRemaining() const
+			{
+				return PayloadData.size() - Position;
+			}
+
+		private:
+
+			// Bounds check, then step past the next byteCount bytes, returning where they start
+			const uint8_t * Take(size_t byteCount)
+			{
+				if (byteCount > GetBytesRemaining())
+				{
+					throw PayloadOverrunException("Payload too short: wanted " + std::to_string(byteCount) + " more bytes at offset " +
+												  std::to_string(Position) + " of a " + std::to_string(PayloadData.size()) + " byte payload");
+				}
+
+				const uint8_t * pBytes = PayloadData.data() + Position;
+				Position += byteCount;
+				return pBytes;
+			}
+
+			ByteSpan PayloadData;
+			size_t Position;
+	};
+
+	// Writes values in order into a buffer the caller provides, so encoding never allocates.
+	//
+	// Every write is bounds checked against the buffer; writing past the end throws PayloadOverrunException.
+	class PayloadWriter
+	{
+		public:
+
+			PayloadWriter(uint8_t * pBuffer, size_t bufferSize) : pBufferBytes(pBuffer), BufferSize(bufferSize), Position(0)
+			{
+			}
+
+			void WriteUint8(uint8_t value)
+			{
+				*Take(1) = value;
+			}
+
+			void WriteUint16(uint16_t value)
+			{
+				StoreLittleEndianUint16(Take(2), value);
+			}
+
+			void WriteUint32(uint32_t value)
+			{
+				StoreLittleEndianUint32(Take(4), value);
+			}
+
+			void WriteInt16(int16_t value)
+			{
+				WriteUint16((uint16_t)value);
+			}
+
+			void WriteInt32(int32_t value)
+			{
+				WriteUint32((uint32_t)value);
+			}
+
+			void WriteBytes(const uint8_t * pBytes, size_t byteCount)
+			{
+				if (byteCount > 0)
+				{
+					std::memcpy(Take(byteCount), pBytes, byteCount);
+				}
+			}
+
+			void WriteString(const std::string & value)
+			{
+				WriteBytes(reinterpret_cast<const uint8_t *>(value.data()), value.size());
+			}
+
+			size_t GetBytesWritten() const
+			{
+				return Position;
+			}
+
+			// View of everything written so far
+			ByteSpan GetWrittenData() const
+			{
+				return ByteSpan(pBufferBytes, Position);
+			}
+
+		private:
+
+			// Bounds check, then step past the next byteCount bytes, returning where they start
+			uint8_t * Take(size_t byteCount)
+			{
+				if (byteCount > BufferSize - Position)
+				{
+					throw PayloadOverrunException("Payload buffer too small: wanted " + std::to_string(byteCount) + " more bytes at offset " +
+												  std::to_string(Position) + " of a " + std::to_string(BufferSize) + " byte buffer");
+				}
+
+				uint8_t * pBytes = pBufferBytes + Position;
+				Position += byteCount;
+				return pBytes;
+			}
+
+			uint8_t * pBufferBytes;
+			size_t BufferSize;
+			size_t Position;
+	};
+
+}
+
+#endif // PAYLOAD_SERIALIZATION_HPP
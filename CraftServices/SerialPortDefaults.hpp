@@ -27,9 +27,43 @@ const int DEFAULT_BAUD_RATE = 19200;
 // It's now configurable though, so users hopefully will offer feedback.
 const int DEFAULT_REFRESH_INTERVAL_IN_MILLISECONDS = 100;
 
+// Bounds on the refresh interval when it is automatic (--autorefresh). The interval also never goes below the
+// airtime one refresh needs at the port's baud rate.
+const int DEFAULT_MINIMUM_AUTO_REFRESH_INTERVAL_IN_MILLISECONDS = 20;
+const int DEFAULT_MAXIMUM_AUTO_REFRESH_INTERVAL_IN_MILLISECONDS = 1000;
+
 // This is currently just a guess about what will be useful
 const int DEFAULT_STALE_INTERVAL_IN_MILLISECONDS = 4000;
 
+// How long to wait for a reply to a request before giving up on it. Generous, since replies over a 
+// radio link take a good deal longer than over a wire.
+const int DEFAULT_RESPONSE_TIMEOUT_IN_MILLISECONDS = 500;
+
+// How many times to resend a request that got no reply
+const int DEFAULT_MAX_RETRY_COUNT = 1;
+
+// How many requests may be awaiting replies at once. Enough for a refresh's worth of messages
+// with a handful of other crafts.
+const int DEFAULT_REQUEST_WINDOW_SIZE = 8;
+
+// How many threads service the flight controllers. 0 is one per processor core (but never more than one per port).
+const int DEFAULT_WORKER_THREAD_COUNT = 0;
+
+// Most log messages waiting to be written at once, when logging asynchronously (--asynclog)
+const int DEFAULT_LOG_QUEUE_SIZE = 8192;
+
+// Size of each raw capture file (--capture). At 115200 baud, a link busy in both directions fills one in about ten minutes.
+const int DEFAULT_CAPTURE_SEGMENT_SIZE_IN_MEGABYTES = 16;
+
+// Emulated flight controllers (--emulate). By default they fly circles around the same spot as the fixed
+// phantom craft, at a plausible fixed-wing cruise, and answer as soon as a request has fully arrived.
+const double DEFAULT_EMULATED_FLIGHT_PATH_CENTER_LAT = 39.490756;
+const double DEFAULT_EMULATED_FLIGHT_PATH_CENTER_LON = -105.081577;
+const int DEFAULT_EMULATED_FLIGHT_PATH_SIZE_IN_METERS = 200;
+const int DEFAULT_EMULATED_FLIGHT_PATH_SPEED_IN_METERS_PER_SECOND = 15;
+const int DEFAULT_EMULATED_FLIGHT_PATH_ALTITUDE_IN_METERS = 100;
+const int DEFAULT_EMULATED_RESPONSE_DELAY_IN_MILLISECONDS = 0;
+
 #endif // SERIALPORTDEFAULTS_HPP
 
 
@@ -19,9 +19,12 @@
 #define ASYNCMSPMESSAGETGYPES_HPP
 
 #include <vector>
+#include <cassert>
 #include <stdint.h>
+#include "CraftServicesTypes.hpp"
 #include "CraftServicesMspID.hpp"
 #include "BitOperators.hpp"
+#include "PayloadSerialization.hpp"
 
 namespace CraftServices 
 {
@@ -35,10 +38,22 @@ typedef std::vector<uint8_t> ByteVector;
 /// Generic message types
 
 // A convenience structure we use to build up a message
-// during one-byte-at-a-time reading. This is a scratch pad
-// about the message, not the message itself.
+// as it is read. This is a scratch pad about the message, 
+// not the message itself.
+//
+// The raw bytes of the message are held inline, so reading a message never allocates. 
+// Keeping the raw bytes also lets the parser rescan them if the message turns out to be
+// bogus -- a '$' inside a payload that looked like the start of a message, for example.
 struct MspMessageScratchPad
 {
+	// Largest data payload we will accept. Matches the largest reply buffer iNav uses; anything
+	// claiming to be bigger is line noise, and is rejected rather than buffered.
+	static const uint16_t MaxDataPayloadLength = 512;
+	// '$', 'X', direction, zero flag, two message ID bytes, two payload length bytes
+	static const size_t HeaderLength = 8;
+	// Header, payload, and the CRC byte
+	static const size_t MaxMessageLength = HeaderLength + MaxDataPayloadLength + 1;
+
 	uint8_t MessageDirectionCharacter = 0;
 	uint8_t MessageIDLowByte = 0;
 	uint8_t MessageIDHighByte = 0;
@@ -47,8 +62,13 @@ struct MspMessageScratchPad
 	uint8_t DataPayloadLengthHighByte = 0;
 	uint16_t DataPayloadLength = 0;
 	uint16_t DataPayloadBytesRead = 0;
-	uint8_t * pDataPayload = NULL;
 	uint8_t CrcByte = 0;
+	// Running CRC of the message bytes read so far, updated byte by byte as the message arrives.
+	// Once the whole message is in, it can be checked against CrcByte directly.
+	uint8_t CalculatedCrc = 0;
+	// Every byte of the message read so far, starting with the '$'. The payload starts at HeaderLength.
+	uint8_t MessageBytes[MaxMessageLength];
+	size_t MessageBytesRead = 0;
 	
 	void ClearValue()
 	{
@@ -60,12 +80,21 @@ struct MspMessageScratchPad
 		DataPayloadLengthHighByte = 0;
 		DataPayloadLength = 0;
 		DataPayloadBytesRead = 0;
-		if (pDataPayload != NULL)
-		{
-			delete pDataPayload;
-			pDataPayload = NULL;
-		}
 		CrcByte = 0;
+		CalculatedCrc = 0;
+		MessageBytesRead = 0;
+	}
+
+	void AppendMessageByte(uint8_t messageByte)
+	{
+		assert(MessageBytesRead < MaxMessageLength);
+		MessageBytes[MessageBytesRead++] = messageByte;
+	}
+
+	// Where the next payload byte belongs
+	uint8_t * GetNextDataPayloadByte()
+	{
+		return MessageBytes + HeaderLength + DataPayloadBytesRead;
 	}
 
 	void InitMessageID()
@@ -73,16 +102,17 @@ struct MspMessageScratchPad
 		MessageID = BitOperators::MakeUint16(MessageIDLowByte, MessageIDHighByte);
 	}
 
-	void InitDataPayload()
+	// Returns false if the length bytes ask for a bigger payload than we are prepared to hold
+	bool InitDataPayload()
 	{
 		DataPayloadLength = BitOperators::MakeUint16(DataPayloadLengthLowByte, DataPayloadLengthHighByte);
-		assert(pDataPayload == NULL);
-		pDataPayload = new uint8_t[DataPayloadLength];
+		return DataPayloadLength <= MaxDataPayloadLength;
 	}
 
-	std::vector<uint8_t> GetPayloadDataAsVector() const
+	// View of the payload read so far. Only valid until the scratch pad is cleared or reused.
+	ByteSpan GetPayloadData() const
 	{
-		return std::vector<uint8_t>(pDataPayload, pDataPayload + DataPayloadLength);
+		return ByteSpan(MessageBytes + HeaderLength, DataPayloadBytesRead);
 	}
 };
 
@@ -99,11 +129,11 @@ struct MspMessageAsync
     // Destructor
     virtual ~MspMessageAsync() { }
  
-    // Encode this message's payload from its current values
-	virtual ByteVector EncodePayload() const = 0;
+    // Encode this message's payload from its current values, into the writer's buffer
+	virtual void EncodePayload(PayloadWriter & payloadWriter) const = 0;
 
 	// Decode message payload, setting this message's appropriate values
-	virtual void DecodePayload(const ByteVector & payloadData) = 0;
+	virtual void DecodePayload(const ByteSpan & payloadData) = 0;
 };
 
 